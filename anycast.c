@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <string.h>
+#include "anycast.h"
+
+anycast *newanycast(void) {
+	anycast *any = (anycast*)calloc(1,sizeof(anycast));
+	any->index=newporttable();
+	return any;
+}
+
+void freeanycast(anycast *any) {
+	if (!any) return;
+	for (int g=0;g<any->numgroups;++g) {
+		free(any->groups[g].members);
+		free(any->groups[g].bound);
+	}
+	free(any->groups);
+	freeporttable(any->index);
+	free(any);
+}
+
+// reads a non-negative number at *s and moves past it, returns -1 if there isn't one
+static int readid(const char **s) {
+	if (**s<'0' || **s>'9') return -1;
+	long long id=0;
+	while (**s>='0' && **s<='9') {
+		id=id*10+(**s-'0');
+		if (id>0x7FFFFFFF) return -1;
+		++*s;
+	}
+	return (int)id;
+}
+
+int addanycast(anycast *any,const char *spec) {
+	const char *s = spec;
+	const int id = readid(&s);
+	if (id<0 || *s!=':' || anycastof(any,id)>=0) return -1;
+	++s;
+	int *members = (int*)malloc(sizeof(int)*MAXANYCASTMEMBERS);
+	int count=0;
+	while (1) {
+		const int first = readid(&s);
+		int last = first;
+		if (*s=='-') {
+			++s;
+			last = readid(&s);
+		}
+		if (first<0 || last<first || (long long)count+(last-first)>=MAXANYCASTMEMBERS || (*s && *s!=',')) {
+			free(members);
+			return -1;
+		}
+		for (int m=first;m<=last;++m) members[count++]=m;
+		if (!*s++) break;
+	}
+	// a member that is a group (or the group itself) would never be a station
+	for (int i=0;i<count;++i) {
+		if (members[i]==id || anycastof(any,members[i])>=0) {
+			free(members);
+			return -1;
+		}
+	}
+	for (int g=0;g<any->numgroups;++g) {
+		for (int i=0;i<any->groups[g].nummembers;++i) {
+			if (any->groups[g].members[i]!=id) continue;
+			free(members);
+			return -1;
+		}
+	}
+	// the index hands out ports in order, the group's port is its entry
+	const int g = portregister(any->index,STATIONID(id));
+	any->groups=(anycastgroup*)realloc(any->groups,sizeof(anycastgroup)*(g+1));
+	any->numgroups=g+1;
+	anycastgroup *group = &any->groups[g];
+	group->id=id;
+	group->nummembers=count;
+	group->members=(int*)realloc(members,sizeof(int)*count);
+	group->bound=(unsigned long long*)calloc(count,sizeof(unsigned long long));
+	group->next=0;
+	return g;
+}
+
+void printanycaststats(anycast *any,FILE *outfile) {
+	if (!any) return;
+	for (int g=0;g<any->numgroups;++g) {
+		anycastgroup *group = &any->groups[g];
+		unsigned long long total=0;
+		for (int i=0;i<group->nummembers;++i) total+=group->bound[i];
+		fprintf(outfile,"CSP: Anycast group %d bound %llu requests to its %d members",group->id,total,group->nummembers);
+		for (int i=0;i<group->nummembers;++i) {
+			if (group->bound[i]) fprintf(outfile,", SP %d %llu",group->members[i],group->bound[i]);
+		}
+		fprintf(outfile,"\n");
+	}
+}
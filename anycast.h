@@ -0,0 +1,47 @@
+#ifndef _FASTETH_ANYCAST_H
+#define _FASTETH_ANYCAST_H
+
+#include <stdio.h>
+#include "porttable.h"
+
+// anycast groups for the CSP, fastserv -anycast=G:members
+// G is a destination id the CSP owns, a request to it is bound to one of the member SPs when it is granted
+// (the reachable member with the least still on its way to it, see fastserv.c), a queued request is rebound
+// on every scheduling pass until then, the acknowledgement has the member in the destination field
+// and the SP sends the frames of that transfer to the member, a group id can't be an SP's
+// the most members a group may have
+#define MAXANYCASTMEMBERS 4096
+
+// one group, bound[i] counts the requests bound to members[i]
+typedef struct anycastgroup {
+	int id;
+	int nummembers;
+	int *members;
+	unsigned long long *bound;
+	int next; // the member a tie goes to, ties go round-robin
+}anycastgroup;
+
+// the groups, index maps a group id (as a station id) to its entry of groups
+typedef struct anycast {
+	porttable *index;
+	int numgroups;
+	anycastgroup *groups;
+}anycast;
+
+anycast *newanycast(void);
+void freeanycast(anycast *any);
+
+// adds the group in spec, "G:a,b,c-d" (SP IDs and ranges of them)
+// returns the index of the group, -1 for a malformed spec, a group id given twice, or a member that is a group
+int addanycast(anycast *any,const char *spec);
+
+// the index of group id, -1 if id isn't a group (any may be NULL)
+static inline int anycastof(anycast *any,const int id) {
+	if (!any || id<0) return -1;
+	return portlookup(any->index,STATIONID(id));
+}
+
+// the requests bound to each member of each group
+void printanycaststats(anycast *any,FILE *outfile);
+
+#endif // _FASTETH_ANYCAST_H
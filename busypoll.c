@@ -0,0 +1,197 @@
+#define _GNU_SOURCE // sched_setaffinity
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "common.h"
+#include "busypoll.h"
+
+// older headers lack the busy poll options, the values are the kernel's
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
+// the histogram bucket of a latency in nanoseconds
+// below 8 ns each value has a bucket, above it each power of two is split in 8
+static inline int latencybucket(const unsigned long long ns) {
+	if (ns<(1ULL<<LATENCYSUBBITS)) return (int)ns;
+	const int msb = 63-__builtin_clzll(ns);
+	return ((msb-LATENCYSUBBITS+1)<<LATENCYSUBBITS)|(int)((ns>>(msb-LATENCYSUBBITS))&((1<<LATENCYSUBBITS)-1));
+}
+
+// the largest latency in nanoseconds that falls in bucket
+static inline unsigned long long bucketlimit(const int bucket) {
+	if (bucket<(1<<LATENCYSUBBITS)) return (unsigned long long)bucket;
+	const int shift = (bucket>>LATENCYSUBBITS)-1;
+	const unsigned long long low = ((unsigned long long)((1<<LATENCYSUBBITS)|(bucket&((1<<LATENCYSUBBITS)-1))))<<shift;
+	return low+(1ULL<<shift)-1;
+}
+
+// the latency in seconds below which fraction of the frames fall, to histogram precision
+static double latencypercentile(busypoller *poller,const double fraction) {
+	unsigned long long rank = (unsigned long long)(fraction*poller->frames);
+	if (rank<1) rank=1;
+	unsigned long long seen=0;
+	for (int b=0;b<LATENCYBUCKETS;++b) {
+		seen+=poller->latency[b];
+		if (seen<rank) continue;
+		// the top of the bucket, but never past the largest latency seen
+		const double limit = bucketlimit(b)/1e9;
+		return limit<poller->latencymax?limit:poller->latencymax;
+	}
+	return poller->latencymax;
+}
+
+// the wall clock, the kernel stamps received data with it
+static inline double getrealtime(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME,&ts);
+	return (double)ts.tv_sec+((double)ts.tv_nsec)/1e9;
+}
+
+busypoller *newbusypoller(const unsigned char enabled,const int core) {
+	busypoller *poller = (busypoller*)calloc(1,sizeof(busypoller));
+	poller->enabled=enabled;
+	poller->core=-1;
+	if (core>=0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(core,&set);
+		if (sched_setaffinity(0,sizeof(cpu_set_t),&set)) fprintf(stderr,"CSP: Unable to pin to core %d, %s\n",core,strerror(errno));
+		else poller->core=core;
+	}
+	getrusage(RUSAGE_SELF,&poller->startusage);
+	poller->startwall=getnow();
+	poller->idlesince=poller->startwall;
+	return poller;
+}
+
+void freebusypoller(busypoller *poller) {
+	free(poller);
+}
+
+// sets the socket options of the mode on a listening socket, accepted sockets inherit them
+// returns 0 if the kernel refused busy polling
+unsigned char setpolloptions(busypoller *poller,const int fd) {
+	int optval=1;
+	setsockopt(fd,SOL_SOCKET,SO_TIMESTAMPNS,(const void*)&optval,sizeof(int));
+	if (!poller->enabled) return 1;
+	optval=BUSYPOLLUSEC;
+	if (setsockopt(fd,SOL_SOCKET,SO_BUSY_POLL,(const void*)&optval,sizeof(int))) return 0;
+	optval=1;
+	if (setsockopt(fd,SOL_SOCKET,SO_PREFER_BUSY_POLL,(const void*)&optval,sizeof(int))) return 0;
+	return 1;
+}
+
+// the select timeout for the next pass, zero when busy polling
+struct timeval polltimeout(busypoller *poller) {
+	struct timeval tv = { .tv_sec=poller->enabled?0:BUSYIDLE, .tv_usec=0 };
+	return tv;
+}
+
+// called with the select result when busy polling, backs off after an empty check
+// returns 1 if the loop should handle this pass
+unsigned char pollready(busypoller *poller,const int ready) {
+	++poller->polls;
+	if (ready) {
+		poller->spins=0;
+		poller->backoff=0;
+		poller->idlesince=0;
+		return 1;
+	}
+	++poller->emptypolls;
+	const double now = getnow();
+	if (poller->idlesince<=0) poller->idlesince=now;
+	// idle as long as a select timeout, let the loop look for stuck SPs
+	if (now-poller->idlesince>=BUSYIDLE) {
+		poller->idlesince=now;
+		return 1;
+	}
+	if (poller->spins<BUSYSPINS) {
+		++poller->spins;
+		return 0;
+	}
+	// spun long enough, sleep a little longer each time nothing shows up
+	poller->backoff=poller->backoff?poller->backoff<<1:BACKOFFMINNS;
+	if (poller->backoff>BACKOFFMAXNS) poller->backoff=BACKOFFMAXNS;
+	struct timespec ts = { .tv_sec=0, .tv_nsec=poller->backoff };
+	nanosleep(&ts,NULL);
+	++poller->sleeps;
+	return 0;
+}
+
+// receives length bytes like rcvbuffer, *stamp is the kernel receive time of the first byte
+// returns 0 for failure, 1 for success
+unsigned char rcvstamped(int fd,void *buffer,int length,double *stamp) {
+	*stamp=0;
+	union {
+		char buffer[CMSG_SPACE(sizeof(struct timespec))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = { .iov_base=buffer, .iov_len=length };
+	struct msghdr msg;
+	memset((void*)&msg,0,sizeof(struct msghdr));
+	msg.msg_iov=&iov;
+	msg.msg_iovlen=1;
+	msg.msg_control=control.buffer;
+	msg.msg_controllen=sizeof(control.buffer);
+	int ret;
+	do {
+		ret = recvmsg(fd,&msg,0);
+	} while (ret<0 && errno==EINTR);
+	if (ret<1) return 0;
+	for (struct cmsghdr *cmsg=CMSG_FIRSTHDR(&msg);cmsg;cmsg=CMSG_NXTHDR(&msg,cmsg)) {
+		if (cmsg->cmsg_level!=SOL_SOCKET || cmsg->cmsg_type!=SCM_TIMESTAMPNS) continue;
+		struct timespec ts;
+		memcpy((void*)&ts,(void*)CMSG_DATA(cmsg),sizeof(struct timespec));
+		*stamp=(double)ts.tv_sec+((double)ts.tv_nsec)/1e9;
+	}
+	// the rest of a header split over segments
+	if (ret<length) return rcvbuffer(fd,(unsigned char*)buffer+ret,length-ret);
+	return 1;
+}
+
+// records the latency of a frame received at stamp and forwarded just now
+void recordlatency(busypoller *poller,const double stamp) {
+	if (stamp<=0) return;
+	double latency = getrealtime()-stamp;
+	if (latency<0) latency=0;
+	++poller->frames;
+	poller->latencysum+=latency;
+	if (latency>poller->latencymax) poller->latencymax=latency;
+	++poller->latency[latencybucket((unsigned long long)(latency*1e9))];
+}
+
+// the seconds of a timeval
+static inline double tvseconds(const struct timeval *tv) {
+	return (double)tv->tv_sec+((double)tv->tv_usec)/1e6;
+}
+
+// prints the polling counters, CPU use, and frame latency side by side
+void printpollstats(busypoller *poller,FILE *outfile) {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF,&usage);
+	const double wall = getnow()-poller->startwall;
+	const double user = tvseconds(&usage.ru_utime)-tvseconds(&poller->startusage.ru_utime);
+	const double sys = tvseconds(&usage.ru_stime)-tvseconds(&poller->startusage.ru_stime);
+	if (poller->enabled)
+		fprintf(outfile,"CSP: Busy polling statistics, %llu checks (%llu empty), %llu back-off sleeps\n",
+						poller->polls,poller->emptypolls,poller->sleeps);
+	else fprintf(outfile,"CSP: Blocking select statistics\n");
+	if (poller->core>=0) fprintf(outfile,"CSP:   pinned to core %d\n",poller->core);
+	fprintf(outfile,"CSP:   CPU %.3f s user, %.3f s system, %.1f%% of one core over %.3f s\n",
+					user,sys,wall>0?100.0*(user+sys)/wall:0,wall);
+	if (!poller->frames) {
+		fprintf(outfile,"CSP:   no frame latencies recorded\n");
+		return;
+	}
+	fprintf(outfile,"CSP:   frame latency (kernel receive to forwarded) over %llu frames: mean %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us\n",
+					poller->frames,1e6*poller->latencysum/poller->frames,1e6*latencypercentile(poller,0.5),
+					1e6*latencypercentile(poller,0.99),1e6*poller->latencymax);
+}
@@ -0,0 +1,67 @@
+#ifndef _FASTETH_BUSYPOLL_H
+#define _FASTETH_BUSYPOLL_H
+
+#include <stdio.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+// the CSP's low latency mode, fastserv -busypoll
+// instead of sleeping in select the event loop checks its descriptors without waiting,
+// spins BUSYSPINS empty checks, then sleeps for a back-off that doubles from BACKOFFMINNS to BACKOFFMAXNS
+// any ready descriptor ends the back-off, BUSYIDLE seconds with nothing ready count as an idle select
+// the SP sockets ask the kernel to busy poll the device queue for BUSYPOLLUSEC on a read
+#define BUSYSPINS 4096
+#define BACKOFFMINNS 1000
+#define BACKOFFMAXNS 1000000
+#define BUSYIDLE 2
+#define BUSYPOLLUSEC 50
+
+// frame latencies are kept in a histogram, 8 buckets per power of two nanoseconds
+#define LATENCYSUBBITS 3
+#define LATENCYBUCKETS (64<<LATENCYSUBBITS)
+
+typedef struct busypoller {
+	unsigned char enabled; // zero for the blocking select
+	int core; // the core the CSP is pinned to, -1 for none
+	unsigned int spins; // empty checks in a row
+	long backoff; // nanoseconds of the next sleep, zero while spinning
+	double idlesince; // when the checks started coming up empty
+	unsigned long long polls, emptypolls, sleeps;
+	// the CPU time and wall time at the start, for the report
+	struct rusage startusage;
+	double startwall;
+	// frame latency, the kernel receive time of a data frame to the end of its forwarding write
+	unsigned long long frames;
+	double latencysum, latencymax;
+	unsigned long long latency[LATENCYBUCKETS];
+}busypoller;
+
+// creates the poller, enabled or not, and pins the process to core if it is >=0
+// the CPU and latency report works in both modes
+busypoller *newbusypoller(const unsigned char enabled,const int core);
+void freebusypoller(busypoller *poller);
+
+// sets the socket options of the mode on a listening socket, accepted sockets inherit them
+// the receive timestamps are always on, busy polling only when enabled
+// returns 0 if the kernel refused busy polling (it needs CAP_NET_ADMIN)
+unsigned char setpolloptions(busypoller *poller,const int fd);
+
+// the select timeout for the next pass, zero when busy polling
+struct timeval polltimeout(busypoller *poller);
+
+// called with the select result when busy polling, backs off after an empty check
+// returns 1 if the loop should handle this pass (something was ready, or the CSP has been idle for BUSYIDLE seconds)
+unsigned char pollready(busypoller *poller,const int ready);
+
+// receives length bytes like rcvbuffer, *stamp is the kernel receive time (CLOCK_REALTIME seconds)
+// of the first byte or zero if the socket doesn't have one
+// returns 0 for failure, 1 for success
+unsigned char rcvstamped(int fd,void *buffer,int length,double *stamp);
+
+// records the latency of a frame received at stamp and forwarded just now
+void recordlatency(busypoller *poller,const double stamp);
+
+// prints the polling counters, CPU use, and frame latency side by side
+void printpollstats(busypoller *poller,FILE *outfile);
+
+#endif // _FASTETH_BUSYPOLL_H
@@ -1,7 +1,10 @@
 #include <errno.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/tcp.h> //TCP_NODELAY
 
@@ -42,12 +45,7 @@ unsigned long long ullfrombuffer(unsigned char *buffer) {
 // does not give up if the socket would block or try again
 unsigned char sendbuffer(int fd,void *buffer,int length) {
 //TCP_QUICKACK // not for portable code. immediately sends ack, must be continually re-set
-//	setsockopt(fd,IPPROTO_TCP,TCP_CORK,(const void*)&optval,sizeof(int));
-//	int optval=1;
-//	setsockopt(fd,IPPROTO_TCP,TCP_QUICKACK,(const void*)&optval,sizeof(int));
-//	setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,(const void*)&optval,sizeof(int)); //disable Nagle algorithm
-	int optval=16;
-	setsockopt(fd,SOL_SOCKET,SO_SNDLOWAT,(const void*)&optval,sizeof(int));
+// socket options are set once where the socket is made, never per write
 	int i=0;
 	while (i<length) {
 		int ret = write(fd,buffer+i,length-i);
@@ -63,11 +61,36 @@ unsigned char sendbuffer(int fd,void *buffer,int length) {
 	return 1;
 }
 
+// sends the count buffers of iov to socket fd, a partial write continues where it stopped
+// returns 0 for failure, 1 for success
+// does not give up if the socket would block or try again
+unsigned char sendvector(int fd,struct iovec *iov,int count) {
+	while (count) {
+		ssize_t ret = writev(fd,iov,count);
+		if (ret<1) {
+			if (errno==EWOULDBLOCK || errno==EAGAIN) {
+				sleep(1);
+				continue;
+			}
+			return 0;
+		}
+		// skip the buffers that were written completely, the rest of a partial one goes next
+		while (count && (size_t)ret>=iov->iov_len) {
+			ret-=iov->iov_len;
+			++iov;
+			--count;
+		}
+		if (count) {
+			iov->iov_base=(void*)((unsigned char*)iov->iov_base+ret);
+			iov->iov_len-=ret;
+		}
+	}
+	return 1;
+}
+
 // receives buffer, of length size, from socket fd
 // returns 0 for failure, 1 for success
 unsigned char rcvbuffer(int fd,void *buffer,int length) {
-	int optval=16;
-	setsockopt(fd,SOL_SOCKET,SO_RCVLOWAT,(const void*)&optval,sizeof(int));
 	int i=0;
 	while (i<length) {
 		int ret = read(fd,buffer+i,length-i);
@@ -84,8 +107,6 @@ unsigned char rcvbuffer(int fd,void *buffer,int length) {
 }
 
 unsigned char semiblockrcv(int fd,void *buffer,int length) {
-	int optval=16;
-	setsockopt(fd,SOL_SOCKET,SO_RCVLOWAT,(const void*)&optval,sizeof(int));
 	int i=0;
 	while (i<length) {
 		int ret = read(fd,buffer+i,length-i);
@@ -94,3 +115,61 @@ unsigned char semiblockrcv(int fd,void *buffer,int length) {
 	}
 	return 1;
 }
+
+// sends the descriptor connfd over the unix socket fd (SCM_RIGHTS) with buffer, of length size, as one message
+// returns 0 for failure, 1 for success
+unsigned char sendconnection(int fd,int connfd,void *buffer,int length) {
+	union {
+		struct cmsghdr header;
+		char space[CMSG_SPACE(sizeof(int))];
+	} control;
+	memset((void*)&control,0,sizeof(control));
+	struct iovec iov = { .iov_base=buffer, .iov_len=(size_t)length };
+	struct msghdr msg = { .msg_iov=&iov, .msg_iovlen=1, .msg_control=control.space, .msg_controllen=sizeof(control.space) };
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level=SOL_SOCKET;
+	cmsg->cmsg_type=SCM_RIGHTS;
+	cmsg->cmsg_len=CMSG_LEN(sizeof(int));
+	memcpy((void*)CMSG_DATA(cmsg),(const void*)&connfd,sizeof(int));
+	while (1) {
+		const ssize_t ret = sendmsg(fd,&msg,MSG_NOSIGNAL);
+		if (ret==(ssize_t)length) return 1;
+		if (ret<0 && errno==EINTR) continue;
+		return 0;
+	}
+}
+
+// receives a descriptor sent with sendconnection and its message of length size, without blocking
+// returns the descriptor, -1 if no message is waiting, -2 if the socket closed or the message is faulty
+int rcvconnection(int fd,void *buffer,int length) {
+	union {
+		struct cmsghdr header;
+		char space[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct iovec iov = { .iov_base=buffer, .iov_len=(size_t)length };
+	struct msghdr msg = { .msg_iov=&iov, .msg_iovlen=1, .msg_control=control.space, .msg_controllen=sizeof(control.space) };
+	const ssize_t ret = recvmsg(fd,&msg,MSG_DONTWAIT);
+	if (ret<0) return (errno==EWOULDBLOCK || errno==EAGAIN || errno==EINTR)?-1:-2;
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_level!=SOL_SOCKET || cmsg->cmsg_type!=SCM_RIGHTS) return -2;
+	int connfd;
+	memcpy((void*)&connfd,(const void*)CMSG_DATA(cmsg),sizeof(int));
+	if (ret!=(ssize_t)length) {
+		close(connfd);
+		return -2;
+	}
+	return connfd;
+}
+
+// sets the receive low water mark of socket fd to a frame header
+void setrcvlowat(int fd) {
+	int optval=16;
+	setsockopt(fd,SOL_SOCKET,SO_RCVLOWAT,(const void*)&optval,sizeof(int));
+}
+
+// returns the seconds on the monotonic clock, used for timing and statistics
+double getnow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (double)ts.tv_sec+((double)ts.tv_nsec)/1e9;
+}
@@ -1,6 +1,81 @@
 #ifndef _FASTETH_COMMON_H
 #define _FASTETH_COMMON_H
 
+#include <sys/uio.h>
+
+// static size at front of every packet
+// every packet begins with 4bytes=src, 4bytes=dst
+// the last 8 bytes are either total transfer size (for initial data request)
+// or they are two integers, the first is the sequence number of the current transfer
+// the second is the remaining data size of the current packet (up to MAXDATASIZE)
+#define INITFRAMESIZE 16
+// the max frame size, max size for send calls
+#define MAXFRAMESIZE 4096
+// max amount of data in a data packet, is the frame size minus the init size
+#define MAXDATASIZE (MAXFRAMESIZE-INITFRAMESIZE)
+// a data frame with a compressed payload has this bit set in its size field (the last int)
+// the size field without it is the number of payload bytes that follow the header
+#define FRAMECOMPRESSED 0x40000000
+// a data frame with a checksum has this bit set, a CRCSIZE byte trailer follows the payload
+// the trailer is the CRC32C (see crc32c.h) of the header and the payload, the size field doesn't count it
+// a sender that checksums its frames sends chunks of at most MAXDATASIZE-CRCSIZE bytes
+#define FRAMECRC 0x20000000
+#define CRCSIZE 4
+// the first and last frames of a transfer are flagged, a single frame transfer has both flags
+// the first frame has the sender's frame number (its script's seqnum) in place of the chunk number, zero
+// a receiver puts a transfer back together from these, the other frames of it follow from the same sender
+#define FRAMEFIRST 0x10000000
+#define FRAMELAST 0x08000000
+// a batch frame carries several small text frames of one sender to one receiver as one transfer (fastcl -batch)
+// its payload is the frames back to back, each its frame number and text length (BATCHHEADERSIZE bytes) then the text
+// the chunk field of the (single) frame has the first frame number, the receiver unpacks and counts every frame
+#define FRAMEBATCH 0x04000000
+#define BATCHHEADERSIZE 8
+#define FRAMEFLAGS (FRAMECOMPRESSED|FRAMECRC|FRAMEFIRST|FRAMELAST|FRAMEBATCH)
+
+// the payload bytes of a data frame with the size field field
+static inline int framepayload(const int field) {
+	return field&~FRAMEFLAGS;
+}
+
+// the bytes that follow the header of a data frame with the size field field, the payload and any trailer
+static inline int framebody(const int field) {
+	return framepayload(field)+((field&FRAMECRC)?CRCSIZE:0);
+}
+
+// sessions, the CSP answers every handshake with (SP_ID, SESSIONID, ull session token)
+// a reconnecting SP sends (SP_ID, SESSIONID, ull token) in place of the handshake
+// the CSP answers with the session frame, then (SESSIONID, transfer number, ull offset)
+// for the last transfer it granted the SP, offset is the data bytes of it already forwarded
+// (RESUMENONE when that transfer was completed or there was none)
+// before re-requesting the rest of that transfer the SP sends (SP_ID, SESSIONID, ull offset)
+// the next grant then continues the transfer instead of starting a new one
+#define SESSIONID -3
+#define RESUMENONE 0xFFFFFFFFFFFFFFFFULL
+
+// the start barrier, once the whole group has joined the CSP sends (SP_ID, BARRIERID, ull group size)
+// to every SP, an SP that joins after that gets it right after its session frames
+// SPs start their scripts on it instead of sleeping after the handshake
+#define BARRIERID -4
+
+// a multiplexed connection carries a block of SPs over one socket, its first frame is
+// (first SP_ID, MUXID, int count, int group size) in place of a handshake for SPs first to first+count-1
+// the CSP answers with the session frames of each of them, after that every frame on it is one SP's frame
+// as it would be on the SP's own connection: frames from the SPs have the SP in the source field,
+// frames to them have it in the first field (control frames) or in the destination field (data frames)
+// a reply is told from a data frame between two SPs of the block by its zero chunk field and a size
+// field of 0 or 1, a data frame's first frame is flagged (FRAMEFIRST) so the size field is never that
+// the CSP reads the frames in the order they come, a sender it holds (see fastserv.c) holds the whole connection
+#define MUXID -5
+// the top 16 bits of the count field of a multiplexed connection's first frame are its simulation (see below)
+#define MUXCOUNTMASK 0xFFFF
+
+// simulations, a CSP daemon (fastserv -daemon) hosts several at once, each in a process of its own
+// a handshake is (SP_ID, SP_ID, int simulation, int group size), the simulation is zero for a plain CSP
+// a multiplexed connection's count field has the simulation in its top 16 bits,
+// and every session token a daemon's simulation hands out has it in its top 16 bits, so resumes find their way back
+#define MAXSIMULATION 0xFFFF
+
 // inserts the int x in the first 4 bytes
 void intinbuffer(unsigned char *buffer,const int x);
 // inserts the ull x in the first 8 bytes
@@ -14,12 +89,31 @@ unsigned long long ullfrombuffer(unsigned char *buffer);
 // returns 0 for failure, 1 for success
 unsigned char sendbuffer(int fd,void *buffer,int length);
 
+// sends the count buffers of iov to socket fd, in as few writev calls as the socket allows
+// returns 0 for failure, 1 for success
+unsigned char sendvector(int fd,struct iovec *iov,int count);
+
 // receives buffer, of length size, from socket fd
 // returns 0 for failure, 1 for success
 unsigned char rcvbuffer(int fd,void *buffer,int length);
 
+// sends the descriptor connfd over the unix socket fd with buffer, of length size, as one message
+// returns 0 for failure, 1 for success
+unsigned char sendconnection(int fd,int connfd,void *buffer,int length);
+
+// receives a descriptor sent with sendconnection and its message of length size, without blocking
+// returns the descriptor, -1 if no message is waiting, -2 if the socket closed or the message is faulty
+int rcvconnection(int fd,void *buffer,int length);
+
 // attempts to receive buffer, this doesn't check for EAGAIN
 unsigned char semiblockrcv(int fd,void *buffer,int length);
 
+// sets the receive low water mark of socket fd to a frame header, select reports it readable
+// once a whole header has arrived. set once when the socket is made, accepted sockets
+// inherit it from the listening socket
+void setrcvlowat(int fd);
+
+// returns the seconds on the monotonic clock, used for timing and statistics
+double getnow(void);
 
 #endif // _FASTETH_COMMON_H
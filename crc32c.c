@@ -0,0 +1,152 @@
+#include <string.h>
+#include <stdint.h>
+#include "crc32c.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define CRCX86
+#endif
+
+// the reflected Castagnoli polynomial
+#define CRCPOLY 0x82F63B78U
+
+// bytes each of the three streams of the pclmul kernel covers per block
+#define CRCLANE 512
+
+// an implementation takes and returns the running (inverted) crc
+typedef unsigned int (*crcfunction)(unsigned int crc,const unsigned char *buffer,size_t length);
+
+// slicing-by-8 tables, crctable[k][b] is the crc of byte b followed by k zero bytes
+static unsigned int crctable[8][256];
+static unsigned char tablesready=0;
+
+static void maketables(void) {
+	if (tablesready) return;
+	for (unsigned int b=0;b<256;++b) {
+		unsigned int crc=b;
+		for (int i=0;i<8;++i) crc=(crc&1)?(crc>>1)^CRCPOLY:crc>>1;
+		crctable[0][b]=crc;
+	}
+	for (unsigned int b=0;b<256;++b)
+		for (int k=1;k<8;++k) crctable[k][b]=(crctable[k-1][b]>>8)^crctable[0][crctable[k-1][b]&0xFF];
+	tablesready=1;
+}
+
+static unsigned int crctableonly(unsigned int crc,const unsigned char *buffer,size_t length) {
+	while (length && ((uintptr_t)buffer&7)) {
+		crc=(crc>>8)^crctable[0][(crc^*buffer++)&0xFF];
+		--length;
+	}
+	while (length>=8) {
+		crc^=(unsigned int)buffer[0]|((unsigned int)buffer[1]<<8)|((unsigned int)buffer[2]<<16)|((unsigned int)buffer[3]<<24);
+		crc=crctable[7][crc&0xFF]^crctable[6][(crc>>8)&0xFF]^crctable[5][(crc>>16)&0xFF]^crctable[4][crc>>24]
+			^crctable[3][buffer[4]]^crctable[2][buffer[5]]^crctable[1][buffer[6]]^crctable[0][buffer[7]];
+		buffer+=8;
+		length-=8;
+	}
+	while (length--) crc=(crc>>8)^crctable[0][(crc^*buffer++)&0xFF];
+	return crc;
+}
+
+#ifdef CRCX86
+// the multipliers that move a stream's crc past the CRCLANE and 2*CRCLANE bytes after it
+static unsigned int crcshift1, crcshift2;
+
+// x^n modulo the polynomial, reflected
+static unsigned int xpower(unsigned int n) {
+	unsigned int v=0x80000000U;
+	while (n--) v=(v&1)?(v>>1)^CRCPOLY:v>>1;
+	return v;
+}
+
+static inline unsigned long long load64(const unsigned char *buffer) {
+	unsigned long long word;
+	memcpy((void*)&word,(const void*)buffer,sizeof(unsigned long long));
+	return word;
+}
+
+__attribute__((target("sse4.2")))
+static unsigned int crcsse42(unsigned int crc,const unsigned char *buffer,size_t length) {
+	unsigned long long crc64=crc;
+	while (length && ((uintptr_t)buffer&7)) {
+		crc64=_mm_crc32_u8((unsigned int)crc64,*buffer++);
+		--length;
+	}
+	while (length>=8) {
+		crc64=_mm_crc32_u64(crc64,load64(buffer));
+		buffer+=8;
+		length-=8;
+	}
+	while (length--) crc64=_mm_crc32_u8((unsigned int)crc64,*buffer++);
+	return (unsigned int)crc64;
+}
+
+// the crc of a stream moved past the bytes after it, the multiplier is x^(8*bytes-33)
+// the carry-less product is 64 bits and the crc32 instruction reduces it
+__attribute__((target("sse4.2,pclmul")))
+static inline unsigned int crcshift(const unsigned int crc,const unsigned int multiplier) {
+	const __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int)crc),_mm_cvtsi32_si128((int)multiplier),0);
+	return (unsigned int)_mm_crc32_u64(0,(unsigned long long)_mm_cvtsi128_si64(product));
+}
+
+// three independent crc32 streams hide the instruction's latency, they are folded at the end of each block
+__attribute__((target("sse4.2,pclmul")))
+static unsigned int crcpclmul(unsigned int crc,const unsigned char *buffer,size_t length) {
+	while (length>=3*CRCLANE) {
+		unsigned long long a=crc, b=0, c=0;
+		for (int i=0;i<CRCLANE;i+=8) {
+			a=_mm_crc32_u64(a,load64(buffer+i));
+			b=_mm_crc32_u64(b,load64(buffer+CRCLANE+i));
+			c=_mm_crc32_u64(c,load64(buffer+2*CRCLANE+i));
+		}
+		crc=crcshift((unsigned int)a,crcshift2)^crcshift((unsigned int)b,crcshift1)^(unsigned int)c;
+		buffer+=3*CRCLANE;
+		length-=3*CRCLANE;
+	}
+	return crcsse42(crc,buffer,length);
+}
+#endif
+
+static unsigned int crcdispatch(unsigned int crc,const unsigned char *buffer,size_t length);
+
+static crcfunction crcimpl = crcdispatch;
+static const char *crcimplname = NULL;
+
+// the first call picks the fastest implementation the CPU runs
+static unsigned int crcdispatch(unsigned int crc,const unsigned char *buffer,size_t length) {
+	if (!crc32cselect("pclmul") && !crc32cselect("sse4.2")) crc32cselect("table");
+	return crcimpl(crc,buffer,length);
+}
+
+unsigned int crc32c(unsigned int crc,const void *buffer,size_t length) {
+	return ~crcimpl(~crc,(const unsigned char*)buffer,length);
+}
+
+const char *crc32cname(void) {
+	if (!crcimplname) crc32c(0,NULL,0);
+	return crcimplname;
+}
+
+unsigned char crc32cselect(const char *name) {
+	if (strcmp(name,"table")==0) {
+		maketables();
+		crcimpl=crctableonly;
+		crcimplname="table";
+		return 1;
+	}
+#ifdef CRCX86
+	if (strcmp(name,"sse4.2")==0 && __builtin_cpu_supports("sse4.2")) {
+		crcimpl=crcsse42;
+		crcimplname="sse4.2";
+		return 1;
+	}
+	if (strcmp(name,"pclmul")==0 && __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul")) {
+		crcshift1=xpower(8*CRCLANE-33);
+		crcshift2=xpower(16*CRCLANE-33);
+		crcimpl=crcpclmul;
+		crcimplname="pclmul";
+		return 1;
+	}
+#endif
+	return 0;
+}
@@ -0,0 +1,22 @@
+#ifndef _FASTETH_CRC32C_H
+#define _FASTETH_CRC32C_H
+
+#include <stddef.h>
+
+// CRC32C (Castagnoli, the iSCSI polynomial), the checksum of a data frame's trailer (see FRAMECRC)
+// there are three implementations, picked by what the CPU supports the first time one is called
+// "pclmul" runs three crc32 instruction streams over each block and folds them with a carry-less multiply
+// "sse4.2" is one stream of the crc32 instruction, "table" is slicing-by-8 for everything else
+// they all give the same checksums
+
+// the CRC32C of length bytes of buffer, continuing from crc (0 to start), chains like zlib's crc32
+unsigned int crc32c(unsigned int crc,const void *buffer,size_t length);
+
+// the name of the implementation in use
+const char *crc32cname(void);
+
+// uses the implementation called name instead of the one the CPU dispatch picked
+// returns 0 if there is no such implementation or the CPU can't run it
+unsigned char crc32cselect(const char *name);
+
+#endif // _FASTETH_CRC32C_H
@@ -0,0 +1,58 @@
+#include <stdlib.h>
+#include "eventq.h"
+
+// starting heap size, it grows by doubling
+#define EVENTQMINSIZE 1024
+
+// 1 if event a comes out before event b
+static inline unsigned char eventbefore(const simevent *a,const simevent *b) {
+	return a->time<b->time || (a->time==b->time && a->seq<b->seq);
+}
+
+eventq *neweventq(void) {
+	eventq *q = (eventq*)calloc(1,sizeof(eventq));
+	q->capacity=EVENTQMINSIZE;
+	q->heap = (simevent*)malloc(sizeof(simevent)*q->capacity);
+	return q;
+}
+
+void freeeventq(eventq *q) {
+	if (!q) return;
+	free(q->heap);
+	free(q);
+}
+
+void pushevent(eventq *q,simevent *ev) {
+	if (q->count==q->capacity) {
+		q->capacity<<=1;
+		q->heap = (simevent*)realloc(q->heap,sizeof(simevent)*q->capacity);
+	}
+	ev->seq=q->seq++;
+	// sift up from the new leaf
+	int i = q->count++;
+	while (i) {
+		const int parent = (i-1)>>1;
+		if (!eventbefore(ev,&q->heap[parent])) break;
+		q->heap[i]=q->heap[parent];
+		i=parent;
+	}
+	q->heap[i]=*ev;
+}
+
+unsigned char popevent(eventq *q,simevent *ev) {
+	if (!q->count) return 0;
+	*ev=q->heap[0];
+	const simevent last = q->heap[--q->count];
+	// sift the last leaf down from the root
+	int i=0;
+	while (1) {
+		int child = (i<<1)+1;
+		if (child>=q->count) break;
+		if (child+1<q->count && eventbefore(&q->heap[child+1],&q->heap[child])) ++child;
+		if (!eventbefore(&q->heap[child],&last)) break;
+		q->heap[i]=q->heap[child];
+		i=child;
+	}
+	q->heap[i]=last;
+	return 1;
+}
@@ -0,0 +1,39 @@
+#ifndef _FASTETH_EVENTQ_H
+#define _FASTETH_EVENTQ_H
+
+// a pending event of a discrete event simulation, times are virtual nanoseconds
+// events with the same time come out in the order they were pushed (seq), so a run is reproducible
+// type, src, dst, arg and value are for the caller, for a frame they are its header fields
+typedef struct simevent {
+	unsigned long long time;
+	unsigned long long seq;
+	int type;
+	int src;
+	int dst;
+	int arg;
+	unsigned long long value;
+}simevent;
+
+// a binary min heap of events ordered by (time, seq)
+typedef struct eventq {
+	simevent *heap;
+	int count;
+	int capacity;
+	unsigned long long seq; // events pushed so far
+}eventq;
+
+eventq *neweventq(void);
+void freeeventq(eventq *q);
+
+// adds a copy of ev, its seq is set here
+void pushevent(eventq *q,simevent *ev);
+
+// removes the earliest event into *ev, returns 0 if there is none
+unsigned char popevent(eventq *q,simevent *ev);
+
+// the time of the earliest event, the queue must not be empty
+static inline unsigned long long nexteventtime(eventq *q) {
+	return q->heap[0].time;
+}
+
+#endif // _FASTETH_EVENTQ_H
@@ -0,0 +1,344 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h> //TCP_NODELAY
+#include "common.h"
+#include "fabric.h"
+
+// sends a trunk control frame to trunk index t
+static unsigned char sendtrunkframe(fabric *fab,const int t,const int type,const int first,const int second) {
+	unsigned char buffer[INITFRAMESIZE];
+	intinbuffer(buffer,TRUNKID);
+	intinbuffer(buffer+4,type);
+	intinbuffer(buffer+8,first);
+	intinbuffer(buffer+12,second);
+	return sendbuffer(fab->trunkfd[t],(void*)buffer,sizeof(unsigned char)*INITFRAMESIZE);
+}
+
+// sends a trunk control frame to every trunk except trunk index except (-1 for all of them)
+static void floodtrunks(fabric *fab,const int except,const int type,const int first,const int second) {
+	for (int t=0;t<fab->numtrunks;++t) {
+		if (t==except || fab->trunkfd[t]<0) continue;
+		sendtrunkframe(fab,t,type,first,second);
+	}
+}
+
+// sends every known route and station state to trunk index t
+// the trunk is corked for the burst so the frames leave in full segments
+static void synctrunk(fabric *fab,const int t) {
+	porttable *ports = fab->ports;
+	int optval=1;
+	setsockopt(fab->trunkfd[t],IPPROTO_TCP,TCP_CORK,(const void*)&optval,sizeof(int));
+	for (int p=0;p<ports->numports;++p) {
+		const int sp_id = SPFROMSTATION(ports->station[p]);
+		// the route is the path through this switch, never advertise a path back to where it came from
+		if (ports->nexthop[p]>=0 && ports->routetrunk[p]!=t && ports->routehops[p]+1<MAXHOPS)
+			sendtrunkframe(fab,t,TRUNKROUTE,sp_id,ports->routehops[p]+1);
+		if (ports->nexthop[p]>=0 && ports->stateseq[p])
+			sendtrunkframe(fab,t,TRUNKSTATE,sp_id,(int)(ports->stateseq[p]<<2)|ports->state[p]);
+	}
+	optval=0;
+	setsockopt(fab->trunkfd[t],IPPROTO_TCP,TCP_CORK,(const void*)&optval,sizeof(int));
+}
+
+// creates a fabric for this switch over its port table
+fabric *newfabric(const int switchid,porttable *ports) {
+	fabric *fab = (fabric*)calloc(1,sizeof(fabric));
+	fab->switchid=switchid;
+	fab->ports=ports;
+	fab->sampledown=mirrorcountdown(0);
+	return fab;
+}
+
+void freefabric(fabric *fab) {
+	free(fab);
+}
+
+// adds a connected trunk and syncs routes and states to it
+// returns the trunk index, or -1 if there is no room
+int addtrunk(fabric *fab,const int fd,const int peerswitch,FILE *outfile) {
+	if (fab->numtrunks==MAXTRUNKS) {
+		fprintf(stderr,"CSP: No room for a trunk to switch %d (max %d)\n",peerswitch,MAXTRUNKS);
+		close(fd);
+		return -1;
+	}
+	const int t = fab->numtrunks++;
+	fab->trunkfd[t]=fd;
+	fab->trunkswitch[t]=peerswitch;
+	fab->trunkframes[t]=0;
+	fprintf(outfile,"CSP: Trunk %d connected to switch %d\n",t,peerswitch);
+	synctrunk(fab,t);
+	return t;
+}
+
+// answers a trunk hello that arrived on the listening socket with this switch's hello
+// then adds the trunk, returns the trunk index or -1
+int answertrunk(fabric *fab,const int fd,const int peerswitch,FILE *outfile) {
+	int optval=1;
+	setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,(const void*)&optval,sizeof(int));
+	unsigned char buffer[INITFRAMESIZE];
+	intinbuffer(buffer,TRUNKID);
+	intinbuffer(buffer+4,TRUNKHELLO);
+	intinbuffer(buffer+8,fab->switchid);
+	intinbuffer(buffer+12,fab->numSPprocesses);
+	if (!sendbuffer(fd,(void*)buffer,sizeof(unsigned char)*INITFRAMESIZE)) {
+		fprintf(stderr,"CSP: Trunk hello reply to switch %d failed\n",peerswitch);
+		close(fd);
+		return -1;
+	}
+	return addtrunk(fab,fd,peerswitch,outfile);
+}
+
+// connects fd to addr, a switch that doesn't answer within a second (a host that is down) is given up on
+// returns 0 for failure, 1 for success
+static unsigned char connectwithin(const int fd,const struct sockaddr_in *addr) {
+	const int flags = fcntl(fd,F_GETFL,0);
+	fcntl(fd,F_SETFL,flags|O_NONBLOCK);
+	int ret = connect(fd,(const struct sockaddr*)addr,sizeof(struct sockaddr));
+	if (ret<0 && errno==EINPROGRESS) {
+		fd_set fdlist;
+		FD_ZERO(&fdlist);
+		FD_SET(fd,&fdlist);
+		struct timeval tv = { .tv_sec=1, .tv_usec=0 };
+		int error=0;
+		socklen_t length=sizeof(int);
+		ret = (select(fd+1,NULL,&fdlist,NULL,&tv)==1 && !getsockopt(fd,SOL_SOCKET,SO_ERROR,(void*)&error,&length) && !error)?0:-1;
+	}
+	fcntl(fd,F_SETFL,flags);
+	return !ret;
+}
+
+// connects to the switch at "ip:port" and sends the trunk hello
+// retries TRUNKDIALTRIES times for the other switch to listen, returns the trunk index or -1
+int dialtrunk(fabric *fab,const char *ipport,FILE *outfile) {
+	char ip[64];
+	const char *colon = strchr(ipport,':');
+	if (!colon || colon-ipport>=(int)sizeof(ip)) {
+		fprintf(stderr,"CSP: Expected \"ip:port\" for a trunk, got \"%s\"\n",ipport);
+		return -1;
+	}
+	memcpy((void*)ip,(void*)ipport,colon-ipport);
+	ip[colon-ipport]='\0';
+	struct sockaddr_in addr;
+	memset((void*)&addr,0,sizeof(struct sockaddr_in));
+	addr.sin_family = AF_INET;
+	addr.sin_port=htons((unsigned short)atoi(colon+1));
+	if (inet_pton(AF_INET,ip,&addr.sin_addr)<=0) {
+		fprintf(stderr,"CSP: Unable to convert trunk ip \"%s\"\n",ip);
+		return -1;
+	}
+	// the other switch may not be up yet, a socket whose connect failed is done with so each try gets a new one
+	// the event loop waits out the tries, a switch that stays down isn't waited for longer
+	int fd=-1;
+	for (int tries=0;fd<0 && tries<TRUNKDIALTRIES;++tries) {
+		if ((fd=socket(AF_INET,SOCK_STREAM,IPPROTO_TCP))<0) {
+			fprintf(stderr,"CSP: Error getting a socket for a trunk\n");
+			return -1;
+		}
+		if (connectwithin(fd,&addr)) break;
+		close(fd);
+		fd=-1;
+		sleep(1);
+	}
+	if (fd<0) {
+		fprintf(stderr,"CSP: No switch listening at %s after %d tries, not linking to it\n",ipport,TRUNKDIALTRIES);
+		return -1;
+	}
+	int optval=1;
+	setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,(const void*)&optval,sizeof(int));
+	setrcvlowat(fd);
+	unsigned char buffer[INITFRAMESIZE];
+	intinbuffer(buffer,TRUNKID);
+	intinbuffer(buffer+4,TRUNKHELLO);
+	intinbuffer(buffer+8,fab->switchid);
+	intinbuffer(buffer+12,fab->numSPprocesses);
+	// the peer replies with its own hello so both ends know who they are linked to
+	if (!sendbuffer(fd,(void*)buffer,sizeof(unsigned char)*INITFRAMESIZE)
+			|| !rcvbuffer(fd,(void*)buffer,sizeof(unsigned char)*INITFRAMESIZE)
+			|| intfrombuffer(buffer)!=TRUNKID || intfrombuffer(buffer+4)!=TRUNKHELLO) {
+		fprintf(stderr,"CSP: Trunk hello to %s failed\n",ipport);
+		close(fd);
+		return -1;
+	}
+	return addtrunk(fab,fd,intfrombuffer(buffer+8),outfile);
+}
+
+// records a station connected to this switch on fd and advertises the route to it
+// returns its port index
+int addlocalsp(fabric *fab,const int sp_id,const int fd) {
+	porttable *ports = fab->ports;
+	const int port = portregister(ports,STATIONID(sp_id));
+	ports->fd[port]=fd;
+	ports->nexthop[port]=fd;
+	ports->routetrunk[port]=-1;
+	ports->routehops[port]=0;
+	// a station resuming its session was already counted and keeps its state
+	if (!ports->session[port]) {
+		ports->state[port]=SPACTIVE;
+		++ports->joined;
+	}
+	floodtrunks(fab,-1,TRUNKROUTE,sp_id,1);
+	return port;
+}
+
+// withdraws the route to a station connected to this switch, the caller deregisters the port
+void removelocalsp(fabric *fab,const int port) {
+	floodtrunks(fab,-1,TRUNKROUTE,SPFROMSTATION(fab->ports->station[port]),MAXHOPS);
+}
+
+// sets the state of a local station and floods it through the fabric
+void announcestate(fabric *fab,const int port,const int state) {
+	porttable *ports = fab->ports;
+	ports->state[port]=state;
+	++ports->stateseq[port];
+	floodtrunks(fab,-1,TRUNKSTATE,SPFROMSTATION(ports->station[port]),(int)(ports->stateseq[port]<<2)|state);
+}
+
+// writes a data frame of length bytes toward the station at port, on its own socket or over a trunk
+// returns 0 for failure, 1 for success
+static unsigned char sendframe(fabric *fab,const int port,unsigned char *buffer,const int length) {
+	porttable *ports = fab->ports;
+	if (ports->routetrunk[port]<0) return flushcontrol(ports,port,buffer,length);
+	if (!sendbuffer(ports->nexthop[port],(void*)buffer,sizeof(unsigned char)*length)) return 0;
+	if (ports->routetrunk[port]>=0) ++fab->trunkframes[ports->routetrunk[port]];
+	return 1;
+}
+
+// sends a data frame of length bytes toward the station at port, on its own socket or over a trunk
+// a local station gets its pending control frames ahead of the data frame in the same write
+// with link emulation the frame may be held on the port until its links let it go
+// returns 0 for failure, 1 for success
+unsigned char forwardframe(fabric *fab,const int src,const int port,unsigned char *buffer,const int length) {
+	porttable *ports = fab->ports;
+	if (ports->nexthop[port]<0) return 0;
+	// the one check the mirror costs a frame
+	if (!--fab->sampledown) fab->sampledown=mirrorframe(fab->mirror,ports,buffer,length);
+	if (fab->link) {
+		const double now = getnow();
+		const double release = linkdeparture(fab->link,src,port,ports->routetrunk[port]<0,length,now);
+		// a frame that could go now still waits for the frames the port holds
+		if (release>now || linkbacklog(fab->link,port)) {
+			linkhold(fab->link,port,ports->station[port],buffer,length,release,now);
+			return 1;
+		}
+	}
+	return sendframe(fab,port,buffer,length);
+}
+
+// sends the frames held by the link emulation that are due by now
+// a frame whose station left (or lost its route) while it was held is dropped
+void releaseframes(fabric *fab,const double now,FILE *outfile) {
+	if (!fab->link) return;
+	porttable *ports = fab->ports;
+	heldframe *frame;
+	int port;
+	while ((frame=linkdue(fab->link,now,&port))) {
+		const int src_sp_id = intfrombuffer(frame->buffer);
+		const int dst_sp_id = intfrombuffer(frame->buffer+4);
+		if (ports->station[port]!=frame->station || ports->nexthop[port]<0)
+			fprintf(outfile,"CSP: Dropped held data frame (from SP %d) to departed SP %d\n",src_sp_id,dst_sp_id);
+		else if (!sendframe(fab,port,frame->buffer,frame->length))
+			fprintf(stderr,"CSP: Error releasing held data frame from SP %d to SP %d\n",src_sp_id,dst_sp_id);
+		linkdone(fab->link,frame);
+	}
+}
+
+// drops trunk index t, every station behind it becomes unreachable
+static void droptrunk(fabric *fab,const int t,FILE *outfile) {
+	porttable *ports = fab->ports;
+	fprintf(outfile,"CSP: Trunk %d to switch %d closed\n",t,fab->trunkswitch[t]);
+	close(fab->trunkfd[t]);
+	fab->trunkfd[t]=-1;
+	for (int p=0;p<ports->numports;++p) {
+		if (ports->routetrunk[p]!=t) continue;
+		ports->routetrunk[p]=-1;
+		ports->nexthop[p]=-1;
+	}
+}
+
+// reads and handles one frame from trunk index t, buffer must hold MAXFRAMESIZE bytes
+// if a remote station's route is withdrawn its port is written to *withdrawn (otherwise -1),
+// the caller purges its queues and deregisters the port
+// returns 0 if the trunk was closed (its stations become unreachable)
+unsigned char handletrunk(fabric *fab,const int t,unsigned char *buffer,int *withdrawn,FILE *outfile) {
+	porttable *ports = fab->ports;
+	*withdrawn=-1;
+	if (!rcvbuffer(fab->trunkfd[t],(void*)buffer,sizeof(unsigned char)*INITFRAMESIZE)) {
+		droptrunk(fab,t,outfile);
+		return 0;
+	}
+	const int src_sp_id = intfrombuffer(buffer);
+	const int dst_sp_id = intfrombuffer(buffer+4);
+	const int first = intfrombuffer(buffer+8);
+	const int second = intfrombuffer(buffer+12);
+	// a data frame, the last field is the size of the data that follows
+	if (src_sp_id!=TRUNKID) {
+		// the payload and any checksum trailer, the trailer goes along with the frame
+		const int payload = framebody(second);
+		if (payload<0 || payload>MAXDATASIZE || !rcvbuffer(fab->trunkfd[t],(void*)(buffer+INITFRAMESIZE),sizeof(unsigned char)*payload)) {
+			fprintf(stderr,"CSP: Bad data frame on trunk %d, closing it\n",t);
+			droptrunk(fab,t,outfile);
+			return 0;
+		}
+		const int port = dst_sp_id<0?-1:portlookup(ports,STATIONID(dst_sp_id));
+		// never send a frame back the way it came
+		if (port<0 || ports->nexthop[port]<0 || ports->routetrunk[port]==t) {
+			fprintf(outfile,"CSP: Dropped data frame (from SP %d) to unreachable SP %d\n",src_sp_id,dst_sp_id);
+			return 1;
+		}
+		if (!forwardframe(fab,-1,port,buffer,INITFRAMESIZE+payload))
+			fprintf(stderr,"CSP: Error forwarding trunk data frame from SP %d to SP %d\n",src_sp_id,dst_sp_id);
+		else
+			fprintf(outfile,"CSP: Forwarded data frame (from SP %d) to SP %d from switch %d\n",src_sp_id,dst_sp_id,fab->trunkswitch[t]);
+		return 1;
+	}
+	if (first<0) return 1;
+	int port = portlookup(ports,STATIONID(first));
+	if (dst_sp_id==TRUNKROUTE) {
+		// the station left the switch the route went through
+		if (second>=MAXHOPS) {
+			if (port<0 || ports->routetrunk[port]!=t) return 1;
+			fprintf(outfile,"CSP: Route to SP %d through switch %d withdrawn\n",first,fab->trunkswitch[t]);
+			floodtrunks(fab,t,TRUNKROUTE,first,MAXHOPS);
+			*withdrawn=port;
+			return 1;
+		}
+		// a local station, or a path that isn't shorter than the one we have
+		if (port>=0 && ports->nexthop[port]>=0 && (ports->routetrunk[port]<0 || ports->routehops[port]<=second)) return 1;
+		if (port<0) port=portregister(ports,STATIONID(first));
+		if (ports->nexthop[port]<0) ++ports->joined;
+		ports->nexthop[port]=fab->trunkfd[t];
+		ports->routetrunk[port]=t;
+		ports->routehops[port]=second;
+		fprintf(outfile,"CSP: Route to SP %d through switch %d (%d hops)\n",first,fab->trunkswitch[t],second);
+		floodtrunks(fab,t,TRUNKROUTE,first,second+1);
+	}
+	else if (dst_sp_id==TRUNKSTATE) {
+		const unsigned int seq = ((unsigned int)second)>>2;
+		const int state = second&0x3;
+		if (port<0) port=portregister(ports,STATIONID(first));
+		// already seen, this stops the flood
+		if (seq<=ports->stateseq[port]) return 1;
+		// the newest state holds whatever came before, a station that rejoined is active again after done
+		ports->stateseq[port]=seq;
+		ports->state[port]=state;
+		floodtrunks(fab,t,TRUNKSTATE,first,second);
+	}
+	return 1;
+}
+
+// closes every trunk and prints the per trunk counters
+void closetrunks(fabric *fab,FILE *outfile) {
+	for (int t=0;t<fab->numtrunks;++t) {
+		fprintf(outfile,"CSP: Trunk %d to switch %d forwarded %llu data frames\n",t,fab->trunkswitch[t],fab->trunkframes[t]);
+		if (fab->trunkfd[t]<0) continue;
+		shutdown(fab->trunkfd[t],SHUT_RDWR);
+		close(fab->trunkfd[t]);
+		fab->trunkfd[t]=-1;
+	}
+}
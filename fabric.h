@@ -0,0 +1,91 @@
+#ifndef _FASTETH_FABRIC_H
+#define _FASTETH_FABRIC_H
+
+#include <stdio.h>
+#include "porttable.h"
+#include "linkemu.h"
+#include "anycast.h"
+#include "mirror.h"
+
+// several CSPs can be linked with trunk connections into one switch fabric
+// a trunk frame has TRUNKID in the source field and the trunk frame type in the destination field
+// the last 8 bytes are two integers, their meaning depends on the type:
+// TRUNKHELLO, the switch id and the number of SP processes (the first frame on a trunk)
+// TRUNKROUTE, an SP id and the number of hops to it from the sending switch (MAXHOPS withdraws it)
+// TRUNKSTATE, an SP id and (sequence number * 4 + SP state), flooded to every switch
+// data frames keep their normal header and are forwarded over trunks as they are
+#define TRUNKID -2
+#define TRUNKHELLO 0
+#define TRUNKROUTE 1
+#define TRUNKSTATE 2
+
+// trunks per switch, and the longest path a route is allowed to have
+#define MAXTRUNKS 16
+#define MAXHOPS 16
+// times a trunk is dialed before the switch at the other end is given up on, a second or two each
+#define TRUNKDIALTRIES 30
+
+// the fabric as seen from one switch, the routes live in the port table
+// a station's nexthop is its own socket when it is connected here, or a trunk socket
+typedef struct fabric {
+	int switchid;
+	int numSPprocesses; // the group size, zero until it is known
+	porttable *ports;
+	int numtrunks;
+	int trunkfd[MAXTRUNKS];
+	int trunkswitch[MAXTRUNKS]; // the switch id at the other end
+	unsigned long long trunkframes[MAXTRUNKS]; // data frames forwarded over each trunk
+	linkemu *link; // the emulated links, NULL when frames go out as soon as they come in
+	anycast *groups; // the anycast groups, NULL without any
+	mirror *mirror; // the sampled copies of forwarded frames, NULL without them
+	unsigned int sampledown; // forwarded frames to the next copy, see mirror.h
+}fabric;
+
+// creates a fabric for this switch over its port table
+fabric *newfabric(const int switchid,porttable *ports);
+void freefabric(fabric *fab);
+
+// adds a connected trunk and syncs routes and states to it
+// returns the trunk index, or -1 if there is no room
+int addtrunk(fabric *fab,const int fd,const int peerswitch,FILE *outfile);
+
+// answers a trunk hello that arrived on the listening socket with this switch's hello
+// then adds the trunk, returns the trunk index or -1
+int answertrunk(fabric *fab,const int fd,const int peerswitch,FILE *outfile);
+
+// connects to the switch at "ip:port" and sends the trunk hello
+// retries TRUNKDIALTRIES times for the other switch to listen, returns the trunk index or -1
+int dialtrunk(fabric *fab,const char *ipport,FILE *outfile);
+
+// records a station connected to this switch on fd and advertises the route to it
+// a station with a session is resuming, it is not counted again
+// returns its port index
+int addlocalsp(fabric *fab,const int sp_id,const int fd);
+
+// withdraws the route to a station connected to this switch, the caller deregisters the port
+void removelocalsp(fabric *fab,const int port);
+
+// sets the state of a local station and floods it through the fabric
+void announcestate(fabric *fab,const int port,const int state);
+
+// sends a data frame of length bytes toward the station at port, on its own socket or over a trunk
+// a local station gets its pending control frames ahead of the data frame in the same write
+// src is the port of the local station it came from, -1 for a frame from a trunk
+// with link emulation the frame may be held on the port until its links let it go (see releaseframes)
+// one in every so many frames is copied to the mirror first (see mirror.h)
+// returns 0 for failure, 1 for success
+unsigned char forwardframe(fabric *fab,const int src,const int port,unsigned char *buffer,const int length);
+
+// sends the frames held by the link emulation that are due by now
+void releaseframes(fabric *fab,const double now,FILE *outfile);
+
+// reads and handles one frame from trunk index t, buffer must hold MAXFRAMESIZE bytes
+// if a remote station's route is withdrawn its port is written to *withdrawn (otherwise -1),
+// the caller purges its queues and deregisters the port
+// returns 0 if the trunk was closed (its stations become unreachable)
+unsigned char handletrunk(fabric *fab,const int t,unsigned char *buffer,int *withdrawn,FILE *outfile);
+
+// closes every trunk and prints the per trunk counters
+void closetrunks(fabric *fab,FILE *outfile);
+
+#endif // _FASTETH_FABRIC_H
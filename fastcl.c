@@ -9,28 +9,40 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/select.h>
-#include <sys/types.h>
 #include <time.h>
 #include <errno.h>
+#include <signal.h>
 #include "common.h"
-
-// static size at front of every packet
-// every packet begins with 4bytes=src, 4bytes=dst
-// the last 8 bytes are either total transfer size (for initial data request)
-// or they are two integers, the first is the sequence number of the current transfer
-// the second is the remaining data size of the current packet (up to MAXDATASIZE)
-#define INITFRAMESIZE 16
-// the max frame size, max size for send calls
-#define MAXFRAMESIZE 4096
-// max amount of data in a data packet, is the frame size minus the init size
-#define MAXDATASIZE MAXFRAMESIZE-INITFRAMESIZE
-
-// max length of a line from the input cmd file
-#define MAXLINELEN 128
+#include "lz.h"
+#include "script.h"
+#include "crc32c.h"
+#include "reassembly.h"
+#include "probes.h"
 
 // max number of SP processes to fork
 #define FORKPROCESSLIMIT 256
 
+// max number of CSP addresses, the SPs are spread over the switches of a fabric
+#define MAXSWITCHES 16
+
+// connection attempts when an SP reconnects to resume its session, about 5 seconds of retries
+#define RECONNECTLIMIT 12
+// the first retry delay of a refused connect in milliseconds, it doubles up to a second
+#define CONNECTRETRYMS 10
+
+// the milliseconds a batch of text frames stays open for more frames when -batch doesn't give them
+#define BATCHDEADLINEMS 10
+
+// the SP's probes, see probes.h and probes/
+PROBESEMAPHORE(sp,requestsent);
+PROBESEMAPHORE(sp,requestaccepted);
+PROBESEMAPHORE(sp,requestrejected);
+PROBESEMAPHORE(sp,framesent);
+PROBESEMAPHORE(sp,framereceived);
+PROBESEMAPHORE(sp,spwait);
+PROBESEMAPHORE(sp,spwake);
+PROBESEMAPHORE(sp,spdone);
+
 // what a SP process wants to do, if they have data to send, blocked send can be masked onto value
 // SENDNONE (nothing), SENDTEXT|SENDFILE (send data), SENDBLOCKED (wait for ok), SENDFINISHED (no more cmd file)
 enum spstatus { SENDNONE=0, SENDTEXT=0x1, SENDFILE=0x10, SENDBLOCKED=0x100, SENDFINISHED=0x1000 };
@@ -41,14 +53,190 @@ enum spstatus { SENDNONE=0, SENDTEXT=0x1, SENDFILE=0x10, SENDBLOCKED=0x100, SEND
 // the dst_sp_id, sequence number (from cmd file), and bufferlen
 // the next send (of buffer) will be of size (bufferlen)
 // the sizeremaining is the (file)size remaining, in case it doesn't all fit in one data frame
+// totalsize and filename let a transfer be resumed after a reconnect
+// a compressed transfer sends each chunk compressed when that makes it smaller, its sizes count compressed bytes
+// framefield is the size field of the frame in the buffer (with FRAMECOMPRESSED)
+// chunk is the number of the frame in the buffer within its transfer, the header gets it as the frame goes out (see stampframe)
+// a checksummed transfer sends smaller chunks, its trailer is added as each frame goes out (see sealframe)
+// a batch is a text frame that holds several text frames (see FRAMEBATCH)
 typedef struct datapacket {
 	unsigned char buffer[MAXFRAMESIZE];
 	int dst_sp_id;
 	int seqnum;
 	int bufferlen;
+	int framefield;
+	int chunk;
+	unsigned char compress;
+	unsigned char crc;
+	unsigned char batch;
 	unsigned long long sizeremaining;
+	unsigned long long totalsize;
+	char filename[MAXLINELEN];
 }datapacket;
 
+// waits for the non-blocking connect in progress on fd, returns 1 if it connected
+static unsigned char connected(const int fd) {
+	fd_set fds;
+	FD_ZERO(&fds);
+	FD_SET(fd,&fds);
+	struct timeval tv = { .tv_sec=1, .tv_usec=0 };
+	if (select(fd+1,NULL,&fds,NULL,&tv)<1) return 0;
+	int err=0;
+	socklen_t len=sizeof(int);
+	if (getsockopt(fd,SOL_SOCKET,SO_ERROR,(void*)&err,&len)) return 0;
+	return !err;
+}
+
+// connects a new socket to the CSP at addr, tries attempts times (forever if attempts<1)
+// a refused connect is retried on a new socket, after CONNECTRETRYMS doubling up to a second
+// returns the socket, or -1
+static int connectcsp(const struct sockaddr_in *addr,const int attempts) {
+	int fd;
+	int tries=0;
+	long delay=CONNECTRETRYMS;
+	while (1) {
+		fd = socket(AF_INET,SOCK_STREAM | SOCK_NONBLOCK,IPPROTO_TCP);
+		if (fd<0) return -1;
+		if (!connect(fd,(const struct sockaddr*)addr,sizeof(struct sockaddr)) || (errno==EINPROGRESS && connected(fd))) break;
+		close(fd);
+		if (attempts>0 && ++tries==attempts) return -1;
+		struct timespec ts = { .tv_sec=delay/1000, .tv_nsec=(delay%1000)*1000000 };
+		nanosleep(&ts,NULL);
+		delay=(delay<<1)>1000?1000:(delay<<1);
+	}
+
+	// I had issues (with many processes fighting for attention) of "Connection reset by peer"
+	int optval=1;
+	// enable the KEEPALIVE flag at the socket level
+	setsockopt(fd,SOL_SOCKET,SO_KEEPALIVE,(const void*)&optval,sizeof(int));
+// (the below TCP options are labelled in the docs as not for portable code)
+// I needed to use these to handle 10 processes and 1 of each CSP queue type . . .
+// These options stopped the mid-simulation connection failures (connection reset by peer)
+// I suppose a reconnect routine could probably fix this without using these options . . .
+	// set the delay for the first KEEPALIVE to 1 second
+	int firstkeepalivedelay=1;
+	setsockopt(fd,IPPROTO_TCP,TCP_KEEPIDLE,&firstkeepalivedelay,sizeof(int));
+	// set the interval between KEEPALIVE messages to 3 seconds
+	int keepaliveinterval=3;
+	setsockopt(fd,IPPROTO_TCP,TCP_KEEPINTVL,&keepaliveinterval,sizeof(int));
+	// set the max number of KEEPALIVE messages to 240
+	int maxkeepalives=240;
+	setsockopt(fd,IPPROTO_TCP,TCP_KEEPCNT,&maxkeepalives,sizeof(int));
+	setrcvlowat(fd);
+	return fd;
+}
+
+// receives length bytes from the non-blocking socket fd, waiting in select for them to arrive
+// returns 0 for failure, 1 for success
+static unsigned char waitrcv(int fd,void *buffer,int length) {
+	fd_set fds;
+	FD_ZERO(&fds);
+	FD_SET(fd,&fds);
+	if (select(fd+1,&fds,NULL,NULL,NULL)<1) return 0;
+	return rcvbuffer(fd,buffer,length);
+}
+
+// waits for the CSP's start barrier, the whole group has joined when it arrives
+// a data frame can beat it (from a switch that saw the group complete first), it is left for the main loop
+// returns 1 for the barrier, 0 for another frame, -1 if the connection closed
+static int waitbarrier(int fd) {
+	unsigned char buffer[INITFRAMESIZE];
+	fd_set fds;
+	FD_ZERO(&fds);
+	FD_SET(fd,&fds);
+	if (select(fd+1,&fds,NULL,NULL,NULL)<1) return -1;
+	// the socket is readable at a whole header (SO_RCVLOWAT), less is the end of the connection
+	if (recv(fd,(void*)buffer,sizeof(unsigned char)*INITFRAMESIZE,MSG_PEEK)<INITFRAMESIZE) return -1;
+	if (intfrombuffer(buffer+4)!=BARRIERID) return 0;
+	return rcvbuffer(fd,(void*)buffer,sizeof(unsigned char)*INITFRAMESIZE)?1:-1;
+}
+
+// checks a socket that had nothing to read, returns 1 if the connection is closed
+static unsigned char connectionlost(int fd) {
+	unsigned char byte;
+	const int ret = recv(fd,(void*)&byte,1,MSG_PEEK|MSG_DONTWAIT);
+	if (!ret) return 1;
+	return ret<0 && errno!=EWOULDBLOCK && errno!=EAGAIN;
+}
+
+// sends the request for the rest of outpacket, after a resume claim for offset claim (unless RESUMENONE)
+// returns 0 for failure, 1 for success
+static unsigned char sendrequest(int fd,const int SP_ID,datapacket *outpacket,const unsigned long long claim) {
+	unsigned char request[INITFRAMESIZE*2];
+	intinbuffer(request,SP_ID);
+	intinbuffer(request+4,SESSIONID);
+	ullinbuffer(request+8,claim);
+	intinbuffer(request+INITFRAMESIZE,SP_ID);
+	intinbuffer(request+INITFRAMESIZE+4,outpacket->dst_sp_id);
+	ullinbuffer(request+INITFRAMESIZE+8,outpacket->sizeremaining);
+	PROBE3(sp,requestsent,SP_ID,outpacket->dst_sp_id,outpacket->sizeremaining);
+	if (claim==RESUMENONE) return sendbuffer(fd,(void*)(request+INITFRAMESIZE),sizeof(unsigned char)*INITFRAMESIZE);
+	return sendbuffer(fd,(void*)request,sizeof(unsigned char)*INITFRAMESIZE*2);
+}
+
+// the most data bytes a frame of outpacket carries, room is left for a checksum trailer
+static inline int chunksize(const datapacket *outpacket) {
+	return outpacket->crc?MAXDATASIZE-CRCSIZE:MAXDATASIZE;
+}
+
+// reads up to limit bytes (at most MAXDATASIZE) of sendfile into payload
+// with compress set the chunk is compressed if that makes it smaller, *compressed says if it was
+// returns the payload length, zero at the end of the file
+static int packchunk(FILE *sendfile,const unsigned char compress,unsigned char *payload,unsigned char *compressed,const unsigned long long limit) {
+	unsigned char raw[MAXDATASIZE];
+	const int want = (limit<MAXDATASIZE)?(int)limit:MAXDATASIZE;
+	*compressed=0;
+	const int length = (int)fread((void*)(compress?raw:payload),sizeof(unsigned char),want,sendfile);
+	if (!compress || length<=0) return length;
+	const int packed = lzcompress(raw,length,payload,length-1);
+	if (packed>0) {
+		*compressed=1;
+		return packed;
+	}
+	memcpy((void*)payload,(void*)raw,length);
+	return length;
+}
+
+// the payload bytes a compressed transfer of sendfile in chunks of chunk bytes puts on the wire, the file is rewound
+static unsigned long long wiresize(FILE *sendfile,const int chunk) {
+	unsigned char payload[MAXDATASIZE];
+	unsigned char compressed;
+	unsigned long long total=0;
+	int length;
+	while ((length=packchunk(sendfile,1,payload,&compressed,chunk))>0) total+=length;
+	rewind(sendfile);
+	return total;
+}
+
+// reads the next chunk of sendfile into the outpacket buffer
+// first two fields of output buffer (src and dst) remain the same (as they were already)
+// the packet counter is incremented, sets bufferlen (zero with sizeremaining if there was nothing left)
+static void readchunk(datapacket *outpacket,FILE **sendfile) {
+	// update the packet counter and the size of the next frame
+	intinbuffer(outpacket->buffer+8,++outpacket->chunk);
+	// a compressed transfer reads whole chunks, its remaining size counts compressed bytes
+	unsigned char compressed;
+	unsigned long long limit = (unsigned long long)chunksize(outpacket);
+	if (!outpacket->compress && outpacket->sizeremaining<limit) limit=outpacket->sizeremaining;
+	const int thistransfersize = packchunk(*sendfile,outpacket->compress,outpacket->buffer+INITFRAMESIZE,&compressed,limit);
+	outpacket->bufferlen=INITFRAMESIZE+thistransfersize;
+	// if we are at EOF close the file and set the pointer to NULL
+	if (feof(*sendfile)) {
+		fclose(*sendfile);
+		*sendfile=NULL;
+	}
+	// we collected bytes to send
+	if (thistransfersize) {
+		outpacket->framefield=thistransfersize|(compressed?FRAMECOMPRESSED:0);
+		intinbuffer(outpacket->buffer+12,outpacket->framefield);
+	}
+	// there was nothing left in the file to send
+	else {
+		outpacket->sizeremaining=0;
+		outpacket->bufferlen=0;
+	}
+}
+
 // print usage info, called for bad command line arguments
 static inline void printusage(char *prog) {
 	fprintf(stderr,"Fast Ethernet Station Process Launcher\n");
@@ -59,6 +247,91 @@ static inline void printusage(char *prog) {
 	fprintf(stderr,"-n X specifies to launch X SP processes (processes are numbered from zero)\n");
 	fprintf(stderr,"Specify output location: %s -n 1 127.0.0.7:52528 -in=input -out=logprefix\n",prog);
 	fprintf(stderr,"Output files then created as: logprefix0.log, logprefix1.log, ..., where the number is the SP number\n");
+	fprintf(stderr,"Switch fabric: %s -n 4 127.0.0.1:52528 127.0.0.1:52529 -in=input\n",prog);
+	fprintf(stderr,"With more than one ip:port, SP X connects to switch (X modulo the number of switches)\n");
+	fprintf(stderr,"Compress file transfers that shrink by at least an eighth: -compress\n");
+	fprintf(stderr,"Send a CRC32C trailer with every data frame, receivers always check one: -crc\n");
+	fprintf(stderr,"Save the transfers each SP receives as files under a directory: -save=dir\n");
+	fprintf(stderr,"Send consecutive text frames to one SP as one transfer of up to N bytes, open for up to M ms: -batch=N[,M]\n");
+	fprintf(stderr,"Join simulation N of a CSP daemon (fastserv -daemon): -sim=N\n");
+}
+
+// prepares outpacket to send its data again from byte offset from
+// a text frame is still in the buffer, a file is reopened and read from the chunk at from
+// returns 0 if the file can't be read again
+static unsigned char resumepacket(datapacket *outpacket,FILE **sendfile,const unsigned long long from) {
+	outpacket->sizeremaining=outpacket->totalsize-from;
+	if (!outpacket->filename[0]) {
+		outpacket->bufferlen=INITFRAMESIZE+(int)outpacket->totalsize;
+		return 1;
+	}
+	if (!*sendfile) *sendfile=fopen(outpacket->filename,"rb");
+	if (!*sendfile) return 0;
+	// the chunk counter picks up where the CSP stopped
+	if (outpacket->compress) {
+		// compressed chunks differ in size, walk them to the one the CSP stopped at
+		rewind(*sendfile);
+		unsigned char payload[MAXDATASIZE];
+		unsigned char compressed;
+		unsigned long long wire=0;
+		int chunk=0, length;
+		while (wire<from && (length=packchunk(*sendfile,1,payload,&compressed,chunksize(outpacket)))>0) {
+			wire+=length;
+			++chunk;
+		}
+		if (wire!=from) {
+			fclose(*sendfile);
+			*sendfile=NULL;
+			return 0;
+		}
+		outpacket->chunk=chunk-1;
+	}
+	else {
+		if (fseek(*sendfile,(long)from,SEEK_SET)) {
+			fclose(*sendfile);
+			*sendfile=NULL;
+			return 0;
+		}
+		outpacket->chunk=(int)(from/chunksize(outpacket))-1;
+	}
+	readchunk(outpacket,sendfile);
+	return 1;
+}
+
+// writes the chunk number and size field of the frame in the outpacket buffer as it goes out
+// the header may still hold the request's ull size, a text frame's size field is its whole payload
+// the first frame of a transfer carries the frame number instead of chunk zero, the last one is flagged
+// a checksummed transfer gets its trailer appended and flagged
+// returns the bytes of the frame to send, bufferlen doesn't count the trailer
+static int stampframe(datapacket *outpacket) {
+	const int payload = outpacket->bufferlen-INITFRAMESIZE;
+	int field = outpacket->filename[0]?outpacket->framefield:payload;
+	if (!outpacket->chunk) field|=FRAMEFIRST;
+	if (outpacket->sizeremaining==(unsigned long long)payload) field|=FRAMELAST;
+	if (outpacket->crc) field|=FRAMECRC;
+	if (outpacket->batch) field|=FRAMEBATCH;
+	intinbuffer(outpacket->buffer+8,outpacket->chunk?outpacket->chunk:outpacket->seqnum);
+	intinbuffer(outpacket->buffer+12,field);
+	if (!outpacket->crc) return outpacket->bufferlen;
+	intinbuffer(outpacket->buffer+outpacket->bufferlen,(int)crc32c(0,outpacket->buffer,outpacket->bufferlen));
+	return outpacket->bufferlen+CRCSIZE;
+}
+
+// logs each frame of a batch from src (and saves it as a transfer of its own), returns the number of frames in it
+static int unbatch(const int SP_ID,const int src,const unsigned char *data,const int length,reassembler *saver,FILE *logfile) {
+	int frames=0, pos=0;
+	while (pos+BATCHHEADERSIZE<=length) {
+		const int seqnum = intfrombuffer((unsigned char*)data+pos);
+		const int textlen = intfrombuffer((unsigned char*)data+pos+4);
+		if (textlen<0 || textlen>length-pos-BATCHHEADERSIZE) break;
+		pos+=BATCHHEADERSIZE;
+		fprintf(logfile,"SP %d: Unpacked frame %d (%d bytes) from SP %d\n",SP_ID,seqnum,textlen,src);
+		if (saver) reassemble(saver,src,seqnum,FRAMEFIRST|FRAMELAST|textlen,data+pos,textlen,logfile);
+		pos+=textlen;
+		++frames;
+	}
+	if (pos!=length) fprintf(logfile,"SP %d: Malformed batch from SP %d, unpacked %d of its %d bytes\n",SP_ID,src,pos,length);
+	return frames;
 }
 
 // station process (SP) driver program
@@ -70,8 +343,21 @@ static inline void printusage(char *prog) {
 // each SP process is independent once forked, only communications are through the CSP
 int main(int argc, char** argv) {
 	// set up initial vars, parse command line args
-	char *logfilename=NULL, *switch_ip=NULL, *inputfilename=NULL;
+	char *logfilename=NULL, *switch_ip=NULL, *inputfilename=NULL, *savedir=NULL;
 	int numprocesses=-1, port = -1;
+	// the simulation to join on a CSP daemon, zero for a plain CSP
+	int simulation=0;
+	// compress file transfers when it is worthwhile
+	unsigned char compress=0;
+	// checksum the data frames we send
+	unsigned char crc=0;
+	// gather consecutive text frames to one SP into batches of this many bytes, kept open this long
+	int batchlimit=0;
+	double batchdeadline=BATCHDEADLINEMS/1000.0;
+	// every ip:port given, SPs are assigned to the switches round-robin
+	char *switch_ips[MAXSWITCHES];
+	int ports[MAXSWITCHES];
+	int numswitches=0;
 
 	// I'm just using a constant value
 /** Seed the random **/
@@ -95,6 +381,8 @@ int main(int argc, char** argv) {
 				if (numprocesses<1) numprocesses=1;
 				if (numprocesses>FORKPROCESSLIMIT) numprocesses=FORKPROCESSLIMIT;
 			}
+			else if (strcmp(chrptr,"compress")==0) compress=1;
+			else if (strcmp(chrptr,"crc")==0) crc=1;
 			else {
 				char *nextchr = strchr(chrptr,'=');
 				if (nextchr) {
@@ -103,6 +391,20 @@ int main(int argc, char** argv) {
 						inputfilename=nextchr+1;
 					else if (strcmp(chrptr,"out")==0)
 						logfilename=nextchr+1;
+					else if (strcmp(chrptr,"save")==0)
+						savedir=nextchr+1;
+					else if (strcmp(chrptr,"sim")==0) {
+						simulation=atoi(nextchr+1);
+						if (simulation<0 || simulation>MAXSIMULATION) {
+							fprintf(stderr,"Error: the simulation must be 0 to %d\n",MAXSIMULATION);
+							return 0;
+						}
+					}
+					else if (strcmp(chrptr,"batch")==0) {
+						batchlimit=atoi(nextchr+1);
+						const char *deadline = strchr(nextchr+1,',');
+						if (deadline) batchdeadline=atof(deadline+1)/1000.0;
+					}
 					else {
 						fprintf(stderr,"Error: expected one of \"-h\", \"-n 1\", \"-in=input\", \"-out=output\"\n");
 						printusage(argv[0]);
@@ -120,6 +422,10 @@ int main(int argc, char** argv) {
 			*switch_ip='\0';
 			port=atoi(switch_ip+1);
 			switch_ip=chrptr;
+			if (numswitches<MAXSWITCHES) {
+				switch_ips[numswitches]=switch_ip;
+				ports[numswitches++]=port;
+			}
 		}
 	}
 	if (!switch_ip || port<0 || numprocesses<1) {
@@ -140,14 +446,16 @@ int main(int argc, char** argv) {
 	}
 
 	// command line arg options are set, set the CSP struct sockaddr_in before we fork
-	struct sockaddr_in addr;
-	memset((void*)&addr,0,sizeof(struct sockaddr_in));
-	addr.sin_family = AF_INET;
-	if (inet_pton(AF_INET,switch_ip,&addr.sin_addr)<=0) {
-		fprintf(stderr,"Error: unable to convert ip \"%s\"\n",switch_ip);
-		return 0;
+	struct sockaddr_in addrs[MAXSWITCHES];
+	for (int i=0;i<numswitches;++i) {
+		memset((void*)&addrs[i],0,sizeof(struct sockaddr_in));
+		addrs[i].sin_family = AF_INET;
+		if (inet_pton(AF_INET,switch_ips[i],&addrs[i].sin_addr)<=0) {
+			fprintf(stderr,"Error: unable to convert ip \"%s\"\n",switch_ips[i]);
+			return 0;
+		}
+		addrs[i].sin_port=htons((unsigned short)ports[i]);
 	}
-	addr.sin_port=htons((unsigned short)port);
 
 	// fork each child SP process
 	// everyone knows their SP number
@@ -182,14 +490,18 @@ int main(int argc, char** argv) {
 
 	// forked processes, the SP processes
 	free(SPs); // (they don't need an incomplete PID list)
+	// a dropped connection shows up as a failed send, the session is resumed
+	signal(SIGPIPE,SIG_IGN);
 
 	// set our input file
-	FILE *cmdfile;
+	FILE *cmdfile=NULL;
+	// or the compiled script (made by fastcomp) mapped in its place
+	compiledscript *compiled=NULL;
 	if (inputfilename) {
 		// if an input file prefix is specified it must open successfully
 		char *myinputfilename = (char*)malloc(sizeof(char)*(strlen(inputfilename)+10)); //allows 9 chars for SP ID
 		sprintf(myinputfilename,"%s%d",inputfilename,SP_ID);
-		if (!(cmdfile=fopen(myinputfilename,"r"))) {
+		if (!(compiled=mapscript(myinputfilename)) && !(cmdfile=fopen(myinputfilename,"r"))) {
 			fprintf(stderr,"Error: SP ID %d unable to open input file %s !\n",SP_ID,myinputfilename);
 			free(myinputfilename);
 			return 0;
@@ -225,56 +537,65 @@ int main(int argc, char** argv) {
 	else logfile = stdout;
 
 	// connect to the CSP, the Communication Switch Process
-	// first, get a socket
-	int fd = socket(AF_INET,SOCK_STREAM | SOCK_NONBLOCK,IPPROTO_TCP);
+	// with several switches, this SP's switch is picked by SP ID
+	const struct sockaddr_in addr = addrs[SP_ID%numswitches];
+	int fd = connectcsp(&addr,0);
 	if (fd<0) {
 		fprintf(stderr,"Error: SP ID %d unable to get a socket\n",SP_ID);
-		fclose(cmdfile);
+		if (cmdfile) fclose(cmdfile);
 		return 0;
 	}
-	// then, connect
-	unsigned char failcount=0; // also using this var later for the CSP rejection counter
-	while ((connect(fd,(const struct sockaddr*)&addr,sizeof(struct sockaddr)))<0) {
-		sleep(1);
-	}
-
-	// I had issues (with many processes fighting for attention) of "Connection reset by peer"
-	int optval=1;
-	// enable the KEEPALIVE flag at the socket level
-	setsockopt(fd,SOL_SOCKET,SO_KEEPALIVE,(const void*)&optval,sizeof(int));
-// (the below TCP options are labelled in the docs as not for portable code)
-// I needed to use these to handle 10 processes and 1 of each CSP queue type . . .
-// These options stopped the mid-simulation connection failures (connection reset by peer)
-// I suppose a reconnect routine could probably fix this without using these options . . .
-	// set the delay for the first KEEPALIVE to 1 second
-	int firstkeepalivedelay=1;
-	setsockopt(fd,IPPROTO_TCP,TCP_KEEPIDLE,&firstkeepalivedelay,sizeof(int));
-	// set the interval between KEEPALIVE messages to 3 seconds
-	int keepaliveinterval=3;
-	setsockopt(fd,IPPROTO_TCP,TCP_KEEPINTVL,&keepaliveinterval,sizeof(int));
-	// set the max number of KEEPALIVE messages to 240
-	int maxkeepalives=240;
-	setsockopt(fd,IPPROTO_TCP,TCP_KEEPCNT,&maxkeepalives,sizeof(int));
+	unsigned char failcount=0; // the CSP rejection counter
+	// received data frames that had a checksum trailer, and those whose checksum didn't match
+	unsigned long long crcframes=0, crcfailures=0;
+	// the received transfers are put back together in files when there is a directory for them
+	reassembler *saver=NULL;
+	if (savedir && !(saver=newreassembler(savedir,SP_ID)))
+		fprintf(stderr,"SP %d: Unable to use %s to save transfers, not saving\n",SP_ID,savedir);
 
 	// our tcp input buffer, this is where TCP input goes
 	unsigned char tcpinbuffer[MAXFRAMESIZE];
 	// the outbound data packet (it also has "unsigned char .buffer[MAXFRAMESIZE]")
-	datapacket outpacket = { .dst_sp_id=-1, .seqnum=1, .bufferlen=0, .sizeremaining=(unsigned long long)0 };
+	datapacket outpacket = { .dst_sp_id=-1, .seqnum=1, .bufferlen=0, .sizeremaining=(unsigned long long)0, .filename="" };
 
-	// send the CSP our SP ID and the number of SP processes it should expect
+	// send the CSP our SP ID, our simulation, and the number of SP processes it should expect
 	intinbuffer(tcpinbuffer,SP_ID);
 	intinbuffer(tcpinbuffer+4,SP_ID);
-	ullinbuffer(tcpinbuffer+8,(unsigned long long)numprocesses);
+	intinbuffer(tcpinbuffer+8,simulation);
+	intinbuffer(tcpinbuffer+12,numprocesses);
 	if (!sendbuffer(fd,(void*)tcpinbuffer,sizeof(unsigned char)*INITFRAMESIZE)) {
 		fprintf(stderr,"SP %d: CSP connection was closed before first communication\n",SP_ID);
-		fclose(cmdfile);
+		if (cmdfile) fclose(cmdfile);
+		fclose(logfile);
+		return 0;
+	}
+	// the CSP answers with our session token (and a resume frame, nothing to resume yet)
+	if (!waitrcv(fd,(void*)tcpinbuffer,sizeof(unsigned char)*INITFRAMESIZE*2) || intfrombuffer(tcpinbuffer+4)!=SESSIONID) {
+		fprintf(stderr,"SP %d: CSP did not answer the first communication with a session\n",SP_ID);
+		if (cmdfile) fclose(cmdfile);
 		fclose(logfile);
 		return 0;
 	}
+	unsigned long long session = ullfrombuffer(tcpinbuffer+8);
+	// the number of transfers the CSP granted us, the CSP counts them the same way
+	int transfers=0;
+	// set when the next grant continues a transfer after a reconnect, it is not counted again
+	unsigned char resuming=0;
+	// set when the connection to the CSP dropped
+	unsigned char lost=0;
+	// the last transfer the CSP granted, and a request held back while it is resumed
+	datapacket granted, deferred;
+	int grantedtype=SENDNONE, deferredtype=SENDNONE;
 
-	// I have found it is helpful (with my single-machine testing)
-	// to sleep here for a second or two
-	sleep(1);
+	// start the script the moment the whole group has joined
+	const int barrier = waitbarrier(fd);
+	if (barrier<0) {
+		fprintf(stderr,"SP %d: CSP connection closed before the start barrier\n",SP_ID);
+		if (cmdfile) fclose(cmdfile);
+		fclose(logfile);
+		return 0;
+	}
+	fprintf(logfile,"SP %d: %s\n",SP_ID,barrier?"All stations present, starting":"Data arrived before the start barrier, starting");
 
 	// counter for number rejections, each retransmission attempt may wait longer than the previous
 	failcount=0;
@@ -285,7 +606,89 @@ int main(int argc, char** argv) {
 	int sendtype=SENDNONE; //SENDNONE=0, SENDTEXT=0x1, SENDFILE=0x10, SENDBLOCKED=0x100
 	// a file to be sent, set through input commands
 	FILE *sendfile=NULL;
+	// the text frames gathered for one SP, each with its batch header, and when the first was added
+	// typed commands aren't batched, the batch would wait for the next line however long that takes
+	unsigned char batchbuffer[MAXDATASIZE];
+	int batchlen=0, batchframes=0, batchdst=-1, batchfirst=0, batchlast=0;
+	double batchsince=0;
+	unsigned long long batches=0, batchedframes=0;
+	if (cmdfile==stdin) batchlimit=0;
+	if (batchlimit>(crc?MAXDATASIZE-CRCSIZE:MAXDATASIZE)) batchlimit=crc?MAXDATASIZE-CRCSIZE:MAXDATASIZE;
+	// the command that closed a batch, it runs once the batch is sent
+	scriptcmd heldcmd;
+	const char *heldtext=NULL;
+	int heldlen=0;
+	unsigned char held=0;
 	while (1) {
+		// the connection to the CSP dropped, reconnect and resume the session
+		if (lost) {
+			lost=0;
+			close(fd);
+			fd = connectcsp(&addr,RECONNECTLIMIT);
+			intinbuffer(tcpinbuffer,SP_ID);
+			intinbuffer(tcpinbuffer+4,SESSIONID);
+			ullinbuffer(tcpinbuffer+8,session);
+			if (fd<0 || !sendbuffer(fd,(void*)tcpinbuffer,sizeof(unsigned char)*INITFRAMESIZE)
+					|| !waitrcv(fd,(void*)tcpinbuffer,sizeof(unsigned char)*INITFRAMESIZE*2)
+					|| intfrombuffer(tcpinbuffer+4)!=SESSIONID) {
+				fprintf(logfile,"SP %d: Unable to resume the session with the CSP\n",SP_ID);
+				break;
+			}
+			session = ullfrombuffer(tcpinbuffer+8);
+			// the last transfer the CSP granted us and how much of it was forwarded
+			const int lastxfer = intfrombuffer(tcpinbuffer+INITFRAMESIZE+4);
+			const unsigned long long offset = ullfrombuffer(tcpinbuffer+INITFRAMESIZE+8);
+			fprintf(logfile,"SP %d: Reconnected to the CSP, session resumed\n",SP_ID);
+			const unsigned char blocked = (sendtype&(SENDTEXT|SENDFILE)) && (sendtype&SENDBLOCKED);
+			unsigned long long from=0;
+			resuming=0;
+			// our request was granted but the acknowledgement never arrived
+			if (blocked && lastxfer==transfers+1) {
+				resuming=1;
+				from=(offset==RESUMENONE)?0:offset;
+			}
+			// the CSP didn't get all of the last granted transfer, it may already be written out on our side
+			else if (lastxfer==transfers && offset!=RESUMENONE) {
+				resuming=1;
+				from=offset;
+				if (!(sendtype&(SENDTEXT|SENDFILE)) || blocked) {
+					// a request that wasn't granted yet is sent after this one
+					if (blocked) {
+						deferred=outpacket;
+						deferredtype=sendtype&(SENDTEXT|SENDFILE);
+					}
+					if (sendfile) fclose(sendfile);
+					sendfile=NULL;
+					outpacket=granted;
+					// finished or not, there is something to send again
+					sendtype=grantedtype;
+				}
+			}
+			// a transfer the CSP doesn't know about starts over
+			transfers=lastxfer;
+			if (sendtype&(SENDTEXT|SENDFILE)) {
+				sendtype=(sendtype&(SENDTEXT|SENDFILE))|SENDBLOCKED;
+				if (!resumepacket(&outpacket,&sendfile,from)) {
+					fprintf(logfile,"SP %d: Unable to reopen %s to resume frame %d\n",SP_ID,outpacket.filename,outpacket.seqnum);
+					sendtype=SENDNONE;
+					resuming=0;
+				}
+				else {
+					fprintf(logfile,"SP %d: Resuming frame %d at byte %llu of %llu\n",SP_ID,outpacket.seqnum,from,outpacket.totalsize);
+					if (!sendrequest(fd,SP_ID,&outpacket,resuming?from:RESUMENONE)) lost=1;
+				}
+			}
+			// tell the CSP again what we are doing, it may have missed it
+			intinbuffer(tcpinbuffer,SP_ID);
+			intinbuffer(tcpinbuffer+4,SP_ID);
+			ullinbuffer(tcpinbuffer+8,(unsigned long long)waitpackets);
+			if (waitpackets || (sendtype==SENDFINISHED && !deferredtype)) {
+				if (!sendbuffer(fd,(void*)tcpinbuffer,sizeof(unsigned char)*INITFRAMESIZE)) lost=1;
+			}
+			failcount=0;
+			resendrequest=0;
+			continue;
+		}
 		// attempt to read from the server, if there is nothing we'll skip this
 		// if we are waiting on packets or don't have any input use the sleep/blocking rcvbuffer
 		if (((sendtype==SENDFINISHED || waitpackets) && rcvbuffer(fd,(void*)tcpinbuffer,sizeof(unsigned char)*INITFRAMESIZE))
@@ -296,6 +699,8 @@ int main(int argc, char** argv) {
 			// the SP processes more often deal with the last 8 bytes as 2 integers
 			const int packetnum = intfrombuffer(tcpinbuffer+8);
 			const int lastfield = intfrombuffer(tcpinbuffer+12);
+			// a start barrier that came after data, we started already
+			if (dstaddr==BARRIERID) continue;
 			// server simulation response
 			if (srcaddr==dstaddr) {
 				// quit simulation
@@ -307,6 +712,7 @@ int main(int argc, char** argv) {
 				}
 				// stop waiting for packets
 				fprintf(logfile,"SP %d: Received notification from CSP to stop waiting for packets\n",SP_ID);
+				PROBE2(sp,spwake,SP_ID,waitpackets);
 				waitpackets=0;
 				continue;
 			}
@@ -314,6 +720,7 @@ int main(int argc, char** argv) {
 			if (srcaddr==SP_ID) {
 				fprintf(logfile,"SP %d: Received ",SP_ID);
 				if (lastfield==0) {
+					PROBE3(sp,requestrejected,SP_ID,dstaddr,failcount);
 					fprintf(logfile,"reject");
 					// we've had 3 retries, drop this request.
 					if (failcount++ == 3) {
@@ -322,33 +729,97 @@ int main(int argc, char** argv) {
 						sendtype=SENDNONE;
 						outpacket.bufferlen=0;
 						outpacket.sizeremaining=0;
+						resuming=0;
 					}
 					// send another request next time
 					else resendrequest=1;
 				}
 				else { // if lastfield>0
 					// send the data packet
+					PROBE3(sp,requestaccepted,SP_ID,dstaddr,outpacket.sizeremaining);
 					fprintf(logfile,"ok");
 					// remove SENDBLOCKED so we can send
 					if (sendtype&SENDBLOCKED) sendtype-=SENDBLOCKED;
 					failcount=0;
+					// a resumed transfer keeps its number
+					if (resuming) resuming=0;
+					else ++transfers;
+					// a request to an anycast group was bound to one of its SPs, the frames go to that SP
+					if (dstaddr!=outpacket.dst_sp_id) {
+						outpacket.dst_sp_id=dstaddr;
+						intinbuffer(outpacket.buffer+4,dstaddr);
+					}
+					// kept until the next grant, the CSP may not have all of it when the connection drops
+					granted=outpacket;
+					grantedtype=sendtype&(SENDTEXT|SENDFILE);
 				}
 				fprintf(logfile," reply from CSP to send data frame %d to SP %d\n",outpacket.seqnum,dstaddr);
 				continue;
 			}
+			// a frame to another SP is a copy the CSP mirrored to this SP as its monitor (fastserv -monitor),
+			// it is logged and isn't counted as a frame for this SP
+			if (dstaddr!=SP_ID) {
+				if (!rcvbuffer(fd,(void*)tcpinbuffer,sizeof(unsigned char)*framebody(lastfield))) {
+					fprintf(logfile,"SP %d: Failed to receive a mirrored packet\n",SP_ID);
+					lost=connectionlost(fd);
+				}
+				else fprintf(logfile,"SP %d: Received mirrored packet %d (%d bytes) from SP %d to SP %d\n",
+										SP_ID,(lastfield&FRAMEFIRST)?0:packetnum,framepayload(lastfield),srcaddr,dstaddr);
+				continue;
+			}
 			// it is incoming data, get the data
 			fprintf(logfile,"SP %d: ",SP_ID);
-			if (!rcvbuffer(fd,(void*)tcpinbuffer,sizeof(unsigned char)*lastfield))
+			const int payloadsize = framepayload(lastfield);
+			int rawsize = payloadsize;
+			// the first frame of a transfer has the sender's frame number where the chunk number would be
+			const int chunknum = (lastfield&FRAMEFIRST)?0:packetnum;
+			// the payload as it was sent, kept when the frame is good and transfers are saved
+			unsigned char raw[MAXDATASIZE];
+			const unsigned char *data=NULL;
+			// the checksum covers the header, take it before the payload overwrites it
+			unsigned int headercrc=0;
+			if (lastfield&FRAMECRC) {
+				headercrc=crc32c(0,tcpinbuffer,INITFRAMESIZE);
+				++crcframes;
+			}
+			if (!rcvbuffer(fd,(void*)tcpinbuffer,sizeof(unsigned char)*framebody(lastfield))) {
 				fprintf(logfile,"Failed to receive");
-			else
+				lost=connectionlost(fd);
+			}
+			else if ((lastfield&FRAMECRC) && crc32c(headercrc,tcpinbuffer,payloadsize)!=(unsigned int)intfrombuffer(tcpinbuffer+payloadsize)) {
+				++crcfailures;
+				fprintf(logfile,"Checksum failed on");
+			}
+			// the sender compressed this frame, rawsize is -1 if it is malformed
+			else if (lastfield&FRAMECOMPRESSED) {
+				rawsize=lzdecompress(tcpinbuffer,payloadsize,raw,MAXDATASIZE);
+				fprintf(logfile,(rawsize<0)?"Failed to decompress":"Received");
+				if (rawsize>=0) data=raw;
+			}
+			else {
 				fprintf(logfile,"Received");
-			fprintf(logfile," packet %d (%d bytes) from SP %d\n",packetnum,lastfield,srcaddr);
+				data=tcpinbuffer;
+			}
+			if (data) PROBE3(sp,framereceived,SP_ID,srcaddr,rawsize);
+			if (lastfield&FRAMECOMPRESSED) fprintf(logfile," packet %d (%d bytes, %d compressed) from SP %d\n",chunknum,rawsize,payloadsize,srcaddr);
+			else fprintf(logfile," packet %d (%d bytes) from SP %d\n",chunknum,payloadsize,srcaddr);
+			// a batch counts as the frames in it
+			int frames=1;
+			if ((lastfield&FRAMEBATCH) && data) frames=unbatch(SP_ID,srcaddr,data,rawsize,saver,logfile);
+			else if (saver && data) reassemble(saver,srcaddr,packetnum,lastfield,data,rawsize,logfile);
 			// we are waiting to receive packets, decrement that counter
 			if (waitpackets) {
-				if (--waitpackets==0) fprintf(logfile,"SP %d: Finished waiting for data frames\n",SP_ID);
+				waitpackets-=(frames<waitpackets)?frames:waitpackets;
+				if (!waitpackets) fprintf(logfile,"SP %d: Finished waiting for data frames\n",SP_ID);
 				continue;
 			}
 		}
+		// nothing to read, the CSP may have gone away
+		else if (connectionlost(fd)) {
+			fprintf(logfile,"SP %d: Lost the connection to the CSP\n",SP_ID);
+			lost=1;
+			continue;
+		}
 		// we are finished with the cmd input or are waiting to receive packets
 		if (sendtype==SENDFINISHED || waitpackets) {
 			if (rand()%2) sleep(1); // sleep for 1 second half the time
@@ -363,8 +834,16 @@ int main(int argc, char** argv) {
 			if (sleepval) sleep(sleepval);
 			// if sendtype is SENDFILE these fields may not be correct for the initial request
 			const unsigned long long lastfield = ullfrombuffer(outpacket.buffer+8);
+			// the CSP drops a resume claim with the rejected request, claim it again
+			if (resuming) {
+				unsigned char claim[INITFRAMESIZE];
+				intinbuffer(claim,SP_ID);
+				intinbuffer(claim+4,SESSIONID);
+				ullinbuffer(claim+8,outpacket.totalsize-outpacket.sizeremaining);
+				sendbuffer(fd,(void*)claim,sizeof(unsigned char)*INITFRAMESIZE);
+			}
 			// the CSP wants the total data size (excluding frame headers)
-			if (sendtype==SENDFILE)
+			if (sendtype&SENDFILE)
 				ullinbuffer(outpacket.buffer+8,outpacket.sizeremaining);
 			if (!sendbuffer(fd,(void*)outpacket.buffer,sizeof(unsigned char)*INITFRAMESIZE)) {
 				fprintf(logfile,"SP %d: Resend attempt %u, failed to resend request frame to CSP\n",SP_ID,failcount);
@@ -375,10 +854,11 @@ int main(int argc, char** argv) {
 				failcount=0;
 			}
 			else {
+				PROBE3(sp,requestsent,SP_ID,outpacket.dst_sp_id,outpacket.sizeremaining);
 				fprintf(logfile,"SP %d: Resent request to send frame %d, (%llu bytes) to SP %d\n",
 					SP_ID,outpacket.seqnum,outpacket.sizeremaining,outpacket.dst_sp_id);
 				// restore whatever was in there if we overwrote it
-				if (sendtype==SENDFILE)
+				if (sendtype&SENDFILE)
 					ullinbuffer(outpacket.buffer+8,lastfield);
 			}
 			// wait for a response, do not resend again
@@ -394,17 +874,32 @@ int main(int argc, char** argv) {
 			}
 			// we are going to send the outgoing data
 			fprintf(logfile,"SP %d: ",SP_ID);
-			if (!sendbuffer(fd,(void*)outpacket.buffer,sizeof(unsigned char)*outpacket.bufferlen))
-				fprintf(logfile,"Error sending");
-			else fprintf(logfile,"Sent");
-			fprintf(logfile," data packet (%d bytes) to SP %d\n",outpacket.bufferlen,outpacket.dst_sp_id);
+			const int framelen = stampframe(&outpacket);
+			if (!sendbuffer(fd,(void*)outpacket.buffer,sizeof(unsigned char)*framelen)) {
+				fprintf(logfile,"Error sending data packet (%d bytes) to SP %d\n",outpacket.bufferlen,outpacket.dst_sp_id);
+				// the session resumes this transfer from what the CSP received
+				lost=1;
+				continue;
+			}
+			fprintf(logfile,"Sent data packet (%d bytes) to SP %d\n",outpacket.bufferlen,outpacket.dst_sp_id);
+			PROBE4(sp,framesent,SP_ID,outpacket.dst_sp_id,outpacket.bufferlen-INITFRAMESIZE,
+						outpacket.sizeremaining-(unsigned long long)(outpacket.bufferlen-INITFRAMESIZE));
 			// we sent ((bufferlen)-(headersize)) bytes of the data remaining
 			outpacket.sizeremaining-=(unsigned long long)(outpacket.bufferlen-INITFRAMESIZE);
 			// there is no more length in the buffer
 			outpacket.bufferlen=0;
 			// there is also no more remaining data to send
-			if (!outpacket.sizeremaining)
+			if (!outpacket.sizeremaining) {
 				sendtype=SENDNONE;
+				// a request held back while an earlier transfer was resumed
+				if (deferredtype) {
+					outpacket=deferred;
+					sendtype=deferredtype|SENDBLOCKED;
+					deferredtype=0;
+					if (!resumepacket(&outpacket,&sendfile,0)) sendtype=SENDNONE;
+					else if (!sendrequest(fd,SP_ID,&outpacket,RESUMENONE)) lost=1;
+				}
+			}
 			// restart the loop
 			continue;
 		}
@@ -412,46 +907,40 @@ int main(int argc, char** argv) {
 		// we can get a "send" or "wait" command from the cmd file, this is handled here
 		// requests are sent when/if we create an outpacket (also set the SENDBLOCKED flag)
 		// wait packet counters are set immediately
-		if (cmdfile) {
-			// still have file remaining (sizeremaining only happens with SENDFILE)
-			if (outpacket.sizeremaining) {
-				// read more input file into buffer
-				// first two fields of output buffer (src and dst) remain the same (as they were already)
-				// update the packet counter and the size of the next frame
-				const int packetcounter = intfrombuffer(outpacket.buffer+8)+1;
-				intinbuffer(outpacket.buffer+8,packetcounter);
-				// minimum size of a transmission with no data
-				outpacket.bufferlen=INITFRAMESIZE;
-				// read until we get to EOF
-				while ((outpacket.buffer[outpacket.bufferlen]=fgetc(sendfile))!=EOF) {
-					// break if we fill the buffer
-					if (++outpacket.bufferlen == MAXFRAMESIZE) break;
-					// break if we read the final byte
-					if (outpacket.bufferlen-INITFRAMESIZE == outpacket.sizeremaining) break;
-				}
-				// if we are at EOF close the file and set the pointer to NULL
-				if (feof(sendfile)) {
-					fclose(sendfile);
-					sendfile=NULL;
-				}
-				const int thistransfersize = outpacket.bufferlen-INITFRAMESIZE;
-				// we collected bytes to send
-				if (thistransfersize)
-					intinbuffer(outpacket.buffer+12,thistransfersize);
-				// there was nothing left in the file to send
-				else {
-					outpacket.sizeremaining=0;
-					outpacket.bufferlen=0;
-				}
-				// restart loop, the next packet is ready
-				continue;
-			}
+		// still have file remaining (sizeremaining only happens with SENDFILE)
+		if (outpacket.sizeremaining && sendfile) {
+			// read more input file into buffer
+			readchunk(&outpacket,&sendfile);
+			// restart loop, the next packet is ready
+			continue;
+		}
+		if (cmdfile || compiled || held || batchframes) {
 			// no pending outpacket, no pending sendfile
 			// still may have some cmd file, try to read a command
+			scriptcmd cmd;
+			// the data of a frame command, the text to send or the file name
+			const char *sendtext=NULL;
+			int sendlen=0;
+			unsigned char havecmd=0, batched=0;
+			// the command that closed the batch sent last goes first
+			if (held) {
+				cmd=heldcmd;
+				sendtext=(heldtext==heldcmd.text)?cmd.text:heldtext;
+				sendlen=heldlen;
+				havecmd=1;
+				held=0;
+			}
+			// a compiled script hands over its commands as they are
+			else if (compiled) {
+				if (!(havecmd=nextcommand(compiled,&cmd,&sendtext,&sendlen))) {
+					unmapscript(compiled);
+					compiled=NULL;
+				}
+			}
 			// line buffer for text input of cmd file
 			char linebuffer[MAXLINELEN];
 			memset((void*)linebuffer,0,sizeof(char)*MAXLINELEN);
-			while (!feof(cmdfile)) {
+			while (!havecmd && cmdfile && !feof(cmdfile)) {
 				// read a line of file
 				char *cmdline = fgets(linebuffer,MAXLINELEN,cmdfile);
 				// cmdline is NULL, must have hit EOF
@@ -463,232 +952,219 @@ int main(int argc, char** argv) {
 				if (strlen(linebuffer)) break;
 			}
 			// if the file is EOF close the file and set to NULL to skip this loop next time
-			if (feof(cmdfile)) {
+			if (cmdfile && feof(cmdfile)) {
 				fclose(cmdfile);
 				cmdfile=NULL;
 			}
 			// we have a line to parse
-			if (linebuffer[0] && strlen(linebuffer)>1) { // minimum cutoff for valid lines*
-				// walking two pointers up with strchr
-				// input format is VERY strict (for placement of a few magic characters)
-				// if parsing doesn't find a match the line will have no effect
-				char *sendchar = NULL;
-				char *nextch = strchr(linebuffer,' ');
-				if (nextch) {
-					*nextch++='\0';
-//Wait for receiving 1 frame
-//Wait for receiving 2 frames # (plural 's' / etc doesn't matter with how this is parsed)
-					// need to set the counter to wait for data frames
-					if (strcmp(linebuffer,"Wait")==0) {
-						char *endch = strchr(nextch,'g');
-						if (endch) {
-							endch+=2;
-							nextch=strchr(endch,' ');
-							if (nextch) {
-								*nextch='\0';
-								waitpackets+=atoi(endch);
-								// we can already do zero
-								if (!waitpackets) continue;
-								fprintf(logfile,"SP %d: Entering wait to receive %d data frames\n",SP_ID,waitpackets);
-								// notify the CSP that we will be waiting
-								intinbuffer(outpacket.buffer,SP_ID);
-								intinbuffer(outpacket.buffer+4,SP_ID);
-								ullinbuffer(outpacket.buffer+8,(unsigned long long)waitpackets);
-								// the CSP will wake us up if every other SP is ready to quit (no one else is expected to send data)
-								if (!sendbuffer(fd,outpacket.buffer,sizeof(unsigned char)*INITFRAMESIZE))
-									fprintf(logfile,"SP %d: Error notifying CSP of wait for %d packets\n",SP_ID,waitpackets);
-							}
-						}
+			if (linebuffer[0] && parsecommand(linebuffer,&cmd)) {
+				havecmd=1;
+				sendtext=cmd.text;
+				sendlen=(int)strlen(cmd.text);
+			}
+			// consecutive text frames to one SP gather into a batch, it is sent as one transfer once a command
+			// that doesn't fit in it comes, the script ends, or it has been open for the deadline
+			if (batchlimit) {
+				const unsigned char batchable = havecmd && cmd.op==SCRIPTFRAME && !cmd.file && BATCHHEADERSIZE+sendlen<=batchlimit;
+				if (batchframes && (!batchable || cmd.dst_sp_id!=batchdst || batchlen+BATCHHEADERSIZE+sendlen>batchlimit
+												|| getnow()-batchsince>batchdeadline)) {
+					if (havecmd) {
+						heldcmd=cmd;
+						heldtext=(sendtext==cmd.text)?heldcmd.text:sendtext;
+						heldlen=sendlen;
+						held=1;
 					}
-// # send frame number to sp 2
-// Frame 1, To SP 2
-// # send text to sp 2 (it just reads the rest of the line up to maxdatasize)
-// Frame 1, To SP 2 text to send
-// # send file to sp 2 ( not yet implemented yet )
-// Frame 1, To SP 2 $sendfile.txt
-					// send data frame
-					else if (strcmp(linebuffer,"Frame")==0) {
-						char *endch = strchr(nextch,',');
-						if (endch) {
-							*endch='\0';
-							// nextch is the first char after the first space
-							// packet number from input
-							outpacket.seqnum = atoi(nextch);
-							nextch = strchr(endch+1,'P');
-							if (nextch) {
-								// nextch is two chars after the 'P'
-								nextch+=2;
-								// endch is the space after
-								char *endch = strchr(nextch,' ');
-								//	   endch points v
-								// "Frame 1, To SP 2 xxx"
-								// nextch points   ^
-								if (endch) {
-									*endch='\0';
-									// dst sp id
-									outpacket.dst_sp_id = atoi(nextch);
-									sendchar=endch+1;
-									// "Frame 1, To SP 2 $./inputfile.txt
-									if (*sendchar=='$') {
-										if (sendchar[1]=='\n' || sendchar[1]=='\0')
-											sendtype=SENDTEXT;
-										// send file if text exists after the '$'
-										else {
-											++sendchar;
-											sendtype=SENDFILE;
-										}
-									}
-									// Frame 1, To SP 2 words to send
-									else sendtype=SENDTEXT;
-								}
-								// no trailing text after "SP 2"
-								// "Frame 1, To SP 2"
-								else {
-									outpacket.dst_sp_id = atoi(nextch);
-									sendtype=SENDTEXT;
-								}
-								// setup the outpacket buffer, src->dst
-								intinbuffer(outpacket.buffer,SP_ID);
-								intinbuffer(outpacket.buffer+4,outpacket.dst_sp_id);
-								// start of the data segment, the data size indicates size of databuffer ready to send
-								outpacket.bufferlen=INITFRAMESIZE;
-								// sending text from input file
-								if (sendtype==SENDTEXT) {
-									// send the rest of the line
-									if (endch) {
-										while (*sendchar!='\0') {
-											outpacket.buffer[outpacket.bufferlen++]=*sendchar;
-											++sendchar;
-										}
-									}
-									// no line, just send the frame number
-									else {
-										char seqnumberchar[16]; // large enough for any int
-										sprintf(seqnumberchar,"%d",outpacket.seqnum);
-										// the data size
-										for (int i=0;seqnumberchar[i]!='\0';++i) {
-											outpacket.buffer[outpacket.bufferlen++]=seqnumberchar[i];
-										}
-									}
-									// the bytes after the header are all there will be
-									outpacket.sizeremaining=((unsigned long long)outpacket.bufferlen)-((unsigned long long)INITFRAMESIZE);
-									// size of full data (excluding headers)
-									ullinbuffer(outpacket.buffer+8,outpacket.sizeremaining);
-								}
-								// sending bytes from a file
-								else if (sendtype==SENDFILE) {
-									// turn any trailing newline into a null terminator
-									for (int i=0;sendchar[i]!='\0';++i) {
-										if (sendchar[i]=='\n') {
-											sendchar[i]='\0';
-											break;
-										}
-									}
-									// try to open the filename
-									sendfile = fopen(sendchar,"rb");
-									if (!sendfile) {
-										// if we couldn't open the file we send a text message
-										sendtype=SENDTEXT;
-										// if we have a string we can send an error string
-										if (strlen(sendchar)>0) {
-											//Error opening: 
-											char *ferrormsg = (char*)malloc(sizeof(char)*(strlen(sendchar)+16));
-											sprintf(ferrormsg,"%s %s","Error opening:",sendchar);
-											// the data size is the string length of this string
-											outpacket.sizeremaining=(unsigned long long)strlen(ferrormsg);
-											// put the string in the buffer
-											for (int i=0;ferrormsg[i]!='\0';++i) {
-												//bufferlen was set to INITFRAMESIZE right before this 'if'
-												outpacket.buffer[outpacket.bufferlen++]=ferrormsg[i];
-											}
-										}
-										// no strlen ?
-										else {
-											// let's send the '$' character
-											outpacket.sizeremaining=(unsigned long long)1;
-											outpacket.buffer[outpacket.bufferlen++]='$';
-										}
-									}
-									else {
-										// we could open the file, get the filesize
-										fseek(sendfile,0,SEEK_END);
-										outpacket.sizeremaining = ftell(sendfile);
-										// it was an empty file, let's just skip this one then.
-										if (!outpacket.sizeremaining) {
-											fclose(sendfile);
-											sendfile=NULL;
-											outpacket.sizeremaining=0;
-											outpacket.bufferlen=0;
-											sendtype=SENDNONE;
-											continue;
-										}
-										rewind(sendfile);
-										// we have the filesize, read up to (filesize) or (MAXFRAMESIZE) bytes
-										while ((outpacket.buffer[outpacket.bufferlen]=fgetc(sendfile))) {
-											// frame is full
-											if (++outpacket.bufferlen == MAXFRAMESIZE) break;
-											// file bytes all read
-											if (outpacket.bufferlen-INITFRAMESIZE==outpacket.sizeremaining) break;
-										}
-										// no file left, close it and set the pointer to null
-										if (feof(sendfile)) {
-											fclose(sendfile);
-											sendfile=NULL;
-										}
-									}
-									// all SENDFILE conditions above have set the .sizeremaining
-									ullinbuffer(outpacket.buffer+8,outpacket.sizeremaining);
+					// the batch is sent in place of a frame command, a batch of one as the frame it is
+					cmd.op=SCRIPTFRAME;
+					cmd.file=0;
+					cmd.dst_sp_id=batchdst;
+					cmd.seqnum=batchfirst;
+					if (batchframes==1) {
+						sendtext=(const char*)(batchbuffer+BATCHHEADERSIZE);
+						sendlen=batchlen-BATCHHEADERSIZE;
+					}
+					else {
+						fprintf(logfile,"SP %d: Batched frames %d to %d (%d frames, %d bytes) to SP %d\n",
+										SP_ID,batchfirst,batchlast,batchframes,batchlen,batchdst);
+						sendtext=(const char*)batchbuffer;
+						sendlen=batchlen;
+						batched=1;
+						++batches;
+						batchedframes+=batchframes;
+					}
+					havecmd=1;
+					batchframes=batchlen=0;
+				}
+				else if (batchable) {
+					if (!batchframes) {
+						batchdst=cmd.dst_sp_id;
+						batchfirst=cmd.seqnum;
+						batchsince=getnow();
+					}
+					intinbuffer(batchbuffer+batchlen,cmd.seqnum);
+					intinbuffer(batchbuffer+batchlen+4,sendlen);
+					memcpy((void*)(batchbuffer+batchlen+BATCHHEADERSIZE),(const void*)sendtext,sizeof(unsigned char)*sendlen);
+					batchlen+=BATCHHEADERSIZE+sendlen;
+					batchlast=cmd.seqnum;
+					++batchframes;
+					continue;
+				}
+			}
+			if (havecmd) {
+				// need to set the counter to wait for data frames
+				if (cmd.op==SCRIPTWAIT) {
+					waitpackets+=cmd.count;
+					// we can already do zero
+					if (!waitpackets) continue;
+					fprintf(logfile,"SP %d: Entering wait to receive %d data frames\n",SP_ID,waitpackets);
+					PROBE2(sp,spwait,SP_ID,waitpackets);
+					// notify the CSP that we will be waiting
+					intinbuffer(outpacket.buffer,SP_ID);
+					intinbuffer(outpacket.buffer+4,SP_ID);
+					ullinbuffer(outpacket.buffer+8,(unsigned long long)waitpackets);
+					// the CSP will wake us up if every other SP is ready to quit (no one else is expected to send data)
+					if (!sendbuffer(fd,outpacket.buffer,sizeof(unsigned char)*INITFRAMESIZE))
+						fprintf(logfile,"SP %d: Error notifying CSP of wait for %d packets\n",SP_ID,waitpackets);
+				}
+				// send data frame, sendtext is the text to send or the file name
+				else {
+					outpacket.seqnum = cmd.seqnum;
+					outpacket.dst_sp_id = cmd.dst_sp_id;
+					sendtype = cmd.file?SENDFILE:SENDTEXT;
+					const char *sendchar = sendtext;
+					// a file name and compression are set below for files
+					outpacket.filename[0]='\0';
+					outpacket.compress=0;
+					outpacket.crc=crc;
+					outpacket.batch=batched;
+					outpacket.chunk=0;
+					// setup the outpacket buffer, src->dst
+					intinbuffer(outpacket.buffer,SP_ID);
+					intinbuffer(outpacket.buffer+4,outpacket.dst_sp_id);
+					// start of the data segment, the data size indicates size of databuffer ready to send
+					outpacket.bufferlen=INITFRAMESIZE;
+					// sending text from input file
+					if (sendtype==SENDTEXT) {
+						// the rest of the line, or just the frame number, as much as fits in a frame
+						if (sendlen>chunksize(&outpacket)) sendlen=chunksize(&outpacket);
+						memcpy((void*)(outpacket.buffer+outpacket.bufferlen),(const void*)sendchar,sizeof(unsigned char)*sendlen);
+						outpacket.bufferlen+=sendlen;
+						// the bytes after the header are all there will be
+						outpacket.sizeremaining=((unsigned long long)outpacket.bufferlen)-((unsigned long long)INITFRAMESIZE);
+						// size of full data (excluding headers)
+						ullinbuffer(outpacket.buffer+8,outpacket.sizeremaining);
+					}
+					// sending bytes from a file
+					else if (sendtype==SENDFILE) {
+						// try to open the filename, keep it in case the transfer is resumed
+						sendfile = fopen(sendchar,"rb");
+						if (!sendfile) {
+							// if we couldn't open the file we send a text message
+							sendtype=SENDTEXT;
+							// if we have a string we can send an error string
+							if (strlen(sendchar)>0) {
+								//Error opening: 
+								char *ferrormsg = (char*)malloc(sizeof(char)*(strlen(sendchar)+16));
+								sprintf(ferrormsg,"%s %s","Error opening:",sendchar);
+								// the data size is the string length of this string
+								outpacket.sizeremaining=(unsigned long long)strlen(ferrormsg);
+								// put the string in the buffer
+								for (int i=0;ferrormsg[i]!='\0';++i) {
+									//bufferlen was set to INITFRAMESIZE right before this 'if'
+									outpacket.buffer[outpacket.bufferlen++]=ferrormsg[i];
 								}
-								// send the initial request (initial packet to CSP is ready)
-								if (sendtype!=SENDNONE) {
-									// sanity check, this means there is no data
-									if (outpacket.bufferlen==INITFRAMESIZE) {
-										outpacket.bufferlen=0;
-										outpacket.sizeremaining=0;
-										// don't know how both of these could happen
-										if (sendtype==SENDFILE && sendfile) {
-											fclose(sendfile);
-											sendfile=NULL;
-										}
-										sendtype=SENDNONE;
-										// let's get out of here
-										continue;
-									}
-									// send the request buffer to the CSP
-									fprintf(logfile,"SP %d: Frame %d, request to send %llu bytes to SP %d\n",
-										SP_ID,outpacket.seqnum,outpacket.sizeremaining,outpacket.dst_sp_id);
-									if (!sendbuffer(fd,(void*)outpacket.buffer,sizeof(unsigned char)*INITFRAMESIZE)) {
-										fprintf(logfile,"SP %d: Error sending data request frame to CSP\n",SP_ID);
-										// shouldn't get an error, cancel the request
-										if (sendtype==SENDFILE && sendfile) {
-											fclose(sendfile);
-											sendfile=NULL;
-										}
-										outpacket.sizeremaining=0;
-										outpacket.bufferlen=0;
-										sendtype=SENDNONE;
-									}
-									// request sent
-									else {
-										// put the block on
-										sendtype|=SENDBLOCKED;
-										// if (sendtype==SENDFILE) (the length will be greater only with files)
-										// ensure correct (file size+packet #) in first frame
-										// the frame to the CSP has the total size, for a file this can be multiple data frames
-										// each frame received by an SP contains an int in the 4th position indicating current size
-										if (outpacket.bufferlen-INITFRAMESIZE<outpacket.sizeremaining) {
-											// this transmission will be broken up over multiple transfers
-											fprintf(logfile,"SP %d: Will send file in chunks of %d bytes\n",SP_ID,MAXDATASIZE);
-											intinbuffer(outpacket.buffer+8,0);
-											intinbuffer(outpacket.buffer+12,outpacket.bufferlen-INITFRAMESIZE); // MAXDATASIZE
-										}
-									}
-									// we have not failed so far
-									failcount=0;
-									resendrequest=0;
+							}
+							// no strlen ?
+							else {
+								// let's send the '$' character
+								outpacket.sizeremaining=(unsigned long long)1;
+								outpacket.buffer[outpacket.bufferlen++]='$';
+							}
+						}
+						else {
+							strcpy(outpacket.filename,sendchar);
+							// we could open the file, get the filesize
+							fseek(sendfile,0,SEEK_END);
+							outpacket.sizeremaining = ftell(sendfile);
+							// it was an empty file, let's just skip this one then.
+							if (!outpacket.sizeremaining) {
+								fclose(sendfile);
+								sendfile=NULL;
+								outpacket.sizeremaining=0;
+								outpacket.bufferlen=0;
+								sendtype=SENDNONE;
+								continue;
+							}
+							rewind(sendfile);
+							// compress the transfer if it saves at least an eighth, sizes are then compressed sizes
+							if (compress) {
+								const unsigned long long wire = wiresize(sendfile,chunksize(&outpacket));
+								fprintf(logfile,"SP %d: Frame %d, %s %llu bytes to %llu (ratio %.2f)\n",SP_ID,outpacket.seqnum,
+									(wire*8<outpacket.sizeremaining*7)?"compressing":"not compressing",
+									outpacket.sizeremaining,wire,(double)outpacket.sizeremaining/(double)(wire?wire:1));
+								if (wire*8<outpacket.sizeremaining*7) {
+									outpacket.compress=1;
+									outpacket.sizeremaining=wire;
 								}
 							}
+							// we have the filesize, read up to (filesize) or (MAXFRAMESIZE) bytes
+							// no file left, this closes it and sets the pointer to null
+							outpacket.chunk=-1;
+							readchunk(&outpacket,&sendfile);
+						}
+						// all SENDFILE conditions above have set the .sizeremaining
+						ullinbuffer(outpacket.buffer+8,outpacket.sizeremaining);
+					}
+					// send the initial request (initial packet to CSP is ready)
+					if (sendtype!=SENDNONE) {
+						// sanity check, this means there is no data
+						if (outpacket.bufferlen==INITFRAMESIZE) {
+							outpacket.bufferlen=0;
+							outpacket.sizeremaining=0;
+							// don't know how both of these could happen
+							if (sendtype==SENDFILE && sendfile) {
+								fclose(sendfile);
+								sendfile=NULL;
+							}
+							sendtype=SENDNONE;
+							// let's get out of here
+							continue;
 						}
+						// the transfer resumes against this size after a reconnect
+						outpacket.totalsize=outpacket.sizeremaining;
+						// send the request buffer to the CSP
+						fprintf(logfile,"SP %d: Frame %d, request to send %llu bytes to SP %d\n",
+							SP_ID,outpacket.seqnum,outpacket.sizeremaining,outpacket.dst_sp_id);
+						PROBE3(sp,requestsent,SP_ID,outpacket.dst_sp_id,outpacket.sizeremaining);
+						if (!sendbuffer(fd,(void*)outpacket.buffer,sizeof(unsigned char)*INITFRAMESIZE)) {
+							fprintf(logfile,"SP %d: Error sending data request frame to CSP\n",SP_ID);
+							// shouldn't get an error, cancel the request
+							if (sendtype==SENDFILE && sendfile) {
+								fclose(sendfile);
+								sendfile=NULL;
+							}
+							outpacket.sizeremaining=0;
+							outpacket.bufferlen=0;
+							sendtype=SENDNONE;
+						}
+						// request sent
+						else {
+							// put the block on
+							sendtype|=SENDBLOCKED;
+							// ensure correct (file size+packet #) in first frame
+							// the frame to the CSP has the total size, for a file this can be multiple data frames
+							// each frame received by an SP contains an int in the 4th position indicating current size
+							if (sendtype&SENDFILE) {
+								// this transmission will be broken up over multiple transfers
+								if (outpacket.bufferlen-INITFRAMESIZE<outpacket.sizeremaining)
+									fprintf(logfile,"SP %d: Will send file in chunks of %d bytes\n",SP_ID,chunksize(&outpacket));
+								intinbuffer(outpacket.buffer+8,0);
+								intinbuffer(outpacket.buffer+12,outpacket.framefield);
+							}
+						}
+						// we have not failed so far
+						failcount=0;
+						resendrequest=0;
 					}
 				}
 			}
@@ -703,20 +1179,25 @@ int main(int argc, char** argv) {
 			intinbuffer(outpacket.buffer+4,SP_ID);
 			ullinbuffer(outpacket.buffer+8,0);
 			fprintf(logfile,"SP %d: Notifying CSP ready to quit\n",SP_ID);
+			PROBE1(sp,spdone,SP_ID);
 			if (!sendbuffer(fd,(void*)outpacket.buffer,sizeof(unsigned char)*INITFRAMESIZE)) {
 					fprintf(logfile,"SP %d: Error sending quit packet to CSP\n",SP_ID);
-					fclose(cmdfile);
+					if (cmdfile) fclose(cmdfile);
 					fclose(logfile);
 					return 0;
 			}
 		}
 	}
 	// simulation is officially over.
+	if (crcframes) fprintf(logfile,"SP %d: Checked %llu data frame checksums, %llu failed\n",SP_ID,crcframes,crcfailures);
+	if (batches) fprintf(logfile,"SP %d: Sent %llu text frames in %llu batches\n",SP_ID,batchedframes,batches);
+	freereassembler(saver,logfile);
 	fprintf(logfile,"SP %d: Ending simulation\n",SP_ID);
 	// close up shop
 	fclose(logfile);
 	// these cases shouldn't happen
 	if (cmdfile) fclose(cmdfile);
+	unmapscript(compiled);
 	if (sendfile) fclose(sendfile);
 	// shut it down
 	shutdown(fd,SHUT_RD);
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "script.h"
+
+// compiles SP input scripts (see README) into the binary op stream fastcl runs from a memory map
+// fastcl takes a compiled script anywhere it takes a text one, it knows one by its first bytes
+// so a load test with millions of commands spends no time parsing lines
+
+static inline void printusage(char *prog) {
+	fprintf(stderr,"Fast Ethernet SP script compiler\n");
+	fprintf(stderr,"Usage: %s -in=[script] -out=[compiled script]\n",prog);
+	fprintf(stderr,"With -n X the names are prefixes like fastcl's, pref0 to pref(X-1) are compiled: %s -n 10 -in=input -out=compiled\n",prog);
+	fprintf(stderr,"The compiled scripts run with fastcl -in=compiled as the text ones would\n");
+}
+
+// compiles one script, returns 1 on success
+static unsigned char compileone(const char *infilename,const char *outfilename) {
+	FILE *in = fopen(infilename,"r");
+	if (!in) {
+		fprintf(stderr,"Error: unable to open script %s\n",infilename);
+		return 0;
+	}
+	FILE *out = fopen(outfilename,"wb");
+	if (!out) {
+		fprintf(stderr,"Error: unable to create %s\n",outfilename);
+		fclose(in);
+		return 0;
+	}
+	fprintf(stderr,"%s:\n",infilename);
+	const double start = getnow();
+	const int numcmds = compilescript(in,out,stderr);
+	const long size = ftell(out);
+	fclose(in);
+	if (fclose(out) || numcmds<0) {
+		fprintf(stderr,"Error: unable to write %s\n",outfilename);
+		return 0;
+	}
+	fprintf(stderr,"%d commands to %s (%ld bytes) in %.3f s\n",numcmds,outfilename,size,getnow()-start);
+	return 1;
+}
+
+int main(int argc, char** argv) {
+	char *inputfilename=NULL, *outputfilename=NULL;
+	int numscripts=0;
+	for (int i=1;i<argc;++i) {
+		char *nextch = strchr(argv[i],'=');
+		if (strcmp(argv[i],"-h")==0) {
+			printusage(argv[0]);
+			return 0;
+		}
+		if (strcmp(argv[i],"-n")==0 && i+1<argc) numscripts=atoi(argv[++i]);
+		else if (!nextch) continue;
+		else if (strncmp(argv[i],"-in=",4)==0) inputfilename=nextch+1;
+		else if (strncmp(argv[i],"-out=",5)==0) outputfilename=nextch+1;
+	}
+	if (!inputfilename || !outputfilename || numscripts<0) {
+		printusage(argv[0]);
+		return 0;
+	}
+	if (!numscripts) {
+		compileone(inputfilename,outputfilename);
+		return 0;
+	}
+	// allows 9 chars for the SP ID like fastcl
+	char *infilename = (char*)malloc(sizeof(char)*(strlen(inputfilename)+10));
+	char *outfilename = (char*)malloc(sizeof(char)*(strlen(outputfilename)+10));
+	for (int i=0;i<numscripts;++i) {
+		sprintf(infilename,"%s%d",inputfilename,i);
+		sprintf(outfilename,"%s%d",outputfilename,i);
+		if (!compileone(infilename,outfilename)) break;
+	}
+	free(infilename);
+	free(outfilename);
+	return 0;
+}
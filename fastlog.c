@@ -0,0 +1,541 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "common.h"
+#include "porttable.h"
+
+// reads the logs of a run (the CSP's -out log, the SPs' logs, or a fastsim event log) in one pass
+// and puts each transfer's lifecycle back together from the lines as they are written:
+// the CSP's request, its accept, queueing, move to the data queue, or reject, and its forwarded frames,
+// the SP's request, rejects and resends, its grant, the frames it sent and received, and its waits
+// the memory is the SPs and the SP pairs seen (a port table each), not the length of the logs
+//
+// a line that starts with a time stamp (fastsim writes them) is at that time, otherwise a line's time is
+// its line number in its file, the CSP's lines are one event order then and each SP's lines another
+
+// longest waits kept for the report
+#define LOGMAXWAITS 100
+// SP pairs with counts of their own, the pairs after these are counted together
+#define LOGMAXPAIRS 65536
+// buckets of the request queue depth timeline, the bucket width doubles as the run gets longer
+#define LOGBUCKETS 32
+// a longer line is cut
+#define LOGLINELEN 4096
+
+// the kinds of wait
+enum logwaitkind { WAITQUEUE=0, WAITGRANT, WAITFRAMES };
+static const char *waitnames[] = { "in the CSP's request queue", "for a grant (SP side, resends included)", "for data frames" };
+
+typedef struct logwait {
+	double length;
+	double from;
+	int kind;
+	int sp_id;
+	int peer; // the destination of a request, -1 for a wait for frames
+}logwait;
+
+// what is known of one SP
+typedef struct logsp {
+	int sp_id;
+	// the CSP's side
+	unsigned long long requests, accepted, queued, moved, rejected, badrequests;
+	unsigned long long framesforwarded;
+	int requestdst; // the request whose outcome line comes next
+	unsigned long long requestbytes;
+	int queueddst; // the request in the request queue
+	double queuedat; // -1 when none is queued
+	// the SP's side
+	unsigned long long sprequests, resends, grants, rejects;
+	unsigned long long framessent, bytessent, framesreceived, bytesreceived, waits;
+	int spdst;
+	double requestedat; // -1 without a request
+	double waitingsince; // -1 when not waiting
+	double grantsum, grantmax;
+}logsp;
+
+// what went from one SP to another
+typedef struct logpair {
+	int src, dst;
+	unsigned long long requests, granted, rejected, bytesgranted;
+	unsigned long long framesforwarded, framessent, bytessent, framesreceived, bytesreceived;
+}logpair;
+
+// the request queue depth over time, LOGBUCKETS buckets of width from start
+typedef struct logtimeline {
+	unsigned char started;
+	double start, width;
+	double last; // the time of the last depth change
+	int depth;
+	int maxdepth;
+	int peak[LOGBUCKETS];
+	double area[LOGBUCKETS]; // depth times time
+}logtimeline;
+
+typedef struct loganalysis {
+	porttable *spids;
+	logsp *sps;
+	int maxsps;
+	porttable *pairids;
+	logpair *pairs;
+	int maxpairs;
+	logpair otherpairs; // pairs past LOGMAXPAIRS
+	logwait waits[LOGMAXWAITS];
+	int numwaits, keepwaits;
+	logtimeline timeline;
+	unsigned char stamped; // lines had time stamps
+	unsigned long long lines, matched;
+}loganalysis;
+
+static logsp *getsp(loganalysis *a,const int sp_id) {
+	const unsigned char known = portlookup(a->spids,STATIONID(sp_id))>=0;
+	const int index = portregister(a->spids,STATIONID(sp_id));
+	if (index>=a->maxsps) {
+		const int old = a->maxsps;
+		while (index>=a->maxsps) a->maxsps=a->maxsps?a->maxsps<<1:64;
+		a->sps=(logsp*)realloc(a->sps,sizeof(logsp)*a->maxsps);
+		memset((void*)(a->sps+old),0,sizeof(logsp)*(a->maxsps-old));
+	}
+	logsp *sp = &a->sps[index];
+	if (!known) {
+		sp->sp_id=sp_id;
+		sp->queuedat=sp->requestedat=sp->waitingsince=-1;
+		sp->requestdst=sp->queueddst=sp->spdst=-1;
+	}
+	return sp;
+}
+
+static logpair *getpair(loganalysis *a,const int src,const int dst) {
+	const unsigned long long key = ((unsigned long long)(unsigned int)src<<32)|(unsigned long long)(unsigned int)dst;
+	int index = portlookup(a->pairids,key);
+	if (index<0) {
+		if (a->pairids->numports>=LOGMAXPAIRS) return &a->otherpairs;
+		index=portregister(a->pairids,key);
+	}
+	if (index>=a->maxpairs) {
+		const int old = a->maxpairs;
+		while (index>=a->maxpairs) a->maxpairs=a->maxpairs?a->maxpairs<<1:64;
+		a->pairs=(logpair*)realloc(a->pairs,sizeof(logpair)*a->maxpairs);
+		memset((void*)(a->pairs+old),0,sizeof(logpair)*(a->maxpairs-old));
+	}
+	logpair *pair = &a->pairs[index];
+	pair->src=src;
+	pair->dst=dst;
+	return pair;
+}
+
+// keeps the wait if it is among the longest
+static void addwait(loganalysis *a,const int kind,const int sp_id,const int peer,const double from,const double to) {
+	const double length = to-from;
+	if (length<0) return;
+	int i = a->numwaits;
+	if (i==a->keepwaits) {
+		if (length<=a->waits[i-1].length) return;
+		--i;
+	}
+	else ++a->numwaits;
+	// insertion, the longest first
+	while (i>0 && a->waits[i-1].length<length) {
+		a->waits[i]=a->waits[i-1];
+		--i;
+	}
+	a->waits[i]=(logwait){ .length=length, .from=from, .kind=kind, .sp_id=sp_id, .peer=peer };
+}
+
+// the depth held from the last change to now goes into the buckets it spans
+static void timelineadvance(logtimeline *tl,const double now) {
+	if (!tl->started) {
+		tl->started=1;
+		tl->start=tl->last=now;
+		tl->width=1e-6;
+	}
+	// widen the buckets until now fits, pairs of buckets merge
+	while (now-tl->start>=tl->width*LOGBUCKETS) {
+		for (int b=0;b<LOGBUCKETS/2;++b) {
+			tl->peak[b]=(tl->peak[2*b]>tl->peak[2*b+1])?tl->peak[2*b]:tl->peak[2*b+1];
+			tl->area[b]=tl->area[2*b]+tl->area[2*b+1];
+		}
+		memset((void*)(tl->peak+LOGBUCKETS/2),0,sizeof(int)*LOGBUCKETS/2);
+		memset((void*)(tl->area+LOGBUCKETS/2),0,sizeof(double)*LOGBUCKETS/2);
+		tl->width*=2;
+	}
+	// b steps on, a time that rounds onto a bucket's end can't hold it up
+	double t = tl->last;
+	for (int b=(int)((t-tl->start)/tl->width);b<LOGBUCKETS && t<now;++b) {
+		double end = tl->start+(b+1)*tl->width;
+		if (end>now || b==LOGBUCKETS-1) end=now;
+		if (end<=t) continue;
+		tl->area[b]+=tl->depth*(end-t);
+		if (tl->depth>tl->peak[b]) tl->peak[b]=tl->depth;
+		t=end;
+	}
+	tl->last=(now>tl->last)?now:tl->last;
+}
+
+static void timelinechange(logtimeline *tl,const double now,const int change) {
+	timelineadvance(tl,now);
+	tl->depth+=change;
+	if (tl->depth<0) tl->depth=0;
+	if (tl->depth>tl->maxdepth) tl->maxdepth=tl->depth;
+	int b = (int)((tl->last-tl->start)/tl->width);
+	if (b>=LOGBUCKETS) b=LOGBUCKETS-1;
+	if (tl->depth>tl->peak[b]) tl->peak[b]=tl->depth;
+}
+
+// the text after the literal lit at *s, or NULL
+static inline const char *skip(const char *s,const char *lit) {
+	while (*lit) if (*s++!=*lit++) return NULL;
+	return s;
+}
+
+// reads a number at *s into *value and moves past it, returns 0 if there isn't one
+static inline unsigned char number(const char **s,unsigned long long *value) {
+	const char *p = *s;
+	if (*p<'0' || *p>'9') return 0;
+	unsigned long long v=0;
+	while (*p>='0' && *p<='9') v=v*10+(unsigned long long)(*p++-'0');
+	*value=v;
+	*s=p;
+	return 1;
+}
+
+// matches s against pattern, literal text and a '%' where a number goes (an unsigned long long * argument)
+// returns 1 when the whole pattern matched
+static unsigned char scan(const char *s,const char *pattern,...) {
+	va_list args;
+	va_start(args,pattern);
+	unsigned char ok=1;
+	while (*pattern && ok) {
+		if (*pattern=='%') {
+			ok=number(&s,va_arg(args,unsigned long long*));
+			++pattern;
+		}
+		else ok=(*s++==*pattern++);
+	}
+	va_end(args);
+	return ok;
+}
+
+// the outcome of the request sp sent last, outcome is the text from the CSP's log line
+static void requestoutcome(loganalysis *a,logsp *sp,const char *outcome,const double now) {
+	if (skip(outcome,"accepted")) {
+		++sp->accepted;
+		logpair *pair = getpair(a,sp->sp_id,sp->requestdst);
+		++pair->granted;
+		pair->bytesgranted+=sp->requestbytes;
+	}
+	else if (skip(outcome,"queued")) {
+		++sp->queued;
+		// one request at a time, a queued one the log lost track of is replaced
+		if (sp->queuedat<0) timelinechange(&a->timeline,now,1);
+		sp->queuedat=now;
+		sp->queueddst=sp->requestdst;
+	}
+	else if (skip(outcome,"rejected")) {
+		++sp->rejected;
+		++getpair(a,sp->sp_id,sp->requestdst)->rejected;
+	}
+}
+
+// a line of the CSP, s is the text after "CSP: ", returns 0 for a line that isn't about transfers
+static unsigned char cspline(loganalysis *a,const char *s,const double now) {
+	unsigned long long src, dst, bytes;
+	const char *rest;
+	if ((rest=skip(s,"Receive request from SP ")) && scan(rest,"% (% bytes to SP %)",&src,&bytes,&dst)) {
+		logsp *sp = getsp(a,(int)src);
+		++sp->requests;
+		sp->requestdst=(int)dst;
+		sp->requestbytes=bytes;
+		++getpair(a,(int)src,(int)dst)->requests;
+		// fastsim has the outcome on the same line
+		if ((rest=strstr(rest,"), "))) requestoutcome(a,sp,rest+3,now);
+	}
+	else if ((rest=skip(s,"Request from SP ")) && number(&rest,&src) && (rest=skip(rest," is "))) {
+		logsp *sp = getsp(a,(int)src);
+		// a queued request dropped because its destination left
+		if (skip(rest,"rejected, SP")) {
+			if (sp->queuedat>=0) timelinechange(&a->timeline,now,-1);
+			sp->queuedat=-1;
+		}
+		else requestoutcome(a,sp,rest,now);
+	}
+	else if (scan(s,"Moved SP % request",&src)) {
+		logsp *sp = getsp(a,(int)src);
+		++sp->moved;
+		logpair *pair = getpair(a,(int)src,sp->queueddst);
+		++pair->granted;
+		pair->bytesgranted+=sp->requestbytes;
+		if (sp->queuedat>=0) {
+			addwait(a,WAITQUEUE,(int)src,sp->queueddst,sp->queuedat,now);
+			timelinechange(&a->timeline,now,-1);
+		}
+		sp->queuedat=-1;
+	}
+	else if (scan(s,"Forwarded data frame (from SP %) to SP %",&src,&dst)) {
+		++getsp(a,(int)src)->framesforwarded;
+		++getpair(a,(int)src,(int)dst)->framesforwarded;
+	}
+	// a request with a bad destination, rejected
+	else if (scan(s,"Received request from SP % with target SP %",&src,&dst)) ++getsp(a,(int)src)->badrequests;
+	else return 0;
+	return 1;
+}
+
+// a line of SP sp_id, s is the text after "SP N: ", returns 0 for a line that isn't about transfers
+static unsigned char spline(loganalysis *a,const int sp_id,const char *s,const double now) {
+	unsigned long long seqnum, bytes, peer, count;
+	const char *rest;
+	logsp *sp;
+	if (scan(s,"Frame %, request to send % bytes to SP %",&seqnum,&bytes,&peer)) {
+		sp = getsp(a,sp_id);
+		++sp->sprequests;
+		sp->spdst=(int)peer;
+		sp->requestedat=now;
+	}
+	else if (scan(s,"Resent request to send frame %, (% bytes) to SP %",&seqnum,&bytes,&peer)) ++getsp(a,sp_id)->resends;
+	else if (scan(s,"Received ok reply from CSP to send data frame % to SP %",&seqnum,&peer)) {
+		sp = getsp(a,sp_id);
+		++sp->grants;
+		if (sp->requestedat>=0) {
+			const double wait = now-sp->requestedat;
+			sp->grantsum+=wait;
+			if (wait>sp->grantmax) sp->grantmax=wait;
+			addwait(a,WAITGRANT,sp_id,(int)peer,sp->requestedat,now);
+		}
+		sp->requestedat=-1;
+	}
+	else if (scan(s,"Received reject reply from CSP to send data frame % to SP %",&seqnum,&peer)) ++getsp(a,sp_id)->rejects;
+	else if (scan(s,"Sent data packet (% bytes) to SP %",&bytes,&peer)) {
+		// the logged size has the header
+		const unsigned long long payload = (bytes>INITFRAMESIZE)?bytes-INITFRAMESIZE:0;
+		sp = getsp(a,sp_id);
+		++sp->framessent;
+		sp->bytessent+=payload;
+		logpair *pair = getpair(a,sp_id,(int)peer);
+		++pair->framessent;
+		pair->bytessent+=payload;
+	}
+	// "(N bytes) from SP S" or "(N bytes, C compressed) from SP S", the bytes are the data as received
+	else if (scan(s,"Received packet % (% bytes",&seqnum,&bytes) && (rest=strstr(s,") from SP ")) && number((rest+=10,&rest),&peer)) {
+		sp = getsp(a,sp_id);
+		++sp->framesreceived;
+		sp->bytesreceived+=bytes;
+		logpair *pair = getpair(a,(int)peer,sp_id);
+		++pair->framesreceived;
+		pair->bytesreceived+=bytes;
+	}
+	else if (scan(s,"Entering wait to receive % data frames",&count)) {
+		sp = getsp(a,sp_id);
+		++sp->waits;
+		if (sp->waitingsince<0) sp->waitingsince=now;
+	}
+	else if (skip(s,"Finished waiting for data frames") || skip(s,"Received notification from CSP to stop waiting")) {
+		sp = getsp(a,sp_id);
+		if (sp->waitingsince>=0) addwait(a,WAITFRAMES,sp_id,-1,sp->waitingsince,now);
+		sp->waitingsince=-1;
+	}
+	else return 0;
+	return 1;
+}
+
+// reads one log, lines are CSP lines or SP lines with or without a time stamp in front
+static void analyzelog(loganalysis *a,FILE *in) {
+	char line[LOGLINELEN];
+	unsigned long long lineno=0;
+	while (fgets(line,LOGLINELEN,in)) {
+		// the rest of a long line is skipped
+		const size_t len = strlen(line);
+		if (len && line[len-1]!='\n') {
+			int c;
+			while ((c=getc(in))!=EOF && c!='\n');
+		}
+		++lineno;
+		++a->lines;
+		const char *s = line;
+		double now = (double)lineno;
+		if (*s>='0' && *s<='9') {
+			char *end;
+			const double stamp = strtod(s,&end);
+			if (*end==' ') {
+				now=stamp;
+				s=end+1;
+				a->stamped=1;
+			}
+		}
+		unsigned long long sp_id;
+		const char *rest;
+		if ((rest=skip(s,"CSP: "))) a->matched+=cspline(a,rest,now);
+		else if ((rest=skip(s,"SP ")) && number(&rest,&sp_id) && (rest=skip(rest,": "))) a->matched+=spline(a,(int)sp_id,rest,now);
+	}
+}
+
+static inline void printusage(char *prog) {
+	fprintf(stderr,"Fast Ethernet run log analyzer\n");
+	fprintf(stderr,"Usage: %s [-top=N] [-waits=N] log...\n",prog);
+	fprintf(stderr,"The logs are the CSP's -out log, the SPs' logs, or a fastsim event log, - reads stdin\n");
+	fprintf(stderr,"-top=N lists the N SPs and SP pairs with the most bytes (20 by default, 0 lists all of them)\n");
+	fprintf(stderr,"-waits=N lists the N longest waits (10 by default, at most %d)\n",LOGMAXWAITS);
+}
+
+// orders for the report, the most bytes first
+static int bysp(const void *x,const void *y) {
+	const logsp *a = *(const logsp**)x, *b = *(const logsp**)y;
+	if (a->bytessent!=b->bytessent) return (a->bytessent<b->bytessent)?1:-1;
+	if (a->framesforwarded!=b->framesforwarded) return (a->framesforwarded<b->framesforwarded)?1:-1;
+	return a->sp_id-b->sp_id;
+}
+static int bypair(const void *x,const void *y) {
+	const logpair *a = *(const logpair**)x, *b = *(const logpair**)y;
+	const unsigned long long av = a->bytessent?a->bytessent:a->bytesgranted, bv = b->bytessent?b->bytessent:b->bytesgranted;
+	if (av!=bv) return (av<bv)?1:-1;
+	if (a->src!=b->src) return a->src-b->src;
+	return a->dst-b->dst;
+}
+
+static void report(loganalysis *a,const int numlogs,const int top,FILE *out) {
+	const char *unit = a->stamped?"s":"lines";
+	fprintf(out,"LOG: %llu lines from %d logs, %llu about transfers, times are ",a->lines,numlogs,a->matched);
+	if (a->stamped) fprintf(out,"the time stamps in seconds\n");
+	else fprintf(out,"line numbers (the CSP's log and each SP's log are an event order of their own)\n");
+
+	// totals
+	logsp total;
+	memset((void*)&total,0,sizeof(logsp));
+	const int numsps = a->spids->numports;
+	for (int i=0;i<numsps;++i) {
+		const logsp *sp = &a->sps[i];
+		total.requests+=sp->requests;
+		total.accepted+=sp->accepted;
+		total.queued+=sp->queued;
+		total.moved+=sp->moved;
+		total.rejected+=sp->rejected;
+		total.badrequests+=sp->badrequests;
+		total.framesforwarded+=sp->framesforwarded;
+		total.sprequests+=sp->sprequests;
+		total.resends+=sp->resends;
+		total.grants+=sp->grants;
+		total.rejects+=sp->rejects;
+		total.framessent+=sp->framessent;
+		total.bytessent+=sp->bytessent;
+		total.framesreceived+=sp->framesreceived;
+		total.bytesreceived+=sp->bytesreceived;
+		total.waits+=sp->waits;
+	}
+	fprintf(out,"LOG: %d SPs, %d SP pairs\n",numsps,a->pairids->numports);
+	fprintf(out,"LOG: CSP: %llu requests, %llu accepted, %llu queued (%llu moved to the data queue), %llu rejected, %llu bad, %llu frames forwarded\n",
+					total.requests,total.accepted,total.queued,total.moved,total.rejected,total.badrequests,total.framesforwarded);
+	fprintf(out,"LOG: SPs: %llu requests, %llu resent, %llu rejects, %llu grants, %llu frames sent (%llu bytes), %llu received (%llu bytes), %llu waits\n",
+					total.sprequests,total.resends,total.rejects,total.grants,total.framessent,total.bytessent,
+					total.framesreceived,total.bytesreceived,total.waits);
+
+	// the request queue depth over the run, a bucket's peak and mean
+	logtimeline *tl = &a->timeline;
+	if (tl->started) {
+		const double span = tl->last-tl->start;
+		double area=0;
+		for (int b=0;b<LOGBUCKETS;++b) area+=tl->area[b];
+		fprintf(out,"LOG: Request queue depth: max %d, mean %.2f over %.6g %s\n",tl->maxdepth,(span>0)?area/span:0,span,unit);
+		for (int b=0;b<LOGBUCKETS && tl->start+b*tl->width<=tl->last;++b) {
+			double from = tl->start+b*tl->width, to = from+tl->width;
+			if (to>tl->last) to=tl->last;
+			fprintf(out,"LOG:   %12.6g to %12.6g %s: peak %3d, mean %6.2f\n",from,to,unit,tl->peak[b],(to>from)?tl->area[b]/(to-from):0);
+		}
+	}
+
+	// SPs, the most bytes sent first
+	const int listsps = (top && top<numsps)?top:numsps;
+	logsp **sps = (logsp**)malloc(sizeof(logsp*)*(numsps+1));
+	for (int i=0;i<numsps;++i) sps[i]=&a->sps[i];
+	qsort(sps,numsps,sizeof(logsp*),bysp);
+	if (numsps) {
+		fprintf(out,"LOG: SPs (%d of %d by bytes sent): CSP requests accepted/queued/rejected, SP requests/resent/rejects, frames and bytes sent and received, grant wait mean/max (%s)\n",
+						listsps,numsps,unit);
+	}
+	for (int i=0;i<listsps;++i) {
+		const logsp *sp = sps[i];
+		fprintf(out,"LOG:   SP %d: %llu %llu/%llu/%llu, %llu/%llu/%llu, sent %llu (%llu bytes), received %llu (%llu bytes), wait %.6g/%.6g\n",
+						sp->sp_id,sp->requests,sp->accepted,sp->queued,sp->rejected,sp->sprequests,sp->resends,sp->rejects,
+						sp->framessent,sp->bytessent,sp->framesreceived,sp->bytesreceived,sp->grants?sp->grantsum/sp->grants:0,sp->grantmax);
+	}
+	free(sps);
+
+	// pairs, the most bytes first (sent as the SP logs have it, or granted as the CSP's log has it)
+	const int numpairs = a->pairids->numports;
+	const int listpairs = (top && top<numpairs)?top:numpairs;
+	logpair **pairs = (logpair**)malloc(sizeof(logpair*)*(numpairs+1));
+	for (int i=0;i<numpairs;++i) pairs[i]=&a->pairs[i];
+	qsort(pairs,numpairs,sizeof(logpair*),bypair);
+	if (numpairs) {
+		fprintf(out,"LOG: SP pairs (%d of %d by bytes): CSP requests granted/rejected (bytes granted), frames forwarded, frames and bytes sent and received\n",
+						listpairs,numpairs);
+	}
+	for (int i=0;i<listpairs;++i) {
+		const logpair *pair = pairs[i];
+		fprintf(out,"LOG:   SP %d to SP %d: %llu %llu/%llu (%llu bytes), forwarded %llu, sent %llu (%llu bytes), received %llu (%llu bytes)\n",
+						pair->src,pair->dst,pair->requests,pair->granted,pair->rejected,pair->bytesgranted,pair->framesforwarded,
+						pair->framessent,pair->bytessent,pair->framesreceived,pair->bytesreceived);
+	}
+	free(pairs);
+	const logpair *other = &a->otherpairs;
+	if (other->requests || other->framesforwarded || other->framessent || other->framesreceived) {
+		fprintf(out,"LOG:   the pairs past %d: %llu %llu/%llu (%llu bytes), forwarded %llu, sent %llu (%llu bytes), received %llu (%llu bytes)\n",
+						LOGMAXPAIRS,other->requests,other->granted,other->rejected,other->bytesgranted,other->framesforwarded,
+						other->framessent,other->bytessent,other->framesreceived,other->bytesreceived);
+	}
+
+	// the longest waits
+	if (a->numwaits) fprintf(out,"LOG: Longest waits (%s):\n",unit);
+	for (int i=0;i<a->numwaits;++i) {
+		const logwait *w = &a->waits[i];
+		if (w->peer>=0) {
+			fprintf(out,"LOG:   %.6g from %.6g, SP %d (to SP %d) %s\n",w->length,w->from,w->sp_id,w->peer,waitnames[w->kind]);
+		}
+		else fprintf(out,"LOG:   %.6g from %.6g, SP %d %s\n",w->length,w->from,w->sp_id,waitnames[w->kind]);
+	}
+}
+
+int main(int argc, char** argv) {
+	int top=20, keepwaits=10, numlogs=0;
+	for (int i=1;i<argc;++i) {
+		if (strcmp(argv[i],"-h")==0) {
+			printusage(argv[0]);
+			return 0;
+		}
+		if (strncmp(argv[i],"-top=",5)==0) top=atoi(argv[i]+5);
+		else if (strncmp(argv[i],"-waits=",7)==0) keepwaits=atoi(argv[i]+7);
+		else ++numlogs;
+	}
+	if (!numlogs || top<0) {
+		printusage(argv[0]);
+		return 0;
+	}
+	if (keepwaits<1) keepwaits=1;
+	if (keepwaits>LOGMAXWAITS) keepwaits=LOGMAXWAITS;
+
+	loganalysis *a = (loganalysis*)calloc(1,sizeof(loganalysis));
+	a->spids=newporttable();
+	a->pairids=newporttable();
+	a->keepwaits=keepwaits;
+	a->otherpairs.src=a->otherpairs.dst=-1;
+	// a big buffer for reading, the logs are read once front to back
+	char *buffer = (char*)malloc(1<<20);
+	for (int i=1;i<argc;++i) {
+		if (argv[i][0]=='-' && argv[i][1]) continue;
+		FILE *in = strcmp(argv[i],"-")?fopen(argv[i],"r"):stdin;
+		if (!in) {
+			fprintf(stderr,"Error: unable to open log %s\n",argv[i]);
+			continue;
+		}
+		if (in!=stdin) setvbuf(in,buffer,_IOFBF,1<<20);
+		analyzelog(a,in);
+		if (in!=stdin) fclose(in);
+	}
+	report(a,numlogs,top,stdout);
+	free(buffer);
+	freeporttable(a->spids);
+	freeporttable(a->pairids);
+	free(a->sps);
+	free(a->pairs);
+	free(a);
+	return 0;
+}
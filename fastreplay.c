@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include "common.h"
+#include "porttable.h"
+#include "trace.h"
+#include "spclient.h"
+
+// plays a trace recorded by the CSP (fastserv -trace) back against a CSP
+// every SP of the trace is an spclient (see spclient.h) of this one process
+// an SP issues its records in order, each one once the previous one is finished:
+// a request waits for its reply (and sends its data when accepted), a wait waits for its frames (or a wake)
+// so the causal order between waits and sends is kept, at any speed
+// with a speed the records are also not issued before their recorded time divided by the speed
+// retries are in the trace as requests of their own, a rejected request is not retried here
+// with -mux=N the SPs share connections, up to N SPs with consecutive IDs on each (see newspmux),
+// they all join at the start instead of at their first record
+
+// the clients are polled, the descriptor limit of the process is the real limit
+#define MAXREPLAYSPS 16384
+
+// what a replayed SP is doing
+enum replaystate { REPLAYIDLE=0, REPLAYBLOCKED, REPLAYSENDING, REPLAYWAITING, REPLAYDONE, REPLAYCLOSED };
+
+// replay totals
+typedef struct replaystats {
+	unsigned long long requests;
+	unsigned long long accepted;
+	unsigned long long rejected;
+	unsigned long long framessent;
+	unsigned long long framesreceived;
+	unsigned long long bytesreceived;
+	double replysum; // request to reply times
+	double replymax;
+}replaystats;
+
+// one SP of the trace
+typedef struct replaysp {
+	int sp_id;
+	spclient *client; // NULL until it joins
+	tracerecord *records; // its records in trace order
+	int numrecords;
+	int next;
+	int state;
+	double requestedat;
+	replaystats *stats;
+	FILE *outfile;
+}replaysp;
+
+// the events of an SP's client move it along its records
+static void replayevent(spclient *client,const spclientevent *event,void *arg) {
+	replaysp *sp = (replaysp*)arg;
+	replaystats *stats = sp->stats;
+	double reply;
+	switch (event->type) {
+	case SPACCEPTED:
+	case SPREJECTED:
+		reply=getnow()-sp->requestedat;
+		stats->replysum+=reply;
+		if (reply>stats->replymax) stats->replymax=reply;
+		if (event->type==SPACCEPTED) {
+			++stats->accepted;
+			sp->state=REPLAYSENDING;
+		}
+		else {
+			++stats->rejected;
+			sp->state=REPLAYIDLE;
+		}
+		break;
+	case SPSENT:
+		sp->state=REPLAYIDLE;
+		break;
+	case SPFRAME:
+		++stats->framesreceived;
+		stats->bytesreceived+=event->length;
+		if (sp->state==REPLAYWAITING && !client->waiting) sp->state=REPLAYIDLE;
+		break;
+	case SPWOKEN:
+		if (sp->state==REPLAYWAITING) sp->state=REPLAYIDLE;
+		break;
+	case SPQUIT:
+		sp->state=REPLAYCLOSED;
+		break;
+	case SPCLOSED:
+		if (!client->session) fprintf(sp->outfile,"REPLAY: SP %d unable to join the CSP\n",sp->sp_id);
+		else fprintf(sp->outfile,"REPLAY: SP %d lost its connection to the CSP\n",sp->sp_id);
+		sp->state=REPLAYCLOSED;
+		break;
+	default:
+		// the start barrier, replayed SPs keep the recorded timing instead
+		break;
+	}
+}
+
+// orders SP IDs for the blocks of -mux
+static int byid(const void *x,const void *y) {
+	const int a = *(const int*)x, b = *(const int*)y;
+	return (a>b)-(a<b);
+}
+
+// starts the SP's client, the session it is given is not used
+static void joinsp(replaysp *sp,const struct sockaddr_in *addr,const int groupsize,const int simulation) {
+	sp->client=newspclient(addr,sp->sp_id,groupsize,simulation,0,replayevent,(void*)sp);
+	if (sp->client) return;
+	fprintf(sp->outfile,"REPLAY: SP %d unable to join the CSP\n",sp->sp_id);
+	sp->state=REPLAYCLOSED;
+}
+
+// issues the SP's next record, the SP is idle
+static void issuerecord(replaysp *sp,const struct sockaddr_in *addr,const int groupsize,const int simulation) {
+	const tracerecord *record = &sp->records[sp->next++];
+	// an SP whose join wasn't recorded joins with its first record
+	if (!sp->client) joinsp(sp,addr,groupsize,simulation);
+	if (sp->state==REPLAYCLOSED || record->class==TRACEJOIN) return;
+	switch (record->class) {
+	case TRACEREQUEST:
+		// the replayed data is zeros, only the sizes matter, an empty request has nothing to replay
+		if (!record->value) break;
+		sp->state=REPLAYBLOCKED;
+		sp->requestedat=getnow();
+		++sp->stats->requests;
+		spclientsend(sp->client,record->dst,sp->next,NULL,record->value);
+		break;
+	case TRACEWAIT:
+		spclientwait(sp->client,(int)record->value);
+		if (sp->client->waiting) sp->state=REPLAYWAITING;
+		break;
+	case TRACEQUIT:
+		sp->state=REPLAYDONE;
+		spclientquit(sp->client);
+		break;
+	}
+}
+
+// print usage info, called for bad command line arguments
+static inline void printusage(char *prog) {
+	fprintf(stderr,"Fast Ethernet trace replay\n");
+	fprintf(stderr,"Usage: %s -trace=[trace file] [ip:port] -speed=[N|asap] -out=[filename]\n",prog);
+	fprintf(stderr,"Plays a trace recorded with fastserv -trace back against the CSP at ip:port\n");
+	fprintf(stderr,"-speed=1 (the default) keeps the recorded timing, -speed=N runs N times faster, asap doesn't wait at all\n");
+	fprintf(stderr,"Each SP keeps its recorded order, a record waits for the reply or the frames of the one before\n");
+	fprintf(stderr,"-mux=N puts up to N SPs with consecutive IDs on each connection to the CSP instead of one each\n");
+	fprintf(stderr,"-sim=N replays into simulation N of a CSP daemon (fastserv -daemon)\n");
+}
+
+int main(int argc, char** argv) {
+	char *tracefilename=NULL, *outfilename=NULL, *cspaddr=NULL;
+	double speed=1.0;
+	int muxsize=0;
+	// the simulation on a CSP daemon
+	int simulation=0;
+	for (int i=1;i<argc;++i) {
+		char *nextch = strchr(argv[i],'=');
+		if (strcmp(argv[i],"-h")==0) {
+			printusage(argv[0]);
+			return 0;
+		}
+		if (argv[i][0]!='-') cspaddr=argv[i];
+		else if (!nextch) continue;
+		else if (strncmp(argv[i],"-trace=",7)==0) tracefilename=nextch+1;
+		else if (strncmp(argv[i],"-out=",5)==0) outfilename=nextch+1;
+		else if (strncmp(argv[i],"-speed=",7)==0) speed=(strcmp(nextch+1,"asap")==0)?0:atof(nextch+1);
+		else if (strncmp(argv[i],"-mux=",5)==0) muxsize=atoi(nextch+1);
+		else if (strncmp(argv[i],"-sim=",5)==0) simulation=atoi(nextch+1);
+	}
+	char *portch = cspaddr?strchr(cspaddr,':'):NULL;
+	if (!tracefilename || !portch || speed<0 || muxsize<0 || simulation<0 || simulation>MAXSIMULATION) {
+		printusage(argv[0]);
+		return 0;
+	}
+	// a multiplexed connection's count is 16 bits
+	if (muxsize>MUXCOUNTMASK) muxsize=MUXCOUNTMASK;
+	*portch='\0';
+	struct sockaddr_in addr;
+	memset((void*)&addr,0,sizeof(struct sockaddr_in));
+	addr.sin_family=AF_INET;
+	addr.sin_port=htons((unsigned short)atoi(portch+1));
+	if (inet_pton(AF_INET,cspaddr,&addr.sin_addr)<=0) {
+		fprintf(stderr,"Error: unable to convert ip \"%s\"\n",cspaddr);
+		return 0;
+	}
+	FILE *tracefile = opentrace(tracefilename);
+	if (!tracefile) {
+		fprintf(stderr,"Error: unable to read the trace %s\n",tracefilename);
+		return 0;
+	}
+	FILE *outfile=NULL;
+	if (outfilename) outfile=fopen(outfilename,"w");
+	if (!outfile) outfile=stdout;
+	signal(SIGPIPE,SIG_IGN);
+
+	// read the whole trace, the SPs are found by SP ID through a port table
+	int numrecords=0, maxrecords=1024;
+	tracerecord *records = (tracerecord*)malloc(sizeof(tracerecord)*maxrecords);
+	while (readtrace(tracefile,&records[numrecords])) {
+		if (++numrecords==maxrecords) {
+			maxrecords<<=1;
+			records = (tracerecord*)realloc(records,sizeof(tracerecord)*maxrecords);
+		}
+	}
+	fclose(tracefile);
+	porttable *ids = newporttable();
+	int groupsize=0;
+	for (int i=0;i<numrecords;++i) {
+		portregister(ids,STATIONID(records[i].src));
+		if (records[i].class==TRACEJOIN && !groupsize) groupsize=(int)records[i].value;
+	}
+	const int numsps = ids->numports;
+	if (!numsps || numsps>MAXREPLAYSPS) {
+		fprintf(stderr,"Error: the trace has %d SPs, this replays 1 to %d\n",numsps,MAXREPLAYSPS);
+		free(records);
+		freeporttable(ids);
+		return 0;
+	}
+	if (groupsize<numsps) groupsize=numsps;
+	// each SP's records, in trace order
+	replaysp *sps = (replaysp*)calloc(numsps,sizeof(replaysp));
+	int *counts = (int*)calloc(numsps,sizeof(int));
+	for (int i=0;i<numrecords;++i) ++counts[portlookup(ids,STATIONID(records[i].src))];
+	for (int p=0;p<numsps;++p) {
+		sps[p].sp_id=SPFROMSTATION(ids->station[p]);
+		sps[p].records=(tracerecord*)malloc(sizeof(tracerecord)*counts[p]);
+	}
+	for (int i=0;i<numrecords;++i) {
+		replaysp *sp = &sps[portlookup(ids,STATIONID(records[i].src))];
+		sp->records[sp->numrecords++]=records[i];
+	}
+	const unsigned long long tracestart = numrecords?records[0].time:0;
+	const unsigned long long traceend = numrecords?records[numrecords-1].time:0;
+	free(records);
+	free(counts);
+	fprintf(outfile,"REPLAY: %d records from %d SPs over %.3f s, speed ",numrecords,numsps,(double)(traceend-tracestart)/1e9);
+	if (speed>0) fprintf(outfile,"%gx\n",speed);
+	else fprintf(outfile,"asap\n");
+
+	replaystats stats;
+	memset((void*)&stats,0,sizeof(replaystats));
+	for (int p=0;p<numsps;++p) {
+		sps[p].stats=&stats;
+		sps[p].outfile=outfile;
+	}
+	spclient **clients = (spclient**)malloc(sizeof(spclient*)*numsps);
+	// the shared connections, each a run of consecutive SP IDs
+	spmux **muxes = (spmux**)malloc(sizeof(spmux*)*numsps);
+	int nummuxes=0;
+	if (muxsize>1) {
+		int *sorted = (int*)malloc(sizeof(int)*numsps);
+		for (int p=0;p<numsps;++p) sorted[p]=sps[p].sp_id;
+		qsort(sorted,numsps,sizeof(int),byid);
+		void **args = (void**)malloc(sizeof(void*)*muxsize);
+		for (int i=0;i<numsps;) {
+			int count=1;
+			while (i+count<numsps && count<muxsize && sorted[i+count]==sorted[i]+count) ++count;
+			for (int n=0;n<count;++n) args[n]=(void*)&sps[portlookup(ids,STATIONID(sorted[i+n]))];
+			spmux *mux = newspmux(&addr,sorted[i],count,groupsize,simulation,0,replayevent,args);
+			for (int n=0;n<count;++n) {
+				replaysp *sp = (replaysp*)args[n];
+				if (mux) sp->client=mux->clients[n];
+				else {
+					fprintf(outfile,"REPLAY: SP %d unable to join the CSP\n",sp->sp_id);
+					sp->state=REPLAYCLOSED;
+				}
+			}
+			if (mux) muxes[nummuxes++]=mux;
+			i+=count;
+		}
+		free(args);
+		free(sorted);
+		fprintf(outfile,"REPLAY: %d SPs on %d connections\n",numsps,nummuxes);
+	}
+	const double start = getnow();
+	while (1) {
+		const double now = getnow();
+		// the earliest time a waiting record is due, and whether anything is left
+		double nextdue = -1;
+		int numclients=0;
+		unsigned char open=0;
+		for (int p=0;p<numsps;++p) {
+			replaysp *sp = &sps[p];
+			// issue what is due, a record waits for the one before it to finish
+			while (sp->state==REPLAYIDLE && sp->next<sp->numrecords) {
+				const tracerecord *record = &sp->records[sp->next];
+				const double due = (speed>0)?start+(double)(record->time-tracestart)/1e9/speed:0;
+				if (due>now) {
+					if (nextdue<0 || due<nextdue) nextdue=due;
+					break;
+				}
+				issuerecord(sp,&addr,groupsize,simulation);
+			}
+			// the trace ended without the SP's quit (a partial recording), the CSP still needs it
+			if (sp->state==REPLAYIDLE && sp->next==sp->numrecords && sp->client) {
+				sp->state=REPLAYDONE;
+				spclientquit(sp->client);
+			}
+			if (sp->state!=REPLAYCLOSED) open=1;
+			if (sp->client && sp->state!=REPLAYCLOSED) clients[numclients++]=sp->client;
+		}
+		if (!open) break;
+		// the clients send as fast as their sockets take it, otherwise sleep until the next record is due
+		// (checking at least once a second)
+		double wait=1;
+		if (nextdue>=0 && nextdue-getnow()<wait) wait=nextdue-getnow();
+		if (wait<0) wait=0;
+		if (nummuxes) spmuxrun(muxes,nummuxes,(int)(wait*1000));
+		else spclientrun(clients,numclients,(int)(wait*1000));
+	}
+	const double elapsed = getnow()-start;
+	for (int p=0;p<numsps;++p) if (sps[p].client) stats.framessent+=sps[p].client->framessent;
+
+	fprintf(outfile,"REPLAY: finished in %.3f s (the trace took %.3f s)\n",elapsed,(double)(traceend-tracestart)/1e9);
+	fprintf(outfile,"REPLAY: %llu requests, %llu accepted, %llu rejected, mean reply %.6f s, max reply %.6f s\n",
+					stats.requests,stats.accepted,stats.rejected,
+					(stats.accepted+stats.rejected)?stats.replysum/(double)(stats.accepted+stats.rejected):0,stats.replymax);
+	fprintf(outfile,"REPLAY: %llu data frames sent, %llu received (%llu bytes)\n",stats.framessent,stats.framesreceived,stats.bytesreceived);
+	if (outfile!=stdout) fclose(outfile);
+	for (int p=0;p<numsps;++p) {
+		free(sps[p].records);
+		if (!nummuxes) freespclient(sps[p].client);
+	}
+	for (int m=0;m<nummuxes;++m) freespmux(muxes[m]);
+	free(muxes);
+	free(clients);
+	free(sps);
+	freeporttable(ids);
+	return 0;
+}
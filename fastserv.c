@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // accept4
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,123 +9,558 @@
 #include <errno.h>
 #include <unistd.h>
 #include <stdint.h>
-#include "common.h"
-
-// static size at front of every packet
-// every packet begins with 4bytes=src, 4bytes=dst
-// the last 8 bytes are either total transfer size (for initial data request)
-// or they are two integers, the first is the sequence number of the current transfer
-// the second is the remaining data size of the current packet (up to MAXDATASIZE)
-#define INITFRAMESIZE 16
-// the max frame size, max size for send calls
-#define MAXFRAMESIZE 4096
-// max amount of data in a data packet, is the frame size minus the init size
-#define MAXDATASIZE MAXFRAMESIZE-INITFRAMESIZE
-
-// queuesizes MUST be >= 1
-// this does work with 64 processes and both queues with size 1
-// 
-#define REQUESTQUEUESIZE 10
-#define DATAQUEUESIZE 2
-
-// we have an array of these -> dataqueue[DATAQUEUESIZE]
-// src_sp_id = -1 to indicate unoccupied
-// has its own buffer, so whoever reserved an index will have a buffer of their own
-// also holds the dst_sp_id and the bytes remaining (actual filesize bytes)
-typedef struct dataqueuenode {
-	unsigned char buffer[MAXFRAMESIZE];
-	unsigned long long bytesremaining;
-	int src_sp_id;
-	int dst_sp_id;
-}dataqueuenode;
-
-// we have an array of these -> requestqueue[REQUESTQUEUESIZE]
-// src_sp_id = -1 to indicate unoccupied
-// also holds the dst_sp_id and the total size of the pending transfer (actual filesize bytes)
-typedef struct requestqueuenode {
-	int src_sp_id;
-	int dst_sp_id;
-	unsigned long long datasize;
-}requestqueuenode;
-
-// Utility functions, beginning with queue helper functions:
-
-// gives the next index of the data queue that doesn't have a source sp id set
-// if the data queue is not full this returns an index
-// if the data queue is full this returns -1
-static inline int getnextdataqindex(dataqueuenode *queue) {
-	for (int i=0;i<DATAQUEUESIZE;++i) {
-		if (queue[i].src_sp_id<0) {
-			return i;
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "queues.h"
+#include "sched.h"
+#include "porttable.h"
+#include "fabric.h"
+#include "trace.h"
+#include "busypoll.h"
+#include "crc32c.h"
+#include "probes.h"
+#include "rules.h"
+
+// seconds the CSP holds the session of an SP whose connection dropped, it may reconnect and resume
+#define SESSIONHOLD 10
+
+// the listen backlog (the kernel caps it at net.core.somaxconn), a whole group may connect at once
+#define LISTENBACKLOG 4096
+// connections whose first frame is still arriving, and the seconds they get to send it
+#define MAXHANDSHAKES 256
+#define HANDSHAKETIMEOUT 10
+
+// data frames a transfer forwards before it yields its data queue slot to a waiting request, see -quantum
+#define TRANSFERQUANTUM 1
+
+// the most SPs one multiplexed connection may carry (see MUXID), its count is 16 bits
+#define MAXMUXSPS MUXCOUNTMASK
+
+// seconds a simulation of the daemon goes without a frame before it is torn down, see -daemon
+#define DAEMONIDLE 60
+
+// a change of the mirroring rate waiting for the loop (see -mirror), a rate of zero or more is the rate to switch to
+#define MIRRORNONE -1
+#define MIRRORFASTER -2
+#define MIRRORSLOWER -3
+
+// the CSP's probes, see probes.h and probes/
+PROBESEMAPHORE(csp,requestreceived);
+PROBESEMAPHORE(csp,requestqueued);
+PROBESEMAPHORE(csp,requestaccepted);
+PROBESEMAPHORE(csp,requestrejected);
+PROBESEMAPHORE(csp,queueshift);
+PROBESEMAPHORE(csp,framereceived);
+PROBESEMAPHORE(csp,frameforwarded);
+PROBESEMAPHORE(csp,spwait);
+PROBESEMAPHORE(csp,spwake);
+PROBESEMAPHORE(csp,spdone);
+PROBESEMAPHORE(csp,rulematched);
+
+// a connection accepted from the listening socket, non-blocking until its first frame is in
+typedef struct handshake {
+	int fd;
+	int length; // bytes of the first frame received so far
+	double since;
+	unsigned char buffer[INITFRAMESIZE];
+}handshake;
+
+// a connection carrying a block of SPs (see MUXID), its stations have its index in ports->mux
+// the CSP reads one frame at a time, the station it is from is found by peeking at the header at the head
+// of the socket, so the loop reads that station as it would read a station on its own socket
+typedef struct muxconn {
+	int fd; // -1 once it closed, the entry is reused
+	int first, count;
+	int head; // the port of the station whose frame is at the head of the socket, -1 until peeked
+}muxconn;
+
+// a simulation of the daemon (see -daemon), run by a process of its own that the daemon hands its connections to
+typedef struct simulation {
+	int id;
+	pid_t pid; // 0 once the process is gone
+	int fd; // the daemon's end of the socket to the process, -1 once it is closed
+	unsigned char ended; // the simulation takes no more connections, those it hands back are still read from fd
+}simulation;
+
+// the simulation this process runs, set in a simulation of the daemon, it tags the session tokens
+static int simulationid=0;
+// set by SIGINT or SIGTERM, the daemon stops taking connections (its simulations run to their end)
+static volatile sig_atomic_t stopping=0;
+// set by SIGUSR1 and SIGUSR2, the loop changes the mirroring rate (see changemirror)
+static volatile sig_atomic_t mirrorsignal=MIRRORNONE;
+
+// a new session token for station, never zero
+// a simulation of the daemon has its id in the top 16 bits, the daemon hands a resume to it by that
+static unsigned long long newsession(const unsigned long long station) {
+	static unsigned long long sessions=0;
+	unsigned long long token;
+	do {
+		token = hashstation(station^((unsigned long long)(getnow()*1e9))^(++sessions<<40));
+		if (simulationid) token=(token&0x0000FFFFFFFFFFFFULL)|((unsigned long long)simulationid<<48);
+	} while (!token);
+	return token;
+}
+
+// a grant starts a new transfer for the source station's session,
+// or continues the transfer the station claimed to resume
+static void startxfer(porttable *ports,dataqueuenode *dataqueue,const int index) {
+	const int port = dataqueue[index].src_port;
+	const unsigned long long bytes = dataqueue[index].bytesremaining;
+	// the data bytes, every frame but the last is full
+	const unsigned long long payload = bytes-INITFRAMESIZE*((bytes+MAXFRAMESIZE-1)/MAXFRAMESIZE);
+	if (ports->resumefrom[port]!=RESUMENONE) {
+		ports->xferoffset[port]=ports->resumefrom[port];
+		ports->resumefrom[port]=RESUMENONE;
+	}
+	else {
+		++ports->xferseq[port];
+		ports->xferoffset[port]=0;
+	}
+	ports->xfertotal[port]=ports->xferoffset[port]+payload;
+	dataqueue[index].dataremaining=payload;
+	dataqueue[index].frames=0;
+	ports->inflight[dataqueue[index].dst_port]+=payload;
+}
+
+// queues the session frame and the resume frame for the last transfer of the station at port
+// returns 0 for failure, 1 for success
+static unsigned char sendsession(porttable *ports,const int port) {
+	unsigned char buffer[INITFRAMESIZE*2];
+	const int sp_id = SPFROMSTATION(ports->station[port]);
+	intinbuffer(buffer,sp_id);
+	intinbuffer(buffer+4,SESSIONID);
+	ullinbuffer(buffer+8,ports->session[port]);
+	intinbuffer(buffer+INITFRAMESIZE,SESSIONID);
+	intinbuffer(buffer+INITFRAMESIZE+4,ports->xferseq[port]);
+	const unsigned char resumable = ports->xferseq[port] && ports->xferoffset[port]<ports->xfertotal[port];
+	ullinbuffer(buffer+INITFRAMESIZE+8,resumable?ports->xferoffset[port]:RESUMENONE);
+	return queuecontrol(ports,port,buffer,sizeof(unsigned char)*INITFRAMESIZE*2);
+}
+
+// takes bytes that were forwarded (or won't be) off the count of the station at port
+static inline void unloadport(porttable *ports,const int port,const unsigned long long bytes) {
+	ports->inflight[port]-=(ports->inflight[port]>bytes)?bytes:ports->inflight[port];
+}
+
+// takes what is left of a granted transfer off its destination, unless the destination left
+// (its port may belong to someone new by now, who doesn't get the transfer)
+static inline void unloadtransfer(porttable *ports,const int dst_port,const int dst_sp_id,const unsigned long long dataremaining) {
+	if (ports->station[dst_port]==STATIONID(dst_sp_id)) unloadport(ports,dst_port,dataremaining);
+}
+
+// takes what the station at port is sending off the counts of its destinations, its queued requests,
+// its data queue slot, and its parked transfer, before releasesource or purgeport and releaseparked let them go
+static void unloadsource(porttable *ports,requestqueuenode *requestqueue,dataqueuenode *dataqueue,parkedqueuenode *parked,const int port) {
+	for (int i=0;i<REQUESTQUEUESIZE && requestqueue[i].src_sp_id>=0;++i) {
+		if (requestqueue[i].src_port==port && requestqueue[i].dst_port>=0) unloadport(ports,requestqueue[i].dst_port,requestqueue[i].datasize);
+	}
+	for (int x=0;x<DATAQUEUESIZE;++x) {
+		if (dataqueue[x].src_sp_id>=0 && dataqueue[x].src_port==port)
+			unloadtransfer(ports,dataqueue[x].dst_port,dataqueue[x].dst_sp_id,dataqueue[x].dataremaining);
+	}
+	for (int i=0;i<PARKEDQUEUESIZE && parked[i].src_sp_id>=0;++i) {
+		if (parked[i].src_port==port) unloadtransfer(ports,parked[i].dst_port,parked[i].dst_sp_id,parked[i].dataremaining);
+	}
+}
+
+// the bytes on their way to the station at port, its count (see porttable.inflight) and the frames held on its link
+static inline unsigned long long portload(fabric *fab,const int port) {
+	unsigned long long load = fab->ports->inflight[port];
+	if (fab->link) load+=(unsigned long long)linkbacklog(fab->link,port)*MAXFRAMESIZE;
+	return load;
+}
+
+// the port of the member of anycast group g a request from src_port goes to, the reachable member with the
+// least on its way to it (ties go round-robin), the sender itself is passed over
+// while the group is still joining and no member is reachable the request waits on a member's port
+// returns -1 if no member can take it
+static int bindanycast(fabric *fab,const int g,const int src_port) {
+	porttable *ports = fab->ports;
+	anycastgroup *group = &fab->groups->groups[g];
+	int best=-1, absent=-1;
+	unsigned long long bestload=0;
+	for (int i=0;i<group->nummembers;++i) {
+		const int sp_id = group->members[(group->next+i)%group->nummembers];
+		const int port = portlookup(ports,STATIONID(sp_id));
+		if (port==src_port) continue;
+		if (port<0 || ports->nexthop[port]<0) {
+			if (absent<0) absent=sp_id;
+			continue;
+		}
+		const unsigned long long load = portload(fab,port);
+		if (best<0 || load<bestload) {
+			best=port;
+			bestload=load;
 		}
 	}
-	return -1;
+	const unsigned char joining = !fab->numSPprocesses || ports->joined<(unsigned long long)fab->numSPprocesses;
+	if (best<0 && absent>=0 && joining) best=portregister(ports,STATIONID(absent));
+	return best;
 }
 
-// add a request to the queue, takes the queue array and all details of the transaction
-// attempts to add the request to the end of the array
-// if the request is added returns 1
-// if the queue is full returns 0
-static inline unsigned char queuerequest(requestqueuenode *queue,const int src_sp_id,const int dst_sp_id,const unsigned long long reqsize) {
-	if (queue[0].src_sp_id<0) {
-		queue[0].src_sp_id=src_sp_id;
-		queue[0].dst_sp_id=dst_sp_id;
-		queue[0].datasize=reqsize;
-		return 1;
+// the anycast requests in the request queue go to whichever member is least loaded now
+// a request no member can take keeps the port it has
+static void rebindanycast(fabric *fab,requestqueuenode *requestqueue) {
+	porttable *ports = fab->ports;
+	for (int i=0;i<REQUESTQUEUESIZE && requestqueue[i].src_sp_id>=0;++i) {
+		const int g = anycastof(fab->groups,requestqueue[i].dst_sp_id);
+		if (g<0) continue;
+		// the request doesn't count against the member it is on
+		const int port = requestqueue[i].dst_port;
+		if (port>=0) unloadport(ports,port,requestqueue[i].datasize);
+		const int bound = bindanycast(fab,g,requestqueue[i].src_port);
+		requestqueue[i].dst_port=(bound<0)?port:bound;
+		if (requestqueue[i].dst_port>=0) ports->inflight[requestqueue[i].dst_port]+=requestqueue[i].datasize;
 	}
-	else {
-		for (int i=0;i<REQUESTQUEUESIZE;++i) {
-			if (queue[i].src_sp_id<0) {
-				queue[i].src_sp_id=src_sp_id;
-				queue[i].dst_sp_id=dst_sp_id;
-				queue[i].datasize=reqsize;
-				return 1;
-			}
+}
+
+// a granted request to an anycast group is bound to the member on its port, the transfer and its
+// acknowledgement have the member's SP ID from here on
+static void bindgranted(fabric *fab,dataqueuenode *dataqueue,const int index,FILE *outfile) {
+	const int g = anycastof(fab->groups,dataqueue[index].dst_sp_id);
+	if (g<0) return;
+	anycastgroup *group = &fab->groups->groups[g];
+	const int sp_id = SPFROMSTATION(fab->ports->station[dataqueue[index].dst_port]);
+	for (int i=0;i<group->nummembers;++i) {
+		if (group->members[i]!=sp_id) continue;
+		++group->bound[i];
+		group->next=(i+1)%group->nummembers;
+		break;
+	}
+	fprintf(outfile,"CSP: SP %d request to anycast group %d bound to SP %d\n",dataqueue[index].src_sp_id,group->id,sp_id);
+	dataqueue[index].dst_sp_id=sp_id;
+}
+
+// queues the acknowledgement for every request the scheduler moved into the data queue
+// a failed acknowledgement frees the data queue slot again
+// the scheduler only grants destinations with a next hop in the port table
+static void grantrequests(fabric *fab,scheduler *sched,requestqueuenode *requestqueue,dataqueuenode *dataqueue,parkedqueuenode *parked,FILE *outfile) {
+	porttable *ports = fab->ports;
+	unsigned char cspbuffer[INITFRAMESIZE];
+	int moved[DATAQUEUESIZE];
+	if (fab->groups) rebindanycast(fab,requestqueue);
+	const int count = schedule(sched,requestqueue,dataqueue,ports->nexthop,ports->numports,getnow(),moved);
+	for (int i=0;i<count;++i) {
+		const int dataqindex = moved[i];
+		// the request's bytes count as the transfer's from here on (see startxfer)
+		unloadport(ports,dataqueue[dataqindex].dst_port,dataqueue[dataqindex].bytesremaining);
+		bindgranted(fab,dataqueue,dataqindex,outfile);
+		// notify the SP that they can send this data
+		intinbuffer(cspbuffer,dataqueue[dataqindex].src_sp_id);
+		intinbuffer(cspbuffer+4,dataqueue[dataqindex].dst_sp_id);
+		intinbuffer(cspbuffer+8,0);
+		intinbuffer(cspbuffer+12,1);
+		startxfer(ports,dataqueue,dataqindex);
+		if (PROBEACTIVE(csp,queueshift))
+			PROBE5(csp,queueshift,dataqueue[dataqindex].src_sp_id,dataqueue[dataqindex].dst_sp_id,dataqueue[dataqindex].bytesremaining,
+						requestqueuedepth(requestqueue),dataqueuedepth(dataqueue));
+		fprintf(outfile,"CSP: Moved SP %d request from request queue to data queue",dataqueue[dataqindex].src_sp_id);
+		if (queuecontrol(ports,dataqueue[dataqindex].src_port,cspbuffer,sizeof(unsigned char)*INITFRAMESIZE))
+			fprintf(outfile,", sent acknowledgement\n");
+		else {
+			fprintf(outfile,", failed to send acknowledgement\n");
+			unloadport(ports,dataqueue[dataqindex].dst_port,dataqueue[dataqindex].dataremaining);
+			dataqueue[dataqindex].src_sp_id=-1;
 		}
 	}
+}
+
+// parked transfers continue in the free data queue slots, the one parked longest first
+// the sender gets no new acknowledgement, its frames are read again from where they stopped
+static void resumeparked(parkedqueuenode *parked,dataqueuenode *dataqueue,FILE *outfile) {
+	int dataqindex;
+	while (parked[0].src_sp_id>=0 && (dataqindex=getnextdataqindex(dataqueue))>=0) {
+		unparktransfer(parked,dataqueue,dataqindex);
+		fprintf(outfile,"CSP: Resumed SP %d transfer to SP %d in the data queue (%llu bytes left)\n",
+						dataqueue[dataqindex].src_sp_id,dataqueue[dataqindex].dst_sp_id,dataqueue[dataqindex].dataremaining);
+	}
+}
+
+// a transfer that has forwarded its quantum gives up its slot when someone else could use it,
+// a queued request with a reachable destination or another parked transfer
+static inline unsigned char yieldwanted(requestqueuenode *requestqueue,parkedqueuenode *parked,porttable *ports) {
+	if (parked[0].src_sp_id>=0) return 1;
+	for (int i=0;i<REQUESTQUEUESIZE && requestqueue[i].src_sp_id>=0;++i) {
+		if (requestqueue[i].dst_port>=0 && ports->nexthop[requestqueue[i].dst_port]>=0) return 1;
+	}
 	return 0;
 }
 
-// gets the next request from the queue, pops from the front and fills out the *result parameter
-// shifts later elements forward, sets the final element's src_sp_id to -1 (to handle if the queue was full)
-// the return value is put in the result parameter, ***set its sp_id to -1 before calling this function***
-// if the sp_id is set all the member vars are also set, otherwise nothing was in the queue
-static inline void getrequest(requestqueuenode *queue,requestqueuenode *result) {
-	if (queue[0].src_sp_id<0) return;
-	result->src_sp_id = queue[0].src_sp_id;
-	result->dst_sp_id = queue[0].dst_sp_id;
-	result->datasize = queue[0].datasize;
-	for (int i=1;i<REQUESTQUEUESIZE;++i) {
-		queue[i-1].src_sp_id=queue[i].src_sp_id;
-		queue[i-1].dst_sp_id=queue[i].dst_sp_id;
-		queue[i-1].datasize=queue[i].datasize;
-		if (queue[i].src_sp_id<0) return; // rest are -1 already
-	}
-	queue[REQUESTQUEUESIZE-1].src_sp_id=-1;
-}
-
-// shifts an element from the request queue to the data queue
-// if successful, returns the index to the data queue element for notification
-// if no shift can be made returns -1
-static int shiftqueues(requestqueuenode *requestqueue,dataqueuenode *dataqueue,int *sp) {
-	// try to move something from the request queue to the data queue
-	if (requestqueue[0].src_sp_id>=0 && requestqueue[0].dst_sp_id>=0 && getnextdataqindex(dataqueue)>=0) {
-		// either the destination SP is invalid or has not connected yet
-		if (sp[requestqueue[0].dst_sp_id]<0) return -1; // don't cause problems, let's just come back for this
-		// we have an open spot in the data queue
-		requestqueuenode result = { .src_sp_id=-1 };
-		getrequest(requestqueue,&result);
-		// we retrieved a request from the queue
-		if (result.src_sp_id>=0) {
-			// put the request queue into the data queue
-			const int dataqindex = getnextdataqindex(dataqueue);
-			dataqueue[dataqindex].src_sp_id = result.src_sp_id;
-			dataqueue[dataqindex].dst_sp_id = result.dst_sp_id;
-			dataqueue[dataqindex].bytesremaining = result.datasize;
-			return dataqindex;
+// a station left, either its connection closed or its route was withdrawn
+// purges its requests, rejects the local requests that were waiting for it, and frees its port
+static void dropstation(fabric *fab,scheduler *sched,requestqueuenode *requestqueue,dataqueuenode *dataqueue,parkedqueuenode *parked,
+												const int port,FILE *outfile) {
+	porttable *ports = fab->ports;
+	const int sp_id = SPFROMSTATION(ports->station[port]);
+	if (ports->fd[port]>=0) {
+		fprintf(outfile,"CSP: SP %d disconnected\n",sp_id);
+		removelocalsp(fab,port);
+		close(ports->fd[port]);
+	}
+	// anycast requests waiting for it go to another member if they can
+	if (fab->groups) rebindanycast(fab,requestqueue);
+	unloadsource(ports,requestqueue,dataqueue,parked,port);
+	requestqueuenode removed[REQUESTQUEUESIZE];
+	const int count = purgeport(requestqueue,dataqueue,port,removed);
+	releaseparked(parked,port);
+	unsigned char cspbuffer[INITFRAMESIZE];
+	for (int i=0;i<count;++i) {
+		if (ports->fd[removed[i].src_port]<0) continue;
+		intinbuffer(cspbuffer,removed[i].src_sp_id);
+		intinbuffer(cspbuffer+4,removed[i].dst_sp_id);
+		intinbuffer(cspbuffer+8,0);
+		intinbuffer(cspbuffer+12,0);
+		fprintf(outfile,"CSP: Request from SP %d is rejected, SP %d left\n",removed[i].src_sp_id,sp_id);
+		if (!queuecontrol(ports,removed[i].src_port,cspbuffer,sizeof(unsigned char)*INITFRAMESIZE))
+			fprintf(stderr,"CSP: Error sending response to SP ID %d\n",removed[i].src_sp_id);
+	}
+	portderegister(ports,port);
+	grantrequests(fab,sched,requestqueue,dataqueue,parked,outfile);
+}
+
+// the connection of a station on this switch dropped, its session is held for SESSIONHOLD seconds
+// its requests and its data queue slot are released, the progress of its transfer stays in the session
+static void detachstation(fabric *fab,scheduler *sched,requestqueuenode *requestqueue,dataqueuenode *dataqueue,parkedqueuenode *parked,
+													const int port,FILE *outfile) {
+	porttable *ports = fab->ports;
+	fprintf(outfile,"CSP: SP %d connection dropped, holding its session for %d seconds\n",SPFROMSTATION(ports->station[port]),SESSIONHOLD);
+	removelocalsp(fab,port);
+	// a multiplexed connection is closed by dropmux once all of its stations are detached
+	if (ports->mux[port]<0) close(ports->fd[port]);
+	ports->fd[port]=-1;
+	ports->mux[port]=-1;
+	ports->ctrllen[port]=0;
+	ports->nexthop[port]=-1;
+	ports->resumefrom[port]=RESUMENONE;
+	ports->detachedat[port]=getnow();
+	unloadsource(ports,requestqueue,dataqueue,parked,port);
+	releasesource(requestqueue,dataqueue,port);
+	releaseparked(parked,port);
+	grantrequests(fab,sched,requestqueue,dataqueue,parked,outfile);
+}
+
+// a multiplexed connection closed or fell out of step (the stream can't be read past a bad frame)
+// every station on it is detached and holds its session, then the socket is closed
+static void dropmux(fabric *fab,scheduler *sched,requestqueuenode *requestqueue,dataqueuenode *dataqueue,parkedqueuenode *parked,
+										muxconn *mux,const int m,FILE *outfile) {
+	porttable *ports = fab->ports;
+	fprintf(outfile,"CSP: Multiplexed connection of SPs %d to %d dropped\n",mux->first,mux->first+mux->count-1);
+	for (int p=0;p<ports->numports;++p) {
+		if (ports->mux[p]==m) detachstation(fab,sched,requestqueue,dataqueue,parked,p,outfile);
+	}
+	close(mux->fd);
+	mux->fd=-1;
+	mux->head=-1;
+}
+
+// an SP reconnected on fd with the session token it was given
+// a held (or still attached) session is resumed, otherwise the SP joins with a new session
+static void resumestation(fabric *fab,scheduler *sched,requestqueuenode *requestqueue,dataqueuenode *dataqueue,parkedqueuenode *parked,
+													const int fd,const int sp_id,const unsigned long long token,FILE *outfile) {
+	porttable *ports = fab->ports;
+	int port = portlookup(ports,STATIONID(sp_id));
+	const unsigned char resumed = port>=0 && token && ports->session[port]==token;
+	// a station still on a multiplexed connection isn't moved off it, the connection has to drop first
+	if ((!resumed && (!fab->numSPprocesses || (port>=0 && ports->nexthop[port]>=0))) || (resumed && ports->mux[port]>=0)) {
+		fprintf(stderr,"CSP: SP %d can't resume session %llx, closing the connection\n",sp_id,token);
+		close(fd);
+		return;
+	}
+	if (resumed) {
+		// the old connection hasn't been noticed as closed yet, the slot it held is stale
+		if (ports->fd[port]>=0) {
+			close(ports->fd[port]);
+			ports->fd[port]=-1;
+			ports->ctrllen[port]=0;
+			unloadsource(ports,requestqueue,dataqueue,parked,port);
+			releasesource(requestqueue,dataqueue,port);
+			releaseparked(parked,port);
 		}
+		ports->detachedat[port]=0;
+		addlocalsp(fab,sp_id,fd);
+		// the other switches get the state back as well
+		announcestate(fab,port,ports->state[port]);
+		fprintf(outfile,"CSP: SP %d resumed its session, last transfer %d at byte %llu\n",
+						sp_id,ports->xferseq[port],ports->xferoffset[port]);
 	}
-	return -1;
+	else {
+		port=addlocalsp(fab,sp_id,fd);
+		ports->session[port]=newsession(ports->station[port]);
+		fprintf(outfile,"CSP: SP %d joined with a new session\n",sp_id);
+	}
+	if (!sendsession(ports,port)) fprintf(stderr,"CSP: Error sending session to SP %d\n",sp_id);
+	grantrequests(fab,sched,requestqueue,dataqueue,parked,outfile);
+}
+
+// queues the start barrier for the station connected at port
+// returns 0 for failure, 1 for success
+static unsigned char sendbarrier(fabric *fab,const int port) {
+	unsigned char buffer[INITFRAMESIZE];
+	intinbuffer(buffer,SPFROMSTATION(fab->ports->station[port]));
+	intinbuffer(buffer+4,BARRIERID);
+	ullinbuffer(buffer+8,(unsigned long long)fab->numSPprocesses);
+	return queuecontrol(fab->ports,port,buffer,sizeof(unsigned char)*INITFRAMESIZE);
+}
+
+// reads what has arrived of the first frame of a new connection
+// returns 1 when the frame is complete, 0 if more is to come, -1 if the connection closed
+static int readhandshake(handshake *h) {
+	const int ret = read(h->fd,(void*)(h->buffer+h->length),INITFRAMESIZE-h->length);
+	if (ret<0) return (errno==EWOULDBLOCK || errno==EAGAIN || errno==EINTR)?0:-1;
+	if (!ret) return -1;
+	h->length+=ret;
+	return h->length==INITFRAMESIZE;
+}
+
+// an SP joins on connfd, its own socket or a multiplexed connection, the caller checked it isn't connected
+// an SP joining after the start barrier gets the barrier behind its session, returns its port
+static int joinstation(fabric *fab,tracewriter *trace,const int sp_id,const int connfd,const unsigned char started,FILE *outfile) {
+	porttable *ports = fab->ports;
+	const int SP_PORT = portlookup(ports,STATIONID(sp_id));
+	// a new SP process replaces a held session
+	if (SP_PORT>=0 && ports->session[SP_PORT]) {
+		fprintf(outfile,"CSP: SP %d rejoined, its held session is released\n",sp_id);
+		ports->detachedat[SP_PORT]=0;
+		ports->xferseq[SP_PORT]=0;
+		ports->xferoffset[SP_PORT]=0;
+		ports->xfertotal[SP_PORT]=0;
+		ports->state[SP_PORT]=SPACTIVE;
+	}
+	// the port table keeps the socket, the fabric advertises the route
+	const int port = addlocalsp(fab,sp_id,connfd);
+	if (ports->stateseq[port]) announcestate(fab,port,SPACTIVE);
+	ports->session[port]=newsession(ports->station[port]);
+	fprintf(outfile,"CSP: SP %d joined\n",sp_id);
+	tracewrite(trace,TRACEJOIN,sp_id,sp_id,(unsigned long long)fab->numSPprocesses);
+	// the SP waits for its session before anything else
+	if (!sendsession(ports,port)) fprintf(stderr,"CSP: Error sending session to SP %d\n",sp_id);
+	// the group already started without it
+	if (started && !sendbarrier(fab,port)) fprintf(stderr,"CSP: Error sending the start barrier to SP %d\n",sp_id);
+	return port;
+}
+
+// a multiplexed connection for SPs first to first+count-1, none of them may be connected already
+// the connection gets a free entry of *muxes (or a new one) and every SP joins on it
+static void admitmux(fabric *fab,tracewriter *trace,muxconn **muxes,int *nummuxes,const int connfd,const int first,const int count,
+										 const unsigned char started,FILE *outfile) {
+	porttable *ports = fab->ports;
+	for (int i=0;i<count;++i) {
+		if (anycastof(fab->groups,first+i)>=0) {
+			fprintf(stderr,"CSP: SP %d is an anycast group, closing the multiplexed connection of SPs %d to %d\n",first+i,first,first+count-1);
+			close(connfd);
+			return;
+		}
+		const int SP_PORT = portlookup(ports,STATIONID(first+i));
+		if (SP_PORT>=0 && ports->nexthop[SP_PORT]>=0) {
+			fprintf(stderr,"CSP: SP %d is already connected, closing the multiplexed connection of SPs %d to %d\n",first+i,first,first+count-1);
+			close(connfd);
+			return;
+		}
+	}
+	int m=0;
+	while (m<*nummuxes && (*muxes)[m].fd>=0) ++m;
+	if (m==*nummuxes) *muxes=(muxconn*)realloc(*muxes,sizeof(muxconn)*++*nummuxes);
+	muxconn *mux = &(*muxes)[m];
+	mux->fd=connfd;
+	mux->first=first;
+	mux->count=count;
+	mux->head=-1;
+	fprintf(outfile,"CSP: Multiplexed connection of SPs %d to %d joined\n",first,first+count-1);
+	for (int i=0;i<count;++i) {
+		const int port = joinstation(fab,trace,first+i,connfd,started,outfile);
+		ports->mux[port]=m;
+	}
+}
+
+// the first frame of a connection is in, an SP's handshake or resume, a multiplexed connection's,
+// or another switch's trunk hello
+// the socket goes back to blocking, the CSP reads and writes it like every other socket
+static void admit(fabric *fab,scheduler *sched,requestqueuenode *requestqueue,dataqueuenode *dataqueue,parkedqueuenode *parked,tracewriter *trace,
+									muxconn **muxes,int *nummuxes,const int connfd,unsigned char *buffer,const unsigned char started,FILE *outfile) {
+	porttable *ports = fab->ports;
+	fcntl(connfd,F_SETFL,fcntl(connfd,F_GETFL)&~O_NONBLOCK);
+	const int src_sp_id=intfrombuffer(buffer);
+	const int dst_sp_id=intfrombuffer(buffer+4);
+	const int checkgroup=intfrombuffer(buffer+12);
+	// a reconnecting SP presents its session token instead of the group size
+	if (src_sp_id>=0 && dst_sp_id==SESSIONID) {
+		resumestation(fab,sched,requestqueue,dataqueue,parked,connfd,src_sp_id,ullfrombuffer(buffer+8),outfile);
+		return;
+	}
+	// the first handshake or hello tells us how big the group is
+	if (!fab->numSPprocesses && checkgroup>0) fab->numSPprocesses=checkgroup;
+	// another switch linking to us
+	if (src_sp_id==TRUNKID && dst_sp_id==TRUNKHELLO && checkgroup==fab->numSPprocesses) {
+		answertrunk(fab,connfd,intfrombuffer(buffer+8),outfile);
+		return;
+	}
+	// a block of SPs on one connection
+	if (dst_sp_id==MUXID) {
+		const int count = intfrombuffer(buffer+8)&MUXCOUNTMASK;
+		if (src_sp_id<0 || count<1 || count>MAXMUXSPS || src_sp_id>0x7FFFFFFF-count || checkgroup!=fab->numSPprocesses) {
+			fprintf(stderr,"Initial communication for multiplexed connection is faulty, SPs %d (+%d), numSPprocesses %d(=%d?)\n",
+							src_sp_id,count,fab->numSPprocesses,checkgroup);
+			close(connfd);
+			return;
+		}
+		admitmux(fab,trace,muxes,nummuxes,connfd,src_sp_id,count,started,outfile);
+		// requests may have been queued for these SPs before they joined
+		grantrequests(fab,sched,requestqueue,dataqueue,parked,outfile);
+		return;
+	}
+	// validity check, a faulty handshake only loses that connection
+	if (src_sp_id!=dst_sp_id || src_sp_id<0 || checkgroup!=fab->numSPprocesses) {
+		fprintf(stderr,"Initial communication for connection is faulty, SP %d(=%d?), numSPprocesses %d(=%d?)\n",
+						src_sp_id,dst_sp_id,fab->numSPprocesses,checkgroup);
+		close(connfd);
+		return;
+	}
+	if (anycastof(fab->groups,src_sp_id)>=0) {
+		fprintf(stderr,"CSP: SP %d is an anycast group, closing the new connection\n",src_sp_id);
+		close(connfd);
+		return;
+	}
+	const int SP_PORT = portlookup(ports,STATIONID(src_sp_id));
+	if (SP_PORT>=0 && ports->nexthop[SP_PORT]>=0) {
+		fprintf(stderr,"CSP: SP %d is already connected, closing the new connection\n",src_sp_id);
+		close(connfd);
+		return;
+	}
+	joinstation(fab,trace,src_sp_id,connfd,started,outfile);
+	// requests may have been queued for this SP before it joined
+	grantrequests(fab,sched,requestqueue,dataqueue,parked,outfile);
+}
+
+// whether the sender at port is held, its transfer is parked or its receiver's link is backed up
+// its socket isn't read until that is over, for a multiplexed connection only while its frame is at the head
+static unsigned char senderheld(fabric *fab,dataqueuenode *dataqueue,parkedqueuenode *parked,const int port) {
+	for (int i=0;i<PARKEDQUEUESIZE && parked[i].src_sp_id>=0;++i) {
+		if (parked[i].src_port==port) return 1;
+	}
+	if (!fab->link) return 0;
+	for (int x=0;x<DATAQUEUESIZE;++x) {
+		if (dataqueue[x].src_sp_id>=0 && dataqueue[x].src_port==port) return linkbacklog(fab->link,dataqueue[x].dst_port)>=LINKMAXHELD;
+	}
+	return 0;
+}
+
+// finds the station whose frame is at the head of multiplexed connection m, without reading it
+// returns 1 with mux->head set, 0 if no whole header is in yet, -1 if the connection closed or the frame isn't from the block
+static int peekmux(porttable *ports,muxconn *mux,const int m) {
+	unsigned char buffer[INITFRAMESIZE];
+	const ssize_t ret = recv(mux->fd,(void*)buffer,sizeof(unsigned char)*INITFRAMESIZE,MSG_PEEK|MSG_DONTWAIT);
+	if (ret<0) return (errno==EWOULDBLOCK || errno==EAGAIN || errno==EINTR)?0:-1;
+	if (!ret) return -1;
+	if (ret<INITFRAMESIZE) return 0;
+	const int src_sp_id = intfrombuffer(buffer);
+	const int port = src_sp_id<0?-1:portlookup(ports,STATIONID(src_sp_id));
+	if (port<0 || ports->mux[port]!=m) {
+		fprintf(stderr,"CSP: Frame from SP %d on the multiplexed connection of SPs %d to %d\n",src_sp_id,mux->first,mux->first+mux->count-1);
+		return -1;
+	}
+	mux->head=port;
+	return 1;
 }
 
 // takes a port number
@@ -144,12 +580,14 @@ static int getlisteningsocket(unsigned short portnum) {
 	int optval=1;
 	setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,(const void*)&optval,sizeof(int));
 	setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,(const void*)&optval,sizeof(int));
+	// accepted sockets inherit the low water mark
+	setrcvlowat(fd);
 	if (bind(fd,(struct sockaddr*)&addr,sizeof(addr))<0) {
 		fprintf(stderr,"CSP: Unable to bind socket\n");
 		close(fd);
 		return -1;
 	}
-	if ((listen(fd,1))<0) {
+	if ((listen(fd,LISTENBACKLOG))<0) {
 		fprintf(stderr,"CSP: Unable to listen to socket\n");
 		close(fd);
 		return -1;
@@ -157,12 +595,243 @@ static int getlisteningsocket(unsigned short portnum) {
 	return fd;
 }
 
+// the simulation a connection's first frame is for, -1 for a frame no simulation of the daemon takes (a trunk hello)
+static int simulationof(unsigned char *buffer) {
+	const int src_sp_id=intfrombuffer(buffer);
+	const int dst_sp_id=intfrombuffer(buffer+4);
+	if (src_sp_id>=0 && dst_sp_id==SESSIONID) return (int)(ullfrombuffer(buffer+8)>>48);
+	if (src_sp_id>=0 && dst_sp_id==MUXID) return (int)((unsigned int)intfrombuffer(buffer+8)>>16);
+	const int id = intfrombuffer(buffer+8);
+	if (src_sp_id>=0 && src_sp_id==dst_sp_id && id>=0 && id<=MAXSIMULATION) return id;
+	return -1;
+}
+
+// hands connection connfd, whose first frame is in buffer, to the process of its simulation, forking one if there is none
+// returns -1 in the daemon, in a forked process it returns that process's end of the socket to the daemon
+// (every other descriptor of the simulations is closed) and the caller leaves the daemon to run the simulation
+static int handoff(simulation **sims,int *numsims,const int connfd,unsigned char *buffer,FILE *outfile) {
+	const int id = simulationof(buffer);
+	if (id<0) {
+		fprintf(stderr,"CSP: A connection for no simulation, SP %d to %d, closing it\n",intfrombuffer(buffer),intfrombuffer(buffer+4));
+		close(connfd);
+		return -1;
+	}
+	// a simulation that ended as the connection came in doesn't take it, a new one starts
+	for (int tries=0;tries<2;++tries) {
+		int s=0;
+		while (s<*numsims && ((*sims)[s].fd<0 || (*sims)[s].ended || (*sims)[s].id!=id)) ++s;
+		if (s==*numsims) {
+			int pair[2];
+			if (socketpair(AF_UNIX,SOCK_SEQPACKET,0,pair)) {
+				fprintf(stderr,"CSP: Unable to make the socket for simulation %d\n",id);
+				break;
+			}
+			fflush(outfile);
+			const pid_t pid = fork();
+			if (pid<0) {
+				fprintf(stderr,"CSP: Unable to fork simulation %d\n",id);
+				close(pair[0]);
+				close(pair[1]);
+				break;
+			}
+			if (!pid) {
+				close(pair[0]);
+				for (int i=0;i<*numsims;++i) {
+					if ((*sims)[i].fd>=0) close((*sims)[i].fd);
+				}
+				close(connfd);
+				simulationid=id;
+				return pair[1];
+			}
+			close(pair[1]);
+			*sims=(simulation*)realloc(*sims,sizeof(simulation)*++*numsims);
+			(*sims)[s].id=id;
+			(*sims)[s].pid=pid;
+			(*sims)[s].fd=pair[0];
+			(*sims)[s].ended=0;
+			fprintf(outfile,"CSP: Simulation %d started (process %d)\n",id,(int)pid);
+		}
+		if (sendconnection((*sims)[s].fd,connfd,(void*)buffer,sizeof(unsigned char)*INITFRAMESIZE)) {
+			close(connfd);
+			return -1;
+		}
+		// it is ending, the connections it hands back on the socket are taken from there (see takeback)
+		(*sims)[s].ended=1;
+	}
+	fprintf(stderr,"CSP: Unable to hand a connection to simulation %d, closing it\n",id);
+	close(connfd);
+	return -1;
+}
+
+// takes the connections simulation s hands back as it ends and hands them off again, they start the next simulation
+// its socket is closed once the process closed its end, returns as handoff does
+static int takeback(simulation **sims,int *numsims,const int s,FILE *outfile) {
+	unsigned char buffer[INITFRAMESIZE];
+	int connfd;
+	(*sims)[s].ended=1;
+	while ((connfd=rcvconnection((*sims)[s].fd,(void*)buffer,sizeof(unsigned char)*INITFRAMESIZE))>=0) {
+		const int ctlfd = handoff(sims,numsims,connfd,buffer,outfile);
+		if (ctlfd>=0) return ctlfd;
+	}
+	if (connfd<-1) {
+		close((*sims)[s].fd);
+		(*sims)[s].fd=-1;
+	}
+	return -1;
+}
+
+// the daemon, it accepts every connection and reads its first frame, then hands it to the process of its simulation
+// a simulation's process is forked for its first connection and runs it as a CSP of its own
+// the daemon keeps listening until SIGINT or SIGTERM, returns -1 then (or if it fails)
+// returns in a forked process with the descriptor it gets its connections on, listenfd is closed there
+static int rundaemon(const int listenfd,FILE *outfile) {
+	simulation *sims=NULL;
+	int numsims=0;
+	handshake *handshakes = (handshake*)malloc(sizeof(handshake)*MAXHANDSHAKES);
+	int numhandshakes=0;
+	int ctlfd=-1;
+	fprintf(outfile,"CSP: Daemon listening, each simulation runs in a process of its own\n");
+	while (!stopping && ctlfd<0) {
+		fflush(outfile);
+		// the simulations that ended
+		// one is forgotten once its socket is closed as well, the connections it handed back are all taken then
+		pid_t pid;
+		while ((pid=waitpid(-1,NULL,WNOHANG))>0) {
+			for (int s=0;s<numsims;++s) {
+				if (sims[s].pid!=pid) continue;
+				fprintf(outfile,"CSP: Simulation %d ended (process %d)\n",sims[s].id,(int)pid);
+				sims[s].pid=0;
+				sims[s].ended=1;
+				break;
+			}
+		}
+		for (int s=0;s<numsims;) {
+			if (!sims[s].pid && sims[s].fd<0) sims[s]=sims[--numsims];
+			else ++s;
+		}
+		fd_set fdlist;
+		FD_ZERO(&fdlist);
+		int maxfd=listenfd;
+		FD_SET(listenfd,&fdlist);
+		for (int i=0;i<numhandshakes;++i) {
+			if (handshakes[i].fd>maxfd) maxfd=handshakes[i].fd;
+			FD_SET(handshakes[i].fd,&fdlist);
+		}
+		// a simulation's process only writes to the daemon as it ends, to hand back the connections it didn't take,
+		// its socket is readable once the simulation is over
+		for (int s=0;s<numsims;++s) {
+			if (sims[s].fd<0) continue;
+			if (sims[s].fd>maxfd) maxfd=sims[s].fd;
+			FD_SET(sims[s].fd,&fdlist);
+		}
+		struct timeval tv = { .tv_sec=1, .tv_usec=0 };
+		if (select(maxfd+1,&fdlist,NULL,NULL,&tv)<0) {
+			if (errno==EINTR) continue;
+			fprintf(stderr,"CSP: Daemon select failed\n");
+			break;
+		}
+		for (int s=0;ctlfd<0 && s<numsims;++s) {
+			if (sims[s].fd>=0 && FD_ISSET(sims[s].fd,&fdlist)) ctlfd=takeback(&sims,&numsims,s,outfile);
+		}
+		// the first frames that are in already go right away, as in a simulation
+		if (FD_ISSET(listenfd,&fdlist)) {
+			int connfd;
+			while (ctlfd<0 && numhandshakes<MAXHANDSHAKES && (connfd=accept4(listenfd,NULL,NULL,SOCK_NONBLOCK))>=0) {
+				handshake *h = &handshakes[numhandshakes];
+				h->fd=connfd;
+				h->length=0;
+				h->since=getnow();
+				const int ret = readhandshake(h);
+				if (ret<0) close(connfd);
+				else if (ret>0) ctlfd=handoff(&sims,&numsims,connfd,h->buffer,outfile);
+				else ++numhandshakes;
+			}
+		}
+		for (int i=0;ctlfd<0 && i<numhandshakes;) {
+			handshake *h = &handshakes[i];
+			int ret=0;
+			if (FD_ISSET(h->fd,&fdlist)) ret=readhandshake(h);
+			else if (getnow()-h->since>HANDSHAKETIMEOUT) ret=-1;
+			if (!ret) {
+				++i;
+				continue;
+			}
+			if (ret<0) close(h->fd);
+			else ctlfd=handoff(&sims,&numsims,h->fd,h->buffer,outfile);
+			*h=handshakes[--numhandshakes];
+		}
+	}
+	// a simulation's process keeps none of the daemon's connections
+	for (int i=0;i<numhandshakes;++i) close(handshakes[i].fd);
+	free(handshakes);
+	free(sims);
+	if (ctlfd>=0) {
+		close(listenfd);
+		return ctlfd;
+	}
+	fprintf(outfile,"CSP: Daemon stopped, %d simulations still running\n",numsims);
+	return -1;
+}
+
+// SIGINT and SIGTERM stop the daemon
+static void stopdaemon(int sig) {
+	(void)sig;
+	stopping=1;
+}
+
+// SIGUSR1 with a value (sigqueue, or kill -s USR1 -q N) sets the mirroring rate to it, 0 turns mirroring off
+// SIGUSR1 without one mirrors twice as often, SIGUSR2 half as often
+static void signalmirror(int sig,siginfo_t *info,void *context) {
+	(void)context;
+	if (sig==SIGUSR2) mirrorsignal=MIRRORSLOWER;
+	else if (info && info->si_code==SI_QUEUE && info->si_value.sival_int>=0) mirrorsignal=info->si_value.sival_int;
+	else mirrorsignal=MIRRORFASTER;
+}
+
+// applies the rate change a signal asked for, the countdown starts over at the new rate
+// halving and doubling leave mirroring that is off as it is
+static void changemirror(fabric *fab,FILE *outfile) {
+	const int change = mirrorsignal;
+	mirrorsignal=MIRRORNONE;
+	mirror *m = fab->mirror;
+	if (change==MIRRORFASTER) {
+		if (m->rate>1) m->rate/=2;
+	}
+	else if (change==MIRRORSLOWER) {
+		if (m->rate && m->rate<=UINT_MAX/2) m->rate*=2;
+	}
+	else m->rate=(unsigned int)change;
+	fab->sampledown=mirrorcountdown(m->rate);
+	if (m->rate) fprintf(outfile,"CSP: Mirroring 1 in %u forwarded data frames\n",m->rate);
+	else fprintf(outfile,"CSP: Mirroring off\n");
+}
+
 // print the command line parameters for invalid command line arguments
 static inline void printusage(char *prog) {
 	fprintf(stderr,"Fast Ethernet CSP Process\n");
-	fprintf(stderr,"Usage: %s -p [port] -out=[filename]\n",prog);
+	fprintf(stderr,"Usage: %s -p [port] -out=[filename] -sched=[",prog);
+	printschedulers(stderr);
+	fprintf(stderr,"]\n");
 	fprintf(stderr,"If outfile is not specified, output is to screen\n");
+	fprintf(stderr,"The scheduler picks which queued requests get data queue slots, the default is fifo\n");
+	fprintf(stderr,"Switch fabric: -id=[switch id] -trunk=[ip:port] (repeat -trunk for each linked switch)\n");
+	fprintf(stderr,"Trunks are dialed once the group size is known, link each pair of switches from one end only\n");
+	fprintf(stderr,"Record every join, request, wait, and quit to a trace file for fastreplay: -trace=[filename]\n");
+	fprintf(stderr,"Low latency mode: -busypoll spins instead of sleeping in select, -busypoll=[core] also pins the CSP to that core\n");
+	fprintf(stderr,"Check the CRC32C trailer of data frames from SPs started with fastcl -crc: -crc\n");
+	fprintf(stderr,"Emulate the SP links: -bandwidth=[Mbps] per direction of each port, -latency=[us] one way propagation delay\n");
+	fprintf(stderr,"A transfer yields its data queue slot to waiting requests every -quantum=[frames] (default %d, 0 keeps it to the end)\n",TRANSFERQUANTUM);
 	fprintf(stderr,"This performs one simulation with a group of SP processes\n");
+	fprintf(stderr,"SPs may join late or leave early, the simulation ends when the whole group has joined and every SP still present is done\n");
+	fprintf(stderr,"A block of SPs may share one connection (fastreplay -mux), each SP keeps its own port\n");
+	fprintf(stderr,"Anycast group: -anycast=[id]:[SP IDs, a-b for a range] (repeat for each group), a request to the id goes to\n");
+	fprintf(stderr,"the member with the least data on its way to it, the acknowledgement names the member\n");
+	fprintf(stderr,"Sampled mirroring: -mirror=[N] copies 1 in N forwarded data frames to -monitor=[SP ID] and/or -capture=[pcap file],\n");
+	fprintf(stderr,"-snaplen=[bytes] of each (default %d, the header included), SIGUSR1 halves N (sigqueue sets it), SIGUSR2 doubles it\n",MIRRORSNAPLEN);
+	fprintf(stderr,"Forwarding rules: -rules=[filename], a rule a line \"src dst size class action\" (* for any), class is single, bulk,\n");
+	fprintf(stderr,"or resume, action is forward, drop, rewrite=[SP ID], limit=[bytes a second], or mirror, the first rule that matches applies\n");
+	fprintf(stderr,"Daemon mode: -daemon[=idle seconds] keeps listening and runs each simulation (fastcl -sim) in a process of its own,\n");
+	fprintf(stderr,"simulation N logs to [filename].N, one without a frame for the idle seconds (default %d) is torn down\n",DAEMONIDLE);
 }
 
 // the simulation driver
@@ -170,11 +839,67 @@ int main(int argc, char** argv) {
 	// first set the couple possible parameters
 	int port = -1;
 	char *outfilename = NULL;
+	char *schedname = "fifo";
+	// the switch fabric, this switch's id and the switches we dial
+	int switchid = 0;
+	char *trunkaddrs[MAXTRUNKS];
+	int numtrunkaddrs = 0;
+	// the traffic trace, recorded if a trace file is given
+	char *tracefilename = NULL;
+	// busy polling instead of a blocking select, and the core to pin to (-1 for none)
+	unsigned char busypoll = 0;
+	int pincore = -1;
+	// check the checksum trailer of data frames from local SPs
+	unsigned char crccheck = 0;
+	// the emulated links, off unless one of these is set
+	double mbps = 0, latencyus = 0;
+	// data frames a transfer forwards before it yields its slot, zero to keep it until the transfer is done
+	int quantum = TRANSFERQUANTUM;
+	// the anycast groups, NULL without any
+	anycast *groups = NULL;
+	// the sampled mirror, the rate (-1 for the default once there is somewhere to copy to), the monitor SP, and capture file
+	int mirrorrate = -1;
+	int snaplen = MIRRORSNAPLEN;
+	int monitor = -1;
+	char *capturefilename = NULL;
+	// the forwarding rules, read from the rule file if one is given
+	char *rulesfilename = NULL;
+	ruletable *rules = NULL;
+	// run as a daemon hosting simulations, and the seconds a simulation may go without a frame (0 for a plain CSP)
+	int idle = 0;
 	for (int i=1;i<argc;++i) {
 		if (argv[i][0]=='-') {
 			char *nextch = strchr(argv[i],'=');
 			if (nextch) {
 				if (argv[i][1]=='p') port = atoi(nextch+1);
+				else if (strncmp(argv[i],"-sched=",7)==0) schedname=nextch+1;
+				else if (strncmp(argv[i],"-id=",4)==0) switchid=atoi(nextch+1);
+				else if (strncmp(argv[i],"-trace=",7)==0) tracefilename=nextch+1;
+				else if (strncmp(argv[i],"-busypoll=",10)==0) {
+					busypoll=1;
+					pincore=atoi(nextch+1);
+				}
+				else if (strncmp(argv[i],"-bandwidth=",11)==0) mbps=atof(nextch+1);
+				else if (strncmp(argv[i],"-latency=",9)==0) latencyus=atof(nextch+1);
+				else if (strncmp(argv[i],"-quantum=",9)==0) quantum=atoi(nextch+1);
+				else if (strncmp(argv[i],"-mirror=",8)==0) mirrorrate=(atoi(nextch+1)>0)?atoi(nextch+1):0;
+				else if (strncmp(argv[i],"-monitor=",9)==0) monitor=atoi(nextch+1);
+				else if (strncmp(argv[i],"-capture=",9)==0) capturefilename=nextch+1;
+				else if (strncmp(argv[i],"-snaplen=",9)==0) snaplen=atoi(nextch+1);
+				else if (strncmp(argv[i],"-rules=",7)==0) rulesfilename=nextch+1;
+				else if (strncmp(argv[i],"-daemon=",8)==0) idle=atoi(nextch+1)>0?atoi(nextch+1):DAEMONIDLE;
+				else if (strncmp(argv[i],"-anycast=",9)==0) {
+					if (!groups) groups=newanycast();
+					if (addanycast(groups,nextch+1)<0) {
+						fprintf(stderr,"CSP: Bad anycast group \"%s\"\n",nextch+1);
+						freeanycast(groups);
+						printusage(argv[0]);
+						return 0;
+					}
+				}
+				else if (strncmp(argv[i],"-trunk=",7)==0) {
+					if (numtrunkaddrs<MAXTRUNKS) trunkaddrs[numtrunkaddrs++]=nextch+1;
+				}
 				else outfilename=nextch+1;
 			}
 			else if (strcmp(argv[i],"-p")==0) {
@@ -185,242 +910,478 @@ int main(int argc, char** argv) {
 				if (++i==argc) break;
 				outfilename = argv[i];
 			}
+			else if (strcmp(argv[i],"-busypoll")==0) busypoll=1;
+			else if (strcmp(argv[i],"-crc")==0) crccheck=1;
+			else if (strcmp(argv[i],"-daemon")==0) idle=DAEMONIDLE;
 		}
 	}
 	if (port<0) {
+		freeanycast(groups);
+		printusage(argv[0]);
+		return 0;
+	}
+	// the copies need somewhere to go
+	if (mirrorrate>0 && monitor<0 && !capturefilename) {
+		fprintf(stderr,"CSP: Mirroring needs a -monitor SP or a -capture file\n");
+		freeanycast(groups);
+		printusage(argv[0]);
+		return 0;
+	}
+	// the rules are read once, a daemon's simulations all forward by them
+	if (rulesfilename && !(rules=loadrules(rulesfilename,stderr))) {
+		freeanycast(groups);
+		printusage(argv[0]);
+		return 0;
+	}
+	if (rules && rules->mirrors && monitor<0 && !capturefilename) {
+		fprintf(stderr,"CSP: A rule mirrors, that needs a -monitor SP or a -capture file\n");
+		freeruletable(rules);
+		freeanycast(groups);
+		printusage(argv[0]);
+		return 0;
+	}
+	// check the scheduler name before we go any further
+	scheduler *sched = newscheduler(schedname);
+	if (!sched) {
+		fprintf(stderr,"CSP: Unknown scheduler \"%s\"\n",schedname);
+		freeanycast(groups);
+		freeruletable(rules);
 		printusage(argv[0]);
 		return 0;
 	}
+	// the fabric is one simulation, a daemon's simulations don't link to other switches
+	if (idle && numtrunkaddrs) {
+		fprintf(stderr,"CSP: A daemon doesn't link to other switches, ignoring -trunk\n");
+		numtrunkaddrs=0;
+	}
 	// set the output file to either a log file or stdout
 	FILE *outfile=NULL;
 	if (outfilename) outfile = fopen(outfilename,"w");
 	if (!outfile) outfile=stdout;
 
+	// a station that goes away shows up as a failed send, not a signal
+	signal(SIGPIPE,SIG_IGN);
+
 	// get our socket
 	int fd = getlisteningsocket((unsigned short)port);
 	if (fd<0) {
 		fclose(outfile);
+		freescheduler(sched);
+		freeanycast(groups);
+		freeruletable(rules);
 		// errors were printed in getlisteningsocket function
 		return 0;
 	}
 
-	// explicitly accept the first connection
-	// the first connection will tell us how big the group is
-	// this is used for allocation and loop preparation
-	int connfd=-1;
-	while (connfd<0) {
-		connfd = accept(fd,NULL,NULL);
-		if (connfd<0) {
-			const int errnumber = errno;
-			if (connfd && (errnumber == EWOULDBLOCK || errnumber == EAGAIN)) {
-				sleep(1);
-				continue;
-			}
-			fprintf(stderr,"Error accepting first connection\n");
+	// the mirroring rate changes while the CSP runs, a daemon's simulations inherit the handlers
+	if (monitor>=0 || capturefilename) {
+		struct sigaction action;
+		memset(&action,0,sizeof(action));
+		action.sa_sigaction=signalmirror;
+		action.sa_flags=SA_SIGINFO|SA_RESTART;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGUSR1,&action,NULL);
+		sigaction(SIGUSR2,&action,NULL);
+	}
+
+	// a daemon listens here for good, each simulation continues below in a process of its own
+	// with the socket its connections come in on in place of the listening socket, and its own log and trace
+	if (idle) {
+		signal(SIGINT,stopdaemon);
+		signal(SIGTERM,stopdaemon);
+		if ((fd=rundaemon(fd,outfile))<0) {
 			fclose(outfile);
-			close(fd);
+			freescheduler(sched);
+			freeanycast(groups);
+			freeruletable(rules);
 			return 0;
 		}
+		signal(SIGINT,SIG_DFL);
+		signal(SIGTERM,SIG_DFL);
+		if (outfilename) {
+			fclose(outfile);
+			char *simfilename = (char*)malloc(sizeof(char)*(strlen(outfilename)+8)); // allows 7 chars for the simulation
+			sprintf(simfilename,"%s.%d",outfilename,simulationid);
+			if (!(outfile=fopen(simfilename,"w"))) outfile=stdout;
+			free(simfilename);
+		}
+		fprintf(outfile,"CSP: Simulation %d\n",simulationid);
+		if (tracefilename) {
+			char *simtracename = (char*)malloc(sizeof(char)*(strlen(tracefilename)+8));
+			sprintf(simtracename,"%s.%d",tracefilename,simulationid);
+			tracefilename=simtracename;
+		}
+		if (capturefilename) {
+			char *simcapturename = (char*)malloc(sizeof(char)*(strlen(capturefilename)+8));
+			sprintf(simcapturename,"%s.%d",capturefilename,simulationid);
+			capturefilename=simcapturename;
+		}
 	}
 
+	tracewriter *trace = NULL;
+	if (tracefilename && !(trace=newtracewriter(tracefilename)))
+		fprintf(stderr,"CSP: Unable to write the trace file %s, not recording\n",tracefilename);
+	mirror *mirroring = NULL;
+	if ((monitor>=0 || capturefilename) && !(mirroring=newmirror((mirrorrate<0)?MIRRORRATE:(unsigned int)mirrorrate,snaplen,monitor,capturefilename)))
+		fprintf(stderr,"CSP: Unable to write the capture file %s, not mirroring\n",capturefilename);
+
+	// the CPU and latency report is kept in both modes
+	busypoller *poller = newbusypoller(busypoll,pincore);
+	// accepted sockets inherit the options, a daemon's simulation sets them on each connection it is handed
+	if (!idle && !setpolloptions(poller,fd)) fprintf(stderr,"CSP: The kernel refused SO_BUSY_POLL (it needs CAP_NET_ADMIN), spinning without it\n");
+	if (crccheck) fprintf(outfile,"CSP: Checking data frame checksums (%s CRC32C)\n",crc32cname());
+
 	// this is the CSP input buffer
 	unsigned char cspbuffer[MAXFRAMESIZE];
 
-	// receive the first communication from the first SP
-	if (!rcvbuffer(connfd,(void*)cspbuffer,INITFRAMESIZE)) {
-		fprintf(stderr,"Error receiving first frame\n");
-		fclose(outfile);
-		close(fd);
-		return 0;
-	}
+	// every station the switch knows about has a port, local SPs and SPs behind trunks
+	// the port table grows as stations join, SP IDs don't have to be below the group size
+	porttable *ports = newporttable();
 
-	// extract the values, do what checking we can
-	int src_sp_id = intfrombuffer(cspbuffer);
-	int dst_sp_id = intfrombuffer(cspbuffer+4);
-	if (src_sp_id!=dst_sp_id) {
-		fprintf(stderr,"Expected %d and %d to match in initial communication\n",src_sp_id,dst_sp_id);
-		fclose(outfile);
-		close(connfd);
-		close(fd);
-		return 0;
+	// every CSP is a switch fabric, on its own it is a fabric with no trunks
+	// the group size is learned from the first SP handshake or trunk hello
+	fabric *fab = newfabric(switchid,ports);
+	fab->groups=groups;
+	fab->mirror=mirroring;
+	if (mirroring) {
+		fab->sampledown=mirrorcountdown(mirroring->rate);
+		if (mirroring->rate) fprintf(outfile,"CSP: Mirroring 1 in %u forwarded data frames (%d bytes of each)",mirroring->rate,mirroring->snaplen);
+		else fprintf(outfile,"CSP: Mirroring no sampled frames (%d bytes of each copy)",mirroring->snaplen);
+		if (mirroring->monitor>=0) fprintf(outfile," to monitor SP %d",mirroring->monitor);
+		if (mirroring->capture) fprintf(outfile,"%s to %s",(mirroring->monitor>=0)?" and":"",capturefilename);
+		fprintf(outfile,"\n");
 	}
-	int numSPprocesses = intfrombuffer(cspbuffer+12);
-	if (src_sp_id < 0 || src_sp_id >= numSPprocesses || numSPprocesses < 1) {
-		fprintf(stderr,"Initial communication is faulty: SP ID (%d) numSPprocesses (%d)\n",src_sp_id,numSPprocesses);
-		fclose(outfile);
-		close(connfd);
-		close(fd);
-		return 0;
+	unsigned char dialed=0;
+	if (mbps>0 || latencyus>0) {
+		fab->link=newlinkemu(mbps,latencyus,getnow());
+		fprintf(outfile,"CSP: Emulating links of ");
+		if (mbps>0) fprintf(outfile,"%.1f Mbps",mbps);
+		else fprintf(outfile,"unlimited bandwidth");
+		fprintf(outfile," with %.1f us latency\n",latencyus);
 	}
 
 	// setup the queue structures
 	requestqueuenode *requestqueue = (requestqueuenode*)malloc(sizeof(requestqueuenode)*REQUESTQUEUESIZE);
 	dataqueuenode *dataqueue = (dataqueuenode*)malloc(sizeof(dataqueuenode)*DATAQUEUESIZE);
+	parkedqueuenode *parked = (parkedqueuenode*)malloc(sizeof(parkedqueuenode)*PARKEDQUEUESIZE);
+	// transfers that yielded their slot, and the times they did
+	unsigned long long yields=0;
 
 	// -1 src_sp_id is used as the empty flag for these
-	for (int i=0;i<DATAQUEUESIZE || i<REQUESTQUEUESIZE;++i) {
+	for (int i=0;i<DATAQUEUESIZE || i<REQUESTQUEUESIZE || i<PARKEDQUEUESIZE;++i) {
 		if (i<DATAQUEUESIZE) dataqueue[i].src_sp_id=-1;
 		if (i<REQUESTQUEUESIZE) requestqueue[i].src_sp_id=-1;
-	}
-
-	// create the sp fd array, set the fd for the connection we had and the others to negative 1
-	// we hold the connected file descriptors here
-	int *sp = (int*)malloc(sizeof(int)*numSPprocesses);
-
-
-	// create the waiting array, SP processes will notify if they are waiting on data
-	// we check the count of these to try to avoid deadlocks when other SPs notify that they are done
-	int *waitsp = (int*)malloc(sizeof(int)*numSPprocesses);
-	for (int i=0;i<numSPprocesses;++i) {
-		if (i==src_sp_id) sp[i]=connfd; // this was our first connection
-		else sp[i]=-1; // these aren't connected yet
-		waitsp[i]=0; // no one is waiting for packets
+		if (i<PARKEDQUEUESIZE) parked[i].src_sp_id=-1;
 	}
 
 	// loop control vars
-	// done counter, count number of SP processes that have notified 'ready for quit'
-	int doneSP = 0;
-	// connections needed, remaining number of connections we are expecting
-	int connectionsneeded = numSPprocesses-1;
+	int connfd=-1;
+	int src_sp_id=-1, dst_sp_id=-1;
 	// a round-robin style iterator
 	// this iterator is used to find the next fd from the fd set after select
-	// increments between 0 and numSPprocesses independent of each single loop iteration
+	// increments over the port indices independent of each single loop iteration
 	int roundrobin=0;
+	// connections that haven't sent their first frame yet
+	handshake *handshakes = (handshake*)malloc(sizeof(handshake)*MAXHANDSHAKES);
+	int numhandshakes=0;
+	// connections carrying a block of SPs each
+	muxconn *muxes=NULL;
+	int nummuxes=0;
+	// set once the whole group has joined and the start barrier went out
+	unsigned char started=0;
+	// the last time a descriptor was ready, a simulation of the daemon ends after idle seconds without one
+	double lastready=getnow();
 
 	// all data structures are ready for work, let's get to it
 	while (1) { // we will break after a final unsuccessful select after everyone has said they are done
+		// now that we know the group size link to the other switches
+		if (!dialed && fab->numSPprocesses) {
+			dialed=1;
+			for (int i=0;i<numtrunkaddrs;++i) {
+				dialtrunk(fab,trunkaddrs[i],outfile);
+			}
+		}
+		// the whole group is here, every SP starts now
+		if (!started && fab->numSPprocesses && ports->joined>=(unsigned long long)fab->numSPprocesses) {
+			started=1;
+			int barriers=0;
+			for (int p=0;p<ports->numports;++p) {
+				if (ports->fd[p]<0) continue;
+				if (!sendbarrier(fab,p)) fprintf(stderr,"CSP: Error sending the start barrier to SP %d\n",SPFROMSTATION(ports->station[p]));
+				else ++barriers;
+			}
+			fprintf(outfile,"CSP: All %d stations present, sent the start barrier to %d local SPs\n",fab->numSPprocesses,barriers);
+		}
+		// a signal asked for another mirroring rate
+		if (mirrorsignal!=MIRRORNONE && fab->mirror) changemirror(fab,outfile);
+		// a slot freed on the way here (a station left, an acknowledgement failed) goes to a parked transfer
+		resumeparked(parked,dataqueue,outfile);
+		// the control frames queued by the last iteration go out, one write per SP
+		if (flushcontrols(ports)) fprintf(stderr,"CSP: Error flushing control frames\n");
 		// initialize the descriptor list for select
 		fd_set fdlist;
 		FD_ZERO(&fdlist);
-		// if we need connections add fd to the list
-		if (connectionsneeded) {
-			connfd=fd; // connfd tracks the largest descriptor value for now
-			FD_SET(fd,&fdlist);
+		// the switch always listens, SPs may join late and other switches may link at any time
+		// (a simulation of the daemon gets its connections from the daemon, fd is -1 if the daemon went away)
+		connfd=fd; // connfd tracks the largest descriptor value for now
+		if (fd>=0) FD_SET(fd,&fdlist);
+		// connections still sending their first frame
+		for (int i=0;i<numhandshakes;++i) {
+			if (handshakes[i].fd>connfd) connfd=handshakes[i].fd;
+			FD_SET(handshakes[i].fd,&fdlist);
+		}
+		// the trunks to other switches
+		for (int t=0;t<fab->numtrunks;++t) {
+			if (fab->trunkfd[t]<0) continue;
+			if (fab->trunkfd[t]>connfd) connfd=fab->trunkfd[t];
+			FD_SET(fab->trunkfd[t],&fdlist);
 		}
 		// let's add any connected SP sockets to the fd set
-		for (int i=0;i<numSPprocesses;++i) {
-			if (sp[i]<0) continue; // nope, not that one
-			if (sp[i]>connfd) connfd=sp[i]; // this one is larger
-			FD_SET(sp[i],&fdlist); // add the descriptor
+		for (int p=0;p<ports->numports;++p) {
+			if (ports->fd[p]<0) continue; // nope, not that one
+			if (ports->fd[p]>connfd) connfd=ports->fd[p]; // this one is larger
+			FD_SET(ports->fd[p],&fdlist); // add the descriptor
+		}
+		// a parked transfer's sender isn't read until the transfer has a slot again
+		for (int i=0;i<PARKEDQUEUESIZE && parked[i].src_sp_id>=0;++i) {
+			if (ports->fd[parked[i].src_port]>=0 && ports->mux[parked[i].src_port]<0) FD_CLR(ports->fd[parked[i].src_port],&fdlist);
+		}
+		// a sender whose receiver's link is backed up isn't read until the link drains
+		if (fab->link) {
+			for (int x=0;x<DATAQUEUESIZE;++x) {
+				if (dataqueue[x].src_sp_id<0 || linkbacklog(fab->link,dataqueue[x].dst_port)<LINKMAXHELD) continue;
+				if (ports->fd[dataqueue[x].src_port]>=0 && ports->mux[dataqueue[x].src_port]<0) FD_CLR(ports->fd[dataqueue[x].src_port],&fdlist);
+			}
+		}
+		// a multiplexed connection is held while a held sender's frame is at its head
+		for (int m=0;m<nummuxes;++m) {
+			if (muxes[m].fd>=0 && muxes[m].head>=0 && senderheld(fab,dataqueue,parked,muxes[m].head)) FD_CLR(muxes[m].fd,&fdlist);
+		}
+		// wait up to 2 seconds and select one of these descriptors, or just check them when busy polling
+		// held frames wake the loop when the first of them is due
+		struct timeval tv = polltimeout(poller);
+		const double linkwait = fab->link?linknext(fab->link,getnow()):-1;
+		if (linkwait>=0 && linkwait<tv.tv_sec+tv.tv_usec/1e6) {
+			tv.tv_sec=(long)linkwait;
+			tv.tv_usec=(long)((linkwait-tv.tv_sec)*1e6);
 		}
-		// wait up to 2 seconds and select one of these descriptors
-		struct timeval tv = { .tv_sec=2, .tv_usec=0 };
 		connfd = select(connfd+1,&fdlist,NULL,NULL,&tv);
+		releaseframes(fab,getnow(),outfile);
+		// nothing ready yet, check again (after a back-off once the spinning is over)
+		if (poller->enabled && !pollready(poller,connfd>0)) continue;
 		// zero descriptors ready or an error
+		// frames still held on the links are data in flight, the SPs aren't idle until they arrive
+		if (connfd<1 && fab->link && fab->link->pending) continue;
 		if (connfd<1) {
-			// they all said they were done already, let's quit
-			if (doneSP==numSPprocesses) break;
-			// make sure at least one of the SPs is not waiting
-			int waitingcount=0;
-			for (int i=0;i<numSPprocesses;++i) {
-				if (waitsp[i]) ++waitingcount;
+			// count the stations that are still reachable and their states
+			// a station holding its session is still a member
+			int members=0, waitingcount=0, doneSP=0;
+			const double now = getnow();
+			if (idle && now-lastready>idle) {
+				fprintf(outfile,"CSP: No frames for %d seconds, tearing the simulation down\n",idle);
+				break;
 			}
+			for (int p=0;p<ports->numports;++p) {
+				if (ports->detachedat[p]>0 && now-ports->detachedat[p]>SESSIONHOLD) {
+					fprintf(outfile,"CSP: SP %d session expired\n",SPFROMSTATION(ports->station[p]));
+					dropstation(fab,sched,requestqueue,dataqueue,parked,p,outfile);
+					continue;
+				}
+				if (ports->nexthop[p]<0 && ports->detachedat[p]<=0) continue;
+				++members;
+				if (ports->state[p]==SPWAITING) ++waitingcount;
+				else if (ports->state[p]==SPDONE) ++doneSP;
+			}
+			// the whole group joined and everyone still here said they were done, let's quit
+			if (fab->numSPprocesses && ports->joined>=(unsigned long long)fab->numSPprocesses && doneSP==members) break;
 			// all of the SP processes are done or waiting, this won't work
-			if (waitingcount+doneSP==numSPprocesses) {
+			if (members && waitingcount+doneSP==members) {
 				// set the final frame section to non-zero, (zero is for quit, non-zero is for wake up)
 				ullinbuffer(cspbuffer+8,(unsigned long long)1);
 				// notify every waiting SP process to stop waiting
-				for (int i=0;i<numSPprocesses;++i) {
-					if (!waitsp[i]) continue;
+				// waiting SPs on other switches are woken by their own switch
+				for (int p=0;p<ports->numports;++p) {
+					if (ports->state[p]!=SPWAITING || ports->fd[p]<0) continue;
 					// they almost missed the bus
-					waitsp[i]=0;
-					intinbuffer(cspbuffer,i);
-					intinbuffer(cspbuffer+4,i);
-					if (!sendbuffer(sp[i],(void*)cspbuffer,sizeof(unsigned char)*INITFRAMESIZE))
-						fprintf(outfile,"CSP: Error sending SP %d notification to stop waiting\n",i);
+					announcestate(fab,p,SPACTIVE);
+					const int SP_ID = SPFROMSTATION(ports->station[p]);
+					intinbuffer(cspbuffer,SP_ID);
+					intinbuffer(cspbuffer+4,SP_ID);
+					PROBE1(csp,spwake,SP_ID);
+					if (!queuecontrol(ports,p,cspbuffer,sizeof(unsigned char)*INITFRAMESIZE))
+						fprintf(outfile,"CSP: Error sending SP %d notification to stop waiting\n",SP_ID);
 					else
-						fprintf(outfile,"CSP: Notified SP %d to stop waiting\n",i);
+						fprintf(outfile,"CSP: Notified SP %d to stop waiting\n",SP_ID);
 				}
 			} // else { someone else should either wait, send data, or quit. }
 			// try again
 			continue;
 		}
-		// we need connections still, see if we have a new connection ready
-		if (connectionsneeded) {
-			// the listening socket has something
-			if (FD_ISSET(fd,&fdlist)) {
-				connfd = accept(fd,NULL,NULL);
-				if (connfd>=0) {
-					// initialize this connection, get their data
-					if (!rcvbuffer(connfd,(void*)cspbuffer,INITFRAMESIZE)) {
-						fprintf(stderr,"Error in CSP init connections, receive an initial packet\n");
-						for (int x=0;x<numSPprocesses;++x) { if (sp[x]>=0) close(sp[x]); }
-						fclose(outfile);
-						close(fd);
-						return 0;
-					}
-					src_sp_id=intfrombuffer(cspbuffer);
-					dst_sp_id=intfrombuffer(cspbuffer+4);
-					int checkgroup=intfrombuffer(cspbuffer+12);
-					// validity check
-					if (src_sp_id!=dst_sp_id || src_sp_id<0 || src_sp_id>=numSPprocesses || checkgroup!=numSPprocesses) {
-						fprintf(stderr,"Initial communication for connection is faulty, SP %d(=%d?), numSPprocesses %d(=%d?)\n",
-										src_sp_id,dst_sp_id,numSPprocesses,checkgroup);
-						for (int x=0;x<numSPprocesses;++x) { if (sp[x]>=0) close(sp[x]); }
-						fclose(outfile);
-						close(fd);
-						return 0;
-					}
-					// set their sp[] element and decrement the connectionsneeded counter
-					sp[src_sp_id]=connfd;
-					--connectionsneeded;
-				}
-				// go back to select another socket
+		// frames from other switches, routes, SP states, and data frames passing through
+		for (int t=0;t<fab->numtrunks;++t) {
+			if (fab->trunkfd[t]<0 || !FD_ISSET(fab->trunkfd[t],&fdlist)) continue;
+			int withdrawn;
+			handletrunk(fab,t,cspbuffer,&withdrawn,outfile);
+			if (withdrawn>=0) dropstation(fab,sched,requestqueue,dataqueue,parked,withdrawn,outfile);
+		}
+		lastready=getnow();
+		// new connections, every pending one is accepted in this pass
+		// a first frame that is already in is handled right away, the rest wait in the handshakes
+		unsigned char admitted=0;
+		if (fd>=0 && idle && FD_ISSET(fd,&fdlist)) {
+			// the daemon hands over connections with their first frame read
+			admitted=1;
+			while ((connfd=rcvconnection(fd,(void*)cspbuffer,sizeof(unsigned char)*INITFRAMESIZE))>=0) {
+				setpolloptions(poller,connfd);
+				admit(fab,sched,requestqueue,dataqueue,parked,trace,&muxes,&nummuxes,connfd,cspbuffer,started,outfile);
+			}
+			if (connfd<-1) {
+				fprintf(outfile,"CSP: The daemon is gone, no more SPs join\n");
+				close(fd);
+				fd=-1;
+			}
+		}
+		else if (fd>=0 && FD_ISSET(fd,&fdlist)) {
+			admitted=1;
+			while (numhandshakes<MAXHANDSHAKES && (connfd=accept4(fd,NULL,NULL,SOCK_NONBLOCK))>=0) {
+				handshake *h = &handshakes[numhandshakes];
+				h->fd=connfd;
+				h->length=0;
+				h->since=getnow();
+				const int ret = readhandshake(h);
+				if (ret<0) close(connfd);
+				else if (ret>0) admit(fab,sched,requestqueue,dataqueue,parked,trace,&muxes,&nummuxes,connfd,h->buffer,started,outfile);
+				else ++numhandshakes;
+			}
+		}
+		// the connections still sending their first frame, a finished one is swapped out for the last
+		for (int i=0;i<numhandshakes;) {
+			handshake *h = &handshakes[i];
+			int ret=0;
+			if (FD_ISSET(h->fd,&fdlist)) ret=readhandshake(h);
+			else if (getnow()-h->since>HANDSHAKETIMEOUT) ret=-1;
+			if (!ret) {
+				++i;
 				continue;
 			}
+			admitted=1;
+			if (ret<0) {
+				fprintf(stderr,"Error in CSP init connections, receive an initial packet\n");
+				close(h->fd);
+			}
+			else admit(fab,sched,requestqueue,dataqueue,parked,trace,&muxes,&nummuxes,h->fd,h->buffer,started,outfile);
+			*h=handshakes[--numhandshakes];
+		}
+		// go back to select another socket
+		if (admitted) continue;
+		// the multiplexed connections that are ready are read as the station whose frame is at the head
+		for (int m=0;m<nummuxes;++m) {
+			muxconn *mux = &muxes[m];
+			if (mux->fd<0 || !FD_ISSET(mux->fd,&fdlist) || mux->head>=0) continue;
+			const int ret = peekmux(ports,mux,m);
+			if (ret<0) {
+				FD_CLR(mux->fd,&fdlist);
+				dropmux(fab,sched,requestqueue,dataqueue,parked,mux,m,outfile);
+			}
+			else if (!ret || senderheld(fab,dataqueue,parked,mux->head)) FD_CLR(mux->fd,&fdlist);
 		}
 		// flag for if we processed a data request. If we forward data we'll re-start the loop.
 		unsigned char haddata=0;
 		// see if we are expecting data from this SP
-		// set the connfd here to the first matching SP ID, in case we don't get data
+		// set the connfd here to the first matching port, in case we don't get data
 		connfd=-1;
-		for (int i=0;i<numSPprocesses;++i) {
+		for (int i=0;i<ports->numports;++i) {
 			// round robin iterator for selecting descriptors, avoid continuing to serve one SP
-			const int SP_ID=roundrobin++;
-			if (roundrobin==numSPprocesses) roundrobin=0;
+			if (roundrobin>=ports->numports) roundrobin=0;
+			const int SP_PORT=roundrobin++;
 			// see if it is ready
-			if (sp[SP_ID]<0) continue;
-			if (!FD_ISSET(sp[SP_ID],&fdlist)) continue;
-			// save this SP_ID, use this for the incoming request section below if no one has data
-			if (connfd<0) connfd=SP_ID;
+			if (ports->fd[SP_PORT]<0) continue;
+			if (!FD_ISSET(ports->fd[SP_PORT],&fdlist)) continue;
+			// a station on a multiplexed connection is ready when its frame is at the head
+			if (ports->mux[SP_PORT]>=0 && muxes[ports->mux[SP_PORT]].head!=SP_PORT) continue;
+			// save this port, use this for the incoming request section below if no one has data
+			if (connfd<0) connfd=SP_PORT;
+			const int SP_ID = SPFROMSTATION(ports->station[SP_PORT]);
 			// this SP is not waiting anymore
-			if (waitsp[SP_ID]) waitsp[SP_ID]=0; // clear the wait flag
+			if (ports->state[SP_PORT]==SPWAITING) announcestate(fab,SP_PORT,SPACTIVE);
 			// see if it is in the data queue
 			for (int x=0;x<DATAQUEUESIZE;++x) {
-				if (dataqueue[x].src_sp_id==SP_ID) {
+				if (dataqueue[x].src_sp_id>=0 && dataqueue[x].src_port==SP_PORT) {
 					// this one is waiting for data and it is ready
 					fprintf(outfile,"CSP: Receiving data frame from SP %d\n",SP_ID);
-					// the size remaining includes the necessary header bytes
-					const int thistransfer = (dataqueue[x].bytesremaining>MAXFRAMESIZE)?MAXFRAMESIZE:dataqueue[x].bytesremaining;
-					// receive their data
-					if (!rcvbuffer(sp[SP_ID],(void*)dataqueue[x].buffer,sizeof(unsigned char)*thistransfer))
+					if (ports->mux[SP_PORT]>=0) muxes[ports->mux[SP_PORT]].head=-1;
+					// receive the header, its size field says how much data follows
+					// a size that doesn't fit the transfer is taken as a full frame (or the rest of the transfer)
+					// body is the payload and its checksum trailer, if the frame has one
+					unsigned char *buffer = dataqueue[x].buffer;
+					int payload = -1, body = -1;
+					double stamp;
+					if (rcvstamped(ports->fd[SP_PORT],(void*)buffer,sizeof(unsigned char)*INITFRAMESIZE,&stamp)) {
+						const int field = intfrombuffer(buffer+12);
+						payload = framepayload(field);
+						body = framebody(field);
+						if (payload<=0 || body>MAXDATASIZE || (unsigned long long)payload>dataqueue[x].dataremaining) {
+							payload = (dataqueue[x].dataremaining>MAXDATASIZE)?MAXDATASIZE:(int)dataqueue[x].dataremaining;
+							body = payload;
+						}
+						// receive their data
+						if (!rcvbuffer(ports->fd[SP_PORT],(void*)(buffer+INITFRAMESIZE),sizeof(unsigned char)*body)) payload=-1;
+						// a bad checksum is counted against the sender, the frame still goes on to the receiver which checks it too
+						else if (crccheck && body>payload) {
+							++ports->crcframes[SP_PORT];
+							if (crc32c(0,buffer,INITFRAMESIZE+payload)!=(unsigned int)intfrombuffer(buffer+INITFRAMESIZE+payload)) {
+								++ports->crcerrors[SP_PORT];
+								fprintf(outfile,"CSP: Checksum failed on data frame from SP %d to SP %d\n",SP_ID,dataqueue[x].dst_sp_id);
+							}
+						}
+					}
+					if (payload>=0) PROBE3(csp,framereceived,SP_ID,dataqueue[x].dst_sp_id,payload);
+					if (payload<0) {
 						fprintf(stderr,"Error in CSP receive data to forward from SP %d\n",SP_ID);
+						if (ports->mux[SP_PORT]>=0) dropmux(fab,sched,requestqueue,dataqueue,parked,&muxes[ports->mux[SP_PORT]],ports->mux[SP_PORT],outfile);
+						else detachstation(fab,sched,requestqueue,dataqueue,parked,SP_PORT,outfile);
+						haddata=1;
+						break;
+					}
+					const int thistransfer = INITFRAMESIZE+body;
+					// the frame is ours, a resumed transfer continues after it
+					ports->xferoffset[SP_PORT]+=payload;
+					// the destination left (its port may even belong to someone new), the data is dropped
+					const int dst_port = dataqueue[x].dst_port;
+					if (ports->station[dst_port]!=STATIONID(dataqueue[x].dst_sp_id) || ports->nexthop[dst_port]<0)
+						fprintf(outfile,"CSP: Dropped data frame (from SP %d) to departed SP %d\n",SP_ID,dataqueue[x].dst_sp_id);
 					// send their data
-					else if (!sendbuffer(sp[dataqueue[x].dst_sp_id],(void*)dataqueue[x].buffer,sizeof(unsigned char)*thistransfer))
-							fprintf(stderr,"Error in CSP forwarding data from SP %d to SP %d\n",SP_ID,dataqueue[x].dst_sp_id);
-					else
+					else if (!forwardframe(fab,SP_PORT,dst_port,dataqueue[x].buffer,thistransfer))
+						fprintf(stderr,"Error in CSP forwarding data from SP %d to SP %d\n",SP_ID,dataqueue[x].dst_sp_id);
+					else {
+						recordlatency(poller,stamp);
+						if (dataqueue[x].mirrored) mirrortransfer(fab->mirror,ports,dataqueue[x].buffer,thistransfer);
+						PROBE4(csp,frameforwarded,SP_ID,dataqueue[x].dst_sp_id,payload,dataqueue[x].dataremaining-payload);
 						fprintf(outfile,"CSP: Forwarded data frame (from SP %d) to SP %d\n",SP_ID,dataqueue[x].dst_sp_id);
+					}
 					// decrement the amount of data we are expecting
-					dataqueue[x].bytesremaining-=thistransfer;
+					unloadtransfer(ports,dst_port,dataqueue[x].dst_sp_id,payload);
+					dataqueue[x].dataremaining-=payload;
+					dataqueue[x].bytesremaining-=(dataqueue[x].bytesremaining>(unsigned long long)thistransfer)?thistransfer:dataqueue[x].bytesremaining;
+					sched->stats.bytesforwarded+=thistransfer;
 					// not expecting any more, remove this SP from the data queue
-					if (!dataqueue[x].bytesremaining) {
+					if (!dataqueue[x].dataremaining) {
 						dataqueue[x].src_sp_id=-1;
-						// try to move something from the request queue to the data queue
-						int dataqindex = shiftqueues(requestqueue,dataqueue,sp);
-						if (dataqindex>=0) {
-							// notify the SP that they can send this data
-							intinbuffer(cspbuffer,dataqueue[dataqindex].src_sp_id);
-							intinbuffer(cspbuffer+4,dataqueue[dataqindex].dst_sp_id);
-							intinbuffer(cspbuffer+8,0);
-							intinbuffer(cspbuffer+12,1);
-							fprintf(outfile,"CSP: Moved SP %d request from request queue to data queue",dataqueue[dataqindex].src_sp_id);
-							if (sendbuffer(sp[dataqueue[dataqindex].src_sp_id],(void*)cspbuffer,sizeof(unsigned char)*INITFRAMESIZE))
-								fprintf(outfile,", sent acknowledgement\n");
-							else {
-								fprintf(outfile,", failed to send acknowledgement\n");
-								dataqueue[dataqindex].src_sp_id=-1;
-							}
-						}
+						// a parked transfer gets the slot first, then the request queue
+						resumeparked(parked,dataqueue,outfile);
+						grantrequests(fab,sched,requestqueue,dataqueue,parked,outfile);
+					}
+					// the quantum is up and someone is waiting, the transfer goes to the back of the parked queue
+					// the request queue gets the slot first, so short transfers don't wait out a long one
+					// a sender on a multiplexed connection keeps its slot, its parked frame would hold up the
+					// connection and with it the transfers that could free a slot
+					else if (quantum>0 && ++dataqueue[x].frames>=quantum && ports->mux[SP_PORT]<0 && yieldwanted(requestqueue,parked,ports)
+									&& parktransfer(parked,dataqueue,x)) {
+						++yields;
+						fprintf(outfile,"CSP: SP %d transfer to SP %d yielded its data queue slot (%llu bytes left)\n",
+										SP_ID,dataqueue[x].dst_sp_id,dataqueue[x].dataremaining);
+						grantrequests(fab,sched,requestqueue,dataqueue,parked,outfile);
+						resumeparked(parked,dataqueue,outfile);
 					}
 					haddata=1;
 					break;
@@ -431,135 +1392,254 @@ int main(int argc, char** argv) {
 		if (haddata) continue;
 		if (connfd>=0) {
 			// set in the check for incoming data, this is the first file descriptor from the select
-			const int SP_ID=connfd;
+			const int SP_PORT=connfd;
+			const int SP_ID=SPFROMSTATION(ports->station[SP_PORT]);
 			// flush the log file
 			fflush(outfile);
+			const int m = ports->mux[SP_PORT];
+			if (m>=0) muxes[m].head=-1;
 			// Read their initframe, this is some other incoming request
-			if (semiblockrcv(sp[SP_ID],(void*)cspbuffer,sizeof(unsigned char)*INITFRAMESIZE)) {
-				// set vals
-				src_sp_id = intfrombuffer(cspbuffer);
-				dst_sp_id = intfrombuffer(cspbuffer+4);
-				unsigned long long datalen = ullfrombuffer(cspbuffer+8);
-				// this is a signal packet from the SP for the CSP
-				if (src_sp_id==dst_sp_id) {
-					// this is the quit notification
-					if (!datalen) {
-						fprintf(outfile,"CSP: Received a ready to quit notification from SP %d",src_sp_id);
-						if (datalen) fprintf(outfile," (ull: expected 0, got %llu)",datalen);
-						fprintf(outfile,"\n");
-						++doneSP;
+			if (!semiblockrcv(ports->fd[SP_PORT],(void*)cspbuffer,sizeof(unsigned char)*INITFRAMESIZE)) {
+				// the SP's connection closed, it may come back and resume
+				if (m>=0) dropmux(fab,sched,requestqueue,dataqueue,parked,&muxes[m],m,outfile);
+				else detachstation(fab,sched,requestqueue,dataqueue,parked,SP_PORT,outfile);
+				continue;
+			}
+			// set vals
+			src_sp_id = intfrombuffer(cspbuffer);
+			dst_sp_id = intfrombuffer(cspbuffer+4);
+			unsigned long long datalen = ullfrombuffer(cspbuffer+8);
+			// this is a signal packet from the SP for the CSP
+			if (src_sp_id==dst_sp_id) {
+				// this is the quit notification
+				if (!datalen) {
+					fprintf(outfile,"CSP: Received a ready to quit notification from SP %d\n",src_sp_id);
+					tracewrite(trace,TRACEQUIT,src_sp_id,src_sp_id,0);
+					PROBE1(csp,spdone,SP_ID);
+					announcestate(fab,SP_PORT,SPDONE);
+				}
+				// this is a waiting notification
+				else {
+					fprintf(outfile,"CSP: Received a notification that SP %d will wait for %llu packets\n",src_sp_id,datalen);
+					tracewrite(trace,TRACEWAIT,src_sp_id,src_sp_id,datalen);
+					PROBE2(csp,spwait,SP_ID,datalen);
+					// not actually counting packets
+					// we turn the flag off when the SP sends something back to us
+					announcestate(fab,SP_PORT,SPWAITING);
+				}
+				grantrequests(fab,sched,requestqueue,dataqueue,parked,outfile);
+				continue;
+			}
+			// the SP claims the transfer it re-requests next continues at this offset
+			if (dst_sp_id==SESSIONID) {
+				if (ports->xferseq[SP_PORT] && datalen<ports->xfertotal[SP_PORT]) {
+					ports->resumefrom[SP_PORT]=datalen;
+					fprintf(outfile,"CSP: SP %d resumes transfer %d at byte %llu\n",SP_ID,ports->xferseq[SP_PORT],datalen);
+				}
+				else fprintf(outfile,"CSP: SP %d claimed to resume at byte %llu, no transfer to resume\n",SP_ID,datalen);
+				continue;
+			}
+			// this is a data transfer request
+			tracewrite(trace,TRACEREQUEST,SP_ID,dst_sp_id,datalen);
+			PROBE3(csp,requestreceived,SP_ID,dst_sp_id,datalen);
+			// the first forwarding rule that matches may reject the request, send it elsewhere, or mirror it
+			unsigned char refused=0, mirrored=0;
+			const int rule = matchrule(rules,SP_ID,dst_sp_id,datalen,((datalen<=MAXDATASIZE)?RULESINGLE:RULEBULK)
+																	|((ports->resumefrom[SP_PORT]!=RESUMENONE)?RULERESUME:0));
+			if (rule>=0) {
+				PROBE4(csp,rulematched,SP_ID,dst_sp_id,datalen,rules->rules[rule].line);
+				const int requested = dst_sp_id;
+				refused = !applyrule(rules,rule,datalen,getnow(),&dst_sp_id,&mirrored);
+				fprintf(outfile,"CSP: SP %d request (%llu bytes to SP %d) matched the rule on line %d",SP_ID,datalen,requested,rules->rules[rule].line);
+				if (refused) fprintf(outfile,", rejected\n");
+				else if (dst_sp_id!=requested) fprintf(outfile,", sent to SP %d\n",dst_sp_id);
+				else fprintf(outfile,"\n");
+			}
+			// a destination we haven't heard of gets a port to queue on while the group is still joining
+			// a request to an anycast group goes to the port of the member it is bound to
+			const int group = anycastof(fab->groups,dst_sp_id);
+			int dst_port = (refused || dst_sp_id<0 || group>=0)?-1:portlookup(ports,STATIONID(dst_sp_id));
+			const unsigned char joining = !fab->numSPprocesses || ports->joined<(unsigned long long)fab->numSPprocesses;
+			if (!refused && group>=0) dst_port=bindanycast(fab,group,SP_PORT);
+			else if (!refused && dst_port<0 && dst_sp_id>=0 && joining) dst_port=portregister(ports,STATIONID(dst_sp_id));
+			// a rule rejected it, the SP may try again (a rate limit lets it through once it has waited)
+			if (refused) {
+				if (PROBEACTIVE(csp,requestrejected)) PROBE4(csp,requestrejected,SP_ID,dst_sp_id,datalen,requestqueuedepth(requestqueue));
+				// a resume claim goes with the request, the SP claims again when it resends
+				ports->resumefrom[SP_PORT]=RESUMENONE;
+				intinbuffer(cspbuffer,SP_ID);
+				intinbuffer(cspbuffer+4,dst_sp_id);
+				intinbuffer(cspbuffer+8,0);
+				intinbuffer(cspbuffer+12,0);
+				if (!queuecontrol(ports,SP_PORT,cspbuffer,sizeof(unsigned char)*INITFRAMESIZE))
+						fprintf(stderr,"CSP: Error sending response to SP ID %d\n",SP_ID);
+			}
+			// sanity check, no need to check buffers if it is a bad request
+			else if (dst_port<0 || dst_port==SP_PORT) {
+				fprintf(outfile,"CSP: Received request from SP %d with target SP %d\n",src_sp_id,dst_sp_id);
+				fprintf(outfile,"CSP: This is a bad transmission, replying with rejection to SP %d\n",SP_ID);
+				if (PROBEACTIVE(csp,requestrejected)) PROBE4(csp,requestrejected,SP_ID,dst_sp_id,datalen,requestqueuedepth(requestqueue));
+				intinbuffer(cspbuffer,SP_ID);
+				intinbuffer(cspbuffer+4,SP_ID+1); // just a different number than the first field
+				ullinbuffer(cspbuffer+8,(unsigned long long)0);
+				if (!queuecontrol(ports,SP_PORT,cspbuffer,sizeof(unsigned char)*INITFRAMESIZE))
+						fprintf(stderr,"CSP: Error sending rejection of invalid init packet to SP ID %d\n",SP_ID);
+			}
+			// the initial data request has the total data size. we set the total size here.
+			// if the transfer spans multiple data frames, the SP will still hold their data queue spot
+			// at least some of the math requires casting, casting all of this
+			// datalen += INITFRAMESIZE * ((datalen+MAXDATASIZE-1)/MAXDATASIZE)
+			else {
+				datalen += (unsigned long long)
+						(((unsigned long long)INITFRAMESIZE)*
+						((datalen+((unsigned long long)(MAXDATASIZE-1)))
+						/((unsigned long long)MAXDATASIZE))); // an init data frame per each MAXDATASIZE
+				// handle the request, sendreject base val = 2
+				unsigned char sendreject=2;
+				// get an index if the data queue has room
+				const int dataqindex = getnextdataqindex(dataqueue);
+				// no room in the data queue or we are still waiting on the destination to connect
+				// schedulers that match ports always queue, the pass at the end of the loop grants
+				if (dataqindex<0 || ports->nexthop[dst_port]<0 || !sched->ops->direct) {
+					// no room in the request queue either
+					if (!queuerequest(requestqueue,SP_ID,dst_sp_id,SP_PORT,dst_port,datalen,getnow(),mirrored)) {
+						sendreject=1; // reject message
+						++sched->stats.rejects;
+						// a resume claim goes with the request, the SP claims again when it resends
+						ports->resumefrom[SP_PORT]=RESUMENONE;
 					}
-					// this is a waiting notification
+					//it was added to the request queue, don't send any response
 					else {
-						fprintf(outfile,"CSP: Received a notification that SP %d will wait for %llu packets\n",src_sp_id,datalen);
-						// not actually counting packets
-						// we turn the flag off when the SP sends something back to us
-						waitsp[src_sp_id]=1;
+						sendreject=0;
+						ports->inflight[dst_port]+=datalen;
 					}
 				}
-				// this is a data transfer request
-				// sanity check, no need to check buffers if it is a bad request
-				else if (dst_sp_id<0 || dst_sp_id>=numSPprocesses) {
-					fprintf(outfile,"CSP: Received request from SP %d with target SP %d\n",src_sp_id,dst_sp_id);
-					fprintf(outfile,"CSP: This is a bad transmission, replying with rejection to SP %d\n",SP_ID);
-					intinbuffer(cspbuffer,SP_ID);
-					intinbuffer(cspbuffer+4,SP_ID+1); // just a different number than the first field
-					ullinbuffer(cspbuffer+8,(unsigned long long)0);
-					if (!sendbuffer(sp[SP_ID],(void*)cspbuffer,sizeof(unsigned char)*INITFRAMESIZE))
-							fprintf(stderr,"CSP: Error sending rejection of invalid init packet to SP ID %d\n",SP_ID);
-				}
-				// the initial data request has the total data size. we set the total size here.
-				// if the transfer spans multiple data frames, the SP will still hold their data queue spot
-				// at least some of the math requires casting, casting all of this
-				// datalen += INITFRAMESIZE * ((datalen+MAXDATASIZE-1)/MAXDATASIZE)
 				else {
-					datalen += (unsigned long long)
-							(((unsigned long long)INITFRAMESIZE)*
-							((datalen+((unsigned long long)(MAXDATASIZE-1)))
-							/((unsigned long long)MAXDATASIZE))); // an init data frame per each MAXDATASIZE
-					// handle the request, sendreject base val = 2
-					unsigned char sendreject=2;
-					// get an index if the data queue has room
-					const int dataqindex = getnextdataqindex(dataqueue);
-					// no room in the data queue or we are still waiting on the destination to connect
-					if (dataqindex<0 || sp[dst_sp_id]<0) {
-						// no room in the request queue either
-						if (!queuerequest(requestqueue,src_sp_id,dst_sp_id,datalen))
-							sendreject=1; // reject message
-						//it was added to the request queue, don't send any response
-						else sendreject=0;
+					// set the dataqueue vals at the index
+					dataqueue[dataqindex].src_sp_id=SP_ID;
+					dataqueue[dataqindex].dst_sp_id=dst_sp_id;
+					dataqueue[dataqindex].src_port=SP_PORT;
+					dataqueue[dataqindex].dst_port=dst_port;
+					dataqueue[dataqindex].bytesremaining=datalen;
+					dataqueue[dataqindex].mirrored=mirrored;
+					schedadmitted(sched,dataqueue,dataqindex,getnow());
+					startxfer(ports,dataqueue,dataqindex);
+					// the acknowledgement names the member an anycast request was bound to
+					bindgranted(fab,dataqueue,dataqindex,outfile);
+					dst_sp_id=dataqueue[dataqindex].dst_sp_id;
+				}
+				// log details of the request
+				fprintf(outfile,"CSP: Receive request from SP %d (%llu bytes to SP %d)\n",SP_ID,datalen,dst_sp_id);
+				// we have a 1 if we send a rejection, 2 for an acceptance  ... (0 is no response)
+				fprintf(outfile,"CSP: Request from SP %d is ",SP_ID);
+				if (sendreject) {
+					intinbuffer(cspbuffer,src_sp_id);
+					intinbuffer(cspbuffer+4,dst_sp_id);
+					intinbuffer(cspbuffer+8,0);
+					// set a 1 in the final field for accept
+					if (sendreject==2) {
+						if (PROBEACTIVE(csp,requestaccepted)) PROBE4(csp,requestaccepted,SP_ID,dst_sp_id,datalen,dataqueuedepth(dataqueue));
+						fprintf(outfile,"accepted\n");
+						intinbuffer(cspbuffer+12,1);
 					}
+					// 0 for reject
 					else {
-						// set the dataqueue vals at the index
-						dataqueue[dataqindex].src_sp_id=SP_ID;
-						dataqueue[dataqindex].dst_sp_id=dst_sp_id;
-						dataqueue[dataqindex].bytesremaining=datalen;
+						if (PROBEACTIVE(csp,requestrejected)) PROBE4(csp,requestrejected,SP_ID,dst_sp_id,datalen,requestqueuedepth(requestqueue));
+						fprintf(outfile,"rejected\n");
+						intinbuffer(cspbuffer+12,0);
 					}
-					// log details of the request
-					fprintf(outfile,"CSP: Receive request from SP %d (%llu bytes to SP %d)\n",SP_ID,datalen,dst_sp_id);
-					// we have a 1 if we send a rejection, 2 for an acceptance  ... (0 is no response)
-					fprintf(outfile,"CSP: Request from SP %d is ",SP_ID);
-					if (sendreject) {
-						intinbuffer(cspbuffer,src_sp_id);
-						intinbuffer(cspbuffer+4,dst_sp_id);
-						intinbuffer(cspbuffer+8,0);
-						// set a 1 in the final field for accept
-						if (sendreject==2) {
-							fprintf(outfile,"accepted\n");
-							intinbuffer(cspbuffer+12,1);
-						}
-						// 0 for reject
-						else {
-							fprintf(outfile,"rejected\n");
-							intinbuffer(cspbuffer+12,0);
-						}
-						// send response
-						if (!sendbuffer(sp[SP_ID],(void*)cspbuffer,sizeof(unsigned char)*INITFRAMESIZE))
-								fprintf(stderr,"CSP: Error sending response to SP ID %d\n",src_sp_id);
-					}
-					// don't send a response
-					else fprintf(outfile,"queued in the request queue\n");
+					// send response
+					if (!queuecontrol(ports,SP_PORT,cspbuffer,sizeof(unsigned char)*INITFRAMESIZE))
+							fprintf(stderr,"CSP: Error sending response to SP ID %d\n",src_sp_id);
+				}
+				// don't send a response
+				else {
+					if (PROBEACTIVE(csp,requestqueued)) PROBE4(csp,requestqueued,SP_ID,dst_sp_id,datalen,requestqueuedepth(requestqueue));
+					fprintf(outfile,"queued in the request queue\n");
 				}
 			}
 		}
 		// try to move something from the request queue to the data queue
-		int dataqindex = shiftqueues(requestqueue,dataqueue,sp);
-		while (dataqindex>=0) {
-			// notify the SP that they can send this data
-			intinbuffer(cspbuffer,dataqueue[dataqindex].src_sp_id);
-			intinbuffer(cspbuffer+4,dataqueue[dataqindex].dst_sp_id);
-			intinbuffer(cspbuffer+8,0);
-			intinbuffer(cspbuffer+12,1);
-			fprintf(outfile,"CSP: Moved SP %d request from request queue to data queue",dataqueue[dataqindex].src_sp_id);
-			if (sendbuffer(sp[dataqueue[dataqindex].src_sp_id],(void*)cspbuffer,sizeof(unsigned char)*INITFRAMESIZE))
-				fprintf(outfile,", sent acknowledgement\n");
-			else {
-				fprintf(outfile,", failed to send acknowledgement\n");
-				dataqueue[dataqindex].src_sp_id=-1;
-			}
-			dataqindex = shiftqueues(requestqueue,dataqueue,sp);
-		}
+		grantrequests(fab,sched,requestqueue,dataqueue,parked,outfile);
 	}
 	// simulation is officially over.
+	// a simulation of the daemon takes no more connections, one that comes in now starts the next simulation
+	// once the socket is shut for reading the daemon can't send any, the ones it sent already go back to it
+	if (idle && fd>=0) {
+		shutdown(fd,SHUT_RD);
+		while ((connfd=rcvconnection(fd,(void*)cspbuffer,sizeof(unsigned char)*INITFRAMESIZE))>=0) {
+			if (!sendconnection(fd,connfd,(void*)cspbuffer,sizeof(unsigned char)*INITFRAMESIZE))
+				fprintf(outfile,"CSP: Unable to hand a connection back to the daemon, closing it\n");
+			close(connfd);
+		}
+		close(fd);
+		fd=-1;
+	}
 	// for each socket send them a quit message and close the socket
 	ullinbuffer(cspbuffer+8,(unsigned long long)0);
-	for (int i=0;i<numSPprocesses;++i) {
-		intinbuffer(cspbuffer,i);
-		intinbuffer(cspbuffer+4,i);
-		if (sendbuffer(sp[i],(void*)cspbuffer,sizeof(unsigned char)*INITFRAMESIZE))
-			fprintf(outfile,"CSP: Sent the quit confirm to SP %d\n",i);
-		else fprintf(outfile,"CSP: Error sending quit confirm to SP %d\n",i);
-		shutdown(sp[i],SHUT_RDWR);
-		close(sp[i]);
+	for (int p=0;p<ports->numports;++p) {
+		if (ports->fd[p]<0) continue; // on another switch
+		const int SP_ID = SPFROMSTATION(ports->station[p]);
+		intinbuffer(cspbuffer,SP_ID);
+		intinbuffer(cspbuffer+4,SP_ID);
+		// the quit goes out behind anything still pending for the SP
+		queuecontrol(ports,p,cspbuffer,sizeof(unsigned char)*INITFRAMESIZE);
+		if (flushcontrol(ports,p,NULL,0))
+			fprintf(outfile,"CSP: Sent the quit confirm to SP %d\n",SP_ID);
+		else fprintf(outfile,"CSP: Error sending quit confirm to SP %d\n",SP_ID);
+		// a multiplexed connection closes after the last of its stations
+		if (ports->mux[p]>=0) continue;
+		shutdown(ports->fd[p],SHUT_RDWR);
+		close(ports->fd[p]);
+	}
+	for (int m=0;m<nummuxes;++m) {
+		if (muxes[m].fd<0) continue;
+		shutdown(muxes[m].fd,SHUT_RDWR);
+		close(muxes[m].fd);
 	}
+	free(muxes);
+	for (int i=0;i<numhandshakes;++i) close(handshakes[i].fd);
+	free(handshakes);
+	printschedstats(sched,outfile,getnow());
+	printanycaststats(fab->groups,outfile);
+	printmirrorstats(fab->mirror,outfile);
+	if (quantum>0) fprintf(outfile,"CSP: Transfers yielded their data queue slot %llu times (quantum %d frames)\n",yields,quantum);
+	printpollstats(poller,outfile);
+	if (fab->link) printlinkstats(fab->link,outfile);
+	printrulestats(rules,outfile);
+	if (crccheck) {
+		unsigned long long checked=0, failed=0;
+		for (int p=0;p<ports->numports;++p) {
+			if (!ports->crcframes[p]) continue;
+			checked+=ports->crcframes[p];
+			failed+=ports->crcerrors[p];
+			if (ports->crcerrors[p])
+				fprintf(outfile,"CSP: SP %d, %llu of %llu checksummed data frames failed\n",
+								SPFROMSTATION(ports->station[p]),ports->crcerrors[p],ports->crcframes[p]);
+		}
+		fprintf(outfile,"CSP: Checked %llu data frame checksums, %llu failed\n",checked,failed);
+	}
+	closetrunks(fab,outfile);
+	if (trace) {
+		fprintf(outfile,"CSP: Recorded %llu trace records to %s\n",trace->records,tracefilename);
+		closetracewriter(trace);
+	}
+	if (idle && tracefilename) free(tracefilename);
+	if (idle && capturefilename) free(capturefilename);
 	// clean up the last of the mess
 	fprintf(outfile,"CSP: Ending simulation\n");
 	fclose(outfile);
-	free(sp);
-	free(waitsp);
 	free(requestqueue);
 	free(dataqueue);
-	close(fd);
+	free(parked);
+	freescheduler(sched);
+	freebusypoller(poller);
+	freelinkemu(fab->link);
+	freeanycast(fab->groups);
+	freemirror(fab->mirror);
+	freeruletable(rules);
+	freefabric(fab);
+	freeporttable(ports);
+	if (fd>=0) close(fd);
 	return 0;
 }
-
@@ -0,0 +1,584 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "queues.h"
+#include "sched.h"
+#include "porttable.h"
+#include "script.h"
+#include "eventq.h"
+
+// the discrete event simulation of one CSP and its SPs, in one process on a virtual clock
+// the CSP uses the same request/data queues, port table, and schedulers as fastserv
+// the SPs run the same input scripts as fastcl, parsed by the same parser
+// every delay is virtual: link serialization and latency, the SPs waiting for the start barrier,
+// the CSP's 2 second select timeout, and the backoff slots of a rejected SP (from a seeded RNG)
+// the event queue breaks time ties in push order, so a run with the same arguments is the same run
+
+// virtual nanoseconds
+#define SIMSECOND 1000000000ULL
+// the CSP's select timeout, it checks for waiting and finished SPs when nothing arrives for this long
+#define SIMIDLE (2*SIMSECOND)
+// a backoff slot is a second
+#define SIMSLOT SIMSECOND
+// SPs connect at a random time within this window
+#define SIMCONNECTWINDOW (SIMSECOND/1000)
+
+// the SP states, as in fastcl
+enum spstatus { SENDNONE=0, SENDTEXT=0x1, SENDFILE=0x10, SENDBLOCKED=0x100, SENDFINISHED=0x1000 };
+
+// the events
+// EVCONNECT, SP src connects and sends its handshake
+// EVSTEP, SP src runs its loop until it has to wait for something
+// EVRESEND, SP src resends its rejected request after its backoff
+// EVTOCSP, a frame from SP src arrives at the CSP
+// EVTOSP, a frame from the CSP arrives at SP dst
+enum simeventtype { EVCONNECT=0, EVSTEP, EVRESEND, EVTOCSP, EVTOSP };
+
+// the frames, in arg, value is the size, count, or chunk number
+// FRHELLO, FRREQUEST (value bytes to dst), FRWAIT (value frames), FRQUIT, FRDATA (chunk value, payload bytes in the event's arg high bits)
+// FRSESSION (handshake answer), FRACK, FRREJECT, FRWAKE, FRBYE (the CSP's quit), FRBARRIER (the whole group joined)
+enum simframe { FRHELLO=0, FRREQUEST, FRWAIT, FRQUIT, FRDATA, FRSESSION, FRACK, FRREJECT, FRWAKE, FRBYE, FRBARRIER };
+
+// a data frame's payload size rides above the frame type in arg
+#define FRAMETYPE(arg) ((arg)&0xF)
+#define FRAMEPAYLOAD(arg) ((arg)>>4)
+#define DATAFRAME(payload) (FRDATA|((payload)<<4))
+
+// one SP input file, shared by every SP that runs it
+// sizes[] is the data size of each frame command (a file's size is taken when the script is loaded)
+typedef struct simscript {
+	script *s;
+	unsigned long long *sizes;
+}simscript;
+
+// an SP, the part of fastcl's state the simulation needs
+// base is added to the destinations of its script, SPs run the scripts in tiles of numscripts SPs
+typedef struct simsp {
+	simscript *script;
+	int base;
+	int pc;
+	int status;
+	int waitpackets;
+	int failcount;
+	int seqnum;
+	int dst;
+	unsigned long long totalsize;
+	unsigned long long sizeremaining;
+	int chunk;
+	unsigned char stepping; // an EVSTEP is pending
+	unsigned char quit;
+	// the times its uplink (to the CSP) and downlink (from the CSP) are free again
+	unsigned long long upfree;
+	unsigned long long downfree;
+}simsp;
+
+// the whole simulation
+typedef struct sim {
+	eventq *events;
+	unsigned long long now;
+	unsigned long long rng;
+	// link model, per frame serialization at the link rate plus the one way latency
+	unsigned long long latency;
+	unsigned long long mbps;
+	FILE *log; // the event log, NULL for none
+	int numsps;
+	simsp *sps;
+	// the CSP
+	porttable *ports;
+	scheduler *sched;
+	requestqueuenode requestqueue[REQUESTQUEUESIZE];
+	dataqueuenode dataqueue[DATAQUEUESIZE];
+	int numSPprocesses;
+	int members;
+	int waiting;
+	int done;
+	unsigned char started; // the start barrier went out
+	unsigned long long lastactivity; // the last frame that arrived at the CSP
+	unsigned char ending;
+	// totals
+	unsigned long long requests;
+	unsigned long long rejects;
+	unsigned long long dropped;
+	unsigned long long framesdelivered;
+	unsigned long long bytesdelivered;
+}sim;
+
+// splitmix64, the seeded RNG of the simulation
+static inline unsigned long long simrandom(sim *s) {
+	s->rng += 0x9e3779b97f4a7c15ULL;
+	return hashstation(s->rng);
+}
+
+// the virtual seconds now, the time stamp of each log line
+static inline double simseconds(sim *s) {
+	return (double)s->now/(double)SIMSECOND;
+}
+
+// the nanoseconds a frame of bytes takes to serialize on a link
+static inline unsigned long long txtime(sim *s,const int bytes) {
+	return (unsigned long long)bytes*8ULL*1000ULL/s->mbps;
+}
+
+static inline void pushsimevent(sim *s,const unsigned long long time,const int type,const int src,const int dst,
+																	const int arg,const unsigned long long value) {
+	simevent ev = { .time=time, .type=type, .src=src, .dst=dst, .arg=arg, .value=value };
+	pushevent(s->events,&ev);
+}
+
+// sends a frame of bytes on the SP's uplink, it arrives at the CSP after serialization and latency
+static void sendtocsp(sim *s,const int sp_id,const int dst,const int arg,const unsigned long long value,const int bytes) {
+	simsp *sp = &s->sps[sp_id];
+	const unsigned long long start = (sp->upfree>s->now)?sp->upfree:s->now;
+	sp->upfree=start+txtime(s,bytes);
+	pushsimevent(s,sp->upfree+s->latency,EVTOCSP,sp_id,dst,arg,value);
+}
+
+// sends a frame of bytes on the SP's downlink
+static void sendtosp(sim *s,const int src,const int sp_id,const int arg,const unsigned long long value,const int bytes) {
+	simsp *sp = &s->sps[sp_id];
+	const unsigned long long start = (sp->downfree>s->now)?sp->downfree:s->now;
+	sp->downfree=start+txtime(s,bytes);
+	pushsimevent(s,sp->downfree+s->latency,EVTOSP,src,sp_id,arg,value);
+}
+
+// the SP runs its loop at time
+static inline void schedulestep(sim *s,const int sp_id,const unsigned long long time) {
+	if (s->sps[sp_id].stepping) return;
+	s->sps[sp_id].stepping=1;
+	pushsimevent(s,time,EVSTEP,sp_id,sp_id,0,0);
+}
+
+// SP side, fastcl's loop without the sockets
+// it sends its next data frame, or runs script commands until one has to wait for the CSP
+static void spstep(sim *s,const int sp_id) {
+	simsp *sp = &s->sps[sp_id];
+	sp->stepping=0;
+	while (!sp->quit && sp->status!=SENDFINISHED && !sp->waitpackets && !(sp->status&SENDBLOCKED)) {
+		// the granted transfer, one frame at a time as the uplink frees up
+		if (sp->sizeremaining) {
+			const int payload = (sp->sizeremaining>MAXDATASIZE)?MAXDATASIZE:(int)sp->sizeremaining;
+			if (s->log) fprintf(s->log,"%.6f SP %d: Sent data packet (%d bytes) to SP %d\n",simseconds(s),sp_id,INITFRAMESIZE+payload,sp->dst);
+			sendtocsp(s,sp_id,sp->dst,DATAFRAME(payload),(unsigned long long)sp->chunk++,INITFRAMESIZE+payload);
+			sp->sizeremaining-=payload;
+			if (!sp->sizeremaining) sp->status=SENDNONE;
+			else {
+				schedulestep(s,sp_id,sp->upfree);
+				return;
+			}
+			continue;
+		}
+		// the end of the script, tell the CSP we are done
+		if (sp->pc==sp->script->s->numcmds) {
+			sp->status=SENDFINISHED;
+			if (s->log) fprintf(s->log,"%.6f SP %d: Notifying CSP ready to quit\n",simseconds(s),sp_id);
+			sendtocsp(s,sp_id,sp_id,FRQUIT,0,INITFRAMESIZE);
+			return;
+		}
+		const int pc = sp->pc++;
+		const scriptcmd *cmd = &sp->script->s->cmds[pc];
+		if (cmd->op==SCRIPTWAIT) {
+			sp->waitpackets+=cmd->count;
+			// we can already do zero
+			if (!sp->waitpackets) continue;
+			if (s->log) fprintf(s->log,"%.6f SP %d: Entering wait to receive %d data frames\n",simseconds(s),sp_id,sp->waitpackets);
+			sendtocsp(s,sp_id,sp_id,FRWAIT,(unsigned long long)sp->waitpackets,INITFRAMESIZE);
+			return;
+		}
+		// an empty file is skipped
+		if (!sp->script->sizes[pc]) continue;
+		sp->seqnum=cmd->seqnum;
+		sp->dst=sp->base+cmd->dst_sp_id;
+		sp->totalsize=sp->script->sizes[pc];
+		sp->failcount=0;
+		sp->status=(cmd->file?SENDFILE:SENDTEXT)|SENDBLOCKED;
+		if (s->log) fprintf(s->log,"%.6f SP %d: Frame %d, request to send %llu bytes to SP %d\n",simseconds(s),sp_id,sp->seqnum,sp->totalsize,sp->dst);
+		sendtocsp(s,sp_id,sp->dst,FRREQUEST,sp->totalsize,INITFRAMESIZE);
+		++s->requests;
+		return;
+	}
+}
+
+// SP side, a frame from the CSP arrived
+static void sprecv(sim *s,const int sp_id,const int src,const int arg,const unsigned long long value) {
+	simsp *sp = &s->sps[sp_id];
+	switch (FRAMETYPE(arg)) {
+	case FRSESSION:
+		// fastcl waits for the start barrier
+		break;
+	case FRBARRIER:
+		if (s->log) fprintf(s->log,"%.6f SP %d: All stations present, starting\n",simseconds(s),sp_id);
+		schedulestep(s,sp_id,s->now);
+		break;
+	case FRACK:
+		if (s->log) fprintf(s->log,"%.6f SP %d: Received ok reply from CSP to send data frame %d to SP %d\n",simseconds(s),sp_id,sp->seqnum,sp->dst);
+		sp->status&=~SENDBLOCKED;
+		sp->failcount=0;
+		sp->sizeremaining=sp->totalsize;
+		sp->chunk=0;
+		schedulestep(s,sp_id,s->now);
+		break;
+	case FRREJECT:
+		if (s->log) fprintf(s->log,"%.6f SP %d: Received reject reply from CSP to send data frame %d to SP %d\n",simseconds(s),sp_id,sp->seqnum,sp->dst);
+		// we've had 3 retries, drop this request
+		if (sp->failcount++==3) {
+			sp->failcount=0;
+			sp->status=SENDNONE;
+			++s->dropped;
+			schedulestep(s,sp_id,s->now);
+		}
+		// a simple BEBO backoff, after the nth failure wait between 0 and (2^n)-1 slots
+		else pushsimevent(s,s->now+(simrandom(s)%(2ULL<<(sp->failcount-1)))*SIMSLOT,EVRESEND,sp_id,sp_id,0,0);
+		break;
+	case FRDATA:
+		if (s->log) fprintf(s->log,"%.6f SP %d: Received packet %llu (%d bytes) from SP %d\n",simseconds(s),sp_id,value,FRAMEPAYLOAD(arg),src);
+		++s->framesdelivered;
+		s->bytesdelivered+=FRAMEPAYLOAD(arg);
+		// we are waiting to receive packets, decrement that counter
+		if (sp->waitpackets && --sp->waitpackets==0) {
+			if (s->log) fprintf(s->log,"%.6f SP %d: Finished waiting for data frames\n",simseconds(s),sp_id);
+			schedulestep(s,sp_id,s->now);
+		}
+		break;
+	case FRWAKE:
+		if (s->log) fprintf(s->log,"%.6f SP %d: Received notification from CSP to stop waiting for packets\n",simseconds(s),sp_id);
+		sp->waitpackets=0;
+		schedulestep(s,sp_id,s->now);
+		break;
+	case FRBYE:
+		if (s->log) {
+			fprintf(s->log,"%.6f SP %d: Received valid quit response from CSP\n",simseconds(s),sp_id);
+			fprintf(s->log,"%.6f SP %d: Ending simulation\n",simseconds(s),sp_id);
+		}
+		sp->quit=1;
+		break;
+	}
+}
+
+// the data bytes of a granted transfer, as in fastserv every frame but the last is full
+static inline void startxfer(dataqueuenode *dataqueue,const int index) {
+	const unsigned long long bytes = dataqueue[index].bytesremaining;
+	dataqueue[index].dataremaining=bytes-INITFRAMESIZE*((bytes+MAXFRAMESIZE-1)/MAXFRAMESIZE);
+}
+
+// CSP side, sends the acknowledgement for every request the scheduler moved into the data queue
+static void grantrequests(sim *s) {
+	int moved[DATAQUEUESIZE];
+	const int count = schedule(s->sched,s->requestqueue,s->dataqueue,s->ports->nexthop,s->ports->numports,simseconds(s),moved);
+	for (int i=0;i<count;++i) {
+		dataqueuenode *slot = &s->dataqueue[moved[i]];
+		startxfer(s->dataqueue,moved[i]);
+		if (s->log) fprintf(s->log,"%.6f CSP: Moved SP %d request from request queue to data queue, sent acknowledgement\n",simseconds(s),slot->src_sp_id);
+		sendtosp(s,slot->src_sp_id,slot->src_sp_id,FRACK,0,INITFRAMESIZE);
+	}
+}
+
+// CSP side, sets the state of the station at port and keeps the counts the idle check uses
+static inline void setstate(sim *s,const int port,const int state) {
+	const int old = s->ports->state[port];
+	if (old==SPWAITING) --s->waiting;
+	else if (old==SPDONE) --s->done;
+	if (state==SPWAITING) ++s->waiting;
+	else if (state==SPDONE) ++s->done;
+	s->ports->state[port]=state;
+}
+
+// CSP side, a data request from the SP at port, fastserv's request handling
+static void csprequest(sim *s,const int sp_id,const int port,const int dst_sp_id,unsigned long long datalen) {
+	porttable *ports = s->ports;
+	// a destination we haven't heard of gets a port to queue on while the group is still joining
+	int dst_port = (dst_sp_id<0)?-1:portlookup(ports,STATIONID(dst_sp_id));
+	if (dst_port<0 && dst_sp_id>=0 && ports->joined<(unsigned long long)s->numSPprocesses) dst_port=portregister(ports,STATIONID(dst_sp_id));
+	if (dst_port<0 || dst_port==port) {
+		if (s->log) fprintf(s->log,"%.6f CSP: Received request from SP %d with target SP %d, replying with rejection\n",simseconds(s),sp_id,dst_sp_id);
+		sendtosp(s,sp_id,sp_id,FRREJECT,0,INITFRAMESIZE);
+		return;
+	}
+	// an init data frame per each MAXDATASIZE
+	datalen += INITFRAMESIZE*((datalen+MAXDATASIZE-1)/MAXDATASIZE);
+	unsigned char sendreject=2;
+	const int dataqindex = getnextdataqindex(s->dataqueue);
+	if (dataqindex<0 || ports->nexthop[dst_port]<0 || !s->sched->ops->direct) {
+		if (!queuerequest(s->requestqueue,sp_id,dst_sp_id,port,dst_port,datalen,simseconds(s),0)) {
+			sendreject=1;
+			++s->sched->stats.rejects;
+			++s->rejects;
+		}
+		else sendreject=0;
+	}
+	else {
+		dataqueuenode *slot = &s->dataqueue[dataqindex];
+		slot->src_sp_id=sp_id;
+		slot->dst_sp_id=dst_sp_id;
+		slot->src_port=port;
+		slot->dst_port=dst_port;
+		slot->bytesremaining=datalen;
+		schedadmitted(s->sched,s->dataqueue,dataqindex,simseconds(s));
+		startxfer(s->dataqueue,dataqindex);
+	}
+	if (s->log) fprintf(s->log,"%.6f CSP: Receive request from SP %d (%llu bytes to SP %d), %s\n",simseconds(s),sp_id,datalen,dst_sp_id,
+											(sendreject==2)?"accepted":(sendreject?"rejected":"queued in the request queue"));
+	if (sendreject) sendtosp(s,sp_id,sp_id,(sendreject==2)?FRACK:FRREJECT,0,INITFRAMESIZE);
+}
+
+// CSP side, a frame from SP sp_id arrived
+static void csprecv(sim *s,const int sp_id,const int dst_sp_id,const int arg,const unsigned long long value) {
+	porttable *ports = s->ports;
+	s->lastactivity=s->now;
+	// the handshake, the first one tells us how big the group is
+	if (FRAMETYPE(arg)==FRHELLO) {
+		if (!s->numSPprocesses) s->numSPprocesses=(int)value;
+		const int port = portregister(ports,STATIONID(sp_id));
+		ports->nexthop[port]=sp_id;
+		ports->state[port]=SPACTIVE;
+		++ports->joined;
+		++s->members;
+		if (s->log) fprintf(s->log,"%.6f CSP: SP %d joined\n",simseconds(s),sp_id);
+		sendtosp(s,sp_id,sp_id,FRSESSION,0,INITFRAMESIZE*2);
+		// the group already started without it
+		if (s->started) sendtosp(s,sp_id,sp_id,FRBARRIER,0,INITFRAMESIZE);
+		// the whole group is here, every SP starts now
+		else if (ports->joined>=(unsigned long long)s->numSPprocesses) {
+			s->started=1;
+			for (int p=0;p<ports->numports;++p) {
+				if (ports->nexthop[p]<0) continue;
+				const int id = SPFROMSTATION(ports->station[p]);
+				sendtosp(s,id,id,FRBARRIER,0,INITFRAMESIZE);
+			}
+			if (s->log) fprintf(s->log,"%.6f CSP: All %d stations present, sent the start barrier\n",simseconds(s),s->numSPprocesses);
+		}
+		// requests may have been queued for this SP before it joined
+		grantrequests(s);
+		return;
+	}
+	const int port = portlookup(ports,STATIONID(sp_id));
+	// this SP is not waiting anymore
+	if (ports->state[port]==SPWAITING) setstate(s,port,SPACTIVE);
+	// see if it is in the data queue
+	for (int x=0;x<DATAQUEUESIZE;++x) {
+		dataqueuenode *slot = &s->dataqueue[x];
+		if (slot->src_sp_id<0 || slot->src_port!=port) continue;
+		const int payload = FRAMEPAYLOAD(arg);
+		if (s->log) fprintf(s->log,"%.6f CSP: Forwarded data frame (from SP %d) to SP %d\n",simseconds(s),sp_id,slot->dst_sp_id);
+		sendtosp(s,sp_id,slot->dst_sp_id,arg,value,INITFRAMESIZE+payload);
+		slot->dataremaining-=(slot->dataremaining>(unsigned long long)payload)?(unsigned long long)payload:slot->dataremaining;
+		slot->bytesremaining-=(slot->bytesremaining>(unsigned long long)(INITFRAMESIZE+payload))?(unsigned long long)(INITFRAMESIZE+payload):slot->bytesremaining;
+		s->sched->stats.bytesforwarded+=INITFRAMESIZE+payload;
+		if (!slot->dataremaining) {
+			slot->src_sp_id=-1;
+			grantrequests(s);
+		}
+		return;
+	}
+	// a signal frame from the SP for the CSP
+	if (FRAMETYPE(arg)==FRQUIT || FRAMETYPE(arg)==FRWAIT) {
+		if (FRAMETYPE(arg)==FRQUIT) {
+			if (s->log) fprintf(s->log,"%.6f CSP: Received a ready to quit notification from SP %d\n",simseconds(s),sp_id);
+			setstate(s,port,SPDONE);
+		}
+		else {
+			if (s->log) fprintf(s->log,"%.6f CSP: Received a notification that SP %d will wait for %llu packets\n",simseconds(s),sp_id,value);
+			setstate(s,port,SPWAITING);
+		}
+		grantrequests(s);
+		return;
+	}
+	csprequest(s,sp_id,port,dst_sp_id,value);
+	grantrequests(s);
+}
+
+// CSP side, nothing arrived for SIMIDLE, fastserv's select timeout
+// returns 1 when the simulation is over (or can't go on)
+static unsigned char cspidle(sim *s) {
+	porttable *ports = s->ports;
+	// the whole group joined and everyone said they were done, let's quit
+	if (s->numSPprocesses && ports->joined>=(unsigned long long)s->numSPprocesses && s->done==s->members) {
+		for (int p=0;p<ports->numports;++p) {
+			if (ports->nexthop[p]<0) continue;
+			const int sp_id = SPFROMSTATION(ports->station[p]);
+			if (s->log) fprintf(s->log,"%.6f CSP: Sent the quit confirm to SP %d\n",simseconds(s),sp_id);
+			sendtosp(s,sp_id,sp_id,FRBYE,0,INITFRAMESIZE);
+		}
+		s->ending=1;
+		return 0;
+	}
+	// all of the SP processes are done or waiting, wake the waiting ones
+	if (s->members && s->waiting && s->waiting+s->done==s->members) {
+		for (int p=0;p<ports->numports;++p) {
+			if (ports->state[p]!=SPWAITING || ports->nexthop[p]<0) continue;
+			setstate(s,p,SPACTIVE);
+			const int sp_id = SPFROMSTATION(ports->station[p]);
+			if (s->log) fprintf(s->log,"%.6f CSP: Notified SP %d to stop waiting\n",simseconds(s),sp_id);
+			sendtosp(s,sp_id,sp_id,FRWAKE,1,INITFRAMESIZE);
+		}
+		return 0;
+	}
+	// nothing is in flight and nothing will change, the real switch would wait forever
+	return !s->events->count;
+}
+
+// reads the scripts prefix0, prefix1, ... until one doesn't open
+// returns the number of scripts, the array is allocated
+static int loadscripts(const char *prefix,simscript **scripts) {
+	int count=0, maxcount=0;
+	*scripts=NULL;
+	char *filename = (char*)malloc(sizeof(char)*(strlen(prefix)+16));
+	while (1) {
+		sprintf(filename,"%s%d",prefix,count);
+		script *s = loadscript(filename);
+		if (!s) break;
+		if (count==maxcount) {
+			maxcount=maxcount?maxcount<<1:16;
+			*scripts = (simscript*)realloc(*scripts,sizeof(simscript)*maxcount);
+		}
+		simscript *ss = &(*scripts)[count++];
+		ss->s=s;
+		ss->sizes = (unsigned long long*)calloc(s->numcmds?s->numcmds:1,sizeof(unsigned long long));
+		for (int i=0;i<s->numcmds;++i) {
+			const scriptcmd *cmd = &s->cmds[i];
+			if (cmd->op!=SCRIPTFRAME) continue;
+			if (!cmd->file) {
+				ss->sizes[i]=strlen(cmd->text);
+				continue;
+			}
+			// fastcl sends "Error opening: name" in place of a file it can't open
+			struct stat st;
+			if (stat(cmd->text,&st)==0) ss->sizes[i]=(unsigned long long)st.st_size;
+			else ss->sizes[i]=strlen("Error opening: ")+strlen(cmd->text);
+		}
+	}
+	free(filename);
+	return count;
+}
+
+// print usage info, called for bad command line arguments
+static inline void printusage(char *prog) {
+	fprintf(stderr,"Fast Ethernet discrete event simulation\n");
+	fprintf(stderr,"Usage: %s -n [SPs] -in=[input prefix] -out=[log] -sched=[",prog);
+	printschedulers(stderr);
+	fprintf(stderr,"] -seed=[x] -latency=[us] -bandwidth=[Mbps]\n");
+	fprintf(stderr,"The CSP and every SP run in this process on a virtual clock, a run is reproducible from its arguments\n");
+	fprintf(stderr,"SP X runs input script (X modulo the number of scripts), its destinations are offset to its tile of SPs\n");
+	fprintf(stderr,"Without -out only the summary is printed\n");
+}
+
+int main(int argc, char** argv) {
+	int numsps=0;
+	char *inputprefix=NULL, *outfilename=NULL;
+	char *schedname="fifo";
+	unsigned long long seed=1337, latencyus=50, mbps=1000;
+	for (int i=1;i<argc;++i) {
+		char *nextch = strchr(argv[i],'=');
+		if (argv[i][0]!='-') continue;
+		if (strcmp(argv[i],"-h")==0) {
+			printusage(argv[0]);
+			return 0;
+		}
+		if (strcmp(argv[i],"-n")==0) {
+			if (++i<argc) numsps=atoi(argv[i]);
+		}
+		else if (!nextch) continue;
+		else if (strncmp(argv[i],"-n=",3)==0) numsps=atoi(nextch+1);
+		else if (strncmp(argv[i],"-in=",4)==0) inputprefix=nextch+1;
+		else if (strncmp(argv[i],"-out=",5)==0) outfilename=nextch+1;
+		else if (strncmp(argv[i],"-sched=",7)==0) schedname=nextch+1;
+		else if (strncmp(argv[i],"-seed=",6)==0) seed=strtoull(nextch+1,NULL,10);
+		else if (strncmp(argv[i],"-latency=",9)==0) latencyus=strtoull(nextch+1,NULL,10);
+		else if (strncmp(argv[i],"-bandwidth=",11)==0) mbps=strtoull(nextch+1,NULL,10);
+	}
+	if (numsps<1 || !inputprefix || !mbps) {
+		printusage(argv[0]);
+		return 0;
+	}
+	scheduler *sched = newscheduler(schedname);
+	if (!sched) {
+		fprintf(stderr,"SIM: Unknown scheduler \"%s\"\n",schedname);
+		printusage(argv[0]);
+		return 0;
+	}
+	simscript *scripts;
+	const int numscripts = loadscripts(inputprefix,&scripts);
+	if (!numscripts) {
+		fprintf(stderr,"SIM: Unable to open input file %s0\n",inputprefix);
+		freescheduler(sched);
+		return 0;
+	}
+
+	sim *s = (sim*)calloc(1,sizeof(sim));
+	s->events=neweventq();
+	s->rng=seed;
+	s->latency=latencyus*1000ULL;
+	s->mbps=mbps;
+	s->log=outfilename?fopen(outfilename,"w"):NULL;
+	s->numsps=numsps;
+	s->sps=(simsp*)calloc(numsps,sizeof(simsp));
+	s->ports=newporttable();
+	s->sched=sched;
+	for (int i=0;i<DATAQUEUESIZE;++i) s->dataqueue[i].src_sp_id=-1;
+	for (int i=0;i<REQUESTQUEUESIZE;++i) s->requestqueue[i].src_sp_id=-1;
+
+	// every SP connects at a random time in the first millisecond and sends its handshake
+	for (int i=0;i<numsps;++i) {
+		s->sps[i].script=&scripts[i%numscripts];
+		s->sps[i].base=i-i%numscripts;
+		pushsimevent(s,simrandom(s)%SIMCONNECTWINDOW,EVCONNECT,i,i,0,0);
+	}
+
+	const double wallstart = getnow();
+	unsigned long long numevents=0;
+	simevent ev;
+	while (1) {
+		// nothing arrives at the CSP before its select times out
+		if (!s->ending && (!s->events->count || nexteventtime(s->events)>s->lastactivity+SIMIDLE)) {
+			s->now=s->lastactivity+SIMIDLE;
+			s->lastactivity=s->now;
+			if (cspidle(s)) {
+				fprintf(stdout,"SIM: Deadlocked at %.6f s, %d of %d SPs done, %d waiting\n",simseconds(s),s->done,s->members,s->waiting);
+				break;
+			}
+			continue;
+		}
+		if (!popevent(s->events,&ev)) break;
+		++numevents;
+		s->now=ev.time;
+		switch (ev.type) {
+		case EVCONNECT:
+			sendtocsp(s,ev.src,ev.src,FRHELLO,(unsigned long long)numsps,INITFRAMESIZE);
+			break;
+		case EVSTEP:
+			spstep(s,ev.src);
+			break;
+		case EVRESEND:
+			if (s->log) fprintf(s->log,"%.6f SP %d: Resent request to send frame %d, (%llu bytes) to SP %d\n",
+													simseconds(s),ev.src,s->sps[ev.src].seqnum,s->sps[ev.src].totalsize,s->sps[ev.src].dst);
+			sendtocsp(s,ev.src,s->sps[ev.src].dst,FRREQUEST,s->sps[ev.src].totalsize,INITFRAMESIZE);
+			++s->requests;
+			break;
+		case EVTOCSP:
+			csprecv(s,ev.src,ev.dst,ev.arg,ev.value);
+			break;
+		case EVTOSP:
+			sprecv(s,ev.dst,ev.src,ev.arg,ev.value);
+			break;
+		}
+	}
+	const double wall = getnow()-wallstart;
+
+	fprintf(stdout,"SIM: %d SPs, %d input scripts, seed %llu, scheduler %s\n",numsps,numscripts,seed,sched->ops->name);
+	fprintf(stdout,"SIM: %llu events, %.6f virtual seconds, %.3f seconds of wall time\n",numevents,simseconds(s),wall);
+	fprintf(stdout,"SIM: %llu requests (%llu rejected, %llu given up), %llu data frames delivered (%llu bytes)\n",
+					s->requests,s->rejects,s->dropped,s->framesdelivered,s->bytesdelivered);
+	printschedstats(sched,stdout,simseconds(s));
+	if (s->log) fclose(s->log);
+	for (int i=0;i<numscripts;++i) {
+		freescript(scripts[i].s);
+		free(scripts[i].sizes);
+	}
+	free(scripts);
+	freeeventq(s->events);
+	freeporttable(s->ports);
+	freescheduler(sched);
+	free(s->sps);
+	free(s);
+	return 0;
+}
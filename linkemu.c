@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <string.h>
+#include "linkemu.h"
+
+// starting size of the per port arrays, they grow by doubling
+#define LINKMINPORTS 16
+
+// the wheel tick of time t, rounded up so a frame never leaves before its time
+static inline unsigned long long linktick(linkemu *link,const double t) {
+	const double ticks = (t-link->start)/LINKTICK;
+	if (ticks<=0) return 0;
+	const unsigned long long whole = (unsigned long long)ticks;
+	return whole+((double)whole<ticks);
+}
+
+static void growports(linkemu *link,const int port) {
+	if (port<link->maxports) return;
+	int maxports = link->maxports?link->maxports:LINKMINPORTS;
+	while (maxports<=port) maxports<<=1;
+	link->uptokens = (double*)realloc(link->uptokens,sizeof(double)*maxports);
+	link->uptokensat = (double*)realloc(link->uptokensat,sizeof(double)*maxports);
+	link->downtokens = (double*)realloc(link->downtokens,sizeof(double)*maxports);
+	link->downtokensat = (double*)realloc(link->downtokensat,sizeof(double)*maxports);
+	link->head = (heldframe**)realloc(link->head,sizeof(heldframe*)*maxports);
+	link->tail = (heldframe**)realloc(link->tail,sizeof(heldframe*)*maxports);
+	link->held = (int*)realloc(link->held,sizeof(int)*maxports);
+	// new links start with a full bucket
+	for (int p=link->maxports;p<maxports;++p) {
+		link->uptokens[p]=LINKBURST;
+		link->uptokensat[p]=link->start;
+		link->downtokens[p]=LINKBURST;
+		link->downtokensat[p]=link->start;
+		link->head[p]=NULL;
+		link->tail[p]=NULL;
+		link->held[p]=0;
+	}
+	timergrow(link->wheel,maxports);
+	link->maxports=maxports;
+}
+
+linkemu *newlinkemu(const double mbps,const double latencyus,const double now) {
+	linkemu *link = (linkemu*)calloc(1,sizeof(linkemu));
+	link->rate=mbps*1e6/8.0;
+	link->latency=latencyus/1e6;
+	link->start=now;
+	link->wheel=newtimerwheel(0);
+	growports(link,0);
+	return link;
+}
+
+void freelinkemu(linkemu *link) {
+	if (!link) return;
+	for (int p=0;p<link->maxports;++p) {
+		while (link->head[p]) {
+			heldframe *frame = link->head[p];
+			link->head[p]=frame->next;
+			free(frame);
+		}
+	}
+	while (link->freeframes) {
+		heldframe *frame = link->freeframes;
+		link->freeframes=frame->next;
+		free(frame);
+	}
+	free(link->uptokens);
+	free(link->uptokensat);
+	free(link->downtokens);
+	free(link->downtokensat);
+	free(link->head);
+	free(link->tail);
+	free(link->held);
+	freetimerwheel(link->wheel);
+	free(link);
+}
+
+// charges length bytes to a token bucket at time t, returns when they have all left
+// the bucket refills at the link rate up to LINKBURST, a frame bigger than what is left puts it in debt
+static inline double bucketcharge(linkemu *link,double *tokens,double *tokensat,const int length,const double t) {
+	if (link->rate<=0) return t;
+	const double base = (t>*tokensat)?t:*tokensat;
+	*tokens+=(base-*tokensat)*link->rate;
+	if (*tokens>LINKBURST) *tokens=LINKBURST;
+	*tokensat=base;
+	*tokens-=length;
+	return (*tokens>=0)?base:base-*tokens/link->rate;
+}
+
+double linkdeparture(linkemu *link,const int src,const int port,const unsigned char local,const int length,const double now) {
+	growports(link,src>port?src:port);
+	double t = now;
+	if (src>=0) t=bucketcharge(link,&link->uptokens[src],&link->uptokensat[src],length,t)+link->latency;
+	if (local) t=bucketcharge(link,&link->downtokens[port],&link->downtokensat[port],length,t)+link->latency;
+	return t;
+}
+
+void linkhold(linkemu *link,const int port,const unsigned long long station,unsigned char *buffer,const int length,const double release,const double now) {
+	growports(link,port);
+	heldframe *frame = link->freeframes;
+	if (frame) link->freeframes=frame->next;
+	else frame = (heldframe*)malloc(sizeof(heldframe));
+	frame->next=NULL;
+	frame->since=now;
+	frame->station=station;
+	frame->length=length;
+	memcpy((void*)frame->buffer,(void*)buffer,sizeof(unsigned char)*length);
+	// never ahead of the frame in front of it
+	frame->release=(link->tail[port] && link->tail[port]->release>release)?link->tail[port]->release:release;
+	if (link->tail[port]) link->tail[port]->next=frame;
+	else {
+		link->head[port]=frame;
+		timeradd(link->wheel,port,linktick(link,frame->release));
+	}
+	link->tail[port]=frame;
+	++link->held[port];
+	++link->framesheld;
+	if (++link->pending>link->mostheld) link->mostheld=link->pending;
+}
+
+heldframe *linkdue(linkemu *link,const double now,int *port) {
+	const unsigned long long tick = linktick(link,now);
+	timeradvance(link->wheel,tick);
+	int p;
+	while ((p=timerpop(link->wheel))>=0) {
+		heldframe *frame = link->head[p];
+		if (!frame) continue;
+		// a timer past the wheel's reach went off early, set it again
+		if (linktick(link,frame->release)>tick) {
+			timeradd(link->wheel,p,linktick(link,frame->release));
+			continue;
+		}
+		link->head[p]=frame->next;
+		if (link->head[p]) timeradd(link->wheel,p,linktick(link,link->head[p]->release));
+		else link->tail[p]=NULL;
+		--link->held[p];
+		--link->pending;
+		link->holdtime+=now-frame->since;
+		*port=p;
+		return frame;
+	}
+	return NULL;
+}
+
+void linkdone(linkemu *link,heldframe *frame) {
+	frame->next=link->freeframes;
+	link->freeframes=frame;
+}
+
+double linknext(linkemu *link,const double now) {
+	if (!link->pending) return -1;
+	const unsigned long long ticks = timernext(link->wheel);
+	if (ticks==TIMERNONE) return -1;
+	const double wait = link->start+(double)(link->wheel->now+ticks)*LINKTICK-now;
+	return wait>0?wait:0;
+}
+
+void printlinkstats(linkemu *link,FILE *outfile) {
+	fprintf(outfile,"CSP: Link emulation, ");
+	if (link->rate>0) fprintf(outfile,"%.1f Mbps",link->rate*8.0/1e6);
+	else fprintf(outfile,"no bandwidth limit");
+	fprintf(outfile," and %.1f us latency each way\n",link->latency*1e6);
+	fprintf(outfile,"CSP:   %llu data frames held (at most %llu at once), mean hold %.1f us\n",
+					link->framesheld,link->mostheld,link->framesheld?1e6*link->holdtime/link->framesheld:0);
+}
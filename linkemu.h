@@ -0,0 +1,77 @@
+#ifndef _FASTETH_LINKEMU_H
+#define _FASTETH_LINKEMU_H
+
+#include <stdio.h>
+#include "common.h"
+#include "timerwheel.h"
+
+// link emulation for the CSP, fastserv -bandwidth=[Mbps] -latency=[us]
+// every port has an uplink (SP to switch) and a downlink (switch to SP), each a token bucket at the link rate
+// holding up to LINKBURST bytes, and each adds the one way latency
+// a data frame from a local SP pays its uplink, a frame to a local SP pays that SP's downlink,
+// so a frame between two SPs of one switch pays both and a frame through a trunk pays each end on its own switch
+// a frame that may not leave yet is copied and held on its destination port, the port's timer on the
+// wheel is set for the frame at the head of the port, frames to a port leave in the order they came
+// control frames are not shaped
+#define LINKBURST (4*MAXFRAMESIZE)
+// frames a port holds before the CSP stops reading from the SPs sending to it
+#define LINKMAXHELD 64
+// a wheel tick in seconds
+#define LINKTICK 1e-6
+
+// a data frame waiting on its port, for the station that was there when it came in
+typedef struct heldframe {
+	struct heldframe *next;
+	double release;
+	double since;
+	unsigned long long station;
+	int length;
+	unsigned char buffer[MAXFRAMESIZE];
+}heldframe;
+
+typedef struct linkemu {
+	double rate; // bytes per second, zero for no limit
+	double latency; // seconds each way
+	double start; // the time of tick zero
+	// per port arrays, grown with the port indices used
+	int maxports;
+	double *uptokens, *uptokensat;
+	double *downtokens, *downtokensat;
+	heldframe **head, **tail;
+	int *held;
+	timerwheel *wheel;
+	heldframe *freeframes;
+	// statistics
+	unsigned long long pending; // frames held right now
+	unsigned long long framesheld, mostheld;
+	double holdtime;
+}linkemu;
+
+// links of mbps (zero for no limit) and latencyus microseconds each way, from now
+linkemu *newlinkemu(const double mbps,const double latencyus,const double now);
+void freelinkemu(linkemu *link);
+
+// the time a frame of length bytes leaves the switch for port, coming in at now from local port src (-1 from a trunk)
+// local says the station at port is connected to this switch, the frame is charged to the buckets it crosses
+double linkdeparture(linkemu *link,const int src,const int port,const unsigned char local,const int length,const double now);
+
+// the frames port is holding
+static inline int linkbacklog(linkemu *link,const int port) {
+	return port<link->maxports?link->held[port]:0;
+}
+
+// holds a copy of the frame for the station at port until release (or until the frames ahead of it leave)
+void linkhold(linkemu *link,const int port,const unsigned long long station,unsigned char *buffer,const int length,const double release,const double now);
+
+// the next held frame that is due by now, removed from its port (written to *port), NULL when none is due
+// the caller sends it and gives it back with linkdone
+heldframe *linkdue(linkemu *link,const double now,int *port);
+void linkdone(linkemu *link,heldframe *frame);
+
+// seconds from now until linkdue should be called again, negative if nothing is held
+double linknext(linkemu *link,const double now);
+
+// prints the link settings and the held frame counters
+void printlinkstats(linkemu *link,FILE *outfile);
+
+#endif // _FASTETH_LINKEMU_H
@@ -0,0 +1,111 @@
+#include <string.h>
+#include "lz.h"
+
+static inline unsigned int read32(const unsigned char *p) {
+	unsigned int x;
+	memcpy((void*)&x,(const void*)p,sizeof(unsigned int));
+	return x;
+}
+
+// writes the rest of a 4 bit length that was 15 or more, returns 0 if it doesn't fit
+static inline unsigned char putlength(unsigned char *dst,int *op,const int dstcap,int length) {
+	for (length-=15;length>=255;length-=255) {
+		if (*op>=dstcap) return 0;
+		dst[(*op)++]=255;
+	}
+	if (*op>=dstcap) return 0;
+	dst[(*op)++]=(unsigned char)length;
+	return 1;
+}
+
+// writes one sequence, matchlength 0 for the last one (literals only)
+// returns 0 if it doesn't fit
+static unsigned char putsequence(unsigned char *dst,int *op,const int dstcap,const unsigned char *literals,const int literallength,
+																	const int offset,const int matchlength) {
+	const int matchcode = matchlength?matchlength-LZMINMATCH:0;
+	if (*op>=dstcap) return 0;
+	dst[(*op)++]=(unsigned char)(((literallength<15?literallength:15)<<4)|(matchcode<15?matchcode:15));
+	if (literallength>=15 && !putlength(dst,op,dstcap,literallength)) return 0;
+	if (*op+literallength>dstcap) return 0;
+	memcpy((void*)(dst+*op),(const void*)literals,literallength);
+	*op+=literallength;
+	if (!matchlength) return 1;
+	if (*op+2>dstcap) return 0;
+	dst[(*op)++]=(unsigned char)(offset&0xFF);
+	dst[(*op)++]=(unsigned char)(offset>>8);
+	if (matchcode>=15 && !putlength(dst,op,dstcap,matchcode)) return 0;
+	return 1;
+}
+
+// compresses srclen bytes of src into dst, which holds dstcap bytes
+// returns the compressed length, or 0 if it doesn't fit in dstcap
+int lzcompress(const unsigned char *src,const int srclen,unsigned char *dst,const int dstcap) {
+	// the last position each 4 byte sequence was seen, hashed
+	int table[1<<LZHASHBITS];
+	for (int i=0;i<(1<<LZHASHBITS);++i) table[i]=-1;
+	int ip=0, anchor=0, op=0;
+	while (ip+LZMINMATCH<=srclen) {
+		const unsigned int sequence = read32(src+ip);
+		const unsigned int h = (sequence*2654435761U)>>(32-LZHASHBITS);
+		const int ref = table[h];
+		table[h]=ip;
+		if (ref<0 || ip-ref>0xFFFF || read32(src+ref)!=sequence) {
+			++ip;
+			continue;
+		}
+		int length=LZMINMATCH;
+		while (ip+length<srclen && src[ref+length]==src[ip+length]) ++length;
+		if (!putsequence(dst,&op,dstcap,src+anchor,ip-anchor,ip-ref,length)) return 0;
+		ip+=length;
+		anchor=ip;
+	}
+	if (!putsequence(dst,&op,dstcap,src+anchor,srclen-anchor,0,0)) return 0;
+	return op;
+}
+
+// reads the rest of a 4 bit length that was 15, returns -1 past the end of src
+static inline int getlength(const unsigned char *src,int *ip,const int srclen) {
+	int length=0;
+	unsigned char byte;
+	do {
+		if (*ip>=srclen) return -1;
+		byte=src[(*ip)++];
+		length+=byte;
+	} while (byte==255);
+	return length;
+}
+
+// decompresses srclen bytes of src into dst, which holds dstcap bytes
+// returns the decompressed length, or -1 for a malformed block
+int lzdecompress(const unsigned char *src,const int srclen,unsigned char *dst,const int dstcap) {
+	int ip=0, op=0;
+	while (ip<srclen) {
+		const unsigned char token = src[ip++];
+		int literallength = token>>4;
+		if (literallength==15) {
+			const int more = getlength(src,&ip,srclen);
+			if (more<0) return -1;
+			literallength+=more;
+		}
+		if (ip+literallength>srclen || op+literallength>dstcap) return -1;
+		memcpy((void*)(dst+op),(const void*)(src+ip),literallength);
+		ip+=literallength;
+		op+=literallength;
+		// the last sequence has no match
+		if (ip==srclen) break;
+		if (ip+2>srclen) return -1;
+		const int offset = src[ip]|(src[ip+1]<<8);
+		ip+=2;
+		int matchlength = token&0xF;
+		if (matchlength==15) {
+			const int more = getlength(src,&ip,srclen);
+			if (more<0) return -1;
+			matchlength+=more;
+		}
+		matchlength+=LZMINMATCH;
+		if (!offset || offset>op || op+matchlength>dstcap) return -1;
+		// byte by byte, the match may overlap what it is copying
+		for (int i=0;i<matchlength;++i,++op) dst[op]=dst[op-offset];
+	}
+	return op;
+}
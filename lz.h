@@ -0,0 +1,21 @@
+#ifndef _FASTETH_LZ_H
+#define _FASTETH_LZ_H
+
+// a small LZ77 block codec for data frame payloads, no dictionary is kept between blocks
+// a block is a run of sequences, each sequence is:
+// a token byte, high 4 bits literal count, low 4 bits match length minus LZMINMATCH
+// (15 in either half means more length follows in bytes, a byte below 255 ends it)
+// the literals, then a 2 byte little endian match offset and the match
+// the last sequence ends with its literals, it has no match
+#define LZMINMATCH 4
+#define LZHASHBITS 12
+
+// compresses srclen bytes of src into dst, which holds dstcap bytes
+// returns the compressed length, or 0 if it doesn't fit in dstcap
+int lzcompress(const unsigned char *src,const int srclen,unsigned char *dst,const int dstcap);
+
+// decompresses srclen bytes of src into dst, which holds dstcap bytes
+// returns the decompressed length, or -1 for a malformed block
+int lzdecompress(const unsigned char *src,const int srclen,unsigned char *dst,const int dstcap);
+
+#endif // _FASTETH_LZ_H
@@ -0,0 +1,372 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "queues.h"
+#include "sched.h"
+#include "porttable.h"
+#include "crc32c.h"
+#include "timerwheel.h"
+
+// per operation costs of the CSP's hot path primitives, each timed on its own
+// a benchmark runs its operation in batches, a sample is the time of one batch divided by the batch size
+// the warm-up samples are thrown away, the rest are sorted for the percentiles
+// the queue benchmarks run at each queue depth (requests already queued), the scheduler and port table
+// benchmarks at each SP count (ports in use, the scheduler's queue is half full)
+// the queue sizes themselves are compile time constants
+
+#define MAXLISTLEN 16
+// operations per sample for the benchmarks whose operations are shorter than a clock read
+#define SHORTBATCH 64
+
+// what every benchmark works on, setup fills in what its operation needs
+typedef struct benchstate {
+	int depth; // requests queued before the operation
+	int sps; // SP count
+	requestqueuenode requestqueue[REQUESTQUEUESIZE];
+	requestqueuenode snapshot[REQUESTQUEUESIZE];
+	dataqueuenode *dataqueue;
+	scheduler *sched;
+	porttable *ports;
+	timerwheel *wheel;
+	int *reach;
+	int moved[DATAQUEUESIZE];
+	int sockets[2];
+	unsigned char frame[MAXFRAMESIZE];
+	unsigned long long rng;
+	unsigned long long sink; // results land here so the compiler keeps the operations
+}benchstate;
+
+// one benchmark, reset runs untimed before every sample (it may be NULL)
+typedef struct bench {
+	const char *name;
+	const char *param; // "depth", "sps", or NULL when it takes neither
+	int batch;
+	void (*setup)(benchstate *state);
+	void (*reset)(benchstate *state);
+	void (*op)(benchstate *state);
+}bench;
+
+// splitmix64, spreads the SP ids of the queued requests
+static inline unsigned long long benchrandom(benchstate *state) {
+	state->rng += 0x9e3779b97f4a7c15ULL;
+	return hashstation(state->rng);
+}
+
+// a random request between the SPs of the benchmark
+static inline void randomrequest(benchstate *state,requestqueuenode *node) {
+	node->src_port=(int)(benchrandom(state)%state->sps);
+	node->dst_port=(int)(benchrandom(state)%state->sps);
+	if (node->dst_port==node->src_port) node->dst_port=(node->dst_port+1)%state->sps;
+	node->src_sp_id=node->src_port;
+	node->dst_sp_id=node->dst_port;
+	node->datasize=MAXFRAMESIZE;
+	node->queuedat=0;
+}
+
+// fills the request queue with depth random requests and keeps a copy to restore it from
+static void fillqueues(benchstate *state) {
+	for (int i=0;i<REQUESTQUEUESIZE;++i) {
+		if (i<state->depth) randomrequest(state,&state->requestqueue[i]);
+		else state->requestqueue[i].src_sp_id=-1;
+	}
+	memcpy((void*)state->snapshot,(void*)state->requestqueue,sizeof(requestqueuenode)*REQUESTQUEUESIZE);
+	for (int i=0;i<DATAQUEUESIZE;++i) state->dataqueue[i].src_sp_id=-1;
+}
+
+static void restorequeues(benchstate *state) {
+	memcpy((void*)state->requestqueue,(void*)state->snapshot,sizeof(requestqueuenode)*REQUESTQUEUESIZE);
+	for (int i=0;i<DATAQUEUESIZE;++i) state->dataqueue[i].src_sp_id=-1;
+}
+
+// the header codec
+static void opencode(benchstate *state) {
+	intinbuffer(state->frame,(int)state->sink);
+	intinbuffer(state->frame+4,(int)state->sink+1);
+	ullinbuffer(state->frame+8,state->sink);
+	state->sink+=state->frame[15];
+}
+
+static void opdecode(benchstate *state) {
+	state->sink+=(unsigned long long)intfrombuffer(state->frame)+(unsigned long long)intfrombuffer(state->frame+4)+ullfrombuffer(state->frame+8);
+	state->frame[15]^=(unsigned char)state->sink;
+}
+
+// queuerequest into a queue holding depth requests, the new request is taken out again (one store)
+static void opqueuerequest(benchstate *state) {
+	state->sink+=queuerequest(state->requestqueue,1,2,1,2,MAXFRAMESIZE,0,0);
+	if (state->depth<REQUESTQUEUESIZE) state->requestqueue[state->depth].src_sp_id=-1;
+}
+
+// getrequest from the front of a queue holding depth requests, the request goes back on the end
+static void opgetrequest(benchstate *state) {
+	requestqueuenode result;
+	result.src_sp_id=-1;
+	getrequest(state->requestqueue,&result);
+	if (result.src_sp_id>=0) state->requestqueue[state->depth-1]=result;
+	state->sink+=result.datasize;
+}
+
+// getnextdataqindex, depth is the number of occupied data queue slots (up to DATAQUEUESIZE)
+static void setupdataqindex(benchstate *state) {
+	for (int i=0;i<DATAQUEUESIZE;++i) state->dataqueue[i].src_sp_id=i<state->depth?i:-1;
+}
+
+static void opdataqindex(benchstate *state) {
+	state->sink+=getnextdataqindex(state->dataqueue);
+	// keeps the scan from being hoisted out of the batch
+	__asm__ __volatile__("" ::: "memory");
+}
+
+// purgeport of the source of the first queued request, the queue is restored before every purge
+static void oppurgeport(benchstate *state) {
+	requestqueuenode removed[REQUESTQUEUESIZE];
+	state->sink+=purgeport(state->requestqueue,state->dataqueue,state->requestqueue[0].src_port,removed);
+}
+
+// the scheduling pass, the request queue is restored before every pass
+static void setupschedule(benchstate *state) {
+	state->reach=(int*)realloc(state->reach,sizeof(int)*state->sps);
+	for (int p=0;p<state->sps;++p) state->reach[p]=p+3;
+	fillqueues(state);
+}
+
+static void opschedule(benchstate *state) {
+	state->sink+=schedule(state->sched,state->requestqueue,state->dataqueue,state->reach,state->sps,0,state->moved);
+}
+
+// the port table with sps stations, lookups of random registered stations
+static void setupports(benchstate *state) {
+	freeporttable(state->ports);
+	state->ports=newporttable();
+	for (int p=0;p<state->sps;++p) portregister(state->ports,STATIONID(p));
+}
+
+static void opportlookup(benchstate *state) {
+	state->sink+=portlookup(state->ports,STATIONID(benchrandom(state)%state->sps));
+}
+
+// a station leaving and joining again, the table stays at sps stations
+static void opportchurn(benchstate *state) {
+	const int sp_id = (int)(benchrandom(state)%state->sps);
+	portderegister(state->ports,portlookup(state->ports,STATIONID(sp_id)));
+	state->sink+=portregister(state->ports,STATIONID(sp_id));
+}
+
+// sendbuffer then rcvbuffer of a header or a full frame over a socketpair
+static void setupsockets(benchstate *state) {
+	if (state->sockets[0]>=0) return;
+	if (socketpair(AF_UNIX,SOCK_STREAM,0,state->sockets)) {
+		fprintf(stderr,"BENCH: Unable to create a socketpair\n");
+		exit(1);
+	}
+}
+
+static void opsendrcvheader(benchstate *state) {
+	sendbuffer(state->sockets[0],(void*)state->frame,sizeof(unsigned char)*INITFRAMESIZE);
+	state->sink+=rcvbuffer(state->sockets[1],(void*)state->frame,sizeof(unsigned char)*INITFRAMESIZE);
+}
+
+static void opsendrcvframe(benchstate *state) {
+	sendbuffer(state->sockets[0],(void*)state->frame,sizeof(unsigned char)*MAXFRAMESIZE);
+	state->sink+=rcvbuffer(state->sockets[1],(void*)state->frame,sizeof(unsigned char)*MAXFRAMESIZE);
+}
+
+// the link emulation's timer wheel with a timer on each of sps ports, due within LINKBENCHSPAN ticks
+// an operation runs the wheel a tick and sets every timer that went off again, as releasing a frame does
+#define LINKBENCHSPAN 4096
+static void setupwheel(benchstate *state) {
+	freetimerwheel(state->wheel);
+	state->wheel=newtimerwheel(0);
+	timergrow(state->wheel,state->sps);
+	for (int p=0;p<state->sps;++p) timeradd(state->wheel,p,benchrandom(state)%LINKBENCHSPAN);
+}
+
+static void optimerwheel(benchstate *state) {
+	timerwheel *w = state->wheel;
+	timeradvance(w,w->now);
+	int timer;
+	while ((timer=timerpop(w))>=0) {
+		timeradd(w,timer,w->now+benchrandom(state)%LINKBENCHSPAN);
+		++state->sink;
+	}
+}
+
+// the checksum of a full frame, once per CRC32C implementation the CPU runs
+static void opcrc32c(benchstate *state) {
+	state->sink+=crc32c(0,state->frame,MAXFRAMESIZE);
+	state->frame[0]^=(unsigned char)state->sink;
+}
+
+// the schedulers are benchmarked by name, the scheduler is made in main
+static const bench benches[] = {
+	{ "header encode", NULL, SHORTBATCH, NULL, NULL, opencode },
+	{ "header decode", NULL, SHORTBATCH, NULL, NULL, opdecode },
+	{ "queuerequest", "depth", SHORTBATCH, fillqueues, NULL, opqueuerequest },
+	{ "getrequest", "depth", SHORTBATCH, fillqueues, NULL, opgetrequest },
+	{ "getnextdataqindex", "depth", SHORTBATCH, setupdataqindex, NULL, opdataqindex },
+	{ "purgeport", "depth", 1, fillqueues, restorequeues, oppurgeport },
+	{ "schedule", "sps", 1, setupschedule, restorequeues, opschedule },
+	{ "portlookup", "sps", SHORTBATCH, setupports, NULL, opportlookup },
+	{ "portderegister+portregister", "sps", SHORTBATCH, setupports, NULL, opportchurn },
+	{ "sendbuffer+rcvbuffer header", NULL, SHORTBATCH, setupsockets, NULL, opsendrcvheader },
+	{ "sendbuffer+rcvbuffer frame", NULL, 8, setupsockets, NULL, opsendrcvframe },
+	{ "crc32c frame", NULL, 8, NULL, NULL, opcrc32c },
+	{ "timeradvance+timeradd", "sps", SHORTBATCH, setupwheel, NULL, optimerwheel },
+};
+#define NUMBENCHES (sizeof(benches)/sizeof(bench))
+
+static int comparedoubles(const void *a,const void *b) {
+	const double x = *(const double*)a, y = *(const double*)b;
+	return x<y?-1:(x>y);
+}
+
+// runs warmup+iters samples of b and prints a line of nanoseconds per operation
+static void runbench(const bench *b,benchstate *state,const char *label,const int param,
+											const int warmup,const int iters,double *samples,FILE *outfile) {
+	if (b->setup) b->setup(state);
+	for (int i=0;i<warmup+iters;++i) {
+		if (b->reset) b->reset(state);
+		const double start = getnow();
+		for (int j=0;j<b->batch;++j) b->op(state);
+		const double elapsed = getnow()-start;
+		if (i>=warmup) samples[i-warmup]=elapsed*1e9/b->batch;
+	}
+	qsort((void*)samples,iters,sizeof(double),comparedoubles);
+	double sum=0;
+	for (int i=0;i<iters;++i) sum+=samples[i];
+	char name[96];
+	if (b->param) snprintf(name,sizeof(name),"%s %s=%d",label,b->param,param);
+	else snprintf(name,sizeof(name),"%s",label);
+	fprintf(outfile,"%-44s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",name,sum/iters,samples[0],
+					samples[iters/2],samples[(int)(iters*0.9)],samples[(int)(iters*0.99)],samples[iters-1]);
+}
+
+// reads a comma separated list of positive numbers, returns how many were read
+static int parselist(const char *text,int *list) {
+	int count=0;
+	while (*text && count<MAXLISTLEN) {
+		char *end;
+		const long value = strtol(text,&end,10);
+		if (end==text) break;
+		if (value>0) list[count++]=(int)value;
+		text=*end==','?end+1:end;
+	}
+	return count;
+}
+
+static inline void printusage(char *prog) {
+	fprintf(stderr,"Fast Ethernet microbenchmarks\n");
+	fprintf(stderr,"Usage: %s -iters=[samples] -warmup=[samples] -depth=[n,n,...] -sps=[n,n,...] -only=[name] -out=[filename]\n",prog);
+	fprintf(stderr,"Times the header codec, the request/data queue operations, the schedulers, the port table,\n");
+	fprintf(stderr,"and sendbuffer/rcvbuffer over a socketpair, in nanoseconds per operation\n");
+	fprintf(stderr,"Queue depths go up to the request queue size (%d here), a bigger queue needs a rebuild:\n",REQUESTQUEUESIZE);
+	fprintf(stderr,"make microbench BENCHFLAGS=\"-DREQUESTQUEUESIZE=256 -DDATAQUEUESIZE=16\"\n");
+	fprintf(stderr,"-only runs the benchmarks whose name contains the text\n");
+}
+
+int main(int argc, char** argv) {
+	int iters=10000, warmup=1000;
+	int depths[MAXLISTLEN] = { 1, (REQUESTQUEUESIZE+1)/2, REQUESTQUEUESIZE };
+	int numdepths = 3;
+	int spcounts[MAXLISTLEN] = { 16, 256, 4096 };
+	int numspcounts = 3;
+	char *only = NULL;
+	char *outfilename = NULL;
+	for (int i=1;i<argc;++i) {
+		char *nextch = strchr(argv[i],'=');
+		if (argv[i][0]!='-') continue;
+		if (strcmp(argv[i],"-h")==0 || !nextch) {
+			printusage(argv[0]);
+			return 0;
+		}
+		if (strncmp(argv[i],"-iters=",7)==0) iters=atoi(nextch+1);
+		else if (strncmp(argv[i],"-warmup=",8)==0) warmup=atoi(nextch+1);
+		else if (strncmp(argv[i],"-depth=",7)==0) numdepths=parselist(nextch+1,depths);
+		else if (strncmp(argv[i],"-sps=",5)==0) numspcounts=parselist(nextch+1,spcounts);
+		else if (strncmp(argv[i],"-only=",6)==0) only=nextch+1;
+		else if (strncmp(argv[i],"-out=",5)==0) outfilename=nextch+1;
+		else {
+			printusage(argv[0]);
+			return 0;
+		}
+	}
+	if (iters<1 || warmup<0 || !numdepths || !numspcounts) {
+		printusage(argv[0]);
+		return 0;
+	}
+	FILE *outfile=NULL;
+	if (outfilename) outfile = fopen(outfilename,"w");
+	if (!outfile) outfile=stdout;
+
+	benchstate *state = (benchstate*)calloc(1,sizeof(benchstate));
+	state->dataqueue = (dataqueuenode*)malloc(sizeof(dataqueuenode)*DATAQUEUESIZE);
+	state->sockets[0]=state->sockets[1]=-1;
+	state->rng=1337;
+	double *samples = (double*)malloc(sizeof(double)*iters);
+
+	fprintf(outfile,"BENCH: %d samples after %d warm-up samples, request queue %d, data queue %d\n",
+					iters,warmup,REQUESTQUEUESIZE,DATAQUEUESIZE);
+	// the benchmarks timed one operation per sample include a clock read
+	const double clockstart = getnow();
+	for (int i=0;i<iters;++i) state->sink+=(unsigned long long)getnow();
+	fprintf(outfile,"BENCH: a clock read costs %.1f ns, samples of one operation (purgeport, schedule) include it\n",
+					(getnow()-clockstart)*1e9/iters);
+	fprintf(outfile,"%-44s %10s %10s %10s %10s %10s %10s\n","ns per operation","mean","min","p50","p90","p99","max");
+	const char *schednames[] = { "fifo", "islip", "mwm" };
+	const char *crcnames[] = { "table", "sse4.2", "pclmul" };
+	for (unsigned int b=0;b<NUMBENCHES;++b) {
+		const bench *bm = &benches[b];
+		// the scheduler benchmark runs once per scheduler, the checksum once per implementation
+		const int rounds = (bm->op==opschedule || bm->op==opcrc32c)?3:1;
+		for (int r=0;r<rounds;++r) {
+			char label[64];
+			if (bm->op==opschedule) {
+				snprintf(label,sizeof(label),"%s %s",bm->name,schednames[r]);
+				state->sched=newscheduler(schednames[r]);
+			}
+			else if (bm->op==opcrc32c) {
+				if (!crc32cselect(crcnames[r])) continue;
+				snprintf(label,sizeof(label),"%s %s",bm->name,crcnames[r]);
+			}
+			else snprintf(label,sizeof(label),"%s",bm->name);
+			if (only && !strstr(label,only)) {
+				freescheduler(state->sched);
+				state->sched=NULL;
+				continue;
+			}
+			const unsigned char byspcount = bm->param && bm->param[0]=='s';
+			const int *params = byspcount?spcounts:depths;
+			const int numparams = !bm->param?1:(byspcount?numspcounts:numdepths);
+			int lastdepth=-1;
+			for (int i=0;i<numparams;++i) {
+				// a depth past the size of the queue runs at the size, once
+				const int size = bm->op==opdataqindex?DATAQUEUESIZE:REQUESTQUEUESIZE;
+				state->depth=byspcount?(REQUESTQUEUESIZE+1)/2:(params[i]<size?params[i]:size);
+				if (!byspcount && state->depth==lastdepth) continue;
+				lastdepth=state->depth;
+				// every request needs a src and a different dst
+				state->sps=byspcount?(params[i]>1?params[i]:2):16;
+				runbench(bm,state,label,byspcount?state->sps:state->depth,warmup,iters,samples,outfile);
+			}
+			freescheduler(state->sched);
+			state->sched=NULL;
+		}
+	}
+	// keeps the results of every operation alive
+	if (state->sink==0x5a5a5a5a5a5a5a5aULL) fprintf(outfile,"\n");
+
+	if (state->sockets[0]>=0) {
+		close(state->sockets[0]);
+		close(state->sockets[1]);
+	}
+	freeporttable(state->ports);
+	freetimerwheel(state->wheel);
+	free(state->reach);
+	free(state->dataqueue);
+	free(state);
+	free(samples);
+	if (outfile!=stdout) fclose(outfile);
+	return 0;
+}
@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "common.h"
+#include "mirror.h"
+
+// the pcap file header and packet record header, in the byte order of the machine writing them
+// (readers tell it from the magic number), timestamps have microseconds
+#define PCAPMAGIC 0xa1b2c3d4
+#define PCAPVERSIONMAJOR 2
+#define PCAPVERSIONMINOR 4
+
+// writes the pcap file header for packets of at most snaplen bytes, returns 0 for failure
+static unsigned char writepcapheader(FILE *file,const int snaplen) {
+	const uint32_t magic = PCAPMAGIC;
+	const uint16_t version[2] = {PCAPVERSIONMAJOR,PCAPVERSIONMINOR};
+	const int32_t thiszone = 0;
+	const uint32_t rest[3] = {0,(uint32_t)snaplen,LINKTYPEUSER0}; // sigfigs, snaplen, link type
+	return fwrite((const void*)&magic,sizeof(magic),1,file)==1 && fwrite((const void*)version,sizeof(version),1,file)==1
+		&& fwrite((const void*)&thiszone,sizeof(thiszone),1,file)==1 && fwrite((const void*)rest,sizeof(rest),1,file)==1;
+}
+
+mirror *newmirror(const unsigned int rate,const int snaplen,const int monitor,const char *capturefile) {
+	mirror *m = (mirror*)calloc(1,sizeof(mirror));
+	m->rate=rate;
+	// a copy has at least the header and fits a frame
+	m->snaplen=(snaplen<INITFRAMESIZE)?INITFRAMESIZE:(snaplen>MAXFRAMESIZE)?MAXFRAMESIZE:snaplen;
+	m->monitor=monitor;
+	if (capturefile) {
+		if (!(m->capture=fopen(capturefile,"wb")) || !writepcapheader(m->capture,m->snaplen)) {
+			if (m->capture) fclose(m->capture);
+			free(m);
+			return NULL;
+		}
+	}
+	return m;
+}
+
+void freemirror(mirror *m) {
+	if (!m) return;
+	if (m->capture) fclose(m->capture);
+	free(m);
+}
+
+// sends the copy of the frame to the monitor, if it is on its own connection to this switch
+// a frame to the monitor itself isn't copied to it
+static void sendmonitor(mirror *m,porttable *ports,const unsigned char *buffer,const int length) {
+	if (intfrombuffer((unsigned char*)buffer+4)==m->monitor) return;
+	const int port = portlookup(ports,STATIONID(m->monitor));
+	if (port<0 || ports->fd[port]<0 || ports->mux[port]>=0) {
+		++m->missed;
+		return;
+	}
+	// the size field says what was copied, the checksum trailer isn't
+	unsigned char copy[MAXFRAMESIZE];
+	const int field = intfrombuffer((unsigned char*)buffer+12);
+	int payload = framepayload(field);
+	if (payload>length-INITFRAMESIZE) payload=length-INITFRAMESIZE;
+	if (payload>m->snaplen-INITFRAMESIZE) payload=m->snaplen-INITFRAMESIZE;
+	memcpy(copy,buffer,INITFRAMESIZE+payload);
+	intinbuffer(copy+12,(field&FRAMEFLAGS&~FRAMECRC)|payload);
+	if (flushcontrol(ports,port,copy,INITFRAMESIZE+payload)) ++m->monitored;
+	else ++m->missed;
+}
+
+// appends the frame to the capture file, cut to the snap length
+static void writecapture(mirror *m,const unsigned char *buffer,const int length) {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME,&now);
+	const int captured = (length<m->snaplen)?length:m->snaplen;
+	const uint32_t record[4] = {(uint32_t)now.tv_sec,(uint32_t)(now.tv_nsec/1000),(uint32_t)captured,(uint32_t)length};
+	fwrite((const void*)record,sizeof(record),1,m->capture);
+	fwrite((const void*)buffer,sizeof(unsigned char),captured,m->capture);
+}
+
+// copies the frame to the monitor and the capture file
+static void copyframe(mirror *m,porttable *ports,const unsigned char *buffer,const int length) {
+	if (m->monitor>=0) sendmonitor(m,ports,buffer,length);
+	if (m->capture) writecapture(m,buffer,length);
+}
+
+unsigned int mirrorframe(mirror *m,porttable *ports,const unsigned char *buffer,const int length) {
+	if (!m || !m->rate) return mirrorcountdown(0);
+	++m->sampled;
+	copyframe(m,ports,buffer,length);
+	return m->rate;
+}
+
+void mirrortransfer(mirror *m,porttable *ports,const unsigned char *buffer,const int length) {
+	if (!m) return;
+	++m->copied;
+	copyframe(m,ports,buffer,length);
+}
+
+void printmirrorstats(mirror *m,FILE *outfile) {
+	if (!m) return;
+	fprintf(outfile,"CSP: Mirrored %llu data frames (%d bytes of each, ",m->sampled,m->snaplen);
+	if (m->rate) fprintf(outfile,"1 in %u at the end)",m->rate);
+	else fprintf(outfile,"off at the end)");
+	if (m->copied) fprintf(outfile," and %llu frames of mirrored transfers",m->copied);
+	if (m->capture) fprintf(outfile,", all to the capture file");
+	if (m->monitor>=0) fprintf(outfile,", %llu to monitor SP %d (%llu missed it)",m->monitored,m->monitor,m->missed);
+	fprintf(outfile,"\n");
+}
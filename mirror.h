@@ -0,0 +1,54 @@
+#ifndef _FASTETH_MIRROR_H
+#define _FASTETH_MIRROR_H
+
+#include <stdio.h>
+#include <limits.h>
+#include "porttable.h"
+
+// sampled mirroring of the data frames the CSP forwards, fastserv -mirror=N
+// one in every N forwarded frames is copied, its header and the first bytes of it (the snap length),
+// to a monitor SP connected to this switch, to a capture file, or both
+// the forwarding path pays one countdown per frame for it (see forwardframe), a frame is copied when it hits zero
+// a copy to the monitor is the frame with its header as it was (so the monitor tells it from a frame of its own
+// by the destination), the size field is the payload bytes copied and there is no checksum trailer
+// the capture file is a pcap file of link type LINKTYPEUSER0, a packet per copy with the frame as it was sent
+// the rate can be changed while the CSP runs, see fastserv.c, a rate of 0 turns mirroring off
+
+// the rate with a monitor or capture file and no -mirror, and the default snap length (the header included)
+#define MIRRORRATE 1000
+#define MIRRORSNAPLEN 128
+// the pcap link type for a private protocol
+#define LINKTYPEUSER0 147
+
+typedef struct mirror {
+	unsigned int rate; // 0 while mirroring is off
+	int snaplen;
+	int monitor; // the monitor SP ID, -1 for none
+	FILE *capture; // NULL for none
+	unsigned long long sampled; // the frames copied
+	unsigned long long copied; // the frames of transfers a forwarding rule mirrors, copied as well (see rules.h)
+	unsigned long long monitored; // the copies that went to the monitor
+	unsigned long long missed; // the copies the monitor wasn't there for
+}mirror;
+
+// starts mirroring one in rate frames, snaplen bytes of each, to the monitor SP (-1 for none) and capture file (NULL for none)
+// returns NULL if the capture file can't be written
+mirror *newmirror(const unsigned int rate,const int snaplen,const int monitor,const char *capturefile);
+void freemirror(mirror *m);
+
+// the countdown to the next copy at rate, with mirroring off it runs as long as an unsigned int does
+static inline unsigned int mirrorcountdown(const unsigned int rate) {
+	return rate?rate:UINT_MAX;
+}
+
+// copies the forwarded frame of length bytes in buffer (m may be NULL)
+// returns the countdown to the next copy
+unsigned int mirrorframe(mirror *m,porttable *ports,const unsigned char *buffer,const int length);
+
+// copies a frame of a transfer a forwarding rule mirrors, every frame of it is (m may be NULL)
+void mirrortransfer(mirror *m,porttable *ports,const unsigned char *buffer,const int length);
+
+// prints the frames copied and where they went
+void printmirrorstats(mirror *m,FILE *outfile);
+
+#endif // _FASTETH_MIRROR_H
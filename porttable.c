@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "porttable.h"
+
+// the most ports on one socket flushed in one writev
+#define FLUSHIOV 64
+
+// allocates the hash table with capacity slots, all empty
+static void allocslots(porttable *ports,const unsigned int capacity) {
+	ports->capacity=capacity;
+	ports->keys = (unsigned long long*)malloc(sizeof(unsigned long long)*capacity);
+	ports->slotport = (int*)malloc(sizeof(int)*capacity);
+	for (unsigned int i=0;i<capacity;++i) ports->slotport[i]=-1;
+}
+
+// the slot holding station, or the empty slot where it would go
+static inline unsigned int findslot(porttable *ports,const unsigned long long station) {
+	const unsigned int mask = ports->capacity-1;
+	unsigned int i = (unsigned int)hashstation(station)&mask;
+	while (ports->slotport[i]>=0 && ports->keys[i]!=station) i=(i+1)&mask;
+	return i;
+}
+
+// doubles the hash table, keeps the load factor at or below one half
+static void growslots(porttable *ports) {
+	unsigned long long *keys = ports->keys;
+	int *slotport = ports->slotport;
+	const unsigned int capacity = ports->capacity;
+	allocslots(ports,capacity<<1);
+	for (unsigned int i=0;i<capacity;++i) {
+		if (slotport[i]<0) continue;
+		const unsigned int slot = findslot(ports,keys[i]);
+		ports->keys[slot]=keys[i];
+		ports->slotport[slot]=slotport[i];
+	}
+	free(keys);
+	free(slotport);
+}
+
+// grows the per port arrays to maxports entries
+static void growports(porttable *ports,const int maxports) {
+	ports->freeports = (int*)realloc(ports->freeports,sizeof(int)*maxports);
+	ports->station = (unsigned long long*)realloc(ports->station,sizeof(unsigned long long)*maxports);
+	ports->fd = (int*)realloc(ports->fd,sizeof(int)*maxports);
+	ports->mux = (int*)realloc(ports->mux,sizeof(int)*maxports);
+	ports->nexthop = (int*)realloc(ports->nexthop,sizeof(int)*maxports);
+	ports->routetrunk = (int*)realloc(ports->routetrunk,sizeof(int)*maxports);
+	ports->routehops = (int*)realloc(ports->routehops,sizeof(int)*maxports);
+	ports->state = (int*)realloc(ports->state,sizeof(int)*maxports);
+	ports->stateseq = (unsigned int*)realloc(ports->stateseq,sizeof(unsigned int)*maxports);
+	ports->session = (unsigned long long*)realloc(ports->session,sizeof(unsigned long long)*maxports);
+	ports->xferseq = (int*)realloc(ports->xferseq,sizeof(int)*maxports);
+	ports->xferoffset = (unsigned long long*)realloc(ports->xferoffset,sizeof(unsigned long long)*maxports);
+	ports->xfertotal = (unsigned long long*)realloc(ports->xfertotal,sizeof(unsigned long long)*maxports);
+	ports->resumefrom = (unsigned long long*)realloc(ports->resumefrom,sizeof(unsigned long long)*maxports);
+	ports->detachedat = (double*)realloc(ports->detachedat,sizeof(double)*maxports);
+	ports->inflight = (unsigned long long*)realloc(ports->inflight,sizeof(unsigned long long)*maxports);
+	ports->ctrlbuf = (unsigned char*)realloc(ports->ctrlbuf,sizeof(unsigned char)*CTRLPENDINGSIZE*maxports);
+	ports->ctrllen = (int*)realloc(ports->ctrllen,sizeof(int)*maxports);
+	ports->crcframes = (unsigned long long*)realloc(ports->crcframes,sizeof(unsigned long long)*maxports);
+	ports->crcerrors = (unsigned long long*)realloc(ports->crcerrors,sizeof(unsigned long long)*maxports);
+	ports->maxports=maxports;
+}
+
+porttable *newporttable(void) {
+	porttable *ports = (porttable*)calloc(1,sizeof(porttable));
+	allocslots(ports,PORTTABLEMINSLOTS);
+	growports(ports,PORTTABLEMINPORTS);
+	return ports;
+}
+
+void freeporttable(porttable *ports) {
+	if (!ports) return;
+	free(ports->keys);
+	free(ports->slotport);
+	free(ports->freeports);
+	free(ports->station);
+	free(ports->fd);
+	free(ports->mux);
+	free(ports->nexthop);
+	free(ports->routetrunk);
+	free(ports->routehops);
+	free(ports->state);
+	free(ports->stateseq);
+	free(ports->session);
+	free(ports->xferseq);
+	free(ports->xferoffset);
+	free(ports->xfertotal);
+	free(ports->resumefrom);
+	free(ports->detachedat);
+	free(ports->inflight);
+	free(ports->ctrlbuf);
+	free(ports->ctrllen);
+	free(ports->crcframes);
+	free(ports->crcerrors);
+	free(ports);
+}
+
+// returns the port index of station, or -1 if it is not registered
+int portlookup(porttable *ports,const unsigned long long station) {
+	return ports->slotport[findslot(ports,station)];
+}
+
+// returns the port index of station, registering it if needed
+// a new port is unreachable and active until the caller fills it in
+int portregister(porttable *ports,const unsigned long long station) {
+	unsigned int slot = findslot(ports,station);
+	if (ports->slotport[slot]>=0) return ports->slotport[slot];
+	if ((ports->count+1)*2>ports->capacity) {
+		growslots(ports);
+		slot = findslot(ports,station);
+	}
+	// reuse a released port index before handing out a new one
+	int port;
+	if (ports->numfree) port=ports->freeports[--ports->numfree];
+	else {
+		if (ports->numports==ports->maxports) growports(ports,ports->maxports<<1);
+		port=ports->numports++;
+	}
+	ports->keys[slot]=station;
+	ports->slotport[slot]=port;
+	++ports->count;
+	ports->station[port]=station;
+	ports->fd[port]=-1;
+	ports->mux[port]=-1;
+	ports->nexthop[port]=-1;
+	ports->routetrunk[port]=-1;
+	ports->routehops[port]=0;
+	ports->state[port]=SPACTIVE;
+	ports->stateseq[port]=0;
+	ports->session[port]=0;
+	ports->xferseq[port]=0;
+	ports->xferoffset[port]=0;
+	ports->xfertotal[port]=0;
+	ports->resumefrom[port]=RESUMENONE;
+	ports->detachedat[port]=0;
+	ports->inflight[port]=0;
+	ports->ctrllen[port]=0;
+	ports->crcframes[port]=0;
+	ports->crcerrors[port]=0;
+	return port;
+}
+
+// removes the station at port index, the index may be handed out again
+// linear probing deletes by shifting later entries of the probe run back into the hole
+void portderegister(porttable *ports,const int port) {
+	const unsigned int mask = ports->capacity-1;
+	unsigned int hole = findslot(ports,ports->station[port]);
+	if (ports->slotport[hole]!=port) return;
+	unsigned int next = hole;
+	while (1) {
+		next=(next+1)&mask;
+		if (ports->slotport[next]<0) break;
+		const unsigned int home = (unsigned int)hashstation(ports->keys[next])&mask;
+		// the entry at next can fill the hole if its home slot is not cyclically in (hole,next]
+		if ((next>hole && (home<=hole || home>next)) || (next<hole && home<=hole && home>next)) {
+			ports->keys[hole]=ports->keys[next];
+			ports->slotport[hole]=ports->slotport[next];
+			hole=next;
+		}
+	}
+	ports->slotport[hole]=-1;
+	--ports->count;
+	ports->fd[port]=-1;
+	ports->mux[port]=-1;
+	ports->nexthop[port]=-1;
+	ports->routetrunk[port]=-1;
+	ports->session[port]=0;
+	ports->detachedat[port]=0;
+	ports->ctrllen[port]=0;
+	ports->freeports[ports->numfree++]=port;
+}
+
+// queues length bytes of control frames for the station connected at port
+// a full pending buffer is written first, returns 0 if that write failed
+unsigned char queuecontrol(porttable *ports,const int port,unsigned char *frames,const int length) {
+	unsigned char ret=1;
+	if (ports->ctrllen[port]+length>CTRLPENDINGSIZE) ret=flushcontrol(ports,port,NULL,0);
+	memcpy((void*)(ports->ctrlbuf+port*CTRLPENDINGSIZE+ports->ctrllen[port]),(void*)frames,sizeof(unsigned char)*length);
+	ports->ctrllen[port]+=length;
+	return ret;
+}
+
+// writes the pending control frames of port followed by length bytes of buffer with a single writev
+// returns 0 for failure, 1 for success
+unsigned char flushcontrol(porttable *ports,const int port,unsigned char *buffer,const int length) {
+	struct iovec iov[2];
+	int count=0;
+	if (ports->ctrllen[port]) {
+		iov[count].iov_base=(void*)(ports->ctrlbuf+port*CTRLPENDINGSIZE);
+		iov[count++].iov_len=ports->ctrllen[port];
+		ports->ctrllen[port]=0;
+	}
+	if (length) {
+		iov[count].iov_base=(void*)buffer;
+		iov[count++].iov_len=length;
+	}
+	if (!count) return 1;
+	if (ports->fd[port]<0) return 0;
+	return sendvector(ports->fd[port],iov,count);
+}
+
+// flushes the pending control frames of every port
+// the ports after port on the same socket join its writev, the stations of a multiplexed connection
+// register together so their frames go out in one write (up to FLUSHIOV ports of them)
+// returns the number of writes that failed, their connections are noticed as closed by the reader
+int flushcontrols(porttable *ports) {
+	int failed=0;
+	struct iovec iov[FLUSHIOV];
+	for (int p=0;p<ports->numports;) {
+		if (!ports->ctrllen[p]) {
+			++p;
+			continue;
+		}
+		const int fd = ports->fd[p];
+		int count=0, q=p;
+		for (;q<ports->numports && count<FLUSHIOV && (q==p || (fd>=0 && ports->fd[q]==fd));++q) {
+			if (!ports->ctrllen[q]) continue;
+			iov[count].iov_base=(void*)(ports->ctrlbuf+q*CTRLPENDINGSIZE);
+			iov[count++].iov_len=ports->ctrllen[q];
+			ports->ctrllen[q]=0;
+		}
+		if (fd<0 || !sendvector(fd,iov,count)) ++failed;
+		p=q;
+	}
+	return failed;
+}
@@ -0,0 +1,104 @@
+#ifndef _FASTETH_PORTTABLE_H
+#define _FASTETH_PORTTABLE_H
+
+// the CSP's ports, one for each station (SP) the switch knows about
+// stations are found by a 64-bit station id in an open addressed hash table (linear probing)
+// each registered station gets a dense port index, indices are reused after deregistration
+// the per port arrays are indexed by port and grow with the number of registered stations
+// SP IDs in frames are 32 bits, the station id of an SP is its SP ID (see STATIONID)
+
+// starting sizes, both grow by doubling
+#define PORTTABLEMINSLOTS 64
+#define PORTTABLEMINPORTS 16
+
+// bytes of control frames a port holds until the next flush, 8 frame headers
+#define CTRLPENDINGSIZE 128
+
+// the states of an SP process, kept for every station
+#define SPACTIVE 0
+#define SPWAITING 1
+#define SPDONE 2
+
+// the station id for an SP ID from a frame, and back
+#define STATIONID(sp_id) ((unsigned long long)(unsigned int)(sp_id))
+#define SPFROMSTATION(station) ((int)((station)&0xFFFFFFFFULL))
+
+// the splitmix64 finalizer, spreads sequential station ids over the table
+static inline unsigned long long hashstation(unsigned long long x) {
+	x ^= x>>30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x>>27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x>>31;
+	return x;
+}
+
+typedef struct porttable {
+	// the hash table, slotport[] is the port index of the station in keys[], -1 for an empty slot
+	unsigned int capacity; // a power of two
+	unsigned int count;
+	unsigned long long *keys;
+	int *slotport;
+	// port index bookkeeping
+	int maxports; // allocated length of the per port arrays
+	int numports; // one more than the highest port index handed out
+	int numfree;
+	int *freeports;
+	// per port arrays
+	unsigned long long *station;
+	int *fd; // socket of a station connected to this switch, otherwise -1
+	int *mux; // the multiplexed connection (see fastserv.c) a local station shares its socket on, otherwise -1
+	int *nexthop; // descriptor that reaches the station (its socket or a trunk), -1 while unreachable
+	int *routetrunk; // trunk index for stations on other switches, otherwise -1
+	int *routehops; // zero for stations connected to this switch
+	int *state; // SPACTIVE, SPWAITING, or SPDONE
+	unsigned int *stateseq; // last state sequence number seen for the station
+	// sessions of stations connected to this switch, see fastserv.c
+	unsigned long long *session; // the token handed out at handshake, zero for none
+	int *xferseq; // number of the last transfer granted to the station
+	unsigned long long *xferoffset; // data bytes of that transfer forwarded so far
+	unsigned long long *xfertotal; // data bytes of that transfer
+	unsigned long long *resumefrom; // offset claimed for the next grant, RESUMENONE for a new transfer
+	double *detachedat; // when the station's connection dropped, zero while attached
+	// the bytes on their way to the station, what is left of the transfers granted to it and the requests queued for it
+	// (fastserv keeps it as they come and go, anycast groups bind to the member with the least)
+	unsigned long long *inflight;
+	// control frames waiting for a station connected to this switch, see queuecontrol
+	unsigned char *ctrlbuf; // CTRLPENDINGSIZE bytes per port
+	int *ctrllen;
+	// data frames from a station connected to this switch that the CSP checksummed, and those that failed
+	unsigned long long *crcframes;
+	unsigned long long *crcerrors;
+	// stations that have connected to the fabric (here or on another switch)
+	unsigned long long joined;
+}porttable;
+
+porttable *newporttable(void);
+void freeporttable(porttable *ports);
+
+// returns the port index of station, or -1 if it is not registered
+int portlookup(porttable *ports,const unsigned long long station);
+
+// returns the port index of station, registering it if needed
+// a new port is unreachable and active until the caller fills it in
+int portregister(porttable *ports,const unsigned long long station);
+
+// removes the station at port index, the index may be handed out again
+void portderegister(porttable *ports,const int port);
+
+// queues length bytes of control frames for the station connected at port
+// the pending frames go out in one write when the event loop flushes, or ahead of the next data frame
+// a full pending buffer is written first, returns 0 if that write failed
+unsigned char queuecontrol(porttable *ports,const int port,unsigned char *frames,const int length);
+
+// writes the pending control frames of port followed by length bytes of buffer (length may be 0)
+// with a single writev, the pending frames are dropped whether or not it succeeds
+// returns 0 for failure, 1 for success
+unsigned char flushcontrol(porttable *ports,const int port,unsigned char *buffer,const int length);
+
+// flushes the pending control frames of every port, once per event loop iteration
+// a run of ports on one socket (the stations of a multiplexed connection join together) goes out in one writev
+// returns the number of writes that failed
+int flushcontrols(porttable *ports);
+
+#endif // _FASTETH_PORTTABLE_H
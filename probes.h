@@ -0,0 +1,42 @@
+#ifndef _FASTETH_PROBES_H
+#define _FASTETH_PROBES_H
+
+// USDT probes (static tracepoints) for perf and bpftrace on a run as it is, the scripts are in probes/
+// a probe is a nop in the code and a note in the binary until a tracer attaches to it
+// without sys/sdt.h (systemtap-sdt-dev) or with -DNOPROBES they compile to nothing
+// the provider is csp in fastserv and sp in fastcl, the probe names are the ones given to PROBEn
+//
+// every probe has a semaphore a tracer raises while it is attached, PROBEACTIVE reads it
+// so an argument that takes work (a queue depth) is only worked out with a tracer attached:
+//   if (PROBEACTIVE(csp,requestqueued)) PROBE4(csp,requestqueued,...,requestqueuedepth(requestqueue));
+// the file with the probes defines each of their semaphores once with PROBESEMAPHORE(provider,name)
+
+#if !defined(NOPROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define HAVEPROBES 1
+#endif
+#endif
+
+#ifdef HAVEPROBES
+#define PROBESEMAPHORE(provider,name) \
+	__extension__ volatile unsigned short provider##_##name##_semaphore __attribute__((unused)) __attribute__((section(".probes")))
+#define PROBEACTIVE(provider,name) __builtin_expect(provider##_##name##_semaphore,0)
+#define PROBE1(provider,name,a) DTRACE_PROBE1(provider,name,a)
+#define PROBE2(provider,name,a,b) DTRACE_PROBE2(provider,name,a,b)
+#define PROBE3(provider,name,a,b,c) DTRACE_PROBE3(provider,name,a,b,c)
+#define PROBE4(provider,name,a,b,c,d) DTRACE_PROBE4(provider,name,a,b,c,d)
+#define PROBE5(provider,name,a,b,c,d,e) DTRACE_PROBE5(provider,name,a,b,c,d,e)
+#else
+// the arguments are not evaluated
+#define PROBESEMAPHORE(provider,name) extern int provider##_##name##_nosemaphore
+#define PROBEACTIVE(provider,name) 0
+#define PROBE1(provider,name,a) do { (void)sizeof(a); } while (0)
+#define PROBE2(provider,name,a,b) do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#define PROBE3(provider,name,a,b,c) do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while (0)
+#define PROBE4(provider,name,a,b,c,d) do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); (void)sizeof(d); } while (0)
+#define PROBE5(provider,name,a,b,c,d,e) do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); (void)sizeof(d); (void)sizeof(e); } while (0)
+#endif
+
+#endif // _FASTETH_PROBES_H
@@ -0,0 +1,231 @@
+#ifndef _FASTETH_QUEUES_H
+#define _FASTETH_QUEUES_H
+
+#include "common.h"
+
+// queuesizes MUST be >= 1
+// this does work with 64 processes and both queues with size 1
+// 
+// both can be set at build time, the microbenchmarks are built at other sizes that way
+#ifndef REQUESTQUEUESIZE
+#define REQUESTQUEUESIZE 10
+#endif
+#ifndef DATAQUEUESIZE
+#define DATAQUEUESIZE 2
+#endif
+// transfers that gave up their data queue slot and wait to continue, see parktransfer
+#ifndef PARKEDQUEUESIZE
+#define PARKEDQUEUESIZE REQUESTQUEUESIZE
+#endif
+
+// we have an array of these -> dataqueue[DATAQUEUESIZE]
+// src_sp_id = -1 to indicate unoccupied
+// has its own buffer, so whoever reserved an index will have a buffer of their own
+// also holds the dst_sp_id and the bytes remaining (actual filesize bytes)
+// bytesremaining counts a header per MAXDATASIZE of data, dataremaining is the data alone
+// the transfer is done when dataremaining reaches zero (compressed transfers have more, smaller frames)
+// src_port and dst_port are the port table indices of the two stations
+// frames counts the frames forwarded since the transfer got this slot, a long transfer yields the slot after a quantum
+// mirrored is set when every frame of the transfer is copied to the mirror (a forwarding rule said so, see rules.h)
+typedef struct dataqueuenode {
+	unsigned char buffer[MAXFRAMESIZE];
+	unsigned long long bytesremaining;
+	unsigned long long dataremaining;
+	int src_sp_id;
+	int dst_sp_id;
+	int src_port;
+	int dst_port;
+	int frames;
+	unsigned char mirrored;
+}dataqueuenode;
+
+// we have an array of these -> parkedqueue[PARKEDQUEUESIZE]
+// src_sp_id = -1 to indicate unoccupied
+// a transfer that yielded its data queue slot, in the order they yielded, with what is left of it
+// the sender isn't read while its transfer is parked, it continues in a free slot without a new grant
+typedef struct parkedqueuenode {
+	unsigned long long bytesremaining;
+	unsigned long long dataremaining;
+	int src_sp_id;
+	int dst_sp_id;
+	int src_port;
+	int dst_port;
+	unsigned char mirrored;
+}parkedqueuenode;
+
+// we have an array of these -> requestqueue[REQUESTQUEUESIZE]
+// src_sp_id = -1 to indicate unoccupied
+// also holds the dst_sp_id and the total size of the pending transfer (actual filesize bytes)
+// queuedat is the time the request entered the queue, schedulers use it for ages and waits
+// src_port and dst_port are the port table indices of the two stations
+// mirrored goes with the request to the transfer it is granted
+typedef struct requestqueuenode {
+	int src_sp_id;
+	int dst_sp_id;
+	int src_port;
+	int dst_port;
+	unsigned long long datasize;
+	double queuedat;
+	unsigned char mirrored;
+}requestqueuenode;
+
+// gives the next index of the data queue that doesn't have a source sp id set
+// if the data queue is not full this returns an index
+// if the data queue is full this returns -1
+static inline int getnextdataqindex(dataqueuenode *queue) {
+	for (int i=0;i<DATAQUEUESIZE;++i) {
+		if (queue[i].src_sp_id<0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// the number of occupied data queue slots
+static inline int dataqueuedepth(const dataqueuenode *queue) {
+	int depth=0;
+	for (int i=0;i<DATAQUEUESIZE;++i) depth+=(queue[i].src_sp_id>=0);
+	return depth;
+}
+
+// the number of queued requests, they are kept at the front of the queue
+static inline int requestqueuedepth(const requestqueuenode *queue) {
+	int depth=0;
+	while (depth<REQUESTQUEUESIZE && queue[depth].src_sp_id>=0) ++depth;
+	return depth;
+}
+
+// add a request to the queue, takes the queue array and all details of the transaction
+// attempts to add the request to the end of the array
+// if the request is added returns 1
+// if the queue is full returns 0
+static inline unsigned char queuerequest(requestqueuenode *queue,const int src_sp_id,const int dst_sp_id,
+																					const int src_port,const int dst_port,const unsigned long long reqsize,const double now,
+																					const unsigned char mirrored) {
+	for (int i=0;i<REQUESTQUEUESIZE;++i) {
+		if (queue[i].src_sp_id<0) {
+			queue[i].src_sp_id=src_sp_id;
+			queue[i].dst_sp_id=dst_sp_id;
+			queue[i].src_port=src_port;
+			queue[i].dst_port=dst_port;
+			queue[i].datasize=reqsize;
+			queue[i].queuedat=now;
+			queue[i].mirrored=mirrored;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// removes the request at index from the queue and fills out the *result parameter
+// shifts later elements forward, sets the final element's src_sp_id to -1 (to handle if the queue was full)
+// the caller must pass the index of an occupied element
+static inline void removerequest(requestqueuenode *queue,const int index,requestqueuenode *result) {
+	*result = queue[index];
+	for (int i=index+1;i<REQUESTQUEUESIZE;++i) {
+		queue[i-1]=queue[i];
+		if (queue[i].src_sp_id<0) return; // rest are -1 already
+	}
+	queue[REQUESTQUEUESIZE-1].src_sp_id=-1;
+}
+
+// gets the next request from the queue, pops from the front and fills out the *result parameter
+// the return value is put in the result parameter, ***set its sp_id to -1 before calling this function***
+// if the sp_id is set all the member vars are also set, otherwise nothing was in the queue
+static inline void getrequest(requestqueuenode *queue,requestqueuenode *result) {
+	if (queue[0].src_sp_id<0) return;
+	removerequest(queue,0,result);
+}
+
+// removes every queued request from port and frees the data queue slot port was sending on
+// used when a station's connection drops, requests waiting for port stay queued
+static inline void releasesource(requestqueuenode *requestqueue,dataqueuenode *dataqueue,const int port) {
+	for (int i=0;i<REQUESTQUEUESIZE && requestqueue[i].src_sp_id>=0;) {
+		if (requestqueue[i].src_port!=port) {
+			++i;
+			continue;
+		}
+		requestqueuenode result;
+		removerequest(requestqueue,i,&result);
+	}
+	for (int i=0;i<DATAQUEUESIZE;++i) {
+		if (dataqueue[i].src_sp_id>=0 && dataqueue[i].src_port==port) dataqueue[i].src_sp_id=-1;
+	}
+}
+
+// removes every queued request from or to port, used when a station leaves
+// the requests that were waiting for port as their destination are copied to removed[]
+// (their senders are owed a reply), returns the number copied
+// the data queue slot port was sending on is freed, transfers to port keep their slot
+static inline int purgeport(requestqueuenode *requestqueue,dataqueuenode *dataqueue,const int port,requestqueuenode *removed) {
+	int count=0;
+	for (int i=0;i<REQUESTQUEUESIZE && requestqueue[i].src_sp_id>=0;) {
+		if (requestqueue[i].src_port!=port && requestqueue[i].dst_port!=port) {
+			++i;
+			continue;
+		}
+		requestqueuenode result;
+		removerequest(requestqueue,i,&result);
+		if (result.src_port!=port) removed[count++]=result;
+	}
+	for (int i=0;i<DATAQUEUESIZE;++i) {
+		if (dataqueue[i].src_sp_id>=0 && dataqueue[i].src_port==port) dataqueue[i].src_sp_id=-1;
+	}
+	return count;
+}
+
+// moves the transfer in data queue slot index to the end of the parked queue and frees the slot
+// returns 0 (and leaves the transfer in its slot) if the parked queue is full
+static inline unsigned char parktransfer(parkedqueuenode *parked,dataqueuenode *dataqueue,const int index) {
+	for (int i=0;i<PARKEDQUEUESIZE;++i) {
+		if (parked[i].src_sp_id<0) {
+			parked[i].bytesremaining=dataqueue[index].bytesremaining;
+			parked[i].dataremaining=dataqueue[index].dataremaining;
+			parked[i].src_sp_id=dataqueue[index].src_sp_id;
+			parked[i].dst_sp_id=dataqueue[index].dst_sp_id;
+			parked[i].src_port=dataqueue[index].src_port;
+			parked[i].dst_port=dataqueue[index].dst_port;
+			parked[i].mirrored=dataqueue[index].mirrored;
+			dataqueue[index].src_sp_id=-1;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// removes the parked transfer at index, shifting later ones forward
+static inline void removeparked(parkedqueuenode *parked,const int index) {
+	for (int i=index+1;i<PARKEDQUEUESIZE;++i) {
+		parked[i-1]=parked[i];
+		if (parked[i].src_sp_id<0) return; // rest are -1 already
+	}
+	parked[PARKEDQUEUESIZE-1].src_sp_id=-1;
+}
+
+// moves the transfer parked longest into the free data queue slot index
+// returns 0 if nothing is parked
+static inline unsigned char unparktransfer(parkedqueuenode *parked,dataqueuenode *dataqueue,const int index) {
+	if (parked[0].src_sp_id<0) return 0;
+	dataqueue[index].bytesremaining=parked[0].bytesremaining;
+	dataqueue[index].dataremaining=parked[0].dataremaining;
+	dataqueue[index].src_sp_id=parked[0].src_sp_id;
+	dataqueue[index].dst_sp_id=parked[0].dst_sp_id;
+	dataqueue[index].src_port=parked[0].src_port;
+	dataqueue[index].dst_port=parked[0].dst_port;
+	dataqueue[index].mirrored=parked[0].mirrored;
+	dataqueue[index].frames=0;
+	removeparked(parked,0);
+	return 1;
+}
+
+// removes the parked transfer from port, used with releasesource and purgeport when a station goes
+static inline void releaseparked(parkedqueuenode *parked,const int port) {
+	for (int i=0;i<PARKEDQUEUESIZE && parked[i].src_sp_id>=0;++i) {
+		if (parked[i].src_port==port) {
+			removeparked(parked,i);
+			return;
+		}
+	}
+}
+
+#endif // _FASTETH_QUEUES_H
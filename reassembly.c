@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "common.h"
+#include "reassembly.h"
+
+// starting number of open transfers, it grows by doubling
+#define REASSEMBLYMINOPEN 8
+
+reassembler *newreassembler(const char *dir,const int sp_id) {
+	if (mkdir(dir,0755) && errno!=EEXIST) return NULL;
+	reassembler *r = (reassembler*)calloc(1,sizeof(reassembler));
+	r->dir=strdup(dir);
+	r->sp_id=sp_id;
+	r->maxopen=REASSEMBLYMINOPEN;
+	r->open=(savedtransfer*)malloc(sizeof(savedtransfer)*r->maxopen);
+	return r;
+}
+
+// the open transfer of (src, seqnum), or with seqnum<0 the one src started last, NULL if there is none
+static savedtransfer *findtransfer(reassembler *r,const int src,const int seqnum) {
+	savedtransfer *found=NULL;
+	for (int i=0;i<r->numopen;++i) {
+		savedtransfer *t = &r->open[i];
+		if (t->src!=src) continue;
+		if (seqnum>=0 && t->seqnum!=seqnum) continue;
+		if (!found || t->started>found->started) found=t;
+	}
+	return found;
+}
+
+static savedtransfer *opentransfer(reassembler *r,const int src,const int seqnum,const double now,FILE *logfile) {
+	char *filename = (char*)malloc(sizeof(char)*(strlen(r->dir)+48));
+	sprintf(filename,"%s/sp%d-from%d-frame%d",r->dir,r->sp_id,src,seqnum);
+	const int fd = open(filename,O_WRONLY|O_CREAT|O_TRUNC,0644);
+	if (fd<0) {
+		fprintf(logfile,"SP %d: Unable to create %s, %s\n",r->sp_id,filename,strerror(errno));
+		free(filename);
+		return NULL;
+	}
+	if (r->numopen==r->maxopen) {
+		r->maxopen<<=1;
+		r->open=(savedtransfer*)realloc(r->open,sizeof(savedtransfer)*r->maxopen);
+	}
+	savedtransfer *t = &r->open[r->numopen++];
+	memset((void*)t,0,sizeof(savedtransfer));
+	t->src=src;
+	t->seqnum=seqnum;
+	t->fd=fd;
+	t->lastchunk=-1;
+	t->since=now;
+	t->filename=filename;
+	return t;
+}
+
+// closes the file of the open transfer t and takes it off the open list
+static void closetransfer(reassembler *r,savedtransfer *t) {
+	close(t->fd);
+	free(t->have);
+	free(t->filename);
+	*t=r->open[--r->numopen];
+}
+
+// writes all length bytes of data at offset
+static unsigned char writeat(const int fd,const unsigned char *data,int length,off_t offset) {
+	while (length>0) {
+		const ssize_t ret = pwrite(fd,(const void*)data,length,offset);
+		if (ret<0 && errno==EINTR) continue;
+		if (ret<=0) return 0;
+		data+=ret;
+		offset+=ret;
+		length-=(int)ret;
+	}
+	return 1;
+}
+
+void reassemble(reassembler *r,const int src,const int chunk,const int field,const unsigned char *data,const int length,FILE *logfile) {
+	const double now = getnow();
+	if (r->firstframe<=0) r->firstframe=now;
+	r->lastframe=now;
+	// the first frame names the transfer, a frame number seen before is the transfer starting over after a resume
+	savedtransfer *t;
+	int number=chunk;
+	if (field&FRAMEFIRST) {
+		number=0;
+		t=findtransfer(r,src,chunk);
+		if (!t && !(t=opentransfer(r,src,chunk,now,logfile))) return;
+		t->started=++r->started;
+	}
+	else if (!(t=findtransfer(r,src,-1)) || number<0) {
+		fprintf(logfile,"SP %d: Not saving packet %d from SP %d, no transfer of it was started\n",r->sp_id,number,src);
+		return;
+	}
+	const int chunkbytes = MAXDATASIZE-((field&FRAMECRC)?CRCSIZE:0);
+	const unsigned long long offset = (unsigned long long)number*(unsigned long long)chunkbytes;
+	if (!writeat(t->fd,data,length,(off_t)offset)) {
+		fprintf(logfile,"SP %d: Error writing packet %d of frame %d from SP %d to %s, %s\n",r->sp_id,number,t->seqnum,src,t->filename,strerror(errno));
+		return;
+	}
+	// count each chunk once, a resume may send one again
+	if (number>=t->havebytes*8) {
+		int havebytes = t->havebytes?t->havebytes:8;
+		while (number>=havebytes*8) havebytes<<=1;
+		t->have=(unsigned char*)realloc(t->have,sizeof(unsigned char)*havebytes);
+		memset((void*)(t->have+t->havebytes),0,sizeof(unsigned char)*(havebytes-t->havebytes));
+		t->havebytes=havebytes;
+	}
+	if (!(t->have[number>>3]&(1<<(number&7)))) {
+		t->have[number>>3]|=(unsigned char)(1<<(number&7));
+		++t->chunks;
+		t->bytes+=(unsigned long long)length;
+	}
+	if (offset+length>t->size) t->size=offset+length;
+	if (field&FRAMELAST) t->lastchunk=number;
+	if (t->lastchunk<0 || t->chunks!=t->lastchunk+1) return;
+	// every chunk is in
+	const double elapsed = now-t->since;
+	if (ftruncate(t->fd,(off_t)t->size)) fprintf(logfile,"SP %d: Error sizing %s\n",r->sp_id,t->filename);
+	fprintf(logfile,"SP %d: Saved frame %d from SP %d, %llu bytes in %d packets to %s in %.3f s",
+					r->sp_id,t->seqnum,src,t->size,t->chunks,t->filename,elapsed);
+	if (elapsed>0) fprintf(logfile," (%.2f Mbps)",8.0*t->size/elapsed/1e6);
+	fprintf(logfile,"\n");
+	++r->completed;
+	r->bytes+=t->size;
+	closetransfer(r,t);
+}
+
+void freereassembler(reassembler *r,FILE *logfile) {
+	if (!r) return;
+	while (r->numopen) {
+		savedtransfer *t = &r->open[0];
+		fprintf(logfile,"SP %d: Frame %d from SP %d incomplete, %d packets",r->sp_id,t->seqnum,t->src,t->chunks);
+		if (t->lastchunk>=0) fprintf(logfile," of %d",t->lastchunk+1);
+		fprintf(logfile," (%llu bytes) in %s\n",t->bytes,t->filename);
+		closetransfer(r,t);
+	}
+	const double elapsed = r->lastframe-r->firstframe;
+	fprintf(logfile,"SP %d: Saved %llu transfers, %llu bytes to %s",r->sp_id,r->completed,r->bytes,r->dir);
+	if (elapsed>0) fprintf(logfile,", goodput %.2f Mbps over %.3f s",8.0*r->bytes/elapsed/1e6,elapsed);
+	fprintf(logfile,"\n");
+	free(r->open);
+	free(r->dir);
+	free(r);
+}
@@ -0,0 +1,52 @@
+#ifndef _FASTETH_REASSEMBLY_H
+#define _FASTETH_REASSEMBLY_H
+
+#include <stdio.h>
+
+// a receiving SP's transfers put back together into files, fastcl -save=[dir]
+// a transfer is keyed by (src SP, frame number), its first frame has the frame number (see FRAMEFIRST)
+// and the frames after it belong to the transfer the same sender started last
+// each payload is written at its own offset (chunk number times the sender's chunk size) with pwrite,
+// so chunks may come in any order and a chunk sent again after a resume lands where it was
+// a transfer is complete once its last frame and every chunk before it are in, the file is then closed
+// and a line with its size, time, and goodput is logged
+// the file for frame N from SP S received by SP R is dir/spR-fromS-frameN
+
+typedef struct savedtransfer {
+	int src;
+	int seqnum;
+	int fd;
+	unsigned long long started; // order the transfers were started in, the newest of a sender gets its frames
+	int lastchunk; // -1 until the last frame is in
+	int chunks; // distinct chunks written
+	unsigned char *have; // a bit per chunk written
+	int havebytes;
+	unsigned long long bytes; // payload bytes written
+	unsigned long long size; // the end of the furthest chunk
+	double since; // when the first of its frames came in
+	char *filename;
+}savedtransfer;
+
+typedef struct reassembler {
+	char *dir;
+	int sp_id;
+	savedtransfer *open;
+	int numopen, maxopen;
+	unsigned long long started;
+	// totals over the completed transfers
+	unsigned long long completed, bytes;
+	double firstframe, lastframe;
+}reassembler;
+
+// saves the transfers received by SP sp_id under dir, it is made if it doesn't exist
+// returns NULL if the directory can't be used
+reassembler *newreassembler(const char *dir,const int sp_id);
+
+// writes the payload of a data frame from src, chunk and field are the last two ints of its header as received
+// data is the payload after decompression, length bytes of it
+void reassemble(reassembler *r,const int src,const int chunk,const int field,const unsigned char *data,const int length,FILE *logfile);
+
+// logs the totals and any transfer still missing chunks, closes every file
+void freereassembler(reassembler *r,FILE *logfile);
+
+#endif // _FASTETH_REASSEMBLY_H
@@ -0,0 +1,343 @@
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "rules.h"
+
+// the keys a rule can be under, by which of src and dst it gives, a bit each in ruletable.shapes
+#define RULESHAPEBOTH 0x1
+#define RULESHAPESRC 0x2
+#define RULESHAPEDST 0x4
+#define RULESHAPENONE 0x8
+
+// the hash key of (src, dst), either may be -1 for any
+static inline unsigned long long rulekey(const int src,const int dst) {
+	return (((unsigned long long)(unsigned int)(src+1))<<32)|(unsigned long long)(unsigned int)(dst+1);
+}
+
+// the slot a key hashes to, the multiply spreads src and dst over the low bits
+static inline unsigned int rulehash(unsigned long long key,const unsigned int capacity) {
+	key ^= key>>31;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key>>29;
+	return (unsigned int)key&(capacity-1);
+}
+
+// the classes of a request of class number c (see RULECLASSES), and the class number of a request's classes
+static inline int ruleclasses(const int c) {
+	return ((c&1)?RULEBULK:RULESINGLE)|((c&2)?RULERESUME:0);
+}
+
+static inline int ruleclassof(const int classes) {
+	return ((classes&RULEBULK)?1:0)|((classes&RULERESUME)?2:0);
+}
+
+// the shape bit of a rule with src and dst
+static inline unsigned char ruleshape(const int src,const int dst) {
+	if (src>=0) return (dst>=0)?RULESHAPEBOTH:RULESHAPESRC;
+	return (dst>=0)?RULESHAPEDST:RULESHAPENONE;
+}
+
+// reads a number at s up to end, returns 0 if there isn't one
+static unsigned char readnumber(const char *s,const char *end,unsigned long long *value) {
+	if (s==end || *s<'0' || *s>'9') return 0;
+	char *stop;
+	*value=strtoull(s,&stop,10);
+	return stop==end;
+}
+
+// reads an SP ID or * (-1), returns 0 if it is neither
+static unsigned char readsp(const char *s,int *sp_id) {
+	unsigned long long value;
+	if (!strcmp(s,"*")) *sp_id=-1;
+	else if (!readnumber(s,s+strlen(s),&value) || value>0x7FFFFFFF) return 0;
+	else *sp_id=(int)value;
+	return 1;
+}
+
+// reads * or a-b, a-, -b, a into the rule's size range
+static unsigned char readsize(const char *s,rule *r) {
+	r->minsize=0;
+	r->maxsize=~0ULL;
+	if (!strcmp(s,"*")) return 1;
+	const char *end = s+strlen(s);
+	const char *dash = strchr(s,'-');
+	if (!dash) {
+		if (!readnumber(s,end,&r->minsize)) return 0;
+		r->maxsize=r->minsize;
+		return 1;
+	}
+	if (dash==s && dash+1==end) return 0;
+	if (dash>s && !readnumber(s,dash,&r->minsize)) return 0;
+	if (dash+1<end && !readnumber(dash+1,end,&r->maxsize)) return 0;
+	return r->minsize<=r->maxsize;
+}
+
+// reads the class and the action of the rule
+static unsigned char readclass(const char *s,rule *r) {
+	if (!strcmp(s,"*")) r->classes=0;
+	else if (!strcmp(s,"single")) r->classes=RULESINGLE;
+	else if (!strcmp(s,"bulk")) r->classes=RULEBULK;
+	else if (!strcmp(s,"resume")) r->classes=RULERESUME;
+	else return 0;
+	return 1;
+}
+
+static unsigned char readaction(const char *s,rule *r) {
+	unsigned long long value;
+	if (!strcmp(s,"forward")) r->action=RULEFORWARD;
+	else if (!strcmp(s,"drop")) r->action=RULEDROP;
+	else if (!strcmp(s,"mirror")) r->action=RULEMIRROR;
+	else if (!strncmp(s,"rewrite=",8)) {
+		r->action=RULEREWRITE;
+		return readsp(s+8,&r->target) && r->target>=0;
+	}
+	else if (!strncmp(s,"limit=",6)) {
+		r->action=RULELIMIT;
+		if (!readnumber(s+6,s+strlen(s),&value) || !value) return 0;
+		r->rate=(double)value;
+	}
+	else return 0;
+	return 1;
+}
+
+// the slot of key, or the empty slot it would take
+static unsigned int findkey(ruletable *rt,const unsigned long long key) {
+	const unsigned int mask = rt->capacity-1;
+	unsigned int slot = rulehash(key,rt->capacity);
+	while (rt->keys[slot].head>=0 && rt->keys[slot].key!=key) slot=(slot+1)&mask;
+	return slot;
+}
+
+// makes the key table capacity slots, rehashing the keys in it
+static void growkeys(ruletable *rt,const unsigned int capacity) {
+	rulekeyslot *old = rt->keys;
+	const unsigned int oldcapacity = rt->capacity;
+	rt->keys=(rulekeyslot*)calloc(capacity,sizeof(rulekeyslot));
+	rt->capacity=capacity;
+	for (unsigned int i=0;i<capacity;++i) rt->keys[i].head=-1;
+	for (unsigned int i=0;i<oldcapacity;++i) {
+		if (old[i].head>=0) rt->keys[findkey(rt,old[i].key)]=old[i];
+	}
+	free(old);
+}
+
+// adds r at the end of the rules under its key
+static void addrule(ruletable *rt,rule *r) {
+	const int i = rt->numrules++;
+	rt->rules=(rule*)realloc(rt->rules,sizeof(rule)*rt->numrules);
+	rt->rules[i]=*r;
+	rt->rules[i].next=-1;
+	const unsigned long long key = rulekey(r->src,r->dst);
+	unsigned int slot = findkey(rt,key);
+	if (rt->keys[slot].head<0) {
+		// at most half full
+		if (2*(rt->numkeys+1)>rt->capacity) {
+			growkeys(rt,rt->capacity*2);
+			slot=findkey(rt,key);
+		}
+		rt->keys[slot].key=key;
+		rt->keys[slot].head=i;
+		++rt->numkeys;
+	}
+	else rt->rules[rt->keys[slot].tail].next=i;
+	rt->keys[slot].tail=i;
+	rt->shapes|=ruleshape(r->src,r->dst);
+	if (r->action==RULEMIRROR) rt->mirrors=1;
+}
+
+static int comparesizes(const void *a,const void *b) {
+	const unsigned long long x = *(const unsigned long long*)a, y = *(const unsigned long long*)b;
+	return (x>y)-(x<y);
+}
+
+// the piece of the key in slot that size falls in
+static inline int findpiece(const rulekeyslot *slot,const unsigned long long size) {
+	int lo=0, hi=slot->numpieces-1;
+	while (lo<hi) {
+		const int mid = (lo+hi+1)/2;
+		if (slot->starts[mid]<=size) lo=mid;
+		else hi=mid-1;
+	}
+	return lo;
+}
+
+// the first piece at or after p that no rule has for the class yet, skip[] links each taken piece onward
+static inline int nextfree(int *skip,int p) {
+	while (skip[p]!=p) {
+		skip[p]=skip[skip[p]];
+		p=skip[p];
+	}
+	return p;
+}
+
+// cuts the sizes of the key in slot into pieces where its rules' ranges start and end, and gives each piece
+// the first rule that takes it for each class, the rules go in file order and a piece is given once a class
+static void cutpieces(ruletable *rt,rulekeyslot *slot) {
+	int count=0;
+	for (int r=slot->head;r>=0;r=rt->rules[r].next) ++count;
+	unsigned long long *starts = (unsigned long long*)malloc(sizeof(unsigned long long)*(2*count+1));
+	int numstarts=0;
+	starts[numstarts++]=0;
+	for (int r=slot->head;r>=0;r=rt->rules[r].next) {
+		starts[numstarts++]=rt->rules[r].minsize;
+		if (rt->rules[r].maxsize!=~0ULL) starts[numstarts++]=rt->rules[r].maxsize+1;
+	}
+	qsort((void*)starts,numstarts,sizeof(unsigned long long),comparesizes);
+	int numpieces=1;
+	for (int i=1;i<numstarts;++i) {
+		if (starts[i]!=starts[numpieces-1]) starts[numpieces++]=starts[i];
+	}
+	slot->starts=starts;
+	slot->numpieces=numpieces;
+	slot->first=(int*)malloc(sizeof(int)*RULECLASSES*numpieces);
+	int *skip = (int*)malloc(sizeof(int)*(numpieces+1));
+	for (int c=0;c<RULECLASSES;++c) {
+		for (int p=0;p<=numpieces;++p) skip[p]=p;
+		for (int r=slot->head;r>=0;r=rt->rules[r].next) {
+			const rule *thisrule = &rt->rules[r];
+			if (thisrule->classes && !(thisrule->classes&ruleclasses(c))) continue;
+			const int last = (thisrule->maxsize==~0ULL)?numpieces-1:findpiece(slot,thisrule->maxsize);
+			for (int p=nextfree(skip,findpiece(slot,thisrule->minsize));p<=last;p=nextfree(skip,p+1)) {
+				slot->first[p*RULECLASSES+c]=r;
+				skip[p]=p+1;
+			}
+		}
+		for (int p=nextfree(skip,0);p<numpieces;p=nextfree(skip,p+1)) {
+			slot->first[p*RULECLASSES+c]=-1;
+			skip[p]=p+1;
+		}
+	}
+	free(skip);
+}
+
+ruletable *loadrules(const char *filename,FILE *errfile) {
+	FILE *file = fopen(filename,"r");
+	if (!file) {
+		fprintf(errfile,"CSP: Unable to read the rule file %s\n",filename);
+		return NULL;
+	}
+	ruletable *rt = (ruletable*)calloc(1,sizeof(ruletable));
+	growkeys(rt,RULEMINKEYS);
+	char line[RULELINESIZE];
+	int linenum=0;
+	const double now = getnow();
+	while (fgets(line,RULELINESIZE,file)) {
+		++linenum;
+		unsigned char bad = !strchr(line,'\n') && !feof(file); // longer than a line may be
+		char *comment = strchr(line,'#');
+		if (comment) *comment='\0';
+		char *fields[6];
+		int count=0;
+		for (char *field=strtok(line," \t\r\n");field && count<6;field=strtok(NULL," \t\r\n")) fields[count++]=field;
+		if (!count && !bad) continue;
+		rule r;
+		memset(&r,0,sizeof(rule));
+		r.line=linenum;
+		if (bad || count!=5 || !readsp(fields[0],&r.src) || !readsp(fields[1],&r.dst) || !readsize(fields[2],&r)
+				|| !readclass(fields[3],&r) || !readaction(fields[4],&r) || rt->numrules>=MAXRULES) {
+			fprintf(errfile,"CSP: Bad rule on line %d of %s\n",linenum,filename);
+			fclose(file);
+			freeruletable(rt);
+			return NULL;
+		}
+		r.tokens=r.rate;
+		r.refilled=now;
+		addrule(rt,&r);
+	}
+	fclose(file);
+	for (unsigned int i=0;i<rt->capacity;++i) {
+		if (rt->keys[i].head>=0) cutpieces(rt,&rt->keys[i]);
+	}
+	return rt;
+}
+
+void freeruletable(ruletable *rt) {
+	if (!rt) return;
+	for (unsigned int i=0;i<rt->capacity;++i) {
+		free(rt->keys[i].starts);
+		free(rt->keys[i].first);
+	}
+	free(rt->keys);
+	free(rt->rules);
+	free(rt);
+}
+
+int matchrule(ruletable *rt,const int src,const int dst,const unsigned long long size,const int classes) {
+	if (!rt) return -1;
+	const int keysrc[4] = {src,src,-1,-1};
+	const int keydst[4] = {dst,-1,dst,-1};
+	const int c = ruleclassof(classes);
+	int best=-1;
+	for (int s=0;s<4;++s) {
+		if (!(rt->shapes&(1<<s))) continue;
+		const rulekeyslot *slot = &rt->keys[findkey(rt,rulekey(keysrc[s],keydst[s]))];
+		if (slot->head<0) continue;
+		// the first rule of each key that takes the request, the one first in the file wins
+		const int r = slot->first[findpiece(slot,size)*RULECLASSES+c];
+		if (r>=0 && (best<0 || r<best)) best=r;
+	}
+	return best;
+}
+
+unsigned char applyrule(ruletable *rt,const int i,const unsigned long long size,const double now,int *dst,unsigned char *mirrored) {
+	rule *r = &rt->rules[i];
+	++r->matched;
+	switch (r->action) {
+	case RULEDROP:
+		++r->rejected;
+		return 0;
+	case RULELIMIT:
+		r->tokens+=(now-r->refilled)*r->rate;
+		if (r->tokens>r->rate) r->tokens=r->rate;
+		r->refilled=now;
+		if (r->tokens<0) {
+			++r->rejected;
+			return 0;
+		}
+		r->tokens-=(double)size;
+		break;
+	case RULEREWRITE:
+		*dst=r->target;
+		break;
+	case RULEMIRROR:
+		*mirrored=1;
+		break;
+	}
+	r->bytes+=size;
+	return 1;
+}
+
+void printrule(rule *r,FILE *outfile) {
+	if (r->src<0) fprintf(outfile,"* ");
+	else fprintf(outfile,"%d ",r->src);
+	if (r->dst<0) fprintf(outfile,"* ");
+	else fprintf(outfile,"%d ",r->dst);
+	if (!r->minsize && r->maxsize==~0ULL) fprintf(outfile,"* ");
+	else if (r->minsize==r->maxsize) fprintf(outfile,"%llu ",r->minsize);
+	else if (r->maxsize==~0ULL) fprintf(outfile,"%llu- ",r->minsize);
+	else fprintf(outfile,"%llu-%llu ",r->minsize,r->maxsize);
+	if (r->classes==RULESINGLE) fprintf(outfile,"single ");
+	else if (r->classes==RULEBULK) fprintf(outfile,"bulk ");
+	else if (r->classes==RULERESUME) fprintf(outfile,"resume ");
+	else fprintf(outfile,"* ");
+	switch (r->action) {
+	case RULEFORWARD: fprintf(outfile,"forward"); break;
+	case RULEDROP: fprintf(outfile,"drop"); break;
+	case RULEREWRITE: fprintf(outfile,"rewrite=%d",r->target); break;
+	case RULELIMIT: fprintf(outfile,"limit=%.0f",r->rate); break;
+	case RULEMIRROR: fprintf(outfile,"mirror"); break;
+	}
+}
+
+void printrulestats(ruletable *rt,FILE *outfile) {
+	if (!rt) return;
+	unsigned long long matched=0;
+	for (int i=0;i<rt->numrules;++i) {
+		rule *r = &rt->rules[i];
+		matched+=r->matched;
+		fprintf(outfile,"CSP: Rule on line %d (",r->line);
+		printrule(r,outfile);
+		fprintf(outfile,") matched %llu requests, forwarded %llu data bytes, rejected %llu\n",r->matched,r->bytes,r->rejected);
+	}
+	fprintf(outfile,"CSP: %d forwarding rules matched %llu requests\n",rt->numrules,matched);
+}
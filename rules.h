@@ -0,0 +1,93 @@
+#ifndef _FASTETH_RULES_H
+#define _FASTETH_RULES_H
+
+#include <stdio.h>
+
+// the CSP's forwarding rules, fastserv -rules=file
+// a rule matches a data request on its source SP, its destination SP, its data size, and its class,
+// and says what the CSP does with the transfer, a request no rule matches is forwarded as before
+// a rule file has a rule a line, blank lines and anything from a # on are skipped:
+//   src dst size class action
+// src and dst are SP IDs or * for any, size is * or a range of data bytes (a-b, a-, -b, or a)
+// class is * or one of single (the data fits one frame), bulk (it doesn't), resume (the SP resumes a transfer)
+// action is one of
+//   forward	forward the transfer, the rules after it aren't tried
+//   drop		reject the request
+//   rewrite=x	forward the transfer to SP x (or anycast group x) instead, the acknowledgement names x
+//   limit=x	forward at most x data bytes a second of the requests the rule matches, reject the rest
+//		(a token bucket a second deep, a request may take it below empty, the next waits out the debt)
+//   mirror	forward the transfer and copy every frame of it to the mirror (see mirror.h)
+// the first rule of the file that matches a request applies
+// the rules are kept in a hash table by (src, dst), with * a key of its own, so a request is looked up
+// under at most four keys however many rules there are
+// a key's sizes are cut into pieces where one of its rules' ranges starts or ends, each piece has the first rule
+// (in file order) for each class a request can have, so a key takes a binary search for the piece and no more
+
+// the most rules a file may have, and the longest line
+#define MAXRULES 65536
+#define RULELINESIZE 256
+
+// request classes, a request has one of single and bulk and may have resume
+#define RULESINGLE 0x1
+#define RULEBULK 0x2
+#define RULERESUME 0x4
+// the classes a request can have, single or bulk with or without resume (see ruleclassof)
+#define RULECLASSES 4
+
+// the starting size of the key table, it grows by doubling
+#define RULEMINKEYS 16
+
+enum ruleaction { RULEFORWARD, RULEDROP, RULEREWRITE, RULELIMIT, RULEMIRROR };
+
+typedef struct rule {
+	int line; // of the rule file
+	int src, dst; // -1 for any
+	unsigned long long minsize, maxsize;
+	int classes; // 0 for any
+	int action;
+	int target; // the SP ID of a rewrite
+	double rate; // the bytes a second of a limit
+	double tokens, refilled; // the limit's bucket and when it was last filled
+	int next; // the next rule with the same src and dst in file order, -1 at the end
+	// the counters, requests matched and their data bytes, and the requests rejected (by drop or limit)
+	unsigned long long matched, bytes, rejected;
+}rule;
+
+// the rules with one (src, dst), in an open addressed table (linear probing) by its key (see rulekey)
+typedef struct rulekeyslot {
+	unsigned long long key;
+	int head; // the key's first rule, -1 for an empty slot
+	int tail; // and its last
+	int numpieces;
+	unsigned long long *starts; // the first size of each piece, ascending, starts[0] is 0
+	int *first; // RULECLASSES entries a piece, the index of the rule for the class, -1 for none
+}rulekeyslot;
+
+typedef struct ruletable {
+	unsigned int capacity; // a power of two
+	unsigned int numkeys;
+	rulekeyslot *keys;
+	int numrules;
+	rule *rules;
+	unsigned char shapes; // the RULESHAPE bits of the keys that have rules, a lookup skips the others
+	unsigned char mirrors; // a rule mirrors
+}ruletable;
+
+// reads the rules in filename, a bad line is reported to errfile
+// returns NULL if the file can't be read or has a bad line
+ruletable *loadrules(const char *filename,FILE *errfile);
+void freeruletable(ruletable *rt);
+
+// the index of the rule for a request from src to dst of size data bytes in the classes given, -1 if none (rt may be NULL)
+int matchrule(ruletable *rt,const int src,const int dst,const unsigned long long size,const int classes);
+
+// counts the request against rule i and applies it, *dst is rewritten and *mirrored set as the rule says
+// returns 0 if the request is rejected
+unsigned char applyrule(ruletable *rt,const int i,const unsigned long long size,const double now,int *dst,unsigned char *mirrored);
+
+// prints the rule r as it was written
+void printrule(rule *r,FILE *outfile);
+// prints the counters of every rule
+void printrulestats(ruletable *rt,FILE *outfile);
+
+#endif // _FASTETH_RULES_H
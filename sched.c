@@ -0,0 +1,369 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sched.h"
+
+// round robin distance from the pointer ptr forward to x, over n ports
+static inline int rrdistance(const int x,const int ptr,const int n) {
+	return (x-ptr+n)%n;
+}
+
+// a request is grantable if its destination is connected and its source is not already sending
+// this is the most permissive rule, it is used to measure capacity lost by a scheduler
+static inline unsigned char grantable(requestqueuenode *request,dataqueuenode *dataqueue,const int *reach) {
+	if (reach[request->dst_port]<0) return 0;
+	for (int i=0;i<DATAQUEUESIZE;++i) {
+		if (dataqueue[i].src_sp_id>=0 && dataqueue[i].src_port==request->src_port) return 0;
+	}
+	return 1;
+}
+
+// moves the chosen request queue indices (ascending order) into free data queue slots
+// records the grants in the statistics, returns the number of moves written to moved[]
+static int grantchosen(scheduler *sched,requestqueuenode *requestqueue,dataqueuenode *dataqueue,
+												const int *chosen,const int count,const double now,int *moved) {
+	schedstats *stats = &sched->stats;
+	for (int i=0;i<count;++i) {
+		requestqueuenode *request = &requestqueue[chosen[i]];
+		const int dataqindex = getnextdataqindex(dataqueue);
+		dataqueue[dataqindex].src_sp_id = request->src_sp_id;
+		dataqueue[dataqindex].dst_sp_id = request->dst_sp_id;
+		dataqueue[dataqindex].src_port = request->src_port;
+		dataqueue[dataqindex].dst_port = request->dst_port;
+		dataqueue[dataqindex].bytesremaining = request->datasize;
+		dataqueue[dataqindex].mirrored = request->mirrored;
+		moved[i]=dataqindex;
+		const double wait = now-request->queuedat;
+		if (!stats->grants) stats->firstgrant=now;
+		++stats->grants;
+		stats->bytesgranted+=request->datasize;
+		stats->waitsum+=wait;
+		if (wait>stats->waitmax) stats->waitmax=wait;
+		++stats->spgrants[request->src_port];
+		stats->spbytes[request->src_port]+=request->datasize;
+		stats->spwait[request->src_port]+=wait;
+	}
+	// remove from the back so the earlier indices stay valid
+	for (int i=count-1;i>=0;--i) {
+		requestqueuenode result;
+		removerequest(requestqueue,chosen[i],&result);
+	}
+	return count;
+}
+
+// the number of free data queue slots
+static inline int freeslots(dataqueuenode *dataqueue) {
+	int count=0;
+	for (int i=0;i<DATAQUEUESIZE;++i) {
+		if (dataqueue[i].src_sp_id<0) ++count;
+	}
+	return count;
+}
+
+// FIFO, the original behavior
+// only the head of the request queue may move, if its destination is not connected everything waits
+static int fifomatch(scheduler *sched,requestqueuenode *requestqueue,dataqueuenode *dataqueue,
+											const int *reach,const double now,int *moved) {
+	int count=0;
+	while (requestqueue[0].src_sp_id>=0 && requestqueue[0].dst_sp_id>=0 && getnextdataqindex(dataqueue)>=0) {
+		// either the destination SP is invalid or has not connected yet
+		if (reach[requestqueue[0].dst_port]<0) break; // don't cause problems, let's just come back for this
+		const int head=0;
+		count+=grantchosen(sched,requestqueue,dataqueue,&head,1,now,moved+count);
+	}
+	return count;
+}
+
+// marks the inputs and outputs of the active transfers as matched
+// each SP sends one transfer at a time and an output port receives from one input at a time
+static void markbusy(scheduler *sched,dataqueuenode *dataqueue) {
+	for (int i=0;i<DATAQUEUESIZE;++i) {
+		if (dataqueue[i].src_sp_id<0) continue;
+		sched->inputmatch[dataqueue[i].src_port]=dataqueue[i].dst_port;
+		sched->outputmatch[dataqueue[i].dst_port]=dataqueue[i].src_port;
+	}
+}
+
+// resets the match arrays touched by the queues, keeps a pass independent of the port count
+static void clearbusy(scheduler *sched,requestqueuenode *requestqueue,dataqueuenode *dataqueue) {
+	for (int i=0;i<REQUESTQUEUESIZE && requestqueue[i].src_sp_id>=0;++i) {
+		sched->inputmatch[requestqueue[i].src_port]=-1;
+		sched->outputmatch[requestqueue[i].dst_port]=-1;
+	}
+	for (int i=0;i<DATAQUEUESIZE;++i) {
+		if (dataqueue[i].src_sp_id<0) continue;
+		sched->inputmatch[dataqueue[i].src_port]=-1;
+		sched->outputmatch[dataqueue[i].dst_port]=-1;
+	}
+}
+
+// iSLIP, request/grant/accept matching with round-robin pointers
+// every unmatched input requests every unmatched output it has a queued request for
+// each output grants the requesting input closest to its grant pointer
+// each input accepts the granting output closest to its accept pointer
+// pointers move one past the match only for matches made in the first iteration
+static int islipmatch(scheduler *sched,requestqueuenode *requestqueue,dataqueuenode *dataqueue,
+											const int *reach,const double now,int *moved) {
+	int slots = freeslots(dataqueue);
+	if (!slots || requestqueue[0].src_sp_id<0) return 0;
+	const int n = sched->numports;
+	int *grantto = sched->grantto;
+	// the accept choice per input is the second half of the scratch array
+	int *acceptof = sched->grantto+n;
+	unsigned char taken[REQUESTQUEUESIZE];
+	memset((void*)taken,0,sizeof(unsigned char)*REQUESTQUEUESIZE);
+	markbusy(sched,dataqueue);
+	for (int iteration=0;iteration<ISLIPITERATIONS && slots;++iteration) {
+		for (int i=0;i<REQUESTQUEUESIZE && requestqueue[i].src_sp_id>=0;++i) {
+			grantto[requestqueue[i].dst_port]=-1;
+			acceptof[requestqueue[i].src_port]=-1;
+		}
+		// request and grant
+		for (int i=0;i<REQUESTQUEUESIZE && requestqueue[i].src_sp_id>=0;++i) {
+			const int src=requestqueue[i].src_port, dst=requestqueue[i].dst_port;
+			if (taken[i] || reach[dst]<0 || sched->inputmatch[src]>=0 || sched->outputmatch[dst]>=0) continue;
+			if (grantto[dst]<0 || rrdistance(src,sched->grantptr[dst],n)<rrdistance(grantto[dst],sched->grantptr[dst],n))
+				grantto[dst]=src;
+		}
+		// accept
+		for (int i=0;i<REQUESTQUEUESIZE && requestqueue[i].src_sp_id>=0;++i) {
+			const int src=requestqueue[i].src_port, dst=requestqueue[i].dst_port;
+			if (taken[i] || grantto[dst]!=src || sched->inputmatch[src]>=0) continue;
+			if (acceptof[src]<0 || rrdistance(dst,sched->acceptptr[src],n)<rrdistance(acceptof[src],sched->acceptptr[src],n))
+				acceptof[src]=dst;
+		}
+		// commit the accepted matches, the oldest request of a pair is the one moved
+		unsigned char progress=0;
+		for (int i=0;i<REQUESTQUEUESIZE && requestqueue[i].src_sp_id>=0 && slots;++i) {
+			const int src=requestqueue[i].src_port, dst=requestqueue[i].dst_port;
+			if (taken[i] || acceptof[src]!=dst || sched->inputmatch[src]>=0 || sched->outputmatch[dst]>=0) continue;
+			sched->inputmatch[src]=dst;
+			sched->outputmatch[dst]=src;
+			taken[i]=1;
+			--slots;
+			progress=1;
+			if (!iteration) {
+				sched->grantptr[dst]=(src+1)%n;
+				sched->acceptptr[src]=(dst+1)%n;
+			}
+		}
+		if (!progress) break;
+	}
+	clearbusy(sched,requestqueue,dataqueue);
+	int chosen[REQUESTQUEUESIZE], count=0;
+	for (int i=0;i<REQUESTQUEUESIZE;++i) {
+		if (taken[i]) chosen[count++]=i;
+	}
+	return grantchosen(sched,requestqueue,dataqueue,chosen,count,now,moved);
+}
+
+// search state for the maximum weight matching
+typedef struct mwmsearch {
+	scheduler *sched;
+	requestqueuenode *requestqueue;
+	int candidates[REQUESTQUEUESIZE];
+	unsigned long long weight[REQUESTQUEUESIZE];
+	unsigned long long remaining[REQUESTQUEUESIZE+1]; // suffix sums of the weights, for pruning
+	int count;
+	int current[REQUESTQUEUESIZE];
+	int best[REQUESTQUEUESIZE];
+	int bestcount;
+	unsigned long long bestweight;
+}mwmsearch;
+
+// branch and bound over the candidate requests, take or skip each one
+// a taken request claims its input and output, at most slots requests are taken
+static void mwmsearchfrom(mwmsearch *search,const int k,const int taken,const int slots,const unsigned long long weight) {
+	if (weight>search->bestweight) {
+		search->bestweight=weight;
+		search->bestcount=taken;
+		memcpy((void*)search->best,(void*)search->current,sizeof(int)*taken);
+	}
+	if (k==search->count || taken==slots) return;
+	// the rest of the candidates can not beat the best matching
+	if (weight+search->remaining[k]<=search->bestweight) return;
+	scheduler *sched = search->sched;
+	requestqueuenode *request = &search->requestqueue[search->candidates[k]];
+	if (sched->inputmatch[request->src_port]<0 && sched->outputmatch[request->dst_port]<0) {
+		sched->inputmatch[request->src_port]=request->dst_port;
+		sched->outputmatch[request->dst_port]=request->src_port;
+		search->current[taken]=search->candidates[k];
+		mwmsearchfrom(search,k+1,taken+1,slots,weight+search->weight[k]);
+		sched->inputmatch[request->src_port]=-1;
+		sched->outputmatch[request->dst_port]=-1;
+	}
+	mwmsearchfrom(search,k+1,taken,slots,weight);
+}
+
+// maximum weight matching, the weight of a request is its age in microseconds (plus one)
+// the request queue is small so the matching is found exactly with a branch and bound search
+// ties go to the older requests, the ones nearer the front of the queue
+static int mwmmatch(scheduler *sched,requestqueuenode *requestqueue,dataqueuenode *dataqueue,
+										const int *reach,const double now,int *moved) {
+	const int slots = freeslots(dataqueue);
+	if (!slots || requestqueue[0].src_sp_id<0) return 0;
+	mwmsearch search = { .sched=sched, .requestqueue=requestqueue, .count=0, .bestcount=0, .bestweight=0 };
+	markbusy(sched,dataqueue);
+	for (int i=0;i<REQUESTQUEUESIZE && requestqueue[i].src_sp_id>=0;++i) {
+		const int src=requestqueue[i].src_port, dst=requestqueue[i].dst_port;
+		if (reach[dst]<0 || sched->inputmatch[src]>=0 || sched->outputmatch[dst]>=0) continue;
+		const double age = now-requestqueue[i].queuedat;
+		search.weight[search.count]=1+(unsigned long long)(age>0?age*1e6:0);
+		search.candidates[search.count++]=i;
+	}
+	search.remaining[search.count]=0;
+	for (int k=search.count-1;k>=0;--k) {
+		search.remaining[k]=search.remaining[k+1]+search.weight[k];
+	}
+	mwmsearchfrom(&search,0,0,slots,0);
+	clearbusy(sched,requestqueue,dataqueue);
+	// the search records the chosen indices in ascending order
+	return grantchosen(sched,requestqueue,dataqueue,search.best,search.bestcount,now,moved);
+}
+
+static const schedops schedulers[] = {
+	{ .name="fifo", .direct=1, .match=fifomatch },
+	{ .name="islip", .direct=0, .match=islipmatch },
+	{ .name="mwm", .direct=0, .match=mwmmatch },
+};
+#define NUMSCHEDULERS (sizeof(schedulers)/sizeof(schedops))
+
+// grows the per port arrays to hold numports ports, new ports start unmatched with zero stats
+static void ensureports(scheduler *sched,const int numports) {
+	if (numports<=sched->numports) return;
+	int newsize = sched->numports?sched->numports:16;
+	while (newsize<numports) newsize<<=1;
+	sched->grantptr = (int*)realloc(sched->grantptr,sizeof(int)*newsize);
+	sched->acceptptr = (int*)realloc(sched->acceptptr,sizeof(int)*newsize);
+	sched->inputmatch = (int*)realloc(sched->inputmatch,sizeof(int)*newsize);
+	sched->outputmatch = (int*)realloc(sched->outputmatch,sizeof(int)*newsize);
+	// grant choices per output followed by accept choices per input
+	sched->grantto = (int*)realloc(sched->grantto,sizeof(int)*newsize*2);
+	sched->stats.spgrants = (unsigned long long*)realloc(sched->stats.spgrants,sizeof(unsigned long long)*newsize);
+	sched->stats.spbytes = (unsigned long long*)realloc(sched->stats.spbytes,sizeof(unsigned long long)*newsize);
+	sched->stats.spwait = (double*)realloc(sched->stats.spwait,sizeof(double)*newsize);
+	for (int i=sched->numports;i<newsize;++i) {
+		sched->grantptr[i]=0;
+		sched->acceptptr[i]=0;
+		sched->inputmatch[i]=-1;
+		sched->outputmatch[i]=-1;
+		sched->stats.spgrants[i]=0;
+		sched->stats.spbytes[i]=0;
+		sched->stats.spwait[i]=0;
+	}
+	sched->numports=newsize;
+}
+
+// creates a scheduler by name ("fifo", "islip", or "mwm")
+// returns NULL if the name is unknown
+scheduler *newscheduler(const char *name) {
+	const schedops *ops=NULL;
+	for (unsigned int i=0;i<NUMSCHEDULERS;++i) {
+		if (strcmp(name,schedulers[i].name)==0) ops=&schedulers[i];
+	}
+	if (!ops) return NULL;
+	scheduler *sched = (scheduler*)calloc(1,sizeof(scheduler));
+	sched->ops=ops;
+	ensureports(sched,1);
+	return sched;
+}
+
+void freescheduler(scheduler *sched) {
+	if (!sched) return;
+	free(sched->grantptr);
+	free(sched->acceptptr);
+	free(sched->inputmatch);
+	free(sched->outputmatch);
+	free(sched->grantto);
+	free(sched->stats.spgrants);
+	free(sched->stats.spbytes);
+	free(sched->stats.spwait);
+	free(sched);
+}
+
+// adds the slot time since the previous pass or admission, at the data queue state it left behind
+static inline void integrateslots(schedstats *stats,const double now) {
+	if (stats->passes || stats->grants) {
+		const double elapsed = now-stats->lastpass;
+		stats->busytime+=elapsed*stats->busyslots;
+		stats->strandedtime+=elapsed*stats->strandedslots;
+	}
+	stats->lastpass=now;
+}
+
+// runs one scheduling pass, see schedops.match
+// this also records the pass in the scheduler statistics
+int schedule(scheduler *sched,requestqueuenode *requestqueue,dataqueuenode *dataqueue,
+							const int *reach,const int numports,const double now,int *moved) {
+	schedstats *stats = &sched->stats;
+	ensureports(sched,numports);
+	integrateslots(stats,now);
+	++stats->passes;
+	const int count = sched->ops->match(sched,requestqueue,dataqueue,reach,now,moved);
+	// the data queue as this pass leaves it holds until the next pass, the slots it granted included
+	const int slots = freeslots(dataqueue);
+	int waiting=0;
+	for (int i=0;i<REQUESTQUEUESIZE && requestqueue[i].src_sp_id>=0;++i) {
+		if (grantable(&requestqueue[i],dataqueue,reach)) ++waiting;
+	}
+	stats->busyslots=DATAQUEUESIZE-slots;
+	stats->strandedslots=(waiting<slots)?waiting:slots;
+	if (stats->strandedslots) ++stats->strandedpasses;
+	return count;
+}
+
+// records that a request was admitted straight into data queue slot index
+void schedadmitted(scheduler *sched,dataqueuenode *dataqueue,const int index,const double now) {
+	schedstats *stats = &sched->stats;
+	const int src = dataqueue[index].src_port;
+	ensureports(sched,src+1);
+	// the slot is taken from now on, it was one a waiting request could have had at most
+	integrateslots(stats,now);
+	const int slots = freeslots(dataqueue);
+	stats->busyslots=DATAQUEUESIZE-slots;
+	if (stats->strandedslots>slots) stats->strandedslots=slots;
+	if (!stats->grants) stats->firstgrant=now;
+	++stats->grants;
+	stats->bytesgranted+=dataqueue[index].bytesremaining;
+	++stats->spgrants[src];
+	stats->spbytes[src]+=dataqueue[index].bytesremaining;
+}
+
+// Jain's fairness index, (sum x)^2 / (n * sum x^2), over the n SPs that were granted anything
+static double jainindex(schedstats *stats,const int numports,const unsigned char usewait) {
+	double sum=0, sumsquares=0;
+	int n=0;
+	for (int i=0;i<numports;++i) {
+		if (!stats->spgrants[i]) continue;
+		const double x = usewait?stats->spwait[i]/stats->spgrants[i]:(double)stats->spbytes[i];
+		sum+=x;
+		sumsquares+=x*x;
+		++n;
+	}
+	if (!n || sumsquares==0) return 1.0;
+	return (sum*sum)/(n*sumsquares);
+}
+
+// prints the fairness and throughput statistics
+void printschedstats(scheduler *sched,FILE *outfile,const double now) {
+	schedstats *stats = &sched->stats;
+	const double elapsed = stats->grants?now-stats->firstgrant:0;
+	fprintf(outfile,"CSP: Scheduler %s statistics\n",sched->ops->name);
+	fprintf(outfile,"CSP:   %llu scheduling passes, %llu grants, %llu rejects\n",stats->passes,stats->grants,stats->rejects);
+	fprintf(outfile,"CSP:   queue wait mean %.6f s, max %.6f s\n",stats->grants?stats->waitsum/stats->grants:0,stats->waitmax);
+	if (elapsed>0) {
+		fprintf(outfile,"CSP:   throughput %.1f bytes/s granted, %.1f bytes/s forwarded\n",
+						stats->bytesgranted/elapsed,stats->bytesforwarded/elapsed);
+		fprintf(outfile,"CSP:   slot utilization %.2f%%, stranded slot time %.2f%%\n",
+						100.0*stats->busytime/(DATAQUEUESIZE*elapsed),100.0*stats->strandedtime/(DATAQUEUESIZE*elapsed));
+	}
+	fprintf(outfile,"CSP:   %llu passes left a free slot while a grantable request waited\n",stats->strandedpasses);
+	fprintf(outfile,"CSP:   Jain fairness index %.4f (granted bytes), %.4f (mean queue wait)\n",
+					jainindex(stats,sched->numports,0),jainindex(stats,sched->numports,1));
+}
+
+// prints the names of the available schedulers
+void printschedulers(FILE *outfile) {
+	for (unsigned int i=0;i<NUMSCHEDULERS;++i) {
+		fprintf(outfile,"%s%s",i?"|":"",schedulers[i].name);
+	}
+}
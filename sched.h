@@ -0,0 +1,82 @@
+#ifndef _FASTETH_SCHED_H
+#define _FASTETH_SCHED_H
+
+#include <stdio.h>
+#include "queues.h"
+
+// the number of request/grant/accept rounds iSLIP runs per scheduling pass
+#define ISLIPITERATIONS 4
+
+// statistics kept by every scheduler, reported at the end of the simulation
+// times are in seconds from whatever clock the caller passes as 'now'
+typedef struct schedstats {
+	unsigned long long passes; // scheduling passes run
+	unsigned long long grants; // requests moved into the data queue
+	unsigned long long rejects; // requests rejected because the request queue was full
+	unsigned long long strandedpasses; // passes that left a slot empty while a grantable request waited
+	unsigned long long bytesgranted; // total transfer bytes (with headers) granted
+	unsigned long long bytesforwarded; // data frame bytes forwarded
+	double strandedtime; // slot-seconds a data queue slot sat empty while a grantable request waited
+	double busytime; // slot-seconds the data queue slots were occupied
+	double waitsum; // sum of queue waits of granted requests
+	double waitmax; // longest queue wait of a granted request
+	double firstgrant; // time of the first grant, start of the throughput window
+	double lastpass; // time of the previous pass (or admission), used for the slot time integrals
+	// the data queue as the previous pass (or admission) left it, held until the next one
+	int busyslots; // occupied slots
+	int strandedslots; // free slots a grantable request waited for
+	unsigned long long *spgrants; // per port number of granted requests
+	unsigned long long *spbytes; // per port granted bytes
+	double *spwait; // per port sum of queue waits
+}schedstats;
+
+struct scheduler;
+
+// the scheduling algorithm
+// match moves requests from the request queue into free data queue slots
+// the scheduler works on port table indices (src_port, dst_port) of the queued requests
+// reach[] holds the next hop descriptor for each port, a negative value means not reachable
+// the data queue index of each move is written to moved[], returns the number of moves
+typedef struct schedops {
+	const char *name;
+	// 1 if a new request may bypass the request queue when a slot is free (legacy FIFO behavior)
+	unsigned char direct;
+	int (*match)(struct scheduler *sched,requestqueuenode *requestqueue,dataqueuenode *dataqueue,
+								const int *reach,const double now,int *moved);
+}schedops;
+
+// a scheduler instance, the algorithm and its per port state
+typedef struct scheduler {
+	const schedops *ops;
+	int numports; // length of the per port arrays, they grow with the port table
+	// iSLIP round-robin pointers, one per output (grant) and one per input (accept)
+	int *grantptr;
+	int *acceptptr;
+	// scratch arrays sized numports, used during a pass
+	int *inputmatch;
+	int *outputmatch;
+	int *grantto;
+	schedstats stats;
+}scheduler;
+
+// creates a scheduler by name ("fifo", "islip", or "mwm")
+// returns NULL if the name is unknown
+scheduler *newscheduler(const char *name);
+void freescheduler(scheduler *sched);
+
+// runs one scheduling pass, see schedops.match
+// numports is one more than the highest port index in use (the length of reach[])
+// this also records the pass in the scheduler statistics
+int schedule(scheduler *sched,requestqueuenode *requestqueue,dataqueuenode *dataqueue,
+							const int *reach,const int numports,const double now,int *moved);
+
+// records that a request was admitted straight into data queue slot index
+void schedadmitted(scheduler *sched,dataqueuenode *dataqueue,const int index,const double now);
+
+// prints the fairness and throughput statistics
+void printschedstats(scheduler *sched,FILE *outfile,const double now);
+
+// prints the names of the available schedulers
+void printschedulers(FILE *outfile);
+
+#endif // _FASTETH_SCHED_H
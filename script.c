@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "common.h"
+#include "script.h"
+
+// walking two pointers up with strchr
+// input format is VERY strict (for placement of a few magic characters)
+// if parsing doesn't find a match the line will have no effect
+unsigned char parseline(char *line,scriptcmd *cmd,char **text,int *textlen) {
+	memset((void*)cmd,0,sizeof(scriptcmd));
+	*text=cmd->text;
+	*textlen=0;
+	// skip lines that begin with these characters, and the minimum cutoff for valid lines
+	if (line[0]=='\0' || line[0]=='\n' || line[0]=='#' || strlen(line)<2) return 0;
+	char *nextch = strchr(line,' ');
+	if (!nextch) return 0;
+	*nextch++='\0';
+//Wait for receiving 1 frame
+//Wait for receiving 2 frames # (plural 's' / etc doesn't matter with how this is parsed)
+	if (strcmp(line,"Wait")==0) {
+		char *endch = strchr(nextch,'g');
+		if (!endch) return 0;
+		endch+=2;
+		nextch=strchr(endch,' ');
+		if (!nextch) return 0;
+		*nextch='\0';
+		cmd->op=SCRIPTWAIT;
+		cmd->count=atoi(endch);
+		return 1;
+	}
+// # send frame number to sp 2
+// Frame 1, To SP 2
+// # send text to sp 2 (it just reads the rest of the line up to maxdatasize)
+// Frame 1, To SP 2 text to send
+// # send file to sp 2
+// Frame 1, To SP 2 $sendfile.txt
+	if (strcmp(line,"Frame")!=0) return 0;
+	char *endch = strchr(nextch,',');
+	if (!endch) return 0;
+	*endch='\0';
+	// nextch is the first char after the first space, the packet number
+	cmd->seqnum = atoi(nextch);
+	nextch = strchr(endch+1,'P');
+	if (!nextch) return 0;
+	// nextch is two chars after the 'P', endch is the space after
+	nextch+=2;
+	endch = strchr(nextch,' ');
+	cmd->op=SCRIPTFRAME;
+	//	   endch points v
+	// "Frame 1, To SP 2 xxx"
+	// nextch points   ^
+	// no trailing text after "SP 2", just send the frame number
+	if (!endch) {
+		cmd->dst_sp_id = atoi(nextch);
+		*textlen=sprintf(cmd->text,"%d",cmd->seqnum);
+		return 1;
+	}
+	*endch='\0';
+	cmd->dst_sp_id = atoi(nextch);
+	char *sendchar = endch+1;
+	// "Frame 1, To SP 2 $./inputfile.txt", a file if text exists after the '$'
+	if (sendchar[0]=='$' && sendchar[1]!='\n' && sendchar[1]!='\0') {
+		cmd->file=1;
+		*text=sendchar+1;
+		// turn any trailing newline into a null terminator
+		char *newline = strchr(*text,'\n');
+		if (newline) *newline='\0';
+	}
+	// Frame 1, To SP 2 words to send, the rest of the line goes as it is
+	else *text=sendchar;
+	*textlen=(int)strlen(*text);
+	return 1;
+}
+
+unsigned char parsecommand(char *line,scriptcmd *cmd) {
+	char *text;
+	int textlen;
+	if (!parseline(line,cmd,&text,&textlen)) return 0;
+	if (text!=cmd->text) {
+		if (textlen>=MAXLINELEN) textlen=MAXLINELEN-1;
+		memcpy((void*)cmd->text,(void*)text,sizeof(char)*textlen);
+		cmd->text[textlen]='\0';
+	}
+	return 1;
+}
+
+script *loadscript(const char *filename) {
+	FILE *cmdfile = fopen(filename,"r");
+	if (!cmdfile) return NULL;
+	script *s = (script*)calloc(1,sizeof(script));
+	int maxcmds=0;
+	char linebuffer[MAXLINELEN];
+	while (fgets(linebuffer,MAXLINELEN,cmdfile)) {
+		scriptcmd cmd;
+		if (!parsecommand(linebuffer,&cmd)) continue;
+		if (s->numcmds==maxcmds) {
+			maxcmds=maxcmds?maxcmds<<1:16;
+			s->cmds = (scriptcmd*)realloc(s->cmds,sizeof(scriptcmd)*maxcmds);
+		}
+		s->cmds[s->numcmds++]=cmd;
+	}
+	fclose(cmdfile);
+	return s;
+}
+
+void freescript(script *s) {
+	if (!s) return;
+	free(s->cmds);
+	free(s);
+}
+
+int compilescript(FILE *in,FILE *out,FILE *errfile) {
+	unsigned char header[8];
+	// the count is written over once it is known
+	intinbuffer(header,SCRIPTMAGIC);
+	intinbuffer(header+4,0);
+	if (fwrite((void*)header,1,sizeof(header),out)!=sizeof(header)) return -1;
+	int numcmds=0, linenum=0;
+	char *line=NULL;
+	size_t linesize=0;
+	// getline so no line is cut short
+	while (getline(&line,&linesize,in)>=0) {
+		++linenum;
+		scriptcmd cmd;
+		char *text;
+		int textlen;
+		if (!parseline(line,&cmd,&text,&textlen)) continue;
+		unsigned char op[17];
+		if (cmd.op==SCRIPTWAIT) {
+			op[0]=SCRIPTWAIT;
+			intinbuffer(op+1,cmd.count);
+			if (fwrite((void*)op,1,5,out)!=5) break;
+			++numcmds;
+			continue;
+		}
+		if (cmd.file && textlen>=MAXLINELEN) {
+			fprintf(errfile,"Line %d: file name longer than %d characters, skipped\n",linenum,MAXLINELEN-1);
+			continue;
+		}
+		if (textlen>MAXDATASIZE) {
+			fprintf(errfile,"Line %d: frame %d text cut to %d bytes\n",linenum,cmd.seqnum,MAXDATASIZE);
+			textlen=MAXDATASIZE;
+			text[textlen]='\0';
+		}
+		op[0]=SCRIPTFRAME|(cmd.file?SCRIPTFILE:0);
+		intinbuffer(op+1,cmd.seqnum);
+		intinbuffer(op+5,cmd.dst_sp_id);
+		intinbuffer(op+9,textlen);
+		if (fwrite((void*)op,1,13,out)!=13 || fwrite((void*)text,1,textlen+1,out)!=(size_t)(textlen+1)) break;
+		++numcmds;
+	}
+	free(line);
+	if (!feof(in)) return -1;
+	intinbuffer(header+4,numcmds);
+	if (fseek(out,4,SEEK_SET) || fwrite((void*)(header+4),1,4,out)!=4 || fseek(out,0,SEEK_END) || fflush(out)) return -1;
+	return numcmds;
+}
+
+compiledscript *mapscript(const char *filename) {
+	const int fd = open(filename,O_RDONLY);
+	if (fd<0) return NULL;
+	struct stat st;
+	unsigned char header[8];
+	if (fstat(fd,&st) || st.st_size<(off_t)sizeof(header) || pread(fd,(void*)header,sizeof(header),0)!=(ssize_t)sizeof(header)
+			|| intfrombuffer(header)!=SCRIPTMAGIC) {
+		close(fd);
+		return NULL;
+	}
+	void *base = mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	// the mapping stays after the file is closed
+	close(fd);
+	if (base==MAP_FAILED) return NULL;
+	// read front to back once
+	posix_madvise(base,(size_t)st.st_size,POSIX_MADV_SEQUENTIAL);
+	compiledscript *s = (compiledscript*)calloc(1,sizeof(compiledscript));
+	s->base=(unsigned char*)base;
+	s->size=(size_t)st.st_size;
+	s->pos=sizeof(header);
+	s->numcmds=intfrombuffer(header+4);
+	return s;
+}
+
+unsigned char nextcommand(compiledscript *s,scriptcmd *cmd,const char **text,int *textlen) {
+	if (s->next>=s->numcmds || s->pos>=s->size) return 0;
+	unsigned char *op = s->base+s->pos;
+	const size_t left = s->size-s->pos;
+	memset((void*)cmd,0,sizeof(scriptcmd));
+	cmd->op=op[0]&~SCRIPTFILE;
+	cmd->file=(op[0]&SCRIPTFILE)!=0;
+	if (cmd->op==SCRIPTWAIT) {
+		if (left<5) return 0;
+		cmd->count=intfrombuffer(op+1);
+		*text=NULL;
+		*textlen=0;
+		s->pos+=5;
+		++s->next;
+		return 1;
+	}
+	if (cmd->op!=SCRIPTFRAME || left<13) return 0;
+	cmd->seqnum=intfrombuffer(op+1);
+	cmd->dst_sp_id=intfrombuffer(op+5);
+	const int length = intfrombuffer(op+9);
+	if (length<0 || length>MAXDATASIZE || (cmd->file && length>=MAXLINELEN) || (size_t)length+14>left || op[13+length]) return 0;
+	*text=(const char*)(op+13);
+	*textlen=length;
+	s->pos+=14+(size_t)length;
+	++s->next;
+	return 1;
+}
+
+void unmapscript(compiledscript *s) {
+	if (!s) return;
+	munmap((void*)s->base,s->size);
+	free(s);
+}
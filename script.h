@@ -0,0 +1,75 @@
+#ifndef _FASTETH_SCRIPT_H
+#define _FASTETH_SCRIPT_H
+
+// max length of a line from the input cmd file
+#define MAXLINELEN 128
+
+#include <stdio.h>
+
+// the SP input script, one command per line (see README for the format)
+// "Wait for receiving N frames " and "Frame N, To SP D [text|$file]"
+// the parsing is strict about a few magic characters, a line that doesn't match is no command
+enum scriptop { SCRIPTNONE=0, SCRIPTWAIT, SCRIPTFRAME };
+
+// one parsed command
+// a wait has the frame count, a frame has its sequence number and destination
+// text is the data of a text frame (the rest of the line as it is, or the sequence number)
+// or the file name of a file frame (file is set)
+typedef struct scriptcmd {
+	int op;
+	int count;
+	int seqnum;
+	int dst_sp_id;
+	unsigned char file;
+	char text[MAXLINELEN];
+}scriptcmd;
+
+// a whole input file of commands
+typedef struct script {
+	int numcmds;
+	scriptcmd *cmds;
+}script;
+
+// parses one line of an input file, the line is modified
+// returns 1 if the line is a command, 0 for empty lines, comments, and lines that don't match
+unsigned char parsecommand(char *line,scriptcmd *cmd);
+
+// parsecommand for a line of any length, the data of a frame is left in the line instead of copied to cmd->text
+// *text points to it (or to cmd->text for a frame without data) and *textlen is its length
+unsigned char parseline(char *line,scriptcmd *cmd,char **text,int *textlen);
+
+// compiled scripts, made by fastcomp and run by fastcl in place of the text script
+// the file is SCRIPTMAGIC and the command count (4 bytes each), then the commands back to back
+// a wait is the SCRIPTWAIT byte and the count, a frame is the SCRIPTFRAME byte (with SCRIPTFILE for a file),
+// the seqnum, the destination, the data length, then the data and a null
+// ints are big endian like the frame headers, a frame's data is at most MAXDATASIZE bytes and a file name
+// shorter than MAXLINELEN, so lines are read whole and long text frames are not cut at MAXLINELEN
+#define SCRIPTMAGIC 0x46455343
+#define SCRIPTFILE 0x80
+
+typedef struct compiledscript {
+	unsigned char *base;
+	size_t size;
+	size_t pos;
+	int numcmds;
+	int next;
+}compiledscript;
+
+// compiles the text script in into out, lines that can't be compiled as they are are reported to errfile
+// returns the number of commands, or -1 if out couldn't be written
+int compilescript(FILE *in,FILE *out,FILE *errfile);
+
+// maps the compiled script filename, returns NULL if it isn't one (or can't be mapped)
+compiledscript *mapscript(const char *filename);
+
+// the next command of a mapped script, *text points into the mapping and is null terminated
+// returns 0 after the last command, or at a command that runs past the end of the file
+unsigned char nextcommand(compiledscript *s,scriptcmd *cmd,const char **text,int *textlen);
+void unmapscript(compiledscript *s);
+
+// reads every command of the input file filename
+// returns NULL if the file can't be opened
+script *loadscript(const char *filename);
+void freescript(script *s);
+
+#endif // _FASTETH_SCRIPT_H
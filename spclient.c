@@ -0,0 +1,593 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h> //TCP_NODELAY
+#include "common.h"
+#include "crc32c.h"
+#include "spclient.h"
+
+// starting number of queued transfers, it grows by doubling
+#define SPCLIENTMINTRANSFERS 8
+
+// a non-blocking socket connecting to addr, -1 if there is no socket and -2 if the connect failed right away
+static int connectsocket(const struct sockaddr_in *addr) {
+	const int fd = socket(AF_INET,SOCK_STREAM | SOCK_NONBLOCK,IPPROTO_TCP);
+	if (fd<0) return -1;
+	// the frames are small and the client waits on the replies, don't let them sit in the stack
+	// there is no receive low water mark as fastcl has, the tail of a frame may be smaller than a header
+	int optval=1;
+	setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,(const void*)&optval,sizeof(int));
+	setsockopt(fd,SOL_SOCKET,SO_KEEPALIVE,(const void*)&optval,sizeof(int));
+	if (connect(fd,(const struct sockaddr*)addr,sizeof(struct sockaddr)) && errno!=EINPROGRESS) {
+		close(fd);
+		return -2;
+	}
+	return fd;
+}
+
+static spclient *newclient(const int sp_id,const int fd,const int groupsize,const int simulation,const int flags,spclientfn fn,void *arg) {
+	spclient *client = (spclient*)calloc(1,sizeof(spclient));
+	client->sp_id=sp_id;
+	client->fd=fd;
+	client->flags=flags;
+	client->groupsize=groupsize;
+	client->simulation=simulation;
+	client->fn=fn;
+	client->arg=arg;
+	client->maxtransfers=SPCLIENTMINTRANSFERS;
+	client->transfers=(sptransfer*)malloc(sizeof(sptransfer)*client->maxtransfers);
+	client->state=SPCONNECTING;
+	return client;
+}
+
+spclient *newspclient(const struct sockaddr_in *addr,const int sp_id,const int groupsize,const int simulation,const int flags,spclientfn fn,void *arg) {
+	const int fd = connectsocket(addr);
+	if (fd==-1) return NULL;
+	// a failed connect is reported as SPCLOSED by the first spclientpoll
+	return newclient(sp_id,fd<0?-1:fd,groupsize,simulation,flags,fn,arg);
+}
+
+void freespclient(spclient *client) {
+	if (!client) return;
+	if (client->fd>=0 && !client->mux) close(client->fd);
+	free(client->transfers);
+	free(client);
+}
+
+static inline void notify(spclient *client,spclientevent *event) {
+	if (client->fn) client->fn(client,event,client->arg);
+}
+
+// ends the client with event type (SPQUIT or SPCLOSED), the queued transfers are dropped
+// the socket of a multiplexed connection stays with the connection
+static void finish(spclient *client,const int type) {
+	if (client->fd>=0 && !client->mux) {
+		shutdown(client->fd,SHUT_RDWR);
+		close(client->fd);
+	}
+	client->fd=-1;
+	client->state=SPFINISHED;
+	client->count=0;
+	client->requested=client->granted=0;
+	client->outlen=client->outpos=0;
+	spclientevent event = { .type=type, .transfer=-1, .peer=client->sp_id };
+	notify(client,&event);
+}
+
+// takes the first transfer off the queue, returns its handle
+static int poptransfer(spclient *client) {
+	const int handle = client->transfers[client->first].handle;
+	client->first=(client->first+1)%client->maxtransfers;
+	--client->count;
+	client->requested=client->granted=0;
+	return handle;
+}
+
+int spclientsend(spclient *client,const int dst,const int seqnum,const void *data,const unsigned long long length) {
+	if (!length || client->state==SPFINISHED || client->announcequit || client->state==SPQUITTING) return -1;
+	if (client->count==client->maxtransfers) {
+		// unroll the ring into the doubled array
+		sptransfer *transfers = (sptransfer*)malloc(sizeof(sptransfer)*client->maxtransfers*2);
+		for (int i=0;i<client->count;++i) transfers[i]=client->transfers[(client->first+i)%client->maxtransfers];
+		free(client->transfers);
+		client->transfers=transfers;
+		client->first=0;
+		client->maxtransfers<<=1;
+	}
+	sptransfer *t = &client->transfers[(client->first+client->count++)%client->maxtransfers];
+	t->handle=client->nexthandle++;
+	if (client->nexthandle<0) client->nexthandle=0;
+	t->dst=dst;
+	t->seqnum=seqnum;
+	t->data=(const unsigned char*)data;
+	t->length=length;
+	return t->handle;
+}
+
+void spclientwait(spclient *client,const int frames) {
+	if (frames<=0 || client->state==SPFINISHED) return;
+	client->waiting+=frames;
+	client->announcewait=1;
+}
+
+void spclientquit(spclient *client) {
+	if (client->state==SPFINISHED) return;
+	client->announcequit=1;
+}
+
+// whether the client has a frame to put in its output buffer, the CSP takes one request at a time
+// and reads a granted SP's frames as data, so nothing else goes between a request and the transfer's last frame
+static inline unsigned char haswork(const spclient *client) {
+	if (client->state!=SPJOINED) return 0;
+	if (client->granted) return 1;
+	if (client->requested) return 0;
+	return client->announcewait || client->count || client->announcequit;
+}
+
+short spclientevents(const spclient *client) {
+	if (client->state==SPFINISHED) return 0;
+	if (client->state==SPCONNECTING) return POLLOUT;
+	return POLLIN | ((client->outpos<client->outlen || haswork(client))?POLLOUT:0);
+}
+
+// puts a bare header frame in the output buffer
+static inline void putheader(spclient *client,const int src,const int dst,const unsigned long long value) {
+	unsigned char *buffer = client->out+client->outlen;
+	intinbuffer(buffer,src);
+	intinbuffer(buffer+4,dst);
+	ullinbuffer(buffer+8,value);
+	client->outlen+=INITFRAMESIZE;
+}
+
+// puts the next data frame of the granted transfer in the output buffer, returns 0 if it doesn't fit
+static unsigned char putdataframe(spclient *client) {
+	const sptransfer *t = &client->transfers[client->first];
+	const unsigned char crc = (client->flags&SPCLIENTCRC)?1:0;
+	const unsigned long long chunkbytes = MAXDATASIZE-(crc?CRCSIZE:0);
+	const unsigned long long left = t->length-client->sent;
+	const int payload = (int)(left>chunkbytes?chunkbytes:left);
+	if (client->outlen+INITFRAMESIZE+payload+CRCSIZE>SPCLIENTBUFSIZE) return 0;
+	unsigned char *buffer = client->out+client->outlen;
+	int field=payload;
+	if (!client->chunk) field|=FRAMEFIRST;
+	if (left==(unsigned long long)payload) field|=FRAMELAST;
+	if (crc) field|=FRAMECRC;
+	intinbuffer(buffer,client->sp_id);
+	intinbuffer(buffer+4,t->dst);
+	intinbuffer(buffer+8,client->chunk?client->chunk:t->seqnum);
+	intinbuffer(buffer+12,field);
+	if (t->data) memcpy((void*)(buffer+INITFRAMESIZE),(const void*)(t->data+client->sent),payload);
+	else memset((void*)(buffer+INITFRAMESIZE),0,payload);
+	int length = INITFRAMESIZE+payload;
+	if (crc) {
+		intinbuffer(buffer+length,(int)crc32c(0,buffer,length));
+		length+=CRCSIZE;
+	}
+	client->outlen+=length;
+	client->sent+=payload;
+	++client->chunk;
+	++client->framessent;
+	client->bytessent+=payload;
+	if (client->sent==t->length) {
+		const int peer = t->dst;
+		spclientevent event = { .type=SPSENT, .transfer=poptransfer(client), .peer=peer };
+		notify(client,&event);
+	}
+	return 1;
+}
+
+// fills the output buffer with what is due
+static void fillout(spclient *client) {
+	// the buffer drains from the front, move what is left of it down first
+	if (client->outpos) {
+		memmove((void*)client->out,(const void*)(client->out+client->outpos),client->outlen-client->outpos);
+		client->outlen-=client->outpos;
+		client->outpos=0;
+	}
+	while (haswork(client) && client->outlen+INITFRAMESIZE<=SPCLIENTBUFSIZE) {
+		if (client->granted) {
+			if (!putdataframe(client)) return;
+		}
+		else if (client->announcewait) {
+			// the frames may all have come in already
+			client->announcewait=0;
+			if (client->waiting) putheader(client,client->sp_id,client->sp_id,(unsigned long long)client->waiting);
+		}
+		else if (client->count) {
+			const sptransfer *t = &client->transfers[client->first];
+			putheader(client,client->sp_id,t->dst,t->length);
+			client->requested=1;
+		}
+		else {
+			putheader(client,client->sp_id,client->sp_id,0);
+			client->announcequit=0;
+			client->state=SPQUITTING;
+		}
+	}
+}
+
+// writes what it can of the output buffer, returns 0 if the connection failed
+static unsigned char flushout(spclient *client) {
+	while (client->outpos<client->outlen) {
+		const ssize_t ret = send(client->fd,(const void*)(client->out+client->outpos),client->outlen-client->outpos,MSG_NOSIGNAL|MSG_DONTWAIT);
+		if (ret<0 && errno==EINTR) continue;
+		if (ret<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) return 1;
+		if (ret<=0) return 0;
+		client->outpos+=(int)ret;
+	}
+	client->outpos=client->outlen=0;
+	return 1;
+}
+
+// handles the whole frame at the front of buffer (inlen bytes of input), returns its length, 0 if it isn't all in
+// or -1 for a frame that can't be (the connection is out of step)
+static int takeframe(spclient *client,unsigned char *buffer,const int inlen) {
+	if (inlen<INITFRAMESIZE) return 0;
+	const int src = intfrombuffer(buffer);
+	const int dst = intfrombuffer(buffer+4);
+	const int chunk = intfrombuffer(buffer+8);
+	const int lastfield = intfrombuffer(buffer+12);
+	spclientevent event = { .transfer=-1, .peer=src, .chunk=chunk, .field=lastfield };
+	// the start barrier
+	if (dst==BARRIERID) {
+		if (!client->started) {
+			client->started=1;
+			event.type=SPSTARTED;
+			notify(client,&event);
+		}
+		return INITFRAMESIZE;
+	}
+	// quit or wake
+	if (src==dst) {
+		if (!lastfield) {
+			finish(client,SPQUIT);
+			return INITFRAMESIZE;
+		}
+		client->waiting=0;
+		event.type=SPWOKEN;
+		notify(client,&event);
+		return INITFRAMESIZE;
+	}
+	// the reply to the request of the first transfer, a malformed request is rejected with (SP_ID, SP_ID+1, 0)
+	if (src==client->sp_id) {
+		if (!client->requested) return -1;
+		event.peer=client->transfers[client->first].dst;
+		event.transfer=client->transfers[client->first].handle;
+		if (lastfield) {
+			// a request to an anycast group was bound to the SP in the reply, the frames go to it
+			client->transfers[client->first].dst=dst;
+			event.peer=dst;
+			client->requested=0;
+			client->granted=1;
+			client->sent=0;
+			client->chunk=0;
+			event.type=SPACCEPTED;
+		}
+		else {
+			poptransfer(client);
+			event.type=SPREJECTED;
+		}
+		notify(client,&event);
+		return INITFRAMESIZE;
+	}
+	// a data frame
+	const int payload = framepayload(lastfield);
+	const int body = framebody(lastfield);
+	if (payload<0 || body>MAXDATASIZE) return -1;
+	if (inlen<INITFRAMESIZE+body) return 0;
+	if (lastfield&FRAMECRC) event.badcrc=crc32c(0,buffer,INITFRAMESIZE+payload)!=(unsigned int)intfrombuffer(buffer+INITFRAMESIZE+payload);
+	// data can beat the barrier, its sender already started
+	if (!client->started) {
+		client->started=1;
+		spclientevent started = { .type=SPSTARTED, .transfer=-1, .peer=src };
+		notify(client,&started);
+		if (client->state==SPFINISHED) return INITFRAMESIZE+body;
+	}
+	++client->framesreceived;
+	client->bytesreceived+=payload;
+	if (client->waiting) --client->waiting;
+	event.type=SPFRAME;
+	event.data=buffer+INITFRAMESIZE;
+	event.length=payload;
+	notify(client,&event);
+	return INITFRAMESIZE+body;
+}
+
+// reads what arrived and handles every whole frame of it, returns 0 if the connection failed
+static unsigned char readin(spclient *client) {
+	while (client->state!=SPFINISHED) {
+		const ssize_t ret = recv(client->fd,(void*)(client->in+client->inlen),SPCLIENTBUFSIZE-client->inlen,MSG_DONTWAIT);
+		if (ret<0 && errno==EINTR) continue;
+		if (ret<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) return 1;
+		if (ret<=0) return 0;
+		client->inlen+=(int)ret;
+		// the session frames answer the handshake, the session isn't resumed so only the token is kept
+		if (client->state==SPJOINING) {
+			if (client->inlen<INITFRAMESIZE*2) continue;
+			client->session=ullfrombuffer(client->in+8);
+			client->state=SPJOINED;
+			client->inlen-=INITFRAMESIZE*2;
+			memmove((void*)client->in,(const void*)(client->in+INITFRAMESIZE*2),client->inlen);
+		}
+		// the callback only ever sees the frame at the front, the rest moves down after it
+		while (client->state!=SPFINISHED) {
+			const int length = takeframe(client,client->in,client->inlen);
+			if (length<0) return 0;
+			if (!length) break;
+			client->inlen-=length;
+			memmove((void*)client->in,(const void*)(client->in+length),client->inlen);
+		}
+	}
+	return 1;
+}
+
+unsigned char spclientpoll(spclient *client,const short revents) {
+	if (client->state==SPFINISHED) return 0;
+	if (client->fd<0) {
+		finish(client,SPCLOSED);
+		return 0;
+	}
+	if (client->state==SPCONNECTING) {
+		if (!(revents&(POLLOUT|POLLERR|POLLHUP))) return 1;
+		int err=0;
+		socklen_t len=sizeof(int);
+		if (getsockopt(client->fd,SOL_SOCKET,SO_ERROR,(void*)&err,&len) || err) {
+			finish(client,SPCLOSED);
+			return 0;
+		}
+		client->state=SPJOINING;
+		putheader(client,client->sp_id,client->sp_id,((unsigned long long)client->simulation<<32)|(unsigned int)client->groupsize);
+	}
+	if ((revents&(POLLIN|POLLERR|POLLHUP)) && !readin(client)) {
+		finish(client,SPCLOSED);
+		return 0;
+	}
+	if (client->state==SPFINISHED) return 0;
+	// the replies that came in may have let more go out
+	fillout(client);
+	if (!flushout(client)) {
+		finish(client,SPCLOSED);
+		return 0;
+	}
+	return 1;
+}
+
+int spclientrun(spclient **clients,const int count,const int timeoutms) {
+	struct pollfd *fds = (struct pollfd*)malloc(sizeof(struct pollfd)*(count?count:1));
+	int open=0;
+	for (int i=0;i<count;++i) {
+		fds[i].fd=(clients[i]->state==SPFINISHED)?-1:clients[i]->fd;
+		fds[i].events=spclientevents(clients[i]);
+		fds[i].revents=0;
+		// a client that couldn't connect is finished by its poll without waiting
+		if (clients[i]->state!=SPFINISHED) ++open;
+	}
+	// an interrupted poll returns with nothing ready, the clients are polled again next time
+	if (open) poll(fds,(nfds_t)count,timeoutms);
+	open=0;
+	for (int i=0;i<count;++i) {
+		if (clients[i]->state==SPFINISHED) continue;
+		if (clients[i]->fd<0 || fds[i].revents) spclientpoll(clients[i],fds[i].revents);
+		if (clients[i]->state!=SPFINISHED) ++open;
+	}
+	free(fds);
+	return open;
+}
+
+spmux *newspmux(const struct sockaddr_in *addr,const int first,const int count,const int groupsize,const int simulation,const int flags,spclientfn fn,void **args) {
+	const int fd = connectsocket(addr);
+	if (fd==-1 || count<1) {
+		if (fd>=0) close(fd);
+		return NULL;
+	}
+	spmux *mux = (spmux*)calloc(1,sizeof(spmux));
+	mux->fd=fd<0?-1:fd;
+	mux->state=SPCONNECTING;
+	mux->first=first;
+	mux->count=count;
+	mux->groupsize=groupsize;
+	mux->simulation=simulation;
+	mux->sessionof=-1;
+	mux->clients=(spclient**)malloc(sizeof(spclient*)*count);
+	for (int i=0;i<count;++i) {
+		mux->clients[i]=newclient(first+i,mux->fd,groupsize,simulation,flags,fn,args?args[i]:NULL);
+		mux->clients[i]->mux=mux;
+	}
+	return mux;
+}
+
+void freespmux(spmux *mux) {
+	if (!mux) return;
+	if (mux->fd>=0) close(mux->fd);
+	for (int i=0;i<mux->count;++i) freespclient(mux->clients[i]);
+	free(mux->clients);
+	free(mux);
+}
+
+// closes the connection, every client that isn't finished yet ends with event type
+static void finishmux(spmux *mux,const int type) {
+	if (mux->fd>=0) {
+		shutdown(mux->fd,SHUT_RDWR);
+		close(mux->fd);
+	}
+	mux->fd=-1;
+	mux->state=SPFINISHED;
+	for (int i=0;i<mux->count;++i) {
+		if (mux->clients[i]->state==SPFINISHED) continue;
+		mux->clients[i]->fd=-1;
+		finish(mux->clients[i],type);
+	}
+}
+
+short spmuxevents(const spmux *mux) {
+	if (mux->state==SPFINISHED) return 0;
+	if (mux->state==SPCONNECTING) return POLLOUT;
+	if (mux->outpos<mux->outlen) return POLLIN|POLLOUT;
+	for (int i=0;i<mux->count;++i) {
+		if (mux->clients[i]->outlen || haswork(mux->clients[i])) return POLLIN|POLLOUT;
+	}
+	return POLLIN;
+}
+
+// the client the frame at the front of buffer is for, *data is set for a data frame
+// the session frames come in pairs, the resume frame has SESSIONID in place of the SP
+// a reply is a frame from an SP with a request out, with a zero chunk and a size field of 0 or 1, as no data frame has
+// (see MUXID), its destination is the request's, SP_ID+1 for a malformed one, or the member an anycast group was bound to
+static spclient *muxtarget(spmux *mux,const unsigned char *buffer,unsigned char *data) {
+	const int src = intfrombuffer((unsigned char*)buffer);
+	const int dst = intfrombuffer((unsigned char*)buffer+4);
+	const int chunk = intfrombuffer((unsigned char*)buffer+8);
+	const int lastfield = intfrombuffer((unsigned char*)buffer+12);
+	*data=0;
+	if (src==SESSIONID) return (mux->sessionof>=0)?mux->clients[mux->sessionof]:NULL;
+	if (src>=mux->first && src-mux->first<mux->count) {
+		spclient *client = mux->clients[src-mux->first];
+		if (dst==SESSIONID || dst==BARRIERID || dst==src) return client;
+		if (client->requested && !chunk && (lastfield==0 || lastfield==1)) return client;
+	}
+	if (dst>=mux->first && dst-mux->first<mux->count) {
+		*data=1;
+		return mux->clients[dst-mux->first];
+	}
+	return NULL;
+}
+
+// reads what arrived and hands every whole frame of it to its client, returns 0 if the connection failed
+static unsigned char readmux(spmux *mux) {
+	while (mux->state!=SPFINISHED) {
+		const ssize_t ret = recv(mux->fd,(void*)(mux->in+mux->inlen),SPMUXBUFSIZE-mux->inlen,MSG_DONTWAIT);
+		if (ret<0 && errno==EINTR) continue;
+		if (ret<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) return 1;
+		if (ret<=0) return 0;
+		mux->inlen+=(int)ret;
+		while (mux->inlen>=INITFRAMESIZE) {
+			unsigned char data;
+			spclient *client = muxtarget(mux,mux->in,&data);
+			if (!client) return 0;
+			int length;
+			// a finished client's frames are passed over
+			if (client->state==SPFINISHED) {
+				length=INITFRAMESIZE+(data?framebody(intfrombuffer(mux->in+12)):0);
+				if (length>MAXFRAMESIZE) return 0;
+				if (mux->inlen<length) length=0;
+			}
+			// the session frame, only the token is kept, then the resume frame that goes with it
+			else if (client->state==SPJOINING) {
+				if (intfrombuffer(mux->in)==SESSIONID) client->state=SPJOINED;
+				else {
+					client->session=ullfrombuffer(mux->in+8);
+					mux->sessionof=client->sp_id-mux->first;
+				}
+				length=INITFRAMESIZE;
+			}
+			else length=takeframe(client,mux->in,mux->inlen);
+			if (length<0) return 0;
+			if (!length) break;
+			mux->inlen-=length;
+			memmove((void*)mux->in,(const void*)(mux->in+length),mux->inlen);
+		}
+	}
+	return 1;
+}
+
+// fills the output buffer with the clients' frames, the clients take turns and only whole frames go in
+static void fillmux(spmux *mux) {
+	if (mux->outpos) {
+		memmove((void*)mux->out,(const void*)(mux->out+mux->outpos),mux->outlen-mux->outpos);
+		mux->outlen-=mux->outpos;
+		mux->outpos=0;
+	}
+	for (int n=0;n<mux->count;++n) {
+		const int i = (mux->next+n)%mux->count;
+		spclient *client = mux->clients[i];
+		if (client->state==SPFINISHED) continue;
+		fillout(client);
+		if (!client->outlen) continue;
+		// no room for its frames, it goes first next time
+		if (mux->outlen+client->outlen>SPMUXBUFSIZE) {
+			mux->next=i;
+			return;
+		}
+		memcpy((void*)(mux->out+mux->outlen),(const void*)client->out,client->outlen);
+		mux->outlen+=client->outlen;
+		client->outlen=0;
+	}
+	mux->next=(mux->next+1)%mux->count;
+}
+
+// writes what it can of the output buffer, returns 0 if the connection failed
+static unsigned char flushmux(spmux *mux) {
+	while (mux->outpos<mux->outlen) {
+		const ssize_t ret = send(mux->fd,(const void*)(mux->out+mux->outpos),mux->outlen-mux->outpos,MSG_NOSIGNAL|MSG_DONTWAIT);
+		if (ret<0 && errno==EINTR) continue;
+		if (ret<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) return 1;
+		if (ret<=0) return 0;
+		mux->outpos+=(int)ret;
+	}
+	mux->outpos=mux->outlen=0;
+	return 1;
+}
+
+unsigned char spmuxpoll(spmux *mux,const short revents) {
+	if (mux->state==SPFINISHED) return 0;
+	if (mux->fd<0) {
+		finishmux(mux,SPCLOSED);
+		return 0;
+	}
+	if (mux->state==SPCONNECTING) {
+		if (!(revents&(POLLOUT|POLLERR|POLLHUP))) return 1;
+		int err=0;
+		socklen_t len=sizeof(int);
+		if (getsockopt(mux->fd,SOL_SOCKET,SO_ERROR,(void*)&err,&len) || err) {
+			finishmux(mux,SPCLOSED);
+			return 0;
+		}
+		mux->state=SPJOINING;
+		for (int i=0;i<mux->count;++i) mux->clients[i]->state=SPJOINING;
+		intinbuffer(mux->out,mux->first);
+		intinbuffer(mux->out+4,MUXID);
+		intinbuffer(mux->out+8,(mux->simulation<<16)|mux->count);
+		intinbuffer(mux->out+12,mux->groupsize);
+		mux->outlen=INITFRAMESIZE;
+	}
+	if ((revents&(POLLIN|POLLERR|POLLHUP)) && !readmux(mux)) {
+		finishmux(mux,SPCLOSED);
+		return 0;
+	}
+	// the connection closes once the CSP has sent every client its quit
+	int open=0;
+	for (int i=0;i<mux->count;++i) open+=(mux->clients[i]->state!=SPFINISHED);
+	if (!open) {
+		finishmux(mux,SPQUIT);
+		return 0;
+	}
+	fillmux(mux);
+	if (!flushmux(mux)) {
+		finishmux(mux,SPCLOSED);
+		return 0;
+	}
+	return 1;
+}
+
+int spmuxrun(spmux **muxes,const int count,const int timeoutms) {
+	struct pollfd *fds = (struct pollfd*)malloc(sizeof(struct pollfd)*(count?count:1));
+	int open=0;
+	for (int i=0;i<count;++i) {
+		fds[i].fd=(muxes[i]->state==SPFINISHED)?-1:muxes[i]->fd;
+		fds[i].events=spmuxevents(muxes[i]);
+		fds[i].revents=0;
+		if (muxes[i]->state!=SPFINISHED) ++open;
+	}
+	if (open) poll(fds,(nfds_t)count,timeoutms);
+	open=0;
+	for (int i=0;i<count;++i) {
+		if (muxes[i]->state==SPFINISHED) continue;
+		if (muxes[i]->fd<0 || fds[i].revents) spmuxpoll(muxes[i],fds[i].revents);
+		if (muxes[i]->state!=SPFINISHED) ++open;
+	}
+	free(fds);
+	return open;
+}
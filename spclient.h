@@ -0,0 +1,161 @@
+#ifndef _FASTETH_SPCLIENT_H
+#define _FASTETH_SPCLIENT_H
+
+#include <netinet/in.h>
+#include "common.h"
+
+// the SP side of the protocol as a library, for programs that attach to the switch without fastcl and a script
+// every client is one SP on its own non-blocking socket, a process runs as many as it has descriptors for
+// the caller polls spclientfd for spclientevents (or lets spclientrun poll a set of clients)
+// and calls spclientpoll with what came back, everything that happened goes to the client's callback
+//
+// transfers are queued with spclientsend and go out in the order they were queued, as many as the caller likes
+// the CSP grants an SP one transfer at a time (it reads the SP's frames as data until the transfer is in),
+// so each request goes out when the transfer before it is finished and waits and the quit go out between transfers
+// the data of a transfer isn't copied, it has to stay valid until the transfer's SPSENT or SPREJECTED event
+// (NULL data sends zeros), it goes in frames of up to MAXDATASIZE bytes with its first and last frames flagged
+// received data frames are handed over one at a time with their payload as it came (see reassembly.h and lz.h)
+// a rejected request is not retried, and a dropped connection ends the client, sessions aren't resumed
+//
+// a block of SPs with consecutive IDs can share one connection (an spmux, see MUXID), each SP is still an spclient
+// with its own queue and events, the clients' frames take turns on the socket and the CSP's frames are handed
+// to the client they are for, the caller polls the spmux instead of its clients (spmuxevents, spmuxpoll, spmuxrun)
+
+// send a CRC32C trailer with every data frame (see FRAMECRC)
+#define SPCLIENTCRC 0x1
+
+// the bytes a client buffers each way, a full data frame with its trailer and a few control frames
+#define SPCLIENTBUFSIZE (MAXFRAMESIZE+CRCSIZE+8*INITFRAMESIZE)
+// the bytes a multiplexed connection buffers each way
+#define SPMUXBUFSIZE (16*SPCLIENTBUFSIZE)
+
+// what a client is doing with its connection
+enum spclientstate { SPCONNECTING=0, SPJOINING, SPJOINED, SPQUITTING, SPFINISHED };
+
+// the events handed to the callback
+// SPSTARTED is the start barrier (or the first data frame to beat it), the whole group is present
+// SPACCEPTED, SPREJECTED, and SPSENT carry the transfer's handle, SPSENT is its last frame framed for the socket
+// the peer of SPACCEPTED is the SP the CSP bound the transfer to, a member of the anycast group it was sent to
+// the callback may queue transfers, waits, and the quit, it must not free the client
+// SPFRAME is a data frame from peer, SPWOKEN the CSP ending a wait, SPQUIT the CSP's quit (the client is finished)
+// SPCLOSED is a connection that failed or dropped, the client is finished and every queued transfer is dropped
+enum spclientevents { SPSTARTED=1, SPACCEPTED, SPREJECTED, SPSENT, SPFRAME, SPWOKEN, SPQUIT, SPCLOSED };
+
+typedef struct spclientevent {
+	int type;
+	int transfer; // handle from spclientsend
+	int peer; // the SP at the other end of the transfer or frame
+	int chunk; // the chunk field of a frame (the sender's frame number in its first frame)
+	int field; // the size field of a frame with its flags
+	const unsigned char *data; // the payload of a frame, valid during the callback
+	int length;
+	unsigned char badcrc; // the frame had a checksum trailer that didn't match
+}spclientevent;
+
+struct spclient;
+struct spmux;
+typedef void (*spclientfn)(struct spclient *client,const spclientevent *event,void *arg);
+
+// a transfer waiting its turn
+typedef struct sptransfer {
+	int handle;
+	int dst;
+	int seqnum;
+	const unsigned char *data;
+	unsigned long long length;
+}sptransfer;
+
+typedef struct spclient {
+	int sp_id;
+	int fd;
+	struct spmux *mux; // the multiplexed connection the client is on, NULL on a socket of its own
+	int state;
+	int flags;
+	int groupsize;
+	int simulation; // on a CSP daemon, zero for a plain CSP
+	unsigned long long session;
+	unsigned char started;
+	spclientfn fn;
+	void *arg;
+	// queued transfers, a ring, the one at first is requested or being sent
+	sptransfer *transfers;
+	int first, count, maxtransfers;
+	int nexthandle;
+	unsigned char requested; // the first transfer's request went out, a reply is due
+	unsigned char granted; // the first transfer was accepted, its frames are going out
+	unsigned long long sent; // data bytes of it framed so far
+	int chunk;
+	// frames the SP waits for (announced to the CSP when they go up), and a wait or quit to announce
+	int waiting;
+	unsigned char announcewait, announcequit;
+	// partial frames each way (a client on a multiplexed connection only uses out, for whole frames)
+	unsigned char in[SPCLIENTBUFSIZE];
+	int inlen;
+	unsigned char out[SPCLIENTBUFSIZE];
+	int outlen, outpos;
+	// totals
+	unsigned long long framessent, framesreceived, bytessent, bytesreceived;
+}spclient;
+
+// SPs first to first+count-1 on one connection
+typedef struct spmux {
+	int fd;
+	int state; // SPCONNECTING, SPJOINING once the hello is out, SPFINISHED once every client is
+	int first, count, groupsize, simulation;
+	spclient **clients; // clients[i] is SP first+i
+	int next; // the client whose frames go out first next time, they take turns
+	int sessionof; // the client of the last session frame, the resume frame after it is its too
+	unsigned char in[SPMUXBUFSIZE];
+	int inlen;
+	unsigned char out[SPMUXBUFSIZE];
+	int outlen, outpos;
+}spmux;
+
+// starts connecting SP sp_id of a group of groupsize to the CSP at addr, fn gets its events with arg
+// simulation is the one to join on a CSP daemon (zero for a plain CSP, see common.h)
+// flags are SPCLIENT options, returns NULL if no socket could be made
+spclient *newspclient(const struct sockaddr_in *addr,const int sp_id,const int groupsize,const int simulation,const int flags,spclientfn fn,void *arg);
+// closes the connection (without a quit) and frees the client, its queued transfers are dropped silently
+void freespclient(spclient *client);
+
+// the socket to poll, and the poll events the client wants on it (none once it is finished)
+static inline int spclientfd(const spclient *client) {
+	return client->fd;
+}
+short spclientevents(const spclient *client);
+
+// does the client's work for the poll events revents, reads what arrived, writes what fits
+// returns 0 once the client is finished (it quit or its connection closed)
+unsigned char spclientpoll(spclient *client,const short revents);
+
+// polls every client of clients that isn't finished, up to timeoutms milliseconds (-1 to block)
+// returns the number of clients not finished
+int spclientrun(spclient **clients,const int count,const int timeoutms);
+
+// queues a transfer of length bytes of data to SP dst, seqnum is its frame number for the receiver
+// returns the transfer's handle, or -1 for an empty transfer or a client that is finishing
+int spclientsend(spclient *client,const int dst,const int seqnum,const void *data,const unsigned long long length);
+
+// tells the CSP the SP waits for frames more data frames, the count goes down with each one received
+// (client->waiting), the CSP may end the wait early with SPWOKEN
+void spclientwait(spclient *client,const int frames);
+
+// tells the CSP the SP is done once every queued transfer is sent, the CSP answers with SPQUIT at the end
+void spclientquit(spclient *client);
+
+// starts connecting SPs first to first+count-1 of a group of groupsize on one connection
+// client i gets its events with args[i] (args may be NULL), returns NULL if no socket could be made
+spmux *newspmux(const struct sockaddr_in *addr,const int first,const int count,const int groupsize,const int simulation,const int flags,spclientfn fn,void **args);
+// closes the connection and frees it with its clients
+void freespmux(spmux *mux);
+
+// as spclientfd, spclientevents, spclientpoll, and spclientrun for the connection and all of its clients
+// spmuxpoll returns 0 once every client is finished, a connection that drops finishes every client with SPCLOSED
+static inline int spmuxfd(const spmux *mux) {
+	return mux->fd;
+}
+short spmuxevents(const spmux *mux);
+unsigned char spmuxpoll(spmux *mux,const short revents);
+int spmuxrun(spmux **muxes,const int count,const int timeoutms);
+
+#endif // _FASTETH_SPCLIENT_H
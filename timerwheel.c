@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <string.h>
+#include "timerwheel.h"
+
+timerwheel *newtimerwheel(const unsigned long long now) {
+	timerwheel *w = (timerwheel*)calloc(1,sizeof(timerwheel));
+	w->now=now;
+	memset((void*)w->head,0xFF,sizeof(w->head));
+	memset((void*)w->tail,0xFF,sizeof(w->tail));
+	w->expiredhead=-1;
+	w->expiredtail=-1;
+	return w;
+}
+
+void freetimerwheel(timerwheel *w) {
+	if (!w) return;
+	free(w->next);
+	free(w->expires);
+	free(w);
+}
+
+void timergrow(timerwheel *w,const int capacity) {
+	if (capacity<=w->capacity) return;
+	w->next = (int*)realloc(w->next,sizeof(int)*capacity);
+	w->expires = (unsigned long long*)realloc(w->expires,sizeof(unsigned long long)*capacity);
+	w->capacity=capacity;
+}
+
+// appends timer to the list at level and slot
+static inline void slotappend(timerwheel *w,const int level,const int slot,const int timer) {
+	w->next[timer]=-1;
+	if (w->tail[level][slot]<0) w->head[level][slot]=timer;
+	else w->next[w->tail[level][slot]]=timer;
+	w->tail[level][slot]=timer;
+	if (!level) w->occupied[slot>>6]|=1ULL<<(slot&63);
+}
+
+static inline void expiredappend(timerwheel *w,const int timer) {
+	w->next[timer]=-1;
+	if (w->expiredtail<0) w->expiredhead=timer;
+	else w->next[w->expiredtail]=timer;
+	w->expiredtail=timer;
+}
+
+// puts a timer in the lowest level whose span from now reaches its expiry
+static void timerplace(timerwheel *w,const int timer) {
+	const unsigned long long expires = w->expires[timer];
+	if (expires<w->now) {
+		expiredappend(w,timer);
+		return;
+	}
+	const unsigned long long delta = expires-w->now;
+	int level=0;
+	while (level<TIMERLEVELS-1 && delta>=(1ULL<<(TIMERBITS*(level+1)))) ++level;
+	slotappend(w,level,(int)((expires>>(TIMERBITS*level))&TIMERMASK),timer);
+	++w->count;
+}
+
+void timeradd(timerwheel *w,const int timer,unsigned long long expires) {
+	if (expires>w->now && expires-w->now>TIMERMAXDELTA) expires=w->now+TIMERMAXDELTA;
+	w->expires[timer]=expires;
+	timerplace(w,timer);
+}
+
+// level 0 wrapped, the current slot of each level above it is spread over the levels below
+// a level only moves on when the one below it wrapped too
+static void cascade(timerwheel *w) {
+	for (int level=1;level<TIMERLEVELS;++level) {
+		const int slot = (int)((w->now>>(TIMERBITS*level))&TIMERMASK);
+		int timer = w->head[level][slot];
+		w->head[level][slot]=-1;
+		w->tail[level][slot]=-1;
+		while (timer>=0) {
+			const int next = w->next[timer];
+			--w->count;
+			timerplace(w,timer);
+			timer=next;
+		}
+		if (slot) break;
+	}
+}
+
+// the first level 0 slot from slot on that holds timers, TIMERSLOTS if none
+static inline int nextoccupied(timerwheel *w,int slot) {
+	while (slot<TIMERSLOTS) {
+		const unsigned long long word = w->occupied[slot>>6]>>(slot&63);
+		if (word) return slot+__builtin_ctzll(word);
+		slot=(slot|63)+1;
+	}
+	return TIMERSLOTS;
+}
+
+void timeradvance(timerwheel *w,const unsigned long long tick) {
+	while (w->now<=tick) {
+		if (!w->count) {
+			w->now=tick+1;
+			return;
+		}
+		const int slot = (int)(w->now&TIMERMASK);
+		if (!slot) cascade(w);
+		// the slot's timers have expired, the list moves over whole
+		if (w->head[0][slot]>=0) {
+			for (int timer=w->head[0][slot];timer>=0;timer=w->next[timer]) --w->count;
+			if (w->expiredtail<0) w->expiredhead=w->head[0][slot];
+			else w->next[w->expiredtail]=w->head[0][slot];
+			w->expiredtail=w->tail[0][slot];
+			w->head[0][slot]=-1;
+			w->tail[0][slot]=-1;
+			w->occupied[slot>>6]&=~(1ULL<<(slot&63));
+		}
+		// on to the next slot with timers, or the next wrap
+		const unsigned long long step = (unsigned long long)(nextoccupied(w,slot+1)-slot);
+		w->now=(w->now+step>tick+1)?tick+1:w->now+step;
+	}
+}
+
+int timerpop(timerwheel *w) {
+	const int timer = w->expiredhead;
+	if (timer<0) return -1;
+	w->expiredhead=w->next[timer];
+	if (w->expiredhead<0) w->expiredtail=-1;
+	return timer;
+}
+
+unsigned long long timernext(timerwheel *w) {
+	if (w->expiredhead>=0) return 0;
+	if (!w->count) return TIMERNONE;
+	const int slot = (int)(w->now&TIMERMASK);
+	const int next = nextoccupied(w,slot);
+	if (next<TIMERSLOTS) return (unsigned long long)(next-slot);
+	// nothing left in this turn of level 0, the next wrap brings the next timers down
+	return (unsigned long long)(TIMERSLOTS-slot);
+}
@@ -0,0 +1,55 @@
+#ifndef _FASTETH_TIMERWHEEL_H
+#define _FASTETH_TIMERWHEEL_H
+
+// a hierarchical timer wheel, the timers are indices 0..capacity-1 (the CSP uses port indices)
+// times are ticks, the caller picks what a tick is
+// level 0 has a slot for each of the next TIMERSLOTS ticks, each level above covers TIMERSLOTS times
+// the span of the one below it, a timer starts in the lowest level whose span reaches its expiry
+// whenever level 0 wraps the next slot of the level above is spread over the levels below it
+// adding a timer is O(1), each timer moves down at most TIMERLEVELS-1 times before it expires
+// empty level 0 slots are skipped with a bitmap, so an advance over idle time is cheap
+// timers that expire in the same tick come out in the order they were added
+#define TIMERBITS 8
+#define TIMERSLOTS (1<<TIMERBITS)
+#define TIMERMASK (TIMERSLOTS-1)
+#define TIMERLEVELS 4
+// the furthest a timer can be set, later ones are set this far out
+#define TIMERMAXDELTA ((1ULL<<(TIMERBITS*TIMERLEVELS))-1)
+// timernext when no timer is set
+#define TIMERNONE 0xFFFFFFFFFFFFFFFFULL
+
+typedef struct timerwheel {
+	unsigned long long now; // the next tick to run, every timer before it has expired
+	int count; // timers in the slots, not counting the expired ones
+	int capacity; // timer indices
+	int *next; // list link of each timer, -1 ends a list
+	unsigned long long *expires;
+	int head[TIMERLEVELS][TIMERSLOTS];
+	int tail[TIMERLEVELS][TIMERSLOTS];
+	unsigned long long occupied[TIMERSLOTS/64]; // the level 0 slots holding timers
+	// timers that have expired and not been taken yet, in expiry order
+	int expiredhead, expiredtail;
+}timerwheel;
+
+// a wheel whose first tick is now
+timerwheel *newtimerwheel(const unsigned long long now);
+void freetimerwheel(timerwheel *w);
+
+// makes room for timers 0..capacity-1
+void timergrow(timerwheel *w,const int capacity);
+
+// sets timer to expire at tick expires, it must not be set already
+// a timer set before the wheel's now has expired at once
+void timeradd(timerwheel *w,const int timer,unsigned long long expires);
+
+// runs the wheel up to and including tick, the timers due by then are moved to the expired list
+void timeradvance(timerwheel *w,const unsigned long long tick);
+
+// takes the next expired timer, -1 if there is none
+int timerpop(timerwheel *w);
+
+// ticks from the wheel's now until it has to be advanced again, TIMERNONE if no timer is set
+// zero if a timer has expired, the wheel may need more than one advance to find a timer in an upper level
+unsigned long long timernext(timerwheel *w);
+
+#endif // _FASTETH_TIMERWHEEL_H
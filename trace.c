@@ -0,0 +1,60 @@
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "trace.h"
+
+// the low 56 bits of a record's last field
+#define TRACEVALUEMASK 0x00FFFFFFFFFFFFFFULL
+
+tracewriter *newtracewriter(const char *filename) {
+	FILE *file = fopen(filename,"wb");
+	if (!file) return NULL;
+	if (fwrite((const void*)TRACEMAGIC,sizeof(char),TRACEMAGICLEN,file)!=TRACEMAGICLEN) {
+		fclose(file);
+		return NULL;
+	}
+	tracewriter *trace = (tracewriter*)calloc(1,sizeof(tracewriter));
+	trace->file=file;
+	trace->start=getnow();
+	return trace;
+}
+
+void tracewrite(tracewriter *trace,const int class,const int src,const int dst,const unsigned long long value) {
+	if (!trace) return;
+	unsigned char record[TRACERECORDSIZE];
+	ullinbuffer(record,(unsigned long long)((getnow()-trace->start)*1e9));
+	intinbuffer(record+8,src);
+	intinbuffer(record+12,dst);
+	ullinbuffer(record+16,(((unsigned long long)class)<<56)|(value&TRACEVALUEMASK));
+	fwrite((const void*)record,sizeof(unsigned char),TRACERECORDSIZE,trace->file);
+	++trace->records;
+}
+
+void closetracewriter(tracewriter *trace) {
+	if (!trace) return;
+	fclose(trace->file);
+	free(trace);
+}
+
+FILE *opentrace(const char *filename) {
+	FILE *file = fopen(filename,"rb");
+	if (!file) return NULL;
+	char magic[TRACEMAGICLEN];
+	if (fread((void*)magic,sizeof(char),TRACEMAGICLEN,file)!=TRACEMAGICLEN || memcmp(magic,TRACEMAGIC,TRACEMAGICLEN)) {
+		fclose(file);
+		return NULL;
+	}
+	return file;
+}
+
+unsigned char readtrace(FILE *file,tracerecord *record) {
+	unsigned char buffer[TRACERECORDSIZE];
+	if (fread((void*)buffer,sizeof(unsigned char),TRACERECORDSIZE,file)!=TRACERECORDSIZE) return 0;
+	record->time=ullfrombuffer(buffer);
+	record->src=intfrombuffer(buffer+8);
+	record->dst=intfrombuffer(buffer+12);
+	const unsigned long long last = ullfrombuffer(buffer+16);
+	record->class=(int)(last>>56);
+	record->value=last&TRACEVALUEMASK;
+	return 1;
+}
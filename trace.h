@@ -0,0 +1,48 @@
+#ifndef _FASTETH_TRACE_H
+#define _FASTETH_TRACE_H
+
+#include <stdio.h>
+
+// a traffic trace recorded by the CSP, what every SP asked of the switch and when
+// the file starts with TRACEMAGIC, then fixed size records in the order the CSP read them:
+// 8 bytes nanoseconds since the trace was opened, 4 bytes src SP ID, 4 bytes dst SP ID,
+// 8 bytes with the record class in the top byte and its value in the low 56 bits
+// all fields are big endian, like frame headers
+#define TRACEMAGIC "FETRACE1"
+#define TRACEMAGICLEN 8
+#define TRACERECORDSIZE 24
+
+// record classes and their values
+// TRACEJOIN, an SP joined (src==dst), value is the group size it gave
+// TRACEREQUEST, a data request from src to dst, value is the data size
+// TRACEWAIT, src will wait (src==dst), value is the number of frames
+// TRACEQUIT, src is done sending (src==dst), value is zero
+enum traceclass { TRACEJOIN=1, TRACEREQUEST, TRACEWAIT, TRACEQUIT };
+
+typedef struct tracerecord {
+	unsigned long long time;
+	int src;
+	int dst;
+	int class;
+	unsigned long long value;
+}tracerecord;
+
+// an open trace being recorded
+typedef struct tracewriter {
+	FILE *file;
+	double start;
+	unsigned long long records;
+}tracewriter;
+
+// creates the trace file, returns NULL if it can't be written
+tracewriter *newtracewriter(const char *filename);
+// appends a record stamped with the time since the trace was opened
+void tracewrite(tracewriter *trace,const int class,const int src,const int dst,const unsigned long long value);
+void closetracewriter(tracewriter *trace);
+
+// opens a trace for reading, returns NULL if it can't be read or isn't a trace
+FILE *opentrace(const char *filename);
+// reads the next record, returns 0 at the end of the trace
+unsigned char readtrace(FILE *file,tracerecord *record);
+
+#endif // _FASTETH_TRACE_H